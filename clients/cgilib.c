@@ -21,10 +21,29 @@
 
 #include <ctype.h>
 #include <stdio.h>
+#include <setjmp.h>
+
+#ifndef WIN32
+# include <netdb.h>
+# include <poll.h>
+# include <sys/socket.h>
+# include <netinet/in.h>
+#endif	/* !WIN32 */
 
 #include "cgilib.h"
 #include "parseconf.h"
 
+/* seconds to wait for a client of the long-running mode to send its
+ * request, or to take the response */
+#define CGI_SERVE_TIMEOUT	10
+
+cgi_host_t	*cgi_hostlist = NULL;
+
+/* query string of the request being served by cgi_serve() */
+static char	*cgi_query = NULL;
+static int	cgi_serving_request = 0;
+static jmp_buf	cgi_request_jmp;
+
 static char *unescape(char *buf)
 {
 	size_t	i, buflen;
@@ -43,14 +62,21 @@ static char *unescape(char *buf)
 
 		if (ch == '%') {
 			long l;
-			if (i + 2 > buflen)
-				fatalx(EXIT_FAILURE, "string too short for escaped char");
+			/* both hex digits must be in the string, not past its end */
+			if (i + 2 >= buflen - 2) {
+				upslogx(LOG_ERR, "string too short for escaped char");
+				free(newbuf);
+				cgi_done(EXIT_FAILURE);
+			}
 			hex[0] = buf[++i];
 			hex[1] = buf[++i];
 			hex[2] = '\0';
 			if (!isxdigit((unsigned char) hex[0])
-				|| !isxdigit((unsigned char) hex[1]))
-				fatalx(EXIT_FAILURE, "bad escape char");
+				|| !isxdigit((unsigned char) hex[1])) {
+				upslogx(LOG_ERR, "bad escape char");
+				free(newbuf);
+				cgi_done(EXIT_FAILURE);
+			}
 			l = strtol(hex, NULL, 16);
 			assert(l>=0);
 			assert(l<=255);
@@ -71,7 +97,11 @@ void extractcgiargs(void)
 	char	*query, *ptr, *eq, *varname, *value, *amp;
 	char	*cleanval, *cleanvar;
 
-	query = getenv("QUERY_STRING");
+	if (cgi_serving_request)
+		query = cgi_query;
+	else
+		query = getenv("QUERY_STRING");
+
 	if (query == NULL)
 		return;		/* not run as a cgi script! */
 	if (strlen(query) == 0)
@@ -157,31 +187,56 @@ void extractpostargs(void)
 /* called for fatal errors in parseconf like malloc failures */
 static void cgilib_err(const char *errmsg)
 {
-	upslogx(LOG_ERR, "Fatal error in parseconf(ups.conf): %s", errmsg);
+	upslogx(LOG_ERR, "Fatal error in parseconf(hosts.conf): %s", errmsg);
 }
 
-int checkhost(const char *host, char **desc)
+static void cgi_hosts_free(void)
 {
+	cgi_host_t	*tmp, *next;
+
+	for (tmp = cgi_hostlist; tmp; tmp = next) {
+		next = tmp->next;
+		free(tmp->sys);
+		free(tmp->desc);
+		free(tmp);
+	}
+
+	cgi_hostlist = NULL;
+}
+
+int cgi_hosts_load(void)
+{
+	static time_t	mtime = 0;
+	static off_t	size = 0;
 	char	fn[NUT_PATH_MAX + 1];
+	struct stat	st;
 	PCONF_CTX_t	ctx;
-
-	if (!host)
-		return 0;		/* deny null hostnames */
+	cgi_host_t	*tmp, *last = NULL;
 
 	snprintf(fn, sizeof(fn), "%s/hosts.conf", confpath());
 
+	/* in the long-running mode, only read it again when it changes */
+	if (stat(fn, &st) != 0) {
+		memset(&st, 0, sizeof(st));
+	} else if (mtime != 0 && st.st_mtime == mtime && st.st_size == size) {
+		return 1;
+	}
+
+	cgi_hosts_free();
+	mtime = 0;
+
 	pconf_init(&ctx, cgilib_err);
 
 	if (!pconf_file_begin(&ctx, fn)) {
 		pconf_finish(&ctx);
-		fprintf(stderr, "%s\n", ctx.errmsg);
+		upslogx(LOG_ERR, "%s", ctx.errmsg);
 
-		return 0;	/* failed: deny access */
+		return 0;
 	}
 
 	while (pconf_file_next(&ctx)) {
 		if (pconf_parse_error(&ctx)) {
-			fprintf(stderr, "Error: %s:%d: %s\n",
+			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
 				fn, ctx.linenum, ctx.errmsg);
 			continue;
 		}
@@ -193,16 +248,348 @@ int checkhost(const char *host, char **desc)
 		if (strcmp(ctx.arglist[0], "MONITOR") != 0)
 			continue;
 
-		if (!strcmp(ctx.arglist[1], host)) {
+		tmp = xcalloc(1, sizeof(*tmp));
+		tmp->sys = xstrdup(ctx.arglist[1]);
+		tmp->desc = xstrdup(ctx.arglist[2]);
+
+		if (last)
+			last->next = tmp;
+		else
+			cgi_hostlist = tmp;
+
+		last = tmp;
+	}
+
+	pconf_finish(&ctx);
+
+	mtime = st.st_mtime;
+	size = st.st_size;
+
+	return 1;
+}
+
+int checkhost(const char *host, char **desc)
+{
+	cgi_host_t	*tmp;
+
+	if (!host)
+		return 0;		/* deny null hostnames */
+
+	if (!cgi_hosts_load())
+		return 0;	/* failed: deny access */
+
+	for (tmp = cgi_hostlist; tmp; tmp = tmp->next) {
+		if (!strcmp(tmp->sys, host)) {
 			if (desc)
-				*desc = xstrdup(ctx.arglist[2]);
+				*desc = xstrdup(tmp->desc);
 
-			pconf_finish(&ctx);
 			return 1;	/* found: allow access */
 		}
 	}
 
-	pconf_finish(&ctx);
-
 	return 0;	/* not found: access denied */
 }
+
+/* connections to upsd, see cgi_upsconn() */
+typedef struct cgi_upsconn_s {
+	char	*hostname;
+	uint16_t	port;
+	UPSCONN_t	conn;
+	struct cgi_upsconn_s	*next;
+} cgi_upsconn_t;
+
+static cgi_upsconn_t	*cgi_upsconns = NULL;
+
+/* nothing is expected from upsd between our requests, so if there is
+ * something to read, it closed the connection (or is out of step) */
+static int cgi_upsconn_usable(UPSCONN_t *ups)
+{
+#ifndef WIN32
+	struct pollfd	pfd;
+
+	if (upscli_fd(ups) < 0)
+		return 0;
+
+	pfd.fd = upscli_fd(ups);
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return (poll(&pfd, 1, 0) == 0);
+#else	/* WIN32 */
+	return (upscli_fd(ups) >= 0);
+#endif	/* WIN32 */
+}
+
+UPSCONN_t *cgi_upsconn(const char *hostname, uint16_t port)
+{
+	cgi_upsconn_t	*tmp;
+
+	for (tmp = cgi_upsconns; tmp; tmp = tmp->next) {
+		if (tmp->port == port && !strcmp(tmp->hostname, hostname))
+			break;
+	}
+
+	if (!tmp) {
+		tmp = xcalloc(1, sizeof(*tmp));
+		tmp->hostname = xstrdup(hostname);
+		tmp->port = port;
+		tmp->conn.fd = -1;
+		tmp->next = cgi_upsconns;
+		cgi_upsconns = tmp;
+	} else if (cgi_upsconn_usable(&tmp->conn)) {
+		upsdebugx(3, "%s: reusing connection to %s:%" PRIu16,
+			__func__, hostname, port);
+		return &tmp->conn;
+	}
+
+	upscli_disconnect(&tmp->conn);
+
+	upsdebugx(2, "%s: connecting to %s:%" PRIu16, __func__, hostname, port);
+	upscli_connect(&tmp->conn, hostname, port, UPSCLI_CONN_TRYSSL);
+
+	return &tmp->conn;
+}
+
+void cgi_upsconn_closeall(void)
+{
+	cgi_upsconn_t	*tmp, *next;
+
+	for (tmp = cgi_upsconns; tmp; tmp = next) {
+		next = tmp->next;
+		upscli_disconnect(&tmp->conn);
+		free(tmp->hostname);
+		free(tmp);
+	}
+
+	cgi_upsconns = NULL;
+}
+
+int cgi_serving(void)
+{
+	return cgi_serving_request;
+}
+
+int cgi_invoked(void)
+{
+	return (getenv("GATEWAY_INTERFACE") != NULL
+		|| getenv("REQUEST_METHOD") != NULL);
+}
+
+void cgi_done(int status)
+{
+	if (cgi_serving_request)
+		longjmp(cgi_request_jmp, 1);
+
+	cgi_upsconn_closeall();
+	exit(status);
+}
+
+#ifndef WIN32
+
+/* [<addr>:]<port>, with IPv6 addresses in brackets; only the local
+ * host by default, since this is meant to be behind a web server */
+static int cgi_listen(const char *listenspec)
+{
+	char	addr[SMALLBUF], *port, *ptr;
+	struct addrinfo	hints, *res, *ai;
+	int	sock_fd = -1, v, one = 1;
+
+	snprintf(addr, sizeof(addr), "%s", listenspec);
+
+	if (addr[0] == '[') {
+		ptr = strchr(addr, ']');
+		if (!ptr || ptr[1] != ':') {
+			upslogx(LOG_ERR, "Invalid listening address: %s", listenspec);
+			return -1;
+		}
+		*ptr = '\0';
+		port = ptr + 2;
+		memmove(addr, addr + 1, strlen(addr));
+	} else if ((ptr = strrchr(addr, ':')) != NULL) {
+		*ptr = '\0';
+		port = ptr + 1;
+	} else {
+		port = addr;
+	}
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags = AI_PASSIVE;
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_protocol = IPPROTO_TCP;
+
+	while ((v = getaddrinfo(port == addr ? "localhost" : addr, port, &hints, &res)) != 0) {
+		if (v == EAI_AGAIN)
+			continue;
+
+		upslogx(LOG_ERR, "getaddrinfo: %s", gai_strerror(v));
+		return -1;
+	}
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		sock_fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (sock_fd < 0)
+			continue;
+
+		setsockopt(sock_fd, SOL_SOCKET, SO_REUSEADDR, (void *)&one, sizeof(one));
+
+		if (bind(sock_fd, ai->ai_addr, ai->ai_addrlen) == 0
+		&& listen(sock_fd, 16) == 0) {
+			break;
+		}
+
+		close(sock_fd);
+		sock_fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (sock_fd < 0)
+		upslog_with_errno(LOG_ERR, "Can not listen on %s", listenspec);
+
+	return sock_fd;
+}
+
+/* read the request head; returns the query string of a GET request
+ * (maybe empty), or NULL after sending an error status */
+static char *cgi_read_request(int fd, char *buf, size_t buflen)
+{
+	size_t	len = 0;
+	ssize_t	ret;
+	char	*target, *ptr;
+
+	/* only the request line is used, but the whole head is read so the
+	 * client does not get a reset for the data it sent */
+	while (len < buflen - 1) {
+		ret = read(fd, buf + len, buflen - 1 - len);
+		if (ret <= 0)
+			break;
+
+		len += (size_t)ret;
+		buf[len] = '\0';
+
+		if (strstr(buf, "\n\r\n") || strstr(buf, "\n\n"))
+			break;
+	}
+
+	buf[len] = '\0';
+
+	if (!strchr(buf, '\n')) {
+		upsdebugx(2, "%s: incomplete request", __func__);
+		return NULL;
+	}
+
+	/* GET <target> HTTP/1.x */
+	if (strncmp(buf, "GET ", 4) != 0) {
+		static const char	notimpl[] = "HTTP/1.0 501 Not Implemented\r\n"
+			"Connection: close\r\n\r\n";
+
+		if (write(fd, notimpl, sizeof(notimpl) - 1) < 0)
+			upsdebug_with_errno(2, "%s: write", __func__);
+		return NULL;
+	}
+
+	target = buf + 4;
+	target[strcspn(target, " \r\n")] = '\0';
+
+	upsdebugx(2, "%s: GET %s", __func__, target);
+
+	ptr = strchr(target, '?');
+
+	return ptr ? ptr + 1 : target + strlen(target);
+}
+
+/* answer one request on fd with the handler (and close it) */
+static void cgi_answer(int fd, void (*handler)(void))
+{
+	int	stdout_fd;
+	char	buf[LARGEBUF], *query;
+
+	query = cgi_read_request(fd, buf, sizeof(buf));
+
+	if (!query) {
+		close(fd);
+		return;
+	}
+
+	/* the handler prints its response like a CGI program does */
+	fflush(stdout);
+	stdout_fd = dup(STDOUT_FILENO);
+
+	if (stdout_fd < 0 || dup2(fd, STDOUT_FILENO) < 0) {
+		upslog_with_errno(LOG_ERR, "Can not redirect the output");
+		if (stdout_fd >= 0)
+			close(stdout_fd);
+		close(fd);
+		return;
+	}
+
+	cgi_query = query;
+	cgi_serving_request = 1;
+
+	printf("HTTP/1.0 200 OK\r\n");
+	printf("Connection: close\r\n");
+
+	if (setjmp(cgi_request_jmp) == 0)
+		handler();
+
+	cgi_serving_request = 0;
+	cgi_query = NULL;
+
+	if (fflush(stdout) != 0)
+		upsdebug_with_errno(2, "%s: writing the response", __func__);
+	clearerr(stdout);
+
+	dup2(stdout_fd, STDOUT_FILENO);
+	close(stdout_fd);
+	close(fd);
+}
+
+int cgi_serve(const char *listenspec, void (*handler)(void))
+{
+	int	sock_fd, fd;
+	struct timeval	tv;
+
+	sock_fd = cgi_listen(listenspec);
+	if (sock_fd < 0)
+		return EXIT_FAILURE;
+
+	/* do not die on clients going away while writing to them */
+	signal(SIGPIPE, SIG_IGN);
+
+	upslogx(LOG_INFO, "Listening on %s", listenspec);
+
+	tv.tv_sec = CGI_SERVE_TIMEOUT;
+	tv.tv_usec = 0;
+
+	for (;;) {
+		fd = accept(sock_fd, NULL, NULL);
+
+		if (fd < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				upslog_with_errno(LOG_ERR, "accept");
+			continue;
+		}
+
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, (void *)&tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, (void *)&tv, sizeof(tv));
+
+		cgi_answer(fd, handler);
+	}
+
+	/* NOTREACHED */
+}
+
+#else	/* WIN32 */
+
+int cgi_serve(const char *listenspec, void (*handler)(void))
+{
+	NUT_UNUSED_VARIABLE(handler);
+
+	upslogx(LOG_ERR, "Can not listen on %s: not supported on this platform",
+		listenspec);
+
+	return EXIT_FAILURE;
+}
+
+#endif	/* WIN32 */
@@ -20,6 +20,8 @@
 #ifndef NUT_CGILIB_H_SEEN
 #define NUT_CGILIB_H_SEEN 1
 
+#include "upsclient.h"
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -38,6 +40,44 @@ void extractpostargs(void);
 /* see if a host is allowed per the hosts.conf */
 int checkhost(const char *host, char **desc);
 
+/* MONITOR <host> <description> entries from hosts.conf */
+typedef struct cgi_host_s {
+	char	*sys;
+	char	*desc;
+	struct cgi_host_s	*next;
+} cgi_host_t;
+
+extern cgi_host_t	*cgi_hostlist;
+
+/* (re)load cgi_hostlist, unless hosts.conf did not change since the
+ * last time; returns 0 if the file can not be read */
+int cgi_hosts_load(void);
+
+/* connection to upsd at hostname:port, kept open for the next requests
+ * of the long-running mode; when it can not connect, the returned one
+ * has upscli_fd() == -1 and the error, and is tried again next time */
+UPSCONN_t *cgi_upsconn(const char *hostname, uint16_t port);
+void cgi_upsconn_closeall(void);
+
+/* Long-running mode: rather than answering the one request of the CGI
+ * environment, listen for HTTP requests on [<addr>:]<port> and answer
+ * them one after the other with the same handler, which gets the query
+ * string of each from extractcgiargs() and prints the CGI headers and
+ * content as usual. The program keeps what it cached between requests.
+ * Only returns on errors. */
+int cgi_serve(const char *listenspec, void (*handler)(void));
+
+/* 1 while serving requests with cgi_serve() */
+int cgi_serving(void);
+
+/* 1 when started by a web server, which does not pass options */
+int cgi_invoked(void);
+
+/* end the current request: exits with the status when running as a
+ * CGI program, or goes back to cgi_serve() for the next request */
+void cgi_done(int status)
+	__attribute__((noreturn));
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
@@ -34,6 +34,7 @@
 #include <iostream>	/* std::cerr debugging */
 #include <cstdint>
 #include <cstdlib>
+#include <cctype>
 #include <stdlib.h>
 
 #ifndef WIN32
@@ -963,6 +964,25 @@ std::map<std::string,std::vector<std::string> > TcpClient::getDeviceVariableValu
 	return map;
 }
 
+/* Device names are not case-sensitive in upsd */
+static bool equalsIgnoreCase(const std::string& a, const std::string& b)
+{
+	if (a.size() != b.size())
+	{
+		return false;
+	}
+
+	for (size_t n=0; n<a.size(); ++n)
+	{
+		if (tolower(static_cast<unsigned char>(a[n])) != tolower(static_cast<unsigned char>(b[n])))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
 std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient::getDevicesVariableValues(const std::set<std::string>& devs)
 {
 	std::map<std::string,std::map<std::string,std::vector<std::string> > > map;
@@ -975,31 +995,130 @@ std::map<std::string,std::map<std::string,std::vector<std::string> > > TcpClient
 		return map;
 	}
 
-	std::vector<std::string> queries;
+	// Ask for many devices at once with "LIST VARS a|b|c...", in as few
+	// queries as fit in the lines upsd reads. Names which would be taken
+	// for patterns, and servers which do not know LIST VARS, get one
+	// "LIST VAR" per device.
+	std::vector<std::string> patterns;
+	std::set<std::string> singles;
 	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
 	{
-		queries.push_back("LIST VAR " + *it);
+		if (it->empty() || it->find_first_of("*?| \t\"\\") != std::string::npos)
+		{
+			singles.insert(*it);
+		}
+		else if (patterns.empty() || patterns.back().size() + it->size() > 400)
+		{
+			patterns.push_back(*it);
+		}
+		else
+		{
+			patterns.back() += "|" + *it;
+		}
+	}
+
+	std::vector<std::string> queries;
+	for (std::vector<std::string>::const_iterator it=patterns.cbegin(); it!=patterns.cend(); ++it)
+	{
+		queries.push_back("LIST VARS " + *it);
 	}
 	sendAsyncQueries(queries);
 
-	for (std::set<std::string>::const_iterator it=devs.cbegin(); it!=devs.cend(); ++it)
+	for (std::vector<std::string>::const_iterator it=patterns.cbegin(); it!=patterns.cend(); ++it)
 	{
-		try
+		std::string req = "VARS " + *it;
+		std::string res = _socket->read();
+
+		if (res.substr(0, 4) == "ERR ")
+		{
+			// Older server: ask for these devices one by one
+			std::string::size_type pos = 0, bar;
+			do {
+				bar = it->find('|', pos);
+				singles.insert(it->substr(pos, bar - pos));
+				pos = bar + 1;
+			} while (bar != std::string::npos);
+			continue;
+		}
+
+		if (res != ("BEGIN LIST " + req))
 		{
-			std::map<std::string,std::vector<std::string> > map2;
-			std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
-			for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
+			throw NutException("Invalid response");
+		}
+
+		while (true)
+		{
+			res = _socket->read();
+			detectError(res);
+			if (res == ("END LIST " + req))
+			{
+				break;
+			}
+
+			if (res.substr(0, 4) == "VAR ")
+			{
+				// VAR <dev> <var> <value>
+				std::vector<std::string> vals = explode(res, 4);
+				if (vals.size() < 2)
+				{
+					throw NutException("Invalid response");
+				}
+
+				// Report it by the name it was asked for
+				std::string dev = vals[0];
+				if (devs.find(dev) == devs.end())
+				{
+					for (std::set<std::string>::const_iterator it2=devs.cbegin(); it2!=devs.cend(); ++it2)
+					{
+						if (equalsIgnoreCase(*it2, dev))
+						{
+							dev = *it2;
+							break;
+						}
+					}
+				}
+
+				std::string var = vals[1];
+				vals.erase(vals.begin(), vals.begin() + 2);
+				map[dev][var] = vals;
+			}
+			else if (res.substr(0, 12) != "UNAVAILABLE ")
 			{
-				std::vector<std::string>& vals = *it2;
-				std::string var = vals[0];
-				vals.erase(vals.begin());
-				map2[var] = vals;
+				// An UNAVAILABLE device is left out, like one
+				// whose LIST VAR failed; anything else is wrong
+				throw NutException("Invalid response");
 			}
-			map[*it] = map2;
 		}
-		catch (NutException&)
+	}
+
+	if (!singles.empty())
+	{
+		queries.clear();
+		for (std::set<std::string>::const_iterator it=singles.cbegin(); it!=singles.cend(); ++it)
+		{
+			queries.push_back("LIST VAR " + *it);
+		}
+		sendAsyncQueries(queries);
+
+		for (std::set<std::string>::const_iterator it=singles.cbegin(); it!=singles.cend(); ++it)
 		{
-			// We sent a bunch of queries, we need to process them all to clear up the backlog.
+			try
+			{
+				std::map<std::string,std::vector<std::string> > map2;
+				std::vector<std::vector<std::string> > res = parseList("VAR " + *it);
+				for (std::vector<std::vector<std::string> >::iterator it2=res.begin(); it2!=res.end(); ++it2)
+				{
+					std::vector<std::string>& vals = *it2;
+					std::string var = vals[0];
+					vals.erase(vals.begin());
+					map2[var] = vals;
+				}
+				map[*it] = map2;
+			}
+			catch (NutException&)
+			{
+				// We sent a bunch of queries, we need to process them all to clear up the backlog.
+			}
 		}
 	}
 
@@ -1532,6 +1532,20 @@ int upscli_list_next(UPSCONN_t *ups, size_t numq, const char **query,
 			return 0;
 	}
 
+	/* q: VARS <upspatterns> [<varpatterns>]           *
+	 * a: VAR <ups> <var> <val>                        *
+	 * a: UNAVAILABLE <ups> <error>                    */
+	if ((numq > 0) && (!strcasecmp(query[0], "VARS"))) {
+		if ((ups->pc_ctx.numargs < 3) ||
+			((strcasecmp(ups->pc_ctx.arglist[0], "VAR") != 0) &&
+			 (strcasecmp(ups->pc_ctx.arglist[0], "UNAVAILABLE") != 0))) {
+			ups->upserror = UPSCLI_ERR_PROTOCOL;
+			return -1;
+		}
+
+		return 1;
+	}
+
 	/* q: VAR <ups> */
 	/* a: VAR <ups> <val> */
 
@@ -54,8 +54,30 @@
 static	char	*monhost = NULL, *cmd = NULL;
 
 static	uint16_t	port;
-static	char	*upsname, *hostname;
-static	UPSCONN_t	ups;
+static	char	*upsname = NULL, *hostname = NULL;
+static	UPSCONN_t	*ups = NULL;
+
+/* imgarg[] values before any request changed them */
+static	int	*imgarg_default = NULL;
+
+/* In the long-running mode, the rendered images are kept for a few
+ * seconds, by all the arguments which make them look the way they do */
+typedef struct imgcache_s {
+	char	*key;
+	unsigned char	*png;
+	size_t	size;
+	time_t	rendered;
+	struct imgcache_s	*next;
+} imgcache_t;
+
+#define IMGCACHE_MAX	1024
+
+static	imgcache_t	*imgcache = NULL;
+static	int	imgcache_ttl = 5;
+
+/* the key of the image being drawn, if it may be cached */
+static	char	imgkey[LARGEBUF];
+static	int	imgkey_valid = 0;
 
 #define RED(x)		((x >> 16) & 0xff)
 #define GREEN(x)	((x >> 8)  & 0xff)
@@ -117,21 +139,96 @@ static int get_imgarg(const char *name)
 	return -1;
 }
 
+static void imgcache_drop(imgcache_t **pp)
+{
+	imgcache_t	*tmp = *pp;
+
+	*pp = tmp->next;
+	free(tmp->key);
+	free(tmp->png);
+	free(tmp);
+}
+
+/* find an image rendered less than imgcache_ttl seconds ago,
+ * forgetting the older ones on the way */
+static imgcache_t *imgcache_find(const char *key)
+{
+	imgcache_t	**pp, *found = NULL;
+	time_t	now;
+
+	time(&now);
+
+	for (pp = &imgcache; *pp; ) {
+		if (difftime(now, (*pp)->rendered) >= imgcache_ttl) {
+			imgcache_drop(pp);
+			continue;
+		}
+
+		if (!found && !strcmp((*pp)->key, key))
+			found = *pp;
+
+		pp = &(*pp)->next;
+	}
+
+	return found;
+}
+
+static void imgcache_add(const char *key, const void *png, size_t size)
+{
+	imgcache_t	*tmp, **pp;
+	size_t	count = 0;
+
+	tmp = xcalloc(1, sizeof(*tmp));
+	tmp->key = xstrdup(key);
+	tmp->png = xmalloc(size);
+	memcpy(tmp->png, png, size);
+	tmp->size = size;
+	time(&tmp->rendered);
+
+	/* newest first, so the oldest ones go when there are too many */
+	tmp->next = imgcache;
+	imgcache = tmp;
+
+	for (pp = &imgcache; *pp; ) {
+		if (++count > IMGCACHE_MAX) {
+			imgcache_drop(pp);
+			continue;
+		}
+
+		pp = &(*pp)->next;
+	}
+}
+
+static void sendimage(const void *png, size_t size)
+{
+	printf("Pragma: no-cache\n");
+	printf("Content-type: image/png\n\n");
+
+	fwrite(png, 1, size, stdout);
+}
+
 /* write the HTML header then have gd dump the image */
 static void drawimage(gdImagePtr im)
 	__attribute__((noreturn));
 
 static void drawimage(gdImagePtr im)
 {
-	printf("Pragma: no-cache\n");
-	printf("Content-type: image/png\n\n");
+	void	*png;
+	int	size = 0;
 
-	gdImagePng(im, stdout);
+	png = gdImagePngPtr(im, &size);
 	gdImageDestroy(im);
 
-	upscli_disconnect(&ups);
+	if (png && size > 0) {
+		if (imgkey_valid && cgi_serving() && imgcache_ttl > 0)
+			imgcache_add(imgkey, png, (size_t)size);
+
+		sendimage(png, (size_t)size);
+	}
+
+	gdFree(png);
 
-	exit(EXIT_SUCCESS);
+	cgi_done(EXIT_SUCCESS);
 }
 
 /* helper function to allocate color in the image */
@@ -326,6 +423,9 @@ static void noimage(const char *fmt, ...)
 #endif
 	va_end(ap);
 
+	/* error images are not cached */
+	imgkey_valid = 0;
+
 	width = get_imgarg("width");
 	height = get_imgarg("height");
 
@@ -351,7 +451,7 @@ static void noimage(const char *fmt, ...)
 
 	/* NOTE: Earlier code called noimage() and then exit(EXIT_FAILURE);
 	 * to signal an error via process exit code. Now that drawimage()
-	 * always ends with exit(EXIT_SUCCESS) - which might make webserver
+	 * always ends with cgi_done(EXIT_SUCCESS) - which might make webserver
 	 * feel good - the command-line use if any suffers no error returns.
 	 */
 
@@ -600,7 +700,7 @@ static int get_var(const char *var, char *buf, size_t buflen)
 
 	numq = 3;
 
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
+	ret = upscli_get(ups, numq, query, &numa, &answer);
 
 	if (ret < 0)
 		return 0;
@@ -612,17 +712,36 @@ static int get_var(const char *var, char *buf, size_t buflen)
 	return 1;
 }
 
-int main(int argc, char **argv)
+/* start afresh for each request of the long-running mode */
+static void reset_request(void)
+{
+	int	i;
+
+	free(monhost);
+	free(cmd);
+	monhost = cmd = NULL;
+
+	free(upsname);
+	free(hostname);
+	upsname = hostname = NULL;
+	ups = NULL;
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		imgarg[i].val = imgarg_default[i];
+
+	imgkey_valid = 0;
+}
+
+static void upsimage_request(void)
 {
 	char	str[SMALLBUF];
 	int	i, min, nom, max;
 	double	var = 0;
-	NUT_UNUSED_VARIABLE(argc);
-	NUT_UNUSED_VARIABLE(argv);
+	imgcache_t	*cached;
 
-	extractcgiargs();
+	reset_request();
 
-	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
+	extractcgiargs();
 
 	/* no 'host=' or 'display=' given */
 	if ((!monhost) || (!cmd))
@@ -631,7 +750,17 @@ int main(int argc, char **argv)
 	if (!checkhost(monhost, NULL))
 		noimage("Access denied");
 
-	upsname = hostname = NULL;
+	/* everything that changes the image, but the UPS data */
+	snprintf(imgkey, sizeof(imgkey), "%s %s", monhost, cmd);
+	for (i = 0; imgarg[i].name != NULL; i++)
+		snprintfcat(imgkey, sizeof(imgkey), " %d", imgarg[i].val);
+
+	if (cgi_serving() && imgcache_ttl > 0
+	&& (cached = imgcache_find(imgkey)) != NULL) {
+		upsdebugx(3, "%s: cached image for %s", __func__, imgkey);
+		sendimage(cached->png, cached->size);
+		cgi_done(EXIT_SUCCESS);
+	}
 
 	if (upscli_splitname(monhost, &upsname, &hostname, &port) != 0) {
 		noimage("Invalid UPS definition (upsname[@hostname[:port]])\n");
@@ -640,9 +769,11 @@ int main(int argc, char **argv)
 #endif
 	}
 
-	if (upscli_connect(&ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0) {
+	ups = cgi_upsconn(hostname, port);
+
+	if (upscli_fd(ups) < 0) {
 		noimage("Can't connect to server:\n%s\n",
-			upscli_strerror(&ups));
+			upscli_strerror(ups));
 #ifndef HAVE___ATTRIBUTE__NORETURN
 		exit(EXIT_FAILURE);	/* Should not get here in practice, but compiler is afraid we can fall through */
 #endif
@@ -717,15 +848,88 @@ int main(int argc, char **argv)
 				max = -1;
 			}
 
+			imgkey_valid = 1;
 			imgvar[i].drawfunc(var, min, nom, max,
 				imgvar[i].deviation, imgvar[i].format);
-			exit(EXIT_SUCCESS);
+			cgi_done(EXIT_SUCCESS);
 		}
 
 	noimage("Unknown display");
-#ifndef HAVE___ATTRIBUTE__NORETURN
-	exit(EXIT_FAILURE);
-#endif
+}
+
+static void usage(const char *prog)
+{
+	print_banner_once(prog, 2);
+	printf("NUT CGI program to draw the UPS status bars.\n");
+
+	printf("\nusage: %s [-l [<addr>:]<port> [-t <secs>]]\n", prog);
+
+	printf("\nNormally started by the web server for each request. Options:\n");
+	printf("  -l <port>  - keep running and answer HTTP requests on this\n");
+	printf("               port (of localhost, unless an address is given)\n");
+	printf("  -t <secs>  - keep the drawn images for this long when running\n");
+	printf("               (default: %d, 0 to disable)\n", imgcache_ttl);
+	printf("  -D         - raise debugging level\n");
+	printf("  -V         - display the version of this software\n");
+	printf("  -h         - display this help text\n");
+
+	nut_report_config_flags();
+
+	printf("\n%s", suggest_doc_links(prog, NULL));
+}
+
+int main(int argc, char **argv)
+{
+	const char	*prog = xbasename(argv[0]);
+	const char	*listenspec = NULL;
+	int	i;
+
+	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
+
+	for (i = 0; imgarg[i].name != NULL; i++)
+		;
+	imgarg_default = xcalloc((size_t)i, sizeof(*imgarg_default));
+	for (i = 0; imgarg[i].name != NULL; i++)
+		imgarg_default[i] = imgarg[i].val;
+
+	/* a web server passes no options (but maybe ISINDEX search words) */
+	if (!cgi_invoked()) {
+		while ((i = getopt(argc, argv, "+hDVl:t:")) != -1) {
+			switch (i)
+			{
+			case 'l':
+				listenspec = optarg;
+				break;
+
+			case 't':
+				if (!str_to_int(optarg, &imgcache_ttl, 10) || imgcache_ttl < 0)
+					fatalx(EXIT_FAILURE, "Invalid image cache time: %s", optarg);
+				break;
+
+			case 'D':
+				nut_debug_level++;
+				break;
+
+			case 'V':
+				print_banner_once(prog, 1);
+				nut_report_config_flags();
+				exit(EXIT_SUCCESS);
+
+			case 'h':
+			default:
+				usage(prog);
+				exit(EXIT_SUCCESS);
+			}
+		}
+	}
+
+	if (listenspec)
+		return cgi_serve(listenspec, upsimage_request);
+
+	upsimage_request();
+
+	/* NOTREACHED */
+	return EXIT_SUCCESS;
 }
 
 imgvar_t imgvar[] = {
@@ -41,12 +41,14 @@ static int	use_celsius = 1, refreshdelay = -1, treemode = 0;
 static char	*monhostdesc = NULL;
 
 static uint16_t	port;
-static char	*upsname, *hostname;
-static char	*upsimgpath="upsimage.cgi", *upsstatpath="upsstats.cgi";
-static UPSCONN_t	ups;
+static char	*upsname = NULL, *hostname = NULL;
+static char	upsimgpath[SMALLBUF], upsstatpath[SMALLBUF];
+static UPSCONN_t	*ups = NULL;
 
-static FILE	*tf;
-static long	forofs = 0;
+/* templates read so far, and the position in the one being displayed */
+static template_t	*templates = NULL;
+static size_t	tplline = 0, tplnext = 0;
+static size_t	forofs = 0;
 
 static ulist_t	*ulhead = NULL, *currups = NULL;
 
@@ -75,16 +77,16 @@ void parsearg(char *var, char *value)
 
 static void report_error(void)
 {
-	if (upscli_upserror(&ups) == UPSCLI_ERR_VARNOTSUPP)
+	if (upscli_upserror(ups) == UPSCLI_ERR_VARNOTSUPP)
 		printf("Not supported\n");
 	else
-		printf("[error: %s]\n", upscli_strerror(&ups));
+		printf("[error: %s]\n", upscli_strerror(ups));
 }
 
 /* make sure we're actually connected to upsd */
 static int check_ups_fd(int do_report)
 {
-	if (upscli_fd(&ups) == -1) {
+	if (upscli_fd(ups) == -1) {
 		if (do_report)
 			report_error();
 
@@ -127,7 +129,7 @@ static int get_var(const char *var, char *buf, size_t buflen, int verbose)
 
 	numq = 3;
 
-	ret = upscli_get(&ups, numq, query, &numa, &answer);
+	ret = upscli_get(ups, numq, query, &numa, &answer);
 
 	if (ret < 0) {
 		if (verbose)
@@ -350,61 +352,23 @@ static int do_img(char *buf)
 	return 0;
 }
 
+/* upsd connections are kept by cgilib, for all the UPSes on each host */
 static void ups_connect(void)
 {
-	static ulist_t	*lastups = NULL;
-	char	*newups, *newhost;
-	uint16_t	newport;
-
-	/* try to minimize reconnects */
-	if (lastups) {
-
-		/* don't reconnect if these are both the same UPS */
-		if (!strcmp(lastups->sys, currups->sys)) {
-			lastups = currups;
-			return;
-		}
-
-		/* see if it's just on the same host */
-		newups = newhost = NULL;
-
-		if (upscli_splitname(currups->sys, &newups, &newhost,
-			&newport) != 0) {
-			printf("Unusable UPS definition [%s]\n", currups->sys);
-			fprintf(stderr, "Unusable UPS definition [%s]\n",
-				currups->sys);
-			exit(EXIT_FAILURE);
-		}
-
-		if ((!strcmp(newhost, hostname)) && (port == newport)) {
-			free(upsname);
-			upsname = newups;
-
-			free(newhost);
-			lastups = currups;
-			return;
-		}
-
-		/* not the same upsd, so disconnect */
-		free(newups);
-		free(newhost);
-	}
-
-	upscli_disconnect(&ups);
-
 	free(upsname);
 	free(hostname);
+	upsname = hostname = NULL;
 
 	if (upscli_splitname(currups->sys, &upsname, &hostname, &port) != 0) {
 		printf("Unusable UPS definition [%s]\n", currups->sys);
 		fprintf(stderr, "Unusable UPS definition [%s]\n", currups->sys);
-		exit(EXIT_FAILURE);
+		cgi_done(EXIT_FAILURE);
 	}
 
-	if (upscli_connect(&ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
-		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(&ups));
+	ups = cgi_upsconn(hostname, port);
 
-	lastups = currups;
+	if (upscli_fd(ups) < 0)
+		fprintf(stderr, "UPS [%s]: can't connect to server: %s\n", currups->sys, upscli_strerror(ups));
 }
 
 static void do_hostlink(void)
@@ -555,14 +519,14 @@ static void do_ifbetween(const char *s)
 static void do_upsstatpath(const char *s) {
 
 	if(strlen(s)) {
-		upsstatpath = strdup(s);
+		snprintf(upsstatpath, sizeof(upsstatpath), "%s", s);
 	}
 }
 
 static void do_upsimgpath(const char *s) {
 
 	if(strlen(s)) {
-		upsimgpath = strdup(s);
+		snprintf(upsimgpath, sizeof(upsimgpath), "%s", s);
 	}
 }
 
@@ -727,7 +691,8 @@ static int do_command(char *cmd)
 	}
 
 	if (!strcmp(cmd, "FOREACHUPS")) {
-		forofs = ftell(tf);
+		/* loop from the next line */
+		forofs = tplline + 1;
 
 		currups = ulhead;
 		ups_connect();
@@ -737,14 +702,15 @@ static int do_command(char *cmd)
 	if (!strcmp(cmd, "ENDFOR")) {
 
 		/* if not in a for, ignore this */
-		if (forofs == 0) {
+		if (forofs == 0 || !currups) {
 			return 1;
 		}
 
 		currups = currups->next;
 
 		if (currups) {
-			fseek(tf, forofs, SEEK_SET);
+			/* after the rest of this line */
+			tplnext = forofs;
 			ups_connect();
 		}
 
@@ -809,31 +775,135 @@ static int do_command(char *cmd)
 	return 0;
 }
 
-static void parse_line(const char *buf)
+static void add_chunk(tline_t *line, int is_cmd, const char *text, size_t len)
 {
-	char	cmd[SMALLBUF];
-	size_t	i, len;
+	tchunk_t	*chunk;
+
+	line->chunks = xrealloc(line->chunks, (line->numchunks + 1) * sizeof(*line->chunks));
+	chunk = &line->chunks[line->numchunks++];
+
+	chunk->is_cmd = is_cmd;
+	chunk->len = len;
+	chunk->text = xmalloc(len + 1);
+	memcpy(chunk->text, text, len);
+	chunk->text[len] = '\0';
+}
+
+/* split a line into text and @COMMANDS@; a command without its closing
+ * '@' on the same line is dropped */
+static void split_line(tline_t *line, const char *buf)
+{
+	size_t	i, len, cmdlen = 0;
+	const char	*cmd = NULL;
 	char	do_cmd = 0;
 
+	line->numchunks = 0;
+	line->chunks = NULL;
+
 	for (i = 0; buf[i]; i += len) {
 
 		len = strcspn(&buf[i], "@");
 
 		if (len == 0) {
 			if (do_cmd) {
-				do_command(cmd);
+				if (cmdlen > 0)
+					add_chunk(line, 1, cmd, cmdlen);
 				do_cmd = 0;
 			} else {
-				cmd[0] = '\0';
+				cmdlen = 0;
 				do_cmd = 1;
 			}
 			i++;	/* skip over the '@' character */
 			continue;
 		}
-		assert (len < INT_MAX);
 
 		if (do_cmd) {
-			snprintf(cmd, sizeof(cmd), "%.*s", (int)len, &buf[i]);
+			cmd = &buf[i];
+			cmdlen = len;
+			continue;
+		}
+
+		add_chunk(line, 0, &buf[i], len);
+	}
+}
+
+static void free_template_lines(template_t *tpl)
+{
+	size_t	i, j;
+
+	for (i = 0; i < tpl->numlines; i++) {
+		for (j = 0; j < tpl->lines[i].numchunks; j++)
+			free(tpl->lines[i].chunks[j].text);
+		free(tpl->lines[i].chunks);
+	}
+
+	free(tpl->lines);
+	tpl->lines = NULL;
+	tpl->numlines = 0;
+}
+
+/* the split up template, read again only when the file changes */
+static template_t *load_template(const char *fn)
+{
+	template_t	*tpl;
+	struct stat	st;
+	FILE	*tf;
+	char	buf[LARGEBUF];
+	size_t	alloced = 0;
+
+	for (tpl = templates; tpl; tpl = tpl->next)
+		if (!strcmp(tpl->fn, fn))
+			break;
+
+	if (stat(fn, &st) != 0)
+		return NULL;
+
+	if (tpl && tpl->lines && tpl->mtime == st.st_mtime && tpl->size == st.st_size)
+		return tpl;
+
+	tf = fopen(fn, "r");
+
+	if (!tf)
+		return NULL;
+
+	if (!tpl) {
+		tpl = xcalloc(1, sizeof(*tpl));
+		tpl->fn = xstrdup(fn);
+		tpl->next = templates;
+		templates = tpl;
+	}
+
+	free_template_lines(tpl);
+	tpl->mtime = st.st_mtime;
+	tpl->size = st.st_size;
+
+	while (fgets(buf, sizeof(buf), tf)) {
+		if (tpl->numlines == alloced) {
+			alloced = alloced ? alloced * 2 : 64;
+			tpl->lines = xrealloc(tpl->lines, alloced * sizeof(*tpl->lines));
+		}
+
+		split_line(&tpl->lines[tpl->numlines++], buf);
+	}
+
+	fclose(tf);
+
+	return tpl;
+}
+
+static void parse_line(const tline_t *line)
+{
+	char	cmd[SMALLBUF];
+	size_t	i;
+	const tchunk_t	*chunk;
+
+	for (i = 0; i < line->numchunks; i++) {
+		chunk = &line->chunks[i];
+
+		if (chunk->is_cmd) {
+			/* the commands may cut up their copy */
+			snprintf(cmd, sizeof(cmd), "%s", chunk->text);
+			do_command(cmd);
 			continue;
 		}
 
@@ -843,31 +913,31 @@ static void parse_line(const char *buf)
 		}
 
 		/* pass it trough */
-		printf("%.*s", (int)len, &buf[i]);
+		fwrite(chunk->text, 1, chunk->len, stdout);
 	}
 }
 
 static void display_template(const char *tfn)
 {
-	char	fn[NUT_PATH_MAX + 1], buf[LARGEBUF];
+	char	fn[NUT_PATH_MAX + 1];
+	template_t	*tpl;
 
 	snprintf(fn, sizeof(fn), "%s/%s", confpath(), tfn);
 
-	tf = fopen(fn, "r");
+	tpl = load_template(fn);
 
-	if (!tf) {
+	if (!tpl) {
 		fprintf(stderr, "upsstats: Can't open %s: %s\n", fn, strerror(errno));
 
 		printf("Error: can't open template file (%s)\n", tfn);
 
-		exit(EXIT_FAILURE);
+		cgi_done(EXIT_FAILURE);
 	}
 
-	while (fgets(buf, sizeof(buf), tf)) {
-		parse_line(buf);
+	for (tplline = 0; tplline < tpl->numlines; tplline = tplnext) {
+		tplnext = tplline + 1;
+		parse_line(&tpl->lines[tplline]);
 	}
-
-	fclose(tf);
 }
 
 static void display_tree(int verbose)
@@ -886,7 +956,7 @@ static void display_tree(int verbose)
 	query[1] = upsname;
 	numq = 2;
 
-	if (upscli_list_start(&ups, numq, query) < 0) {
+	if (upscli_list_start(ups, numq, query) < 0) {
 		if (verbose)
 			report_error();
 		return;
@@ -911,7 +981,7 @@ static void display_tree(int verbose)
 
 	printf("<TR><TH COLSPAN=3 BGCOLOR=\"#60B0B0\"></TH></TR>\n");
 
-	while (upscli_list_next(&ups, numq, query, &numa, &answer) == 1) {
+	while (upscli_list_next(ups, numq, query, &numa, &answer) == 1) {
 
 		/* VAR <upsname> <varname> <val> */
 		if (numa < 4) {
@@ -960,24 +1030,25 @@ static void add_ups(char *sys, char *desc)
 		ulhead = tmp;
 }
 
-/* called for fatal errors in parseconf like malloc failures */
-static void upsstats_hosts_err(const char *errmsg)
+static void free_ups_list(void)
 {
-	upslogx(LOG_ERR, "Fatal error in parseconf(hosts.conf): %s", errmsg);
+	ulist_t	*tmp, *next;
+
+	for (tmp = ulhead; tmp; tmp = next) {
+		next = tmp->next;
+		free(tmp->sys);
+		free(tmp->desc);
+		free(tmp);
+	}
+
+	ulhead = currups = NULL;
 }
 
 static void load_hosts_conf(void)
 {
-	char	fn[NUT_PATH_MAX + 1];
-	PCONF_CTX_t	ctx;
-
-	snprintf(fn, sizeof(fn), "%s/hosts.conf", CONFPATH);
-
-	pconf_init(&ctx, upsstats_hosts_err);
-
-	if (!pconf_file_begin(&ctx, fn)) {
-		pconf_finish(&ctx);
+	cgi_host_t	*host;
 
+	if (!cgi_hosts_load()) {
 		printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
 		printf("	\"http://www.w3.org/TR/REC-html40/loose.dtd\">\n");
 		printf("<HTML><HEAD>\n");
@@ -986,28 +1057,13 @@ static void load_hosts_conf(void)
 		printf("Error: can't open hosts.conf\n");
 		printf("</BODY></HTML>\n");
 
-		/* leave something for the admin */
-		fprintf(stderr, "upsstats: %s\n", ctx.errmsg);
-		exit(EXIT_FAILURE);
-	}
-
-	while (pconf_file_next(&ctx)) {
-		if (pconf_parse_error(&ctx)) {
-			upslogx(LOG_ERR, "Parse error: %s:%d: %s",
-				fn, ctx.linenum, ctx.errmsg);
-			continue;
-		}
-
-		if (ctx.numargs < 3)
-			continue;
-
-		/* MONITOR <host> <desc> */
-		if (!strcmp(ctx.arglist[0], "MONITOR"))
-			add_ups(ctx.arglist[1], ctx.arglist[2]);
-
+		/* leave something for the admin (details logged by cgilib) */
+		fprintf(stderr, "upsstats: can't open hosts.conf\n");
+		cgi_done(EXIT_FAILURE);
 	}
 
-	pconf_finish(&ctx);
+	for (host = cgi_hostlist; host; host = host->next)
+		add_ups(host->sys, host->desc);
 
 	if (!ulhead) {
 		printf("<!DOCTYPE HTML PUBLIC \"-//W3C//DTD HTML 4.0 Transitional//EN\"\n");
@@ -1020,7 +1076,7 @@ static void load_hosts_conf(void)
 
 		/* leave something for the admin */
 		fprintf(stderr, "upsstats: no hosts to monitor\n");
-		exit(EXIT_FAILURE);
+		cgi_done(EXIT_FAILURE);
 	}
 }
 
@@ -1029,7 +1085,7 @@ static void display_single(void)
 	if (!checkhost(monhost, &monhostdesc)) {
 		printf("Access to that host [%s] is not authorized.\n",
 			monhost);
-		exit(EXIT_FAILURE);
+		cgi_done(EXIT_FAILURE);
 	}
 
 	add_ups(monhost, monhostdesc);
@@ -1042,19 +1098,38 @@ static void display_single(void)
 		display_tree(1);
 	else
 		display_template("upsstats-single.html");
+}
+
+/* start afresh for each request of the long-running mode */
+static void reset_request(void)
+{
+	free(monhost);
+	free(monhostdesc);
+	monhost = monhostdesc = NULL;
+
+	use_celsius = 1;
+	refreshdelay = -1;
+	treemode = 0;
+	skip_clause = skip_block = 0;
+	forofs = 0;
+
+	snprintf(upsimgpath, sizeof(upsimgpath), "%s", "upsimage.cgi");
+	snprintf(upsstatpath, sizeof(upsstatpath), "%s", "upsstats.cgi");
 
-	upscli_disconnect(&ups);
+	free_ups_list();
+
+	free(upsname);
+	free(hostname);
+	upsname = hostname = NULL;
+	ups = NULL;
 }
 
-int main(int argc, char **argv)
+static void upsstats_request(void)
 {
-	NUT_UNUSED_VARIABLE(argc);
-	NUT_UNUSED_VARIABLE(argv);
+	reset_request();
 
 	extractcgiargs();
 
-	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
-
 	printf("Content-type: text/html\n");
 	printf("Pragma: no-cache\n");
 	printf("\n");
@@ -1062,7 +1137,7 @@ int main(int argc, char **argv)
 	/* if a host is specified, use upsstats-single.html instead */
 	if (monhost) {
 		display_single();
-		exit(EXIT_SUCCESS);
+		cgi_done(EXIT_SUCCESS);
 	}
 
 	/* default: multimon replacement mode */
@@ -1073,7 +1148,67 @@ int main(int argc, char **argv)
 
 	display_template("upsstats.html");
 
-	upscli_disconnect(&ups);
+	cgi_done(EXIT_SUCCESS);
+}
+
+static void usage(const char *prog)
+{
+	print_banner_once(prog, 2);
+	printf("NUT CGI program to generate the UPS status pages.\n");
+
+	printf("\nusage: %s [-l [<addr>:]<port>]\n", prog);
 
-	return 0;
+	printf("\nNormally started by the web server for each request. Options:\n");
+	printf("  -l <port>  - keep running and answer HTTP requests on this\n");
+	printf("               port (of localhost, unless an address is given)\n");
+	printf("  -D         - raise debugging level\n");
+	printf("  -V         - display the version of this software\n");
+	printf("  -h         - display this help text\n");
+
+	nut_report_config_flags();
+
+	printf("\n%s", suggest_doc_links(prog, NULL));
+}
+
+int main(int argc, char **argv)
+{
+	const char	*prog = xbasename(argv[0]);
+	const char	*listenspec = NULL;
+	int	i;
+
+	upscli_init_default_connect_timeout(NULL, NULL, UPSCLI_DEFAULT_CONNECT_TIMEOUT);
+
+	/* a web server passes no options (but maybe ISINDEX search words) */
+	if (!cgi_invoked()) {
+		while ((i = getopt(argc, argv, "+hDVl:")) != -1) {
+			switch (i)
+			{
+			case 'l':
+				listenspec = optarg;
+				break;
+
+			case 'D':
+				nut_debug_level++;
+				break;
+
+			case 'V':
+				print_banner_once(prog, 1);
+				nut_report_config_flags();
+				exit(EXIT_SUCCESS);
+
+			case 'h':
+			default:
+				usage(prog);
+				exit(EXIT_SUCCESS);
+			}
+		}
+	}
+
+	if (listenspec)
+		return cgi_serve(listenspec, upsstats_request);
+
+	upsstats_request();
+
+	/* NOTREACHED */
+	return EXIT_SUCCESS;
 }
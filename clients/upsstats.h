@@ -32,6 +32,28 @@ typedef struct {
 	void	*next;
 }	ulist_t;
 
+/* a template file, split up into the text to pass through and the
+ * commands between '@' characters of each line when it is read */
+typedef struct {
+	int	is_cmd;
+	size_t	len;
+	char	*text;
+}	tchunk_t;
+
+typedef struct {
+	size_t	numchunks;
+	tchunk_t	*chunks;
+}	tline_t;
+
+typedef struct template_s {
+	char	*fn;
+	time_t	mtime;
+	off_t	size;
+	size_t	numlines;
+	tline_t	*lines;
+	struct template_s	*next;
+}	template_t;
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
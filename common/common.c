@@ -41,6 +41,10 @@
 #endif
 
 #include <dirent.h>
+#if (defined HAVE_PTHREAD) && !(defined WIN32)
+# include <pthread.h>
+# define NUT_LOG_ASYNC_SUPPORTED 1
+#endif
 #if !HAVE_DECL_REALPATH
 # include <sys/stat.h>
 #endif
@@ -3176,14 +3180,435 @@ char * mkstr_dynamic(const char *fmt_dynamic, const char *fmt_reference, ...)
 	return buf;
 }
 
-static void vupslog(int priority, const char *fmt, va_list va, int use_strerror)
+/* Optional rate limiting of log messages per call site, see
+ * upslog_set_ratelimit(): sites are told apart by the address of their
+ * (literal) format string, so the few sites logging a ready string as
+ * "%s" share a limit. A direct-mapped table, so two sites sharing a
+ * slot just restart each other's count. */
+#define UPSLOG_RATELIMIT_SITES	256
+
+typedef struct {
+	const void	*site;
+	time_t	window;
+	unsigned int	count;
+	unsigned int	suppressed;
+} upslog_site_t;
+
+static upslog_site_t	upslog_sites[UPSLOG_RATELIMIT_SITES];
+static unsigned int	upslog_ratelimit = 0;
+static size_t	upslog_suppressed_total = 0;
+
+/* Optional asynchronous logging, see upslog_async_start(): the caller
+ * formats the message into a slot of a ring buffer, and a background
+ * thread writes it out, so a slow syslog or stderr consumer does not
+ * stall the event loop of a daemon. With one producer at a time (the
+ * producer lock only matters for multi-threaded programs) and the one
+ * writer thread, the ring indexes need no lock between the two. */
+#define UPSLOG_ASYNC_DEFAULT_SLOTS	1024
+#define UPSLOG_ASYNC_SLOT_TEXT	480	/* longer messages are allocated */
+
+typedef struct {
+	int	priority;
+	int	flags;		/* upslog_flags when logged */
+	int	timestamp;	/* stderr lines with a timestamp */
+	struct timeval	tv;
+	char	*ext;
+	char	text[UPSLOG_ASYNC_SLOT_TEXT];
+} upslog_slot_t;
+
+#ifdef NUT_LOG_ASYNC_SUPPORTED
+static upslog_slot_t	*upslog_ring = NULL;
+static size_t	upslog_ring_slots = 0;
+static volatile size_t	upslog_ring_head = 0, upslog_ring_tail = 0;
+static volatile int	upslog_async_running = 0, upslog_async_stopping = 0, upslog_async_sleeping = 0;
+static int	upslog_async_restart = 0;	/* in a forked child, on its first message */
+static volatile size_t	upslog_async_dropped_total = 0;
+static pthread_t	upslog_async_thread;
+static pthread_mutex_t	upslog_async_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t	upslog_async_wake_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	upslog_async_wake = PTHREAD_COND_INITIALIZER;
+
+# if defined(__GNUC__) || defined(__clang__)
+#  define UPSLOG_BARRIER()	__sync_synchronize()
+# else
+#  define UPSLOG_BARRIER()	do { } while (0)
+# endif
+#endif	/* NUT_LOG_ASYNC_SUPPORTED */
+
+/* Returns 0 if the message from this site should be dropped, otherwise
+ * 1 and the count of messages suppressed since it was last let through */
+static int upslog_ratelimit_pass(const void *site, time_t now, unsigned int *suppressed)
+{
+	upslog_site_t	*entry;
+
+	*suppressed = 0;
+
+	if (!upslog_ratelimit || !site)
+		return 1;
+
+	entry = &upslog_sites[((uintptr_t)site >> 3) % UPSLOG_RATELIMIT_SITES];
+
+	if (entry->site != site) {
+		entry->site = site;
+		entry->window = now;
+		entry->count = 0;
+		entry->suppressed = 0;
+	} else if (entry->window != now) {
+		entry->window = now;
+		entry->count = 0;
+	}
+
+	if (++entry->count > upslog_ratelimit) {
+		entry->suppressed++;
+		upslog_suppressed_total++;
+		return 0;
+	}
+
+	*suppressed = entry->suppressed;
+	entry->suppressed = 0;
+
+	return 1;
+}
+
+/* Write out one formatted message to the logging devices in "flags" */
+static void upslog_output(int priority, int flags, int timestamp, struct timeval *tv, const char *buf)
+{
+	if (xbit_test(flags, UPSLOG_STDERR)) {
+		if (timestamp) {
+			struct timeval		now = *tv;
+
+			if (upslog_start.tv_usec > now.tv_usec) {
+				now.tv_usec += 1000000;
+				now.tv_sec -= 1;
+			}
+
+			/* Print all in one shot, to better avoid
+			 * mixed lines in parallel threads */
+			fprintf(stderr, "%4.0f.%06ld\t%s\n",
+				difftime(now.tv_sec, upslog_start.tv_sec),
+				(long)(now.tv_usec - upslog_start.tv_usec),
+				buf);
+		} else {
+			fprintf(stderr, "%s\n", buf);
+		}
+#ifdef WIN32
+		fflush(stderr);
+#endif	/* WIN32 */
+	}
+	if (xbit_test(flags, UPSLOG_SYSLOG))
+		syslog(priority, "%s", buf);
+}
+
+#ifdef NUT_LOG_ASYNC_SUPPORTED
+static void *upslog_async_writer(void *arg)
+{
+	size_t	dropped_reported = 0;
+
+	NUT_UNUSED_VARIABLE(arg);
+
+	for (;;) {
+		while (upslog_ring_tail != upslog_ring_head) {
+			upslog_slot_t	*slot;
+
+			UPSLOG_BARRIER();
+			slot = &upslog_ring[upslog_ring_tail % upslog_ring_slots];
+			upslog_output(slot->priority, slot->flags, slot->timestamp, &slot->tv,
+				slot->ext ? slot->ext : slot->text);
+			if (slot->ext) {
+				free(slot->ext);
+				slot->ext = NULL;
+			}
+			UPSLOG_BARRIER();
+			upslog_ring_tail++;
+		}
+
+		if (upslog_async_dropped_total != dropped_reported) {
+			struct timeval	tv;
+			char	msg[SMALLBUF];
+
+			snprintf(msg, sizeof(msg), "upslog: %" PRIuSIZE " messages were dropped (log buffer full)",
+				upslog_async_dropped_total - dropped_reported);
+			dropped_reported = upslog_async_dropped_total;
+			gettimeofday(&tv, NULL);
+			upslog_output(LOG_WARNING, upslog_flags, (nut_debug_level > 0), &tv, msg);
+		}
+
+		if (upslog_async_stopping)
+			break;
+
+		/* Sleep until a producer finds us sleeping, with a
+		 * timeout in case the wake-up raced with going to bed */
+		pthread_mutex_lock(&upslog_async_wake_lock);
+		upslog_async_sleeping = 1;
+		UPSLOG_BARRIER();
+		if (upslog_ring_tail == upslog_ring_head && !upslog_async_stopping) {
+			struct timeval	now;
+			struct timespec	until;
+
+			gettimeofday(&now, NULL);
+			until.tv_sec = now.tv_sec;
+			until.tv_nsec = (long)now.tv_usec * 1000 + 100000000L;
+			if (until.tv_nsec >= 1000000000L) {
+				until.tv_sec++;
+				until.tv_nsec -= 1000000000L;
+			}
+			pthread_cond_timedwait(&upslog_async_wake, &upslog_async_wake_lock, &until);
+		}
+		upslog_async_sleeping = 0;
+		pthread_mutex_unlock(&upslog_async_wake_lock);
+	}
+
+	return NULL;
+}
+
+static void upslog_async_kick(void)
+{
+	UPSLOG_BARRIER();
+	if (upslog_async_sleeping) {
+		pthread_mutex_lock(&upslog_async_wake_lock);
+		pthread_cond_signal(&upslog_async_wake);
+		pthread_mutex_unlock(&upslog_async_wake_lock);
+	}
+}
+
+/* Wait (a bit) for the writer to catch up; returns 0 if it did */
+static int upslog_async_drain(void)
+{
+	int	i;
+
+	for (i = 0; i < 2000 && upslog_async_running && upslog_ring_tail != upslog_ring_head; i++) {
+		struct timespec	delay = { 0, 1000000L };
+
+		upslog_async_kick();
+		nanosleep(&delay, NULL);
+	}
+
+	return (upslog_ring_tail == upslog_ring_head) ? 0 : -1;
+}
+
+/* Queue a message for the writer; returns 0 if the caller should write
+ * it out synchronously (async logging is not running) */
+static int upslog_async_push(int priority, int flags, int timestamp, struct timeval *tv, const char *buf)
+{
+	upslog_slot_t	*slot;
+	size_t	len;
+	char	*ext = NULL;
+
+	if (!upslog_async_running) {
+		if (!upslog_async_restart)
+			return 0;
+		upslog_async_restart = 0;
+		if (upslog_async_start(upslog_ring_slots) < 0)
+			return 0;
+	}
+
+	/* Copy a long message before taking the lock, and without xstrdup():
+	 * its fatal() would log, and so come back here to lock it again.
+	 * Without memory, the message is cut to what fits in the slot. */
+	len = strlen(buf);
+	if (len >= sizeof(slot->text))
+		ext = strdup(buf);
+
+	pthread_mutex_lock(&upslog_async_lock);
+	if (!upslog_async_running) {
+		pthread_mutex_unlock(&upslog_async_lock);
+		free(ext);
+		return 0;
+	}
+
+	if (upslog_ring_head - upslog_ring_tail >= upslog_ring_slots) {
+		upslog_async_dropped_total++;
+		pthread_mutex_unlock(&upslog_async_lock);
+		free(ext);
+		upslog_async_kick();
+		return 1;
+	}
+
+	slot = &upslog_ring[upslog_ring_head % upslog_ring_slots];
+	slot->priority = priority;
+	slot->flags = flags;
+	slot->timestamp = timestamp;
+	slot->tv = *tv;
+
+	slot->ext = ext;
+	if (!ext) {
+		if (len >= sizeof(slot->text))
+			len = sizeof(slot->text) - 1;
+		memcpy(slot->text, buf, len);
+		slot->text[len] = '\0';
+	}
+
+	UPSLOG_BARRIER();
+	upslog_ring_head++;
+	pthread_mutex_unlock(&upslog_async_lock);
+
+	upslog_async_kick();
+	return 1;
+}
+
+/* The writer thread does not survive fork(): let it write out what was
+ * queued so far, and have the child start its own on the next message */
+static void upslog_async_atfork_prepare(void)
+{
+	pthread_mutex_lock(&upslog_async_lock);
+	upslog_async_drain();
+}
+
+static void upslog_async_atfork_parent(void)
+{
+	pthread_mutex_unlock(&upslog_async_lock);
+}
+
+static void upslog_async_atfork_child(void)
+{
+	pthread_mutex_init(&upslog_async_wake_lock, NULL);
+	pthread_cond_init(&upslog_async_wake, NULL);
+	upslog_ring_tail = upslog_ring_head;
+	upslog_async_sleeping = 0;
+	upslog_async_restart = upslog_async_running;
+	upslog_async_running = 0;
+	pthread_mutex_unlock(&upslog_async_lock);
+}
+
+static void upslog_async_atexit(void)
+{
+	upslog_async_stop();
+}
+#endif	/* NUT_LOG_ASYNC_SUPPORTED */
+
+int upslog_async_start(size_t slots)
+{
+#ifdef NUT_LOG_ASYNC_SUPPORTED
+	static int	registered = 0;
+
+	if (upslog_async_running)
+		return 0;
+
+	if (!slots)
+		slots = UPSLOG_ASYNC_DEFAULT_SLOTS;
+
+	if (upslog_ring && upslog_ring_slots != slots) {
+		free(upslog_ring);
+		upslog_ring = NULL;
+	}
+	if (!upslog_ring) {
+		upslog_ring = xcalloc(slots, sizeof(*upslog_ring));
+		upslog_ring_slots = slots;
+	}
+	upslog_ring_head = upslog_ring_tail = 0;
+	upslog_async_stopping = 0;
+
+	if (upslog_start.tv_sec == 0)
+		gettimeofday(&upslog_start, NULL);
+
+	if (pthread_create(&upslog_async_thread, NULL, upslog_async_writer, NULL)) {
+		upslog_with_errno(LOG_WARNING, "%s: could not start the log writer thread, logging synchronously", __func__);
+		return -1;
+	}
+
+	if (!registered) {
+		pthread_atfork(upslog_async_atfork_prepare, upslog_async_atfork_parent, upslog_async_atfork_child);
+		atexit(upslog_async_atexit);
+		registered = 1;
+	}
+
+	upslog_async_running = 1;
+	return 0;
+#else
+	NUT_UNUSED_VARIABLE(slots);
+	return -1;
+#endif	/* NUT_LOG_ASYNC_SUPPORTED */
+}
+
+void upslog_async_stop(void)
+{
+#ifdef NUT_LOG_ASYNC_SUPPORTED
+	if (!upslog_async_running)
+		return;
+
+	pthread_mutex_lock(&upslog_async_lock);
+	upslog_async_running = 0;
+	pthread_mutex_unlock(&upslog_async_lock);
+
+	upslog_async_stopping = 1;
+	UPSLOG_BARRIER();
+	pthread_mutex_lock(&upslog_async_wake_lock);
+	pthread_cond_signal(&upslog_async_wake);
+	pthread_mutex_unlock(&upslog_async_wake_lock);
+	pthread_join(upslog_async_thread, NULL);
+#endif	/* NUT_LOG_ASYNC_SUPPORTED */
+}
+
+size_t upslog_async_dropped(void)
+{
+#ifdef NUT_LOG_ASYNC_SUPPORTED
+	return upslog_async_dropped_total;
+#else
+	return 0;
+#endif	/* NUT_LOG_ASYNC_SUPPORTED */
+}
+
+void upslog_set_ratelimit(unsigned int per_second)
+{
+	upslog_ratelimit = per_second;
+	memset(upslog_sites, 0, sizeof(upslog_sites));
+}
+
+size_t upslog_ratelimit_suppressed(void)
+{
+	return upslog_suppressed_total;
+}
+
+/* Apply the NUT_LOG_ASYNC and NUT_LOG_RATELIMIT envvars once */
+static void upslog_init_env(void)
+{
+	static int	done = 0;
+	const char	*s;
+	long	l;
+
+	if (done)
+		return;
+	done = 1;
+
+	if ((s = getenv("NUT_LOG_RATELIMIT")) != NULL && *s) {
+		if (str_to_long(s, &l, 10) && l >= 0) {
+			upslog_ratelimit = (unsigned int)l;
+		} else {
+			upsdebugx(0, "%s: unknown NUT_LOG_RATELIMIT='%s' value, ignored", __func__, s);
+		}
+	}
+
+	if ((s = getenv("NUT_LOG_ASYNC")) != NULL && *s
+	 && strcmp(s, "false") && strcmp(s, "no") && strcmp(s, "0")
+	) {
+		l = 0;
+		if (strcmp(s, "true") && strcmp(s, "yes")
+		 && !(str_to_long(s, &l, 10) && l > 0)
+		) {
+			upsdebugx(0, "%s: unknown NUT_LOG_ASYNC='%s' value, assuming 'true'", __func__, s);
+			l = 0;
+		}
+		if (upslog_async_start((size_t)l) < 0)
+			upsdebugx(1, "%s: asynchronous logging is not available", __func__);
+	}
+}
+
+static void vupslog(int priority, const void *site, const char *fmt, va_list va, int use_strerror)
 {
 	int	ret, errno_orig = errno;
-	size_t	bufsize = LARGEBUF;
-	char	*buf = xcalloc(bufsize, sizeof(char));
+	unsigned int	suppressed = 0;
+	struct timeval	now;
+	char	sbuf[LARGEBUF];
+	size_t	bufsize = sizeof(sbuf);
+	char	*buf = sbuf;
 
-	/* Be pedantic about our limitations */
-	bufsize *= sizeof(char);
+	upslog_init_env();
+
+	gettimeofday(&now, NULL);
+	if (!upslog_ratelimit_pass(site, now.tv_sec, &suppressed))
+		return;
+
+	sbuf[0] = '\0';
 
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
@@ -3259,7 +3684,10 @@ static void vupslog(int priority, const char *fmt, va_list va, int use_strerror)
 						newbufsize);
 				}
 				bufsize = newbufsize;
-				buf = xrealloc(buf, bufsize);
+				/* Contents are formatted anew, no need to copy */
+				if (buf != sbuf)
+					free(buf);
+				buf = xmalloc(bufsize);
 				continue;
 			}
 		} else {
@@ -3324,42 +3752,22 @@ vupslog_too_long:
 #endif	/* WIN32 */
 	}
 
+	if (suppressed)
+		snprintfcat(buf, bufsize, " [%u similar messages suppressed]", suppressed);
+
 	/* Note: nowadays debug level can be changed during run-time,
 	 * so mark the starting point whenever we first try to log */
 	if (upslog_start.tv_sec == 0) {
-		struct timeval		now;
-
-		gettimeofday(&now, NULL);
 		upslog_start = now;
 	}
 
-	if (xbit_test(upslog_flags, UPSLOG_STDERR)) {
-		if (nut_debug_level > 0) {
-			struct timeval		now;
+#ifdef NUT_LOG_ASYNC_SUPPORTED
+	if (!upslog_async_push(priority, upslog_flags, (nut_debug_level > 0), &now, buf))
+#endif	/* NUT_LOG_ASYNC_SUPPORTED */
+		upslog_output(priority, upslog_flags, (nut_debug_level > 0), &now, buf);
 
-			gettimeofday(&now, NULL);
-
-			if (upslog_start.tv_usec > now.tv_usec) {
-				now.tv_usec += 1000000;
-				now.tv_sec -= 1;
-			}
-
-			/* Print all in one shot, to better avoid
-			 * mixed lines in parallel threads */
-			fprintf(stderr, "%4.0f.%06ld\t%s\n",
-				difftime(now.tv_sec, upslog_start.tv_sec),
-				(long)(now.tv_usec - upslog_start.tv_usec),
-				buf);
-		} else {
-			fprintf(stderr, "%s\n", buf);
-		}
-#ifdef WIN32
-		fflush(stderr);
-#endif	/* WIN32 */
-	}
-	if (xbit_test(upslog_flags, UPSLOG_SYSLOG))
-		syslog(priority, "%s", buf);
-	free(buf);
+	if (buf != sbuf)
+		free(buf);
 }
 
 
@@ -3517,6 +3925,7 @@ void check_unix_socket_filename(const char *fn) {
 void upslog_with_errno(int priority, const char *fmt, ...)
 {
 	va_list va;
+	const void	*site = fmt;
 
 	va_start(va, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
@@ -3532,7 +3941,7 @@ void upslog_with_errno(int priority, const char *fmt, ...)
 	 * format string (we should not get it from configs etc.
 	 * or the calling methods should check it against their
 	 * "fmt_dynamic" expectations). */
-	vupslog(priority, fmt, va, 1);
+	vupslog(priority, site, fmt, va, 1);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
@@ -3543,6 +3952,7 @@ void upslog_with_errno(int priority, const char *fmt, ...)
 void upslogx(int priority, const char *fmt, ...)
 {
 	va_list va;
+	const void	*site = fmt;
 
 	va_start(va, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
@@ -3558,7 +3968,7 @@ void upslogx(int priority, const char *fmt, ...)
 	 * format string (we should not get it from configs etc.
 	 * or the calling methods should check it against their
 	 * "fmt_dynamic" expectations). */
-	vupslog(priority, fmt, va, 0);
+	vupslog(priority, site, fmt, va, 0);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
@@ -3569,6 +3979,7 @@ void s_upsdebug_with_errno(int level, const char *fmt, ...)
 {
 	va_list va;
 	char fmt2[LARGEBUF];
+	const void	*site = fmt;
 	static int NUT_DEBUG_PID = -1;
 
 	/* Note: Thanks to macro wrapping, we do not quite need this
@@ -3624,7 +4035,7 @@ void s_upsdebug_with_errno(int level, const char *fmt, ...)
 	 * format string (we should not get it from configs etc.
 	 * or the calling methods should check it against their
 	 * "fmt_dynamic" expectations). */
-	vupslog(LOG_DEBUG, fmt, va, 1);
+	vupslog(LOG_DEBUG, site, fmt, va, 1);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
@@ -3635,6 +4046,7 @@ void s_upsdebugx(int level, const char *fmt, ...)
 {
 	va_list va;
 	char fmt2[LARGEBUF];
+	const void	*site = fmt;
 	static int NUT_DEBUG_PID = -1;
 
 	if (nut_debug_level < level)
@@ -3683,7 +4095,7 @@ void s_upsdebugx(int level, const char *fmt, ...)
 	 * format string (we should not get it from configs etc.
 	 * or the calling methods should check it against their
 	 * "fmt_dynamic" expectations). */
-	vupslog(LOG_DEBUG, fmt, va, 0);
+	vupslog(LOG_DEBUG, site, fmt, va, 0);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
@@ -3800,6 +4212,9 @@ static void vfatal(const char *fmt, va_list va, int use_strerror)
 	int	syslog_disabled = syslog_is_disabled(),
 		stderr_disabled = (syslog_disabled == 0 || syslog_disabled == 2);
 
+	/* Write out what was queued, and the last words synchronously */
+	upslog_async_stop();
+
 	if (xbit_test(upslog_flags, UPSLOG_STDERR_ON_FATAL))
 		xbit_set(&upslog_flags, UPSLOG_STDERR);
 	if (xbit_test(upslog_flags, UPSLOG_SYSLOG_ON_FATAL)) {
@@ -3827,7 +4242,7 @@ static void vfatal(const char *fmt, va_list va, int use_strerror)
 	 * format string (we should not get it from configs etc.
 	 * or the calling methods should check it against their
 	 * "fmt_dynamic" expectations). */
-	vupslog(LOG_ERR, fmt, va, use_strerror);
+	vupslog(LOG_ERR, NULL, fmt, va, use_strerror);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic pop
 #endif
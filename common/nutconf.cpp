@@ -36,6 +36,7 @@
 #include <sstream>
 #include <iostream>
 #include <cassert>
+#include <utility>
 
 
 namespace nut {
@@ -540,7 +541,7 @@ void NutConfigParser::parseConfig()
 						break;
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
-						name = tok.str;
+						name = std::move(tok.str);
 						state = CPS_DIRECTIVE_HAVE_NAME;
 						break;
 
@@ -560,7 +561,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Should occur ! */
-						name = tok.str;
+						name = std::move(tok.str);
 						state = CPS_SECTION_HAVE_NAME;
 						break;
 					case Token::TOKEN_BRACKET_CLOSE:
@@ -680,7 +681,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Could occur ! */
-						values.push_back(tok.str);
+						values.push_back(std::move(tok.str));
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 
@@ -716,7 +717,7 @@ void NutConfigParser::parseConfig()
 					case Token::TOKEN_STRING:
 					case Token::TOKEN_QUOTED_STRING:
 						/* Could occur ! */
-						values.push_back(tok.str);
+						values.push_back(std::move(tok.str));
 						state = CPS_DIRECTIVE_VALUES;
 						break;
 
@@ -826,10 +827,9 @@ void DefaultConfigParser::onParseDirective(
 	// Separator has no specific semantic in this context
 
 	// Save values
-	_section.entries[directiveName].name = directiveName;
-	_section.entries[directiveName].values = values;
-
-	// TODO Can probably be optimized.
+	GenericConfigSectionEntry & entry = _section.entries[directiveName];
+	entry.name = directiveName;
+	entry.values = values;
 }
 
 void DefaultConfigParser::onParseEnd()
@@ -911,7 +911,9 @@ void GenericConfiguration::parseFromString(const std::string& str)
 
 bool GenericConfiguration::parseFrom(NutStream & istream)
 {
-	// TODO: The parser is highly inefficient, it should use NutStream, directly
+	// The parser works on the whole text in memory (it needs to look back);
+	// configuration files are small enough for this, and NutFile reads
+	// them in blocks
 	std::string str;
 
 	if (NutStream::NUTS_OK != istream.getString(str))
@@ -946,18 +948,17 @@ bool GenericConfiguration::get(const std::string & section, const std::string &
 		if (caseSensitive)
 			return false;
 
-		// Another pass, maybe slower and inefficient, for case-insensitive matching
-		// We are already at one end of the entries, so scroll back to beginning
-		GenericConfigSection::EntryMap::const_iterator entry_begin = entries.begin();
-		for (; entry_iter != entry_begin; entry_iter--) {
+		// Another pass for case-insensitive matching; a section only has
+		// a handful of entries, so a linear scan of them is cheap enough
+		for (entry_iter = entries.begin(); entry_iter != entries.end(); ++entry_iter) {
 			if (!(::strcasecmp(entry_iter->first.c_str(), entry.c_str())))
-				goto found;
+				break;
 		}
 
-		return false;
+		if (entry_iter == entries.end())
+			return false;
 	}
 
-found:
 	// Provide parameters values
 	params = entry_iter->second.values;
 
@@ -1973,6 +1974,13 @@ void UpsdConfigParser::onParseDirective(const std::string& directiveName, char s
 				_config->statePath = values.front();
 			}
 		}
+		else if(directiveName == "STATS_SOCKET")
+		{
+			if(values.size()>0)
+			{
+				_config->statsSocket = values.front();
+			}
+		}
 		else if(directiveName == "MAXCONN")
 		{
 			if(values.size()>0)
@@ -1987,6 +1995,13 @@ void UpsdConfigParser::onParseDirective(const std::string& directiveName, char s
 				_config->trackingDelay = StringToSettableNumber<unsigned int>(values.front());
 			}
 		}
+		else if(directiveName == "MAXCONCURRENTDUMPS")
+		{
+			if(values.size()>0)
+			{
+				_config->maxConcurrentDumps = StringToSettableNumber<unsigned int>(values.front());
+			}
+		}
 		else if(directiveName == "ALLOW_NO_DEVICE")
 		{
 			if(values.size()>0)
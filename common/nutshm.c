@@ -0,0 +1,497 @@
+/* nutshm.c - Network UPS Tools shared memory export of driver data
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "config.h"	/* must be first */
+
+#include <stdio.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#ifndef WIN32
+#include <sys/mman.h>
+#endif	/* !WIN32 */
+
+#include "common.h"
+#include "nut_stdint.h"
+#include "state.h"
+#include "nutshm.h"
+
+/* Smallest data area to start with, and how many times the current
+ * data size to allocate when it has to grow (so values changing in
+ * length do not cause a new file on every update) */
+#define NUTSHM_MIN_SIZE	16384
+#define NUTSHM_GROWTH	2
+
+/* Tries to get a consistent copy before giving up for now */
+#define NUTSHM_READ_RETRIES	1000
+
+/* Full memory barrier for the seqlock */
+#if defined(__GNUC__) || defined(__clang__)
+# define NUTSHM_BARRIER()	__sync_synchronize()
+#else
+# define NUTSHM_BARRIER()	do { } while (0)
+#endif
+
+struct nutshm_writer_s {
+	char	*path;
+	char	*refpath;	/* file to copy group ownership from */
+	int	fd;
+	unsigned char	*map;
+	size_t	size;
+	uint64_t	seq;
+};
+
+struct nutshm_reader_s {
+	char	*path;
+	int	fd;
+	const unsigned char	*map;
+	size_t	size;
+	uint64_t	mapgen;	/* counts the files mapped, see nutshm_snapshot_t */
+};
+
+#ifndef WIN32
+
+static size_t st_tree_export_size(const st_tree_t *node, size_t *count)
+{
+	size_t	len = 0;
+
+	for (; node; node = node->right) {
+		len += st_tree_export_size(node->left, count);
+		len += strlen(node->var) + 1 + (node->raw ? strlen(node->raw) : 0) + 1;
+		(*count)++;
+	}
+
+	return len;
+}
+
+static unsigned char *st_tree_export(const st_tree_t *node, unsigned char *dst)
+{
+	size_t	len;
+
+	for (; node; node = node->right) {
+		dst = st_tree_export(node->left, dst);
+
+		len = strlen(node->var) + 1;
+		memcpy(dst, node->var, len);
+		dst += len;
+
+		if (node->raw) {
+			len = strlen(node->raw) + 1;
+			memcpy(dst, node->raw, len);
+			dst += len;
+		} else {
+			*dst++ = '\0';
+		}
+	}
+
+	return dst;
+}
+
+/* let readers in the group of the reference file (driver socket) in */
+static void nutshm_writer_chgrp(nutshm_writer_t *w)
+{
+	struct stat	st;
+
+	if (!w->refpath || stat(w->refpath, &st))
+		return;
+
+	if (fchown(w->fd, (uid_t)-1, st.st_gid))
+		upsdebug_with_errno(1, "%s: chown of %s failed", __func__, w->path);
+}
+
+/* create (or replace) the file with at least datasize bytes for data */
+static int nutshm_writer_create(nutshm_writer_t *w, size_t datasize)
+{
+	char	tmppath[NUT_PATH_MAX + 1];
+	size_t	size = sizeof(nutshm_header_t) + datasize;
+	nutshm_header_t	*h;
+	unsigned char	*map;
+	int	fd;
+
+	snprintf(tmppath, sizeof(tmppath), "%s.new", w->path);
+	unlink(tmppath);
+
+	fd = open(tmppath, O_RDWR | O_CREAT | O_EXCL, 0640);
+	if (fd < 0) {
+		upslog_with_errno(LOG_ERR, "%s: can't create %s", __func__, tmppath);
+		return -1;
+	}
+
+	if (ftruncate(fd, (off_t)size)) {
+		upslog_with_errno(LOG_ERR, "%s: can't resize %s", __func__, tmppath);
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+
+	map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		upslog_with_errno(LOG_ERR, "%s: can't map %s", __func__, tmppath);
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+
+	h = (nutshm_header_t *)map;
+	memcpy(h->magic, NUTSHM_MAGIC, sizeof(h->magic));
+	h->version = NUTSHM_VERSION;
+	h->flags = NUTSHM_FLAG_STALE;
+	h->seq = w->seq;
+	h->size = size;
+
+	if (rename(tmppath, w->path)) {
+		upslog_with_errno(LOG_ERR, "%s: can't rename %s to %s", __func__, tmppath, w->path);
+		munmap(map, size);
+		close(fd);
+		unlink(tmppath);
+		return -1;
+	}
+
+	/* tell the readers of the old file to re-open */
+	if (w->map) {
+		((nutshm_header_t *)w->map)->flags |= NUTSHM_FLAG_OBSOLETE;
+		munmap(w->map, w->size);
+		close(w->fd);
+	}
+
+	w->fd = fd;
+	w->map = map;
+	w->size = size;
+
+	nutshm_writer_chgrp(w);
+
+	upsdebugx(2, "%s: %s is now %" PRIuSIZE " bytes", __func__, w->path, size);
+
+	return 0;
+}
+
+nutshm_writer_t *nutshm_writer_open(const char *path, const char *refpath)
+{
+	nutshm_writer_t	*w = xcalloc(1, sizeof(*w));
+
+	w->path = xstrdup(path);
+	w->refpath = refpath ? xstrdup(refpath) : NULL;
+	w->fd = -1;
+
+	if (nutshm_writer_create(w, NUTSHM_MIN_SIZE)) {
+		nutshm_writer_close(w);
+		return NULL;
+	}
+
+	return w;
+}
+
+int nutshm_writer_publish(nutshm_writer_t *w, const st_tree_t *root, int stale)
+{
+	volatile nutshm_header_t	*h;
+	size_t	count = 0, datalen;
+
+	if (!w || !w->map)
+		return -1;
+
+	datalen = st_tree_export_size(root, &count);
+
+	if (sizeof(nutshm_header_t) + datalen > w->size) {
+		if (nutshm_writer_create(w, datalen * NUTSHM_GROWTH))
+			return -1;
+	}
+
+	h = (volatile nutshm_header_t *)w->map;
+
+	h->seq = ++w->seq;	/* odd: update in progress */
+	NUTSHM_BARRIER();
+
+	st_tree_export(root, w->map + sizeof(nutshm_header_t));
+	h->datalen = datalen;
+	h->count = count;
+	h->updated = (int64_t)time(NULL);
+	if (stale)
+		h->flags |= NUTSHM_FLAG_STALE;
+	else
+		h->flags &= ~(uint32_t)NUTSHM_FLAG_STALE;
+
+	NUTSHM_BARRIER();
+	h->seq = ++w->seq;	/* even: consistent again */
+
+	return 0;
+}
+
+void nutshm_writer_close(nutshm_writer_t *w)
+{
+	if (!w)
+		return;
+
+	if (w->map) {
+		((nutshm_header_t *)w->map)->flags |= NUTSHM_FLAG_STALE | NUTSHM_FLAG_OBSOLETE;
+		munmap(w->map, w->size);
+		unlink(w->path);
+	}
+
+	if (w->fd >= 0)
+		close(w->fd);
+
+	free(w->path);
+	free(w->refpath);
+	free(w);
+}
+
+static int nutshm_reader_map(nutshm_reader_t *r)
+{
+	const nutshm_header_t	*h;
+	struct stat	st;
+	void	*map;
+
+	r->fd = open(r->path, O_RDONLY);
+	if (r->fd < 0) {
+		upsdebug_with_errno(2, "%s: can't open %s", __func__, r->path);
+		return -1;
+	}
+
+	if (fstat(r->fd, &st) || (size_t)st.st_size < sizeof(nutshm_header_t)) {
+		upsdebugx(2, "%s: %s is not a valid export", __func__, r->path);
+		close(r->fd);
+		r->fd = -1;
+		return -1;
+	}
+
+	map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, r->fd, 0);
+	if (map == MAP_FAILED) {
+		upsdebug_with_errno(2, "%s: can't map %s", __func__, r->path);
+		close(r->fd);
+		r->fd = -1;
+		return -1;
+	}
+
+	h = (const nutshm_header_t *)map;
+	if (memcmp(h->magic, NUTSHM_MAGIC, sizeof(h->magic))
+	 || h->version != NUTSHM_VERSION
+	 || h->size != (uint64_t)st.st_size
+	) {
+		upsdebugx(2, "%s: %s is not a valid export", __func__, r->path);
+		munmap(map, (size_t)st.st_size);
+		close(r->fd);
+		r->fd = -1;
+		return -1;
+	}
+
+	r->map = map;
+	r->size = (size_t)st.st_size;
+	r->mapgen++;
+
+	return 0;
+}
+
+static void nutshm_reader_unmap(nutshm_reader_t *r)
+{
+	if (r->map) {
+		munmap((void *)r->map, r->size);
+		r->map = NULL;
+	}
+
+	if (r->fd >= 0) {
+		close(r->fd);
+		r->fd = -1;
+	}
+}
+
+nutshm_reader_t *nutshm_reader_open(const char *path)
+{
+	nutshm_reader_t	*r = xcalloc(1, sizeof(*r));
+
+	r->path = xstrdup(path);
+
+	if (nutshm_reader_map(r)) {
+		nutshm_reader_close(r);
+		return NULL;
+	}
+
+	return r;
+}
+
+void nutshm_reader_close(nutshm_reader_t *r)
+{
+	if (!r)
+		return;
+
+	nutshm_reader_unmap(r);
+	free(r->path);
+	free(r);
+}
+
+int nutshm_reader_snapshot(nutshm_reader_t *r, nutshm_snapshot_t *snap)
+{
+	const volatile nutshm_header_t	*h;
+	uint64_t	seq;
+	size_t	datalen, count;
+	uint32_t	flags;
+	int64_t	updated;
+	int	i;
+
+	if (!r || !snap)
+		return -1;
+
+	for (i = 0; i < NUTSHM_READ_RETRIES; i++) {
+		if (!r->map && nutshm_reader_map(r))
+			return -1;
+
+		h = (const volatile nutshm_header_t *)r->map;
+
+		if (h->flags & NUTSHM_FLAG_OBSOLETE) {
+			nutshm_reader_unmap(r);
+			continue;
+		}
+
+		seq = h->seq;
+		if (seq & 1)
+			continue;	/* being written */
+
+		NUTSHM_BARRIER();
+
+		/* a restarted driver counts its sequence from scratch
+		 * in a new file: the same number there means nothing */
+		if (snap->buf && snap->seq == seq && snap->mapgen == r->mapgen)
+			return 0;	/* nothing new */
+
+		datalen = (size_t)h->datalen;
+		count = (size_t)h->count;
+		flags = h->flags;
+		updated = h->updated;
+
+		if (datalen > r->size - sizeof(nutshm_header_t))
+			continue;	/* torn read */
+
+		if (datalen > snap->bufsize) {
+			snap->buf = xrealloc(snap->buf, datalen);
+			snap->bufsize = datalen;
+		}
+
+		memcpy(snap->buf, r->map + sizeof(nutshm_header_t), datalen);
+
+		NUTSHM_BARRIER();
+
+		if (h->seq != seq)
+			continue;	/* changed while copying */
+
+		snap->buflen = datalen;
+		snap->count = count;
+		snap->flags = flags;
+		snap->updated = (time_t)updated;
+		snap->seq = seq;
+		snap->mapgen = r->mapgen;
+
+		return 1;
+	}
+
+	upsdebugx(2, "%s: %s kept changing, giving up for now", __func__, r->path);
+	errno = EAGAIN;
+	return -1;
+}
+
+#else	/* WIN32 */
+
+/* NUT_WIN32_INCOMPLETE(): not implemented on this platform yet */
+
+nutshm_writer_t *nutshm_writer_open(const char *path, const char *refpath)
+{
+	NUT_UNUSED_VARIABLE(path);
+	NUT_UNUSED_VARIABLE(refpath);
+	upsdebugx(1, "%s: shared memory export is not implemented on this platform", __func__);
+	return NULL;
+}
+
+int nutshm_writer_publish(nutshm_writer_t *w, const st_tree_t *root, int stale)
+{
+	NUT_UNUSED_VARIABLE(w);
+	NUT_UNUSED_VARIABLE(root);
+	NUT_UNUSED_VARIABLE(stale);
+	return -1;
+}
+
+void nutshm_writer_close(nutshm_writer_t *w)
+{
+	NUT_UNUSED_VARIABLE(w);
+}
+
+nutshm_reader_t *nutshm_reader_open(const char *path)
+{
+	NUT_UNUSED_VARIABLE(path);
+	return NULL;
+}
+
+void nutshm_reader_close(nutshm_reader_t *r)
+{
+	NUT_UNUSED_VARIABLE(r);
+}
+
+int nutshm_reader_snapshot(nutshm_reader_t *r, nutshm_snapshot_t *snap)
+{
+	NUT_UNUSED_VARIABLE(r);
+	NUT_UNUSED_VARIABLE(snap);
+	return -1;
+}
+
+#endif	/* WIN32 */
+
+nutshm_reader_t *nutshm_reader_open_ups(const char *drvname, const char *upsname)
+{
+	char	path[NUT_PATH_MAX + 1];
+
+	snprintf(path, sizeof(path), "%s/%s-%s" NUTSHM_SUFFIX,
+		dflt_statepath(), drvname, upsname);
+
+	return nutshm_reader_open(path);
+}
+
+int nutshm_snapshot_next(const nutshm_snapshot_t *snap, size_t *pos,
+	const char **name, const char **value)
+{
+	size_t	len;
+
+	if (!snap || !snap->buf || *pos >= snap->buflen)
+		return 0;
+
+	*name = snap->buf + *pos;
+	len = strlen(*name) + 1;
+	if (*pos + len >= snap->buflen)
+		return 0;	/* truncated record */
+
+	*value = *name + len;
+	*pos += len + strlen(*value) + 1;
+
+	return 1;
+}
+
+const char *nutshm_snapshot_get(const nutshm_snapshot_t *snap, const char *name)
+{
+	const char	*n, *v;
+	size_t	pos = 0;
+
+	while (nutshm_snapshot_next(snap, &pos, &n, &v)) {
+		if (!strcasecmp(n, name))
+			return v;
+	}
+
+	return NULL;
+}
+
+void nutshm_snapshot_free(nutshm_snapshot_t *snap)
+{
+	if (!snap)
+		return;
+
+	free(snap->buf);
+	memset(snap, 0, sizeof(*snap));
+}
@@ -710,20 +710,20 @@ NutStream::status_t NutFile::getString(std::string & str)
 	if (nullptr == m_impl)
 		return NUTS_ERROR;
 
-	// Note that ::fgetc is used instead of ::fgets
+	// Note that ::fread is used instead of ::fgets
 	// That's because of \0 char. support
 	for (;;) {
-		char ch;
+		char	buf[4096];
+		size_t	len = ::fread(buf, 1, sizeof(buf), m_impl);
 
-		status_t status = fgetcWrapper(m_impl, ch);
+		str.append(buf, len);
 
-		if (NUTS_ERROR == status)
-			return status;
+		if (len < sizeof(buf)) {
+			if (::ferror(m_impl))
+				return NUTS_ERROR;
 
-		if (NUTS_EOF == status)
 			return NUTS_OK;
-
-		str += ch;
+		}
 	}
 }
 
@@ -807,10 +807,12 @@ NutWriter::status_t UpsdConfigWriter::writeConfig(const UpsdConfiguration & conf
 	UPSD_DIRECTIVEX("MAXAGE",                   unsigned int, config.maxAge);
 	UPSD_DIRECTIVEX("MAXCONN",                  unsigned int, config.maxConn);
 	UPSD_DIRECTIVEX("TRACKINGDELAY",            unsigned int, config.trackingDelay);
+	UPSD_DIRECTIVEX("MAXCONCURRENTDUMPS",       unsigned int, config.maxConcurrentDumps);
 	UPSD_DIRECTIVEX("ALLOW_NO_DEVICE",          bool,         config.allowNoDevice);
 	UPSD_DIRECTIVEX("ALLOW_NOT_ALL_LISTENERS",  bool,         config.allowNotAllListeners);
 	UPSD_DIRECTIVEX("DISABLE_WEAK_SSL",         bool,         config.disableWeakSsl);
 	CONFIG_DIRECTIVEX("STATEPATH",              std::string,  config.statePath, true);
+	CONFIG_DIRECTIVEX("STATS_SOCKET",           std::string,  config.statsSocket, true);
 	CONFIG_DIRECTIVEX("CERTFILE",               std::string,  config.certFile, true);
 	CONFIG_DIRECTIVEX("CERTPATH",               std::string,  config.certPath, true);
 	UPSD_DIRECTIVEX("CERTREQUEST",              unsigned int, config.certRequestLevel);
@@ -27,7 +27,8 @@
  * All subsequent calls must have it as the first argument.  There are
  * two entry points for parsing lines.  You can have it read a file
  * (pconf_file_begin and pconf_file_next), take lines directly from
- * the caller (pconf_line), or go along a character at a time (pconf_char).
+ * the caller (pconf_line), go along a character at a time (pconf_char),
+ * or hand over whatever a read() returned (pconf_buf).
  * The parsing is identical no matter how you feed it.
  *
  * Since there are no more callbacks, you take the successful return
@@ -74,6 +75,11 @@
  * Finally, there is argsize, which remembers how long each of the
  * arglist elements are.  This is how we know when to expand them.
  *
+ * When fed a buffer (pconf_buf), runs of ordinary characters inside a
+ * word are located in one scan and appended to the word at once, while
+ * anything special (quotes, escapes, comments, whitespace, invalid bytes)
+ * still goes through the state machine one character at a time.
+ *
  */
 
 #include "config.h" /* should be first */
@@ -149,7 +155,7 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = 0;
 	}
 
-	wbuflen = strlen(ctx->wordbuf);
+	wbuflen = (size_t)(ctx->wordptr - ctx->wordbuf);
 
 	/* now see if the string itself grew compared to last time */
 	if (wbuflen >= ctx->argsize[argpos]) {
@@ -168,18 +174,33 @@ static void add_arg_word(PCONF_CTX_t *ctx)
 		ctx->argsize[argpos] = newlen;
 	}
 
-	/* strncpy doesn't give us a trailing NULL, so prep the space */
-	memset(ctx->arglist[argpos], '\0', ctx->argsize[argpos]);
+	/* finally copy the new value (with its trailing NULL) into the provided space */
+	memcpy(ctx->arglist[argpos], ctx->wordbuf, wbuflen + 1);
+}
+
+/* make room in wordbuf for at least wbuflen + len chars and the null */
+static void growwordbuf(PCONF_CTX_t *ctx, size_t wbuflen, size_t len)
+{
+	if (wbuflen + len < ctx->wordbufsize)
+		return;
+
+	ctx->wordbufsize = ((wbuflen + len) / 8 + 1) * 8;
 
-	/* finally copy the new value into the provided space */
-	strncpy(ctx->arglist[argpos], ctx->wordbuf, wbuflen);
+	ctx->wordbuf = realloc(ctx->wordbuf, ctx->wordbufsize);
+
+	if (!ctx->wordbuf)
+		pconf_fatal(ctx, "realloc wordbuf failed");
+
+	/* repoint as wordbuf may have moved */
+	ctx->wordptr = &ctx->wordbuf[wbuflen];
 }
 
 static void addchar(PCONF_CTX_t *ctx)
 {
 	size_t	wbuflen;
 
-	wbuflen = strlen(ctx->wordbuf);
+	/* wordbuf never contains a null before wordptr, see below */
+	wbuflen = (size_t)(ctx->wordptr - ctx->wordbuf);
 
 	/* CVE-2012-2944: only allow the subset of ASCII charset from Space to ~ */
 	if ((ctx->ch < 0x20) || (ctx->ch > 0x7f)) {
@@ -197,19 +218,32 @@ static void addchar(PCONF_CTX_t *ctx)
 	}
 
 	/* allow for the null */
-	if (wbuflen >= (ctx->wordbufsize - 1)) {
-		ctx->wordbufsize += 8;
+	growwordbuf(ctx, wbuflen, 1);
+
+	*ctx->wordptr++ = (char)ctx->ch;
+	*ctx->wordptr = '\0';
+}
+
+/* append a run of len chars which addchar() would all accept one by one */
+static void addchars(PCONF_CTX_t *ctx, const char *src, size_t len)
+{
+	size_t	wbuflen;
 
-		ctx->wordbuf = realloc(ctx->wordbuf, ctx->wordbufsize);
+	wbuflen = (size_t)(ctx->wordptr - ctx->wordbuf);
 
-		if (!ctx->wordbuf)
-			pconf_fatal(ctx, "realloc wordbuf failed");
+	if (ctx->wordlen_limit != 0) {
+		if (wbuflen >= ctx->wordlen_limit)
+			return;
 
-		/* repoint as wordbuf may have moved */
-		ctx->wordptr = &ctx->wordbuf[wbuflen];
+		/* limit reached: don't append any more */
+		if (len > ctx->wordlen_limit - wbuflen)
+			len = ctx->wordlen_limit - wbuflen;
 	}
 
-	*ctx->wordptr++ = (char)ctx->ch;
+	growwordbuf(ctx, wbuflen, len);
+
+	memcpy(ctx->wordptr, src, len);
+	ctx->wordptr += len;
 	*ctx->wordptr = '\0';
 }
 
@@ -629,6 +663,99 @@ char *pconf_encode(const char *src, char *dest, size_t destsize)
 	return dest;
 }
 
+/* length of the run of chars at the start of buf that the current state
+ * would just add to the word (and stay in that state), 0 if there is none */
+static size_t plain_span(const PCONF_CTX_t *ctx, const char *buf, size_t buflen)
+{
+	size_t	i;
+	unsigned char	c;
+
+	switch (ctx->state) {
+		case STATE_COLLECT:
+			for (i = 0; i < buflen; i++) {
+				c = (unsigned char)buf[i];
+
+				/* no spaces or controls, only what addchar() allows */
+				if (c <= 0x20 || c > 0x7f)
+					return i;
+
+				if (c == '#' || c == '=' || c == '\\')
+					return i;
+			}
+
+			return buflen;
+
+		case STATE_QUOTECOLLECT:
+			for (i = 0; i < buflen; i++) {
+				c = (unsigned char)buf[i];
+
+				/* spaces are fine in quotes, controls are not */
+				if (c < 0x20 || c > 0x7f)
+					return i;
+
+				if (c == '#' || c == '"' || c == '\\')
+					return i;
+			}
+
+			return buflen;
+
+		default:
+			return 0;
+	}	/* switch */
+}
+
+/* parse a buffer of input, stopping after the first completed line (or
+ * parse error): returns as pconf_char() would for the last char consumed,
+ * with the count of chars consumed from buf stored in *used */
+int pconf_buf(PCONF_CTX_t *ctx, const char *buf, size_t buflen, size_t *used)
+{
+	size_t	i, span;
+
+	if (used)
+		*used = 0;
+
+	if (!check_magic(ctx))
+		return -1;
+
+	for (i = 0; i < buflen; i++) {
+
+		/* if the last char finished a line, clean stuff up for another */
+		if ((ctx->state == STATE_ENDOFLINE) || (ctx->state == STATE_PARSEERR)) {
+			ctx->numargs = 0;
+			ctx->state = STATE_FINDWORDSTART;
+		}
+
+		/* bulk-copy ordinary chars inside a word */
+		span = plain_span(ctx, buf + i, buflen - i);
+
+		if (span > 0) {
+			addchars(ctx, buf + i, span);
+			i += span - 1;
+			continue;
+		}
+
+		ctx->ch = buf[i];
+		parse_char(ctx);
+
+		if (ctx->state == STATE_ENDOFLINE) {
+			if (used)
+				*used = i + 1;
+			return 1;
+		}
+
+		if (ctx->state == STATE_PARSEERR) {
+			if (used)
+				*used = i + 1;
+			return -1;
+		}
+	}
+
+	if (used)
+		*used = buflen;
+
+	return 0;
+}
+
 /* parse input a character at a time */
 int pconf_char(PCONF_CTX_t *ctx, char ch)
 {
@@ -33,15 +33,186 @@
 #endif	/* !WIN32 */
 
 #include "common.h"
+#include "nut_stdint.h"
 #include "state.h"
 #include "parseconf.h"
 
+/* Value buffers are allocated in multiples of this size, so that values
+ * slowly changing in length (e.g. counters, "9" -> "10") are updated in
+ * place rather than reallocated every time they grow by a character */
+#define ST_VALUE_ALLOC_GRANULARITY	16
+
+/* Variable and command names are interned: each spelling of a name is
+ * stored once per process, shared by all the trees and command lists
+ * which use it, and freed with the last of them. Names are compared
+ * case-insensitively (as the trees are sorted), so all the spellings
+ * of a name hash the same: a name with no spelling in this table is
+ * in no tree at all, and a node name spelled the same as the one it
+ * is compared with is the same pointer. Each tree keeps the spelling
+ * it was given, as it would without the table. Like the trees, the
+ * table is not locked against concurrent changes. */
+typedef struct st_name_s {
+	char	*name;	/* allocated along with the entry */
+	uint32_t	hash;
+	size_t	refs;
+	struct st_name_s	*next;	/* in the same hash bucket */
+} st_name_t;
+
+/* initial count of hash buckets (a power of two), doubled as names come */
+#define ST_NAME_HASH_MIN	256
+
+static st_name_t	**st_name_hash = NULL;
+static size_t	st_name_hashsize = 0;
+static size_t	st_name_num = 0;
+
 /* internal helpers */
 
+static void st_name_rehash(size_t newsize)
+{
+	st_name_t	**newhash, *item, *next_item;
+	size_t	i, bucket;
+
+	newhash = xcalloc(newsize, sizeof(*newhash));
+
+	for (i = 0; i < st_name_hashsize; i++) {
+		for (item = st_name_hash[i]; item; item = next_item) {
+			next_item = item->next;
+			bucket = item->hash & (newsize - 1);
+			item->next = newhash[bucket];
+			newhash[bucket] = item;
+		}
+	}
+
+	free(st_name_hash);
+	st_name_hash = newhash;
+	st_name_hashsize = newsize;
+}
+
+/* the entry of this very spelling of name, or (if not "exact") of any
+ * other spelling when there is none */
+static st_name_t *st_name_lookup(const char *name, uint32_t hash, int exact)
+{
+	st_name_t	*item, *found = NULL;
+
+	if (!st_name_num)
+		return NULL;
+
+	for (item = st_name_hash[hash & (st_name_hashsize - 1)]; item; item = item->next) {
+		if (item->hash != hash)
+			continue;
+
+		if (!strcmp(item->name, name))
+			return item;
+
+		if (!exact && !found && !strcasecmp(item->name, name))
+			found = item;
+	}
+
+	return found;
+}
+
+/* an interned spelling of name, or NULL if no tree or list uses it */
+static const char *st_name_find(const char *name)
+{
+	st_name_t	*item = st_name_lookup(name, str_hash_nocase(name), 0);
+
+	return item ? item->name : NULL;
+}
+
+/* the interned copy of name (added if needed), referenced once more */
+static char *st_name_get(const char *name)
+{
+	uint32_t	hash = str_hash_nocase(name);
+	st_name_t	*item = st_name_lookup(name, hash, 1);
+	size_t	len, bucket;
+
+	if (item) {
+		item->refs++;
+		return item->name;
+	}
+
+	if (st_name_num >= st_name_hashsize) {
+		st_name_rehash(st_name_hashsize ? st_name_hashsize * 2 : ST_NAME_HASH_MIN);
+	}
+
+	len = strlen(name) + 1;
+	item = xcalloc(1, sizeof(*item) + len);
+	item->name = (char *)(item + 1);
+	memcpy(item->name, name, len);
+	item->hash = hash;
+	item->refs = 1;
+
+	bucket = hash & (st_name_hashsize - 1);
+	item->next = st_name_hash[bucket];
+	st_name_hash[bucket] = item;
+	st_name_num++;
+
+	return item->name;
+}
+
+/* drop a reference to an interned name, freeing it with the last one */
+static void st_name_put(char *name)
+{
+	st_name_t	*item = ((st_name_t *)name) - 1, **pp;
+
+	if (--item->refs > 0)
+		return;
+
+	for (pp = &st_name_hash[item->hash & (st_name_hashsize - 1)]; *pp; pp = &(*pp)->next) {
+		if (*pp == item) {
+			*pp = item->next;
+			break;
+		}
+	}
+
+	st_name_num--;
+	free(item);
+
+	if (!st_name_num) {
+		free(st_name_hash);
+		st_name_hash = NULL;
+		st_name_hashsize = 0;
+	}
+}
+
+/* compare a node name with an interned one (of any spelling), for the
+ * tree order */
+static int st_tree_name_cmp(const char *nodevar, const char *ivar)
+{
+	if (nodevar == ivar)
+		return 0;
+
+	return strcasecmp(nodevar, ivar);
+}
+
+static size_t st_tree_value_size(size_t len)
+{
+	/* allow for the trailing NULL */
+	return ((len / ST_VALUE_ALLOC_GRANULARITY) + 1) * ST_VALUE_ALLOC_GRANULARITY;
+}
+
+/* allocate a node for an interned var name, which it now references */
+static st_tree_t *st_tree_node_alloc(char *ivar)
+{
+	st_tree_t	*node = xcalloc(1, sizeof(*node));
+
+	node->var = ivar;
+	node->numprec = -1;
+
+	return node;
+}
+
 static void val_escape(st_tree_t *node)
 {
 	char	etmp[ST_MAX_VALUE_LEN];
 
+	/* most values have nothing to escape (and need no truncation),
+	 * so don't bother encoding and comparing them */
+	if (strlen(node->raw) < sizeof(etmp) && !strpbrk(node->raw, "#\\\"")) {
+		node->val = node->raw;
+		return;
+	}
+
 	/* escape any tricky stuff like \ and " */
 	pconf_encode(node->raw, etmp, sizeof(etmp));
 
@@ -53,7 +224,7 @@ static void val_escape(st_tree_t *node)
 
 	/* if the escaped value grew, deal with it */
 	if (node->safesize < (strlen(etmp) + 1)) {
-		node->safesize = strlen(etmp) + 1;
+		node->safesize = st_tree_value_size(strlen(etmp));
 		node->safe = xrealloc(node->safe, node->safesize);
 	}
 
@@ -69,7 +240,7 @@ static void st_tree_enum_free(enum_t *list)
 
 	st_tree_enum_free(list->next);
 
-	free(list->val);
+	/* list->val is allocated along with the item itself */
 	free(list);
 }
 
@@ -87,11 +258,11 @@ static void st_tree_range_free(range_t *list)
 /* free all memory associated with a node */
 static void st_tree_node_free(st_tree_t *node)
 {
-	free(node->var);
 	free(node->raw);
 	free(node->safe);
 
 	/* never free node->val, since it's just a pointer to raw or safe */
+	st_name_put(node->var);
 
 	/* blow away the list of enums */
 	st_tree_enum_free(node->enum_list);
@@ -113,13 +284,14 @@ static void st_tree_node_add(st_tree_t **nptr, st_tree_t *sptr)
 	while (*nptr) {
 
 		st_tree_t	*node = *nptr;
+		int	cmp = st_tree_name_cmp(node->var, sptr->var);
 
-		if (strcasecmp(node->var, sptr->var) > 0) {
+		if (cmp > 0) {
 			nptr = &node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, sptr->var) < 0) {
+		if (cmp < 0) {
 			nptr = &node->right;
 			continue;
 		}
@@ -139,6 +311,13 @@ static int st_tree_node_refresh_timestamp(const st_tree_t *node)
 	return state_get_timestamp((st_tree_timespec_t *)&node->lastset);
 }
 
+/* to be called right after st_tree_node_refresh_timestamp() when
+ * that write has actually changed something in the node */
+static void st_tree_node_changed(st_tree_t *node)
+{
+	node->lastchanged = node->lastset;
+}
+
 /* interface */
 
 /* As underlying system methods:
@@ -190,22 +369,68 @@ int st_tree_node_compare_timestamp(
 	return 0;
 }
 
+/* Same as st_tree_node_compare_timestamp() but for node->lastchanged */
+int st_tree_node_compare_changed(
+	const st_tree_t *node,
+	const st_tree_timespec_t *cutoff
+) {
+	double d;
+
+	if (!node)
+		return -2;
+
+	if (!cutoff)
+		return -3;
+
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	d = difftimespec(node->lastchanged, *cutoff);
+#else
+	d = difftimeval(node->lastchanged, *cutoff);
+#endif
+
+	if (d < 0)
+		return -1;
+	if (d > 0)
+		return 1;
+	return 0;
+}
+
+/* For callers which change node fields directly (e.g. flags or aux
+ * in dstate.c), refresh both the lastset and lastchanged timestamps.
+ * Returns as state_get_timestamp() does. */
+int st_tree_node_mark_changed(st_tree_t *node)
+{
+	int	ret = st_tree_node_refresh_timestamp(node);
+
+	if (ret == 0)
+		st_tree_node_changed(node);
+
+	return ret;
+}
+
 /* remove a variable from a tree
  * except for variables with ST_FLAG_IMMUTABLE
  * (for override.* to survive) per issue #737
  */
 int state_delinfo(st_tree_t **nptr, const char *var)
 {
+	const char	*ivar = st_name_find(var);
+
+	if (!ivar) {
+		return 0;	/* not in any tree */
+	}
+
 	while (*nptr) {
 
 		st_tree_t	*node = *nptr;
+		int	cmp = st_tree_name_cmp(node->var, ivar);
 
-		if (strcasecmp(node->var, var) > 0) {
+		if (cmp > 0) {
 			nptr = &node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			nptr = &node->right;
 			continue;
 		}
@@ -231,16 +456,23 @@ int state_delinfo(st_tree_t **nptr, const char *var)
 
 int state_delinfo_olderthan(st_tree_t **nptr, const char *var, const st_tree_timespec_t *cutoff)
 {
+	const char	*ivar = st_name_find(var);
+
+	if (!ivar) {
+		return 0;	/* not in any tree */
+	}
+
 	while (*nptr) {
 
 		st_tree_t	*node = *nptr;
+		int	cmp = st_tree_name_cmp(node->var, ivar);
 
-		if (strcasecmp(node->var, var) > 0) {
+		if (cmp > 0) {
 			nptr = &node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			nptr = &node->right;
 			continue;
 		}
@@ -272,20 +504,27 @@ int state_delinfo_olderthan(st_tree_t **nptr, const char *var, const st_tree_tim
 
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 {
+	size_t	vallen;
+	/* a new node would keep this reference */
+	char	*ivar = st_name_get(var);
+
 	while (*nptr) {
 
 		st_tree_t	*node = *nptr;
+		int	cmp = st_tree_name_cmp(node->var, ivar);
 
-		if (strcasecmp(node->var, var) > 0) {
+		if (cmp > 0) {
 			nptr = &node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			nptr = &node->right;
 			continue;
 		}
 
+		st_name_put(ivar);
+
 		/* refresh even if "skip-writing" same info value */
 		st_tree_node_refresh_timestamp(node);
 
@@ -300,35 +539,80 @@ int state_setinfo(st_tree_t **nptr, const char *var, const char *val)
 			return 0;	/* no change */
 		}
 
-		/* expand the buffer if the value grows */
-		if (node->rawsize < (strlen(val) + 1)) {
-			node->rawsize = strlen(val) + 1;
+		/* expand the buffer if the value grows,
+		 * otherwise update it in place */
+		vallen = strlen(val);
+		if (node->rawsize < (vallen + 1)) {
+			node->rawsize = st_tree_value_size(vallen);
 			node->raw = xrealloc(node->raw, node->rawsize);
 		}
 
 		/* store the literal value for later comparisons */
-		snprintf(node->raw, node->rawsize, "%s", val);
+		memcpy(node->raw, val, vallen + 1);
+		node->numprec = -1;
 
 		val_escape(node);
+		st_tree_node_changed(node);
 
 		return 1;	/* changed */
 	}
 
-	*nptr = xcalloc(1, sizeof(**nptr));
+	*nptr = st_tree_node_alloc(ivar);
 
-	(*nptr)->var = xstrdup(var);
-	(*nptr)->raw = xstrdup(val);
-	(*nptr)->rawsize = strlen(val) + 1;
+	vallen = strlen(val);
+	(*nptr)->rawsize = st_tree_value_size(vallen);
+	(*nptr)->raw = xmalloc((*nptr)->rawsize);
+	memcpy((*nptr)->raw, val, vallen + 1);
 	st_tree_node_refresh_timestamp(*nptr);
+	st_tree_node_changed(*nptr);
 
 	val_escape(*nptr);
 
 	return 1;	/* added */
 }
 
+/* Like state_setinfo() for a value shown as "%.<prec>f", but when the
+ * same number was last set with the same precision, only refresh the
+ * timestamp without formatting and comparing it all over again.
+ * The numbers are compared bit by bit, so that e.g. 0.0 and -0.0
+ * (shown differently) are not taken for the same.
+ */
+int state_setinfo_number(st_tree_t **nptr, const char *var, double val, int prec)
+{
+	st_tree_t	*node;
+	char	value[ST_MAX_VALUE_LEN];
+	int	ret;
+
+	if (prec < 0)
+		prec = 0;
+
+	node = state_tree_find(*nptr, var);
+
+	if (node && node->numprec == prec && !memcmp(&node->numval, &val, sizeof(val))) {
+		/* refresh even if "skip-writing" same info value */
+		st_tree_node_refresh_timestamp(node);
+		return 0;	/* no change */
+	}
+
+	snprintf(value, sizeof(value), "%.*f", prec, val);
+	ret = state_setinfo(nptr, var, value);
+
+	if (!node)
+		node = state_tree_find(*nptr, var);
+
+	/* not if the value was immutable */
+	if (node && !strcmp(node->raw, value)) {
+		node->numval = val;
+		node->numprec = prec;
+	}
+
+	return ret;
+}
+
 static int st_tree_enum_add(enum_t **list, const char *enc)
 {
 	enum_t	*item;
+	size_t	enclen;
 
 	while (*list) {
 
@@ -340,8 +624,11 @@ static int st_tree_enum_add(enum_t **list, const char *enc)
 		return 0;	/* duplicate */
 	}
 
-	item = xcalloc(1, sizeof(*item));
-	item->val = xstrdup(enc);
+	/* allocate the value along with the item */
+	enclen = strlen(enc) + 1;
+	item = xcalloc(1, sizeof(*item) + enclen);
+	item->val = (char *)(item + 1);
+	memcpy(item->val, enc, enclen);
 	item->next = *list;
 
 	/* now we're done creating it, add it to the list */
@@ -368,7 +655,11 @@ int state_addenum(st_tree_t *root, const char *var, const char *val)
 	pconf_encode(val, enc, sizeof(enc));
 
 	st_tree_node_refresh_timestamp(sttmp);
-	return st_tree_enum_add(&sttmp->enum_list, enc);
+	if (!st_tree_enum_add(&sttmp->enum_list, enc))
+		return 0;	/* duplicate */
+
+	st_tree_node_changed(sttmp);
+	return 1;	/* added */
 }
 
 static int st_tree_range_add(range_t **list, const int min, const int max)
@@ -417,7 +708,11 @@ int state_addrange(st_tree_t *root, const char *var, const int min, const int ma
 	}
 
 	st_tree_node_refresh_timestamp(sttmp);
-	return st_tree_range_add(&sttmp->range_list, min, max);
+	if (!st_tree_range_add(&sttmp->range_list, min, max))
+		return 0;	/* duplicate */
+
+	st_tree_node_changed(sttmp);
+	return 1;	/* added */
 }
 
 int state_setaux(st_tree_t *root, const char *var, const char *auxs)
@@ -443,6 +738,7 @@ int state_setaux(st_tree_t *root, const char *var, const char *auxs)
 	}
 
 	sttmp->aux = aux;
+	st_tree_node_changed(sttmp);
 
 	return 1;
 }
@@ -521,6 +817,7 @@ void state_setflags(st_tree_t *root, const char *var, size_t numflags, char **fl
 {
 	size_t	i;
 	st_tree_t	*sttmp;
+	int	oldflags;
 
 	/* find the tree node for var */
 	sttmp = state_tree_find(root, var);
@@ -532,6 +829,7 @@ void state_setflags(st_tree_t *root, const char *var, size_t numflags, char **fl
 	}
 
 	st_tree_node_refresh_timestamp(sttmp);
+	oldflags = sttmp->flags;
 	sttmp->flags = 0;
 
 	for (i = 0; i < numflags; i++) {
@@ -553,29 +851,36 @@ void state_setflags(st_tree_t *root, const char *var, size_t numflags, char **fl
 
 		upsdebugx(2, "%s: Unrecognized flag [%s]", __func__, flag[i]);
 	}
+
+	if (sttmp->flags != oldflags)
+		st_tree_node_changed(sttmp);
 }
 
 int state_addcmd(cmdlist_t **list, const char *cmd)
 {
 	cmdlist_t	*item;
+	/* the new item would keep this reference */
+	char	*icmd = st_name_get(cmd);
 
 	while (*list) {
+		int	cmp = st_tree_name_cmp((*list)->name, icmd);
 
-		if (strcasecmp((*list)->name, cmd) > 0) {
+		if (cmp > 0) {
 			/* insertion point reached */
 			break;
 		}
 
-		if (strcasecmp((*list)->name, cmd) < 0) {
+		if (cmp < 0) {
 			list = &(*list)->next;
 			continue;
 		}
 
+		st_name_put(icmd);
 		return 0;	/* duplicate */
 	}
 
 	item = xcalloc(1, sizeof(*item));
-	item->name = xstrdup(cmd);
+	item->name = icmd;
 	item->next = *list;
 
 	/* now we're done creating it, insert it in the list */
@@ -604,22 +909,29 @@ void state_cmdfree(cmdlist_t *list)
 
 	state_cmdfree(list->next);
 
-	free(list->name);
+	st_name_put(list->name);
 	free(list);
 }
 
 int state_delcmd(cmdlist_t **list, const char *cmd)
 {
+	const char	*icmd = st_name_find(cmd);
+
+	if (!icmd) {
+		return 0;	/* not in any list */
+	}
+
 	while (*list) {
 
 		cmdlist_t	*item = *list;
+		int	cmp = st_tree_name_cmp(item->name, icmd);
 
-		if (strcasecmp(item->name, cmd) > 0) {
+		if (cmp > 0) {
 			/* not found */
 			break;
 		}
 
-		if (strcasecmp(item->name, cmd) < 0) {
+		if (cmp < 0) {
 			list = &item->next;
 			continue;
 		}
@@ -628,7 +940,7 @@ int state_delcmd(cmdlist_t **list, const char *cmd)
 
 		*list = item->next;
 
-		free(item->name);
+		st_name_put(item->name);
 		free(item);
 
 		return 1;	/* deleted */
@@ -652,7 +964,7 @@ static int st_tree_del_enum(enum_t **list, const char *val)
 		/* we found it! */
 		*list = item->next;
 
-		free(item->val);
+		/* item->val is allocated along with the item itself */
 		free(item);
 
 		return 1;	/* deleted */
@@ -716,14 +1028,25 @@ int state_delrange(st_tree_t *root, const char *var, const int min, const int ma
 
 st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 {
+	const char	*ivar;
+
+	if (!node) {
+		return NULL;
+	}
+
+	if ((ivar = st_name_find(var)) == NULL) {
+		return NULL;	/* not in any tree */
+	}
+
 	while (node) {
+		int	cmp = st_tree_name_cmp(node->var, ivar);
 
-		if (strcasecmp(node->var, var) > 0) {
+		if (cmp > 0) {
 			node = node->left;
 			continue;
 		}
 
-		if (strcasecmp(node->var, var) < 0) {
+		if (cmp < 0) {
 			node = node->right;
 			continue;
 		}
@@ -733,3 +1056,8 @@ st_tree_t *state_tree_find(st_tree_t *node, const char *var)
 
 	return node;
 }
+
+size_t state_names_count(void)
+{
+	return st_name_num;
+}
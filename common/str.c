@@ -628,6 +628,17 @@ int str_ends_with(const char *s, const char *suff) {
 	return (slen >= sufflen) && (!memcmp(s + slen - sufflen, suff, sufflen));
 }
 
+uint32_t str_hash_nocase(const char *s) {
+	uint32_t	hash = 2166136261U;
+
+	for (; *s; s++) {
+		hash ^= (uint32_t)tolower((unsigned char)*s);
+		hash *= 16777619U;
+	}
+
+	return hash;
+}
+
 #ifndef HAVE_STRTOF
 # include <errno.h>
 # include <stdio.h>
@@ -26,6 +26,7 @@
 
 #include "main.h"
 #include "adelsystem_cbi.h"
+#include "modbus_plan.h"
 #include <modbus.h>
 #include <timehead.h>
 
@@ -34,7 +35,7 @@
 #endif
 
 #define DRIVER_NAME	"NUT ADELSYSTEM DC-UPS CB/CBI driver (libmodbus link type: " NUT_MODBUS_LINKTYPE_STR ")"
-#define DRIVER_VERSION	"0.05"
+#define DRIVER_VERSION	"0.06"
 
 /* variables */
 static modbus_t *mbctx = NULL;							/* modbus memory context */
@@ -52,6 +53,7 @@ static uint32_t mod_resp_to_s = MODRESP_TIMEOUT_s;		/* set the modbus response t
 static uint32_t mod_resp_to_us = MODRESP_TIMEOUT_us;	/* set the modbus response time out (us) */
 static uint32_t mod_byte_to_s = MODBYTE_TIMEOUT_s;		/* set the modbus byte time out (us) */
 static uint32_t mod_byte_to_us = MODBYTE_TIMEOUT_us;	/* set the modbus byte time out (us) */
+static mbplan_t *mbplan = NULL;							/* registers read each poll */
 
 /* initialize alarm structs */
 void alrminit(void);
@@ -521,6 +523,8 @@ void upsdrv_cleanup(void)
 	if (dstate != NULL) {
 		free(dstate);
 	}
+	mbplan_free(mbplan);
+	mbplan = NULL;
 }
 
 /*
@@ -622,19 +626,21 @@ void reginit(void)
 	}
 }
 
-/* read registers' memory region */
-int read_all_regs(modbus_t *mb, uint16_t *data)
+/* Block reads for the plan of read_all_regs(); this may reconnect,
+ * so it uses the current context rather than one passed in */
+static int plan_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *data)
 {
 	int rval;
 
-	/* read all HOLDING registers */
-	rval = modbus_read_registers(mb, regs[H_REG_STARTIDX].xaddr, MAX_H_REGS, data);
+	NUT_UNUSED_VARIABLE(ctx);
+
+	rval = mbplan_modbus_read(mbctx, type, addr, count, data);
 	if (rval == -1) {
 		upslogx(LOG_ERR,
 			"ERROR:(%s) modbus_read: addr:0x%x, length:%8d, path:%s",
 			modbus_strerror(errno),
-			(unsigned int)(regs[H_REG_STARTIDX].xaddr),
-			MAX_H_REGS,
+			(unsigned int)addr,
+			count,
 			device_path
 		);
 
@@ -645,7 +651,45 @@ int read_all_regs(modbus_t *mb, uint16_t *data)
 		}
 	}
 
-	/* no COIL, INPUT_B or INPUT_R register regions to read */
+	return rval;
+}
+
+/* read registers' memory region: only the span from the first to the
+ * last register which is polled, in a single block read as before */
+int read_all_regs(modbus_t *mb, uint16_t *data)
+{
+	static const devreg_t polled[] = {
+		CHRG, PMNG, BATV, LVDC, LCUR, BSOC, BTMP, OTMP, VAC,
+		BSTA, SCSH, BVAL, DEVF, VACA, MAIN, OBTA, PRDN, TBUF
+	};
+	size_t i;
+	int rval = 0;
+
+	/* registers are at consecutive addresses from the first one; any
+	 * gap between those polled is cheaper to read than another round
+	 * trip to the device, so allow the whole region in one block */
+	if (mbplan == NULL) {
+		mbplan = mbplan_new();
+		mbplan_set_limits(mbplan, (mbplan_type_t)regs[H_REG_STARTIDX].type,
+			MAX_H_REGS, MAX_H_REGS);
+		for (i = 0; i < sizeof(polled) / sizeof(polled[0]); i++) {
+			mbplan_add(mbplan, (mbplan_type_t)regs[polled[i]].type,
+				regs[H_REG_STARTIDX].saddr + polled[i], 1);
+		}
+	}
+
+	NUT_UNUSED_VARIABLE(mb);
+	if (mbplan_read(mbplan, plan_read, NULL) > 0) {
+		rval = -1;
+	}
+
+	for (i = 0; i < sizeof(polled) / sizeof(polled[0]); i++) {
+		if (mbplan_get(mbplan, (mbplan_type_t)regs[polled[i]].type,
+			regs[H_REG_STARTIDX].saddr + polled[i], 1, &data[polled[i]])
+		) {
+			rval = -1;
+		}
+	}
 
 	return rval;
 }
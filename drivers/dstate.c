@@ -43,6 +43,7 @@
 #include "parseconf.h"
 #include "attribute.h"
 #include "nut_stdint.h"
+#include "nutshm.h"
 
 	static TYPE_FD	sockfd = ERROR_FD;
 #ifndef WIN32
@@ -59,6 +60,24 @@
 	static st_tree_t	*dtree_root = NULL;
 	static cmdlist_t	*cmdhead = NULL;
 
+	/* For incremental dumps (DUMPALL GEN ...): the identity of this
+	 * driver instance, and when anything was last deleted from the
+	 * data tree or command list (which a partial dump can not convey) */
+	static char	dump_instance[SMALLBUF] = "";
+	static st_tree_timespec_t	dump_lastdel;
+
+	/* Shared memory export of the data tree ("sharedmem" flag):
+	 * published from the main loop when anything was changed */
+	static char	*shm_path = NULL, *shm_refpath = NULL;
+	static nutshm_writer_t	*shm_writer = NULL;
+	static int	shm_dirty = 0;
+
+	/* Count of changed device data values (not "driver.*" ones),
+	 * for the adaptive poll scheduling in main.c, and of all the
+	 * updates to them (changed or not), for the poll statistics */
+	static unsigned long	data_changes = 0;
+	static unsigned long	data_updates = 0;
+
 	struct ups_handler	upsh;
 
 #ifndef WIN32
@@ -270,6 +289,10 @@ static void send_to_all(const char *fmt, ...)
 	va_list	ap;
 	conn_t	*conn, *cnext;
 
+	/* everything changed is also broadcast, so this is the spot to
+	 * note that the shared memory export needs an update */
+	shm_dirty = 1;
+
 	va_start(ap, fmt);
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
@@ -680,7 +703,10 @@ static int st_tree_dump_conn_one_node(st_tree_t *node, conn_t *conn)
 	return 1;	/* everything's OK here ... */
 }
 
-static int st_tree_dump_conn(st_tree_t *node, conn_t *conn)
+/* dump the (sub)tree, or only the nodes changed since cutoff if not NULL;
+ * the ups.status is always dumped so a reconnecting reader can replace
+ * its "WAIT" placeholder */
+static int st_tree_dump_conn(st_tree_t *node, conn_t *conn, const st_tree_timespec_t *cutoff)
 {
 	int	ret;
 
@@ -689,18 +715,23 @@ static int st_tree_dump_conn(st_tree_t *node, conn_t *conn)
 	}
 
 	if (node->left) {
-		ret = st_tree_dump_conn(node->left, conn);
+		ret = st_tree_dump_conn(node->left, conn, cutoff);
 
 		if (!ret) {
 			return 0;	/* write failed in the child */
 		}
 	}
 
-	if (!st_tree_dump_conn_one_node(node, conn))
-		return 0;	/* one of writes failed, bail out */
+	if (!cutoff
+	 || st_tree_node_compare_changed(node, cutoff) >= 0
+	 || !strcasecmp(node->var, "ups.status")
+	) {
+		if (!st_tree_dump_conn_one_node(node, conn))
+			return 0;	/* one of writes failed, bail out */
+	}
 
 	if (node->right) {
-		return st_tree_dump_conn(node->right, conn);
+		return st_tree_dump_conn(node->right, conn, cutoff);
 	}
 
 	return 1;	/* everything's OK here ... */
@@ -725,6 +756,60 @@ static void send_tracking(conn_t *conn, const char *id, int value)
 	send_to_one(conn, "TRACKING %s %i\n", id, value);
 }
 
+/* remember that something was deleted, so earlier generations
+ * can not be served with an incremental dump anymore */
+static void dump_deleted(void)
+{
+	state_get_timestamp(&dump_lastdel);
+}
+
+/* Parse a "<instance> <sec> <subsec>" generation as sent in DUMPGEN
+ * by this driver earlier, into cutoff. Returns 1 if it is usable for
+ * an incremental dump, or 0 if a full dump is needed. */
+static int dump_parse_generation(size_t numarg, char **arg, st_tree_timespec_t *cutoff)
+{
+	long	sec, subsec;
+
+	if (numarg < 3 || strcmp(arg[0], dump_instance)) {
+		upsdebugx(3, "%s: no generation, or of another driver instance", __func__);
+		return 0;
+	}
+
+	if (!str_to_long(arg[1], &sec, 10) || !str_to_long(arg[2], &subsec, 10)
+	 || sec < 0 || subsec < 0
+	) {
+		upsdebugx(3, "%s: invalid generation", __func__);
+		return 0;
+	}
+
+	memset(cutoff, 0, sizeof(*cutoff));
+	cutoff->tv_sec = (time_t)sec;
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	cutoff->tv_nsec = subsec;
+	if (difftimespec(dump_lastdel, *cutoff) >= 0) {
+#else
+	cutoff->tv_usec = subsec;
+	if (difftimeval(dump_lastdel, *cutoff) >= 0) {
+#endif
+		upsdebugx(3, "%s: data was deleted since that generation", __func__);
+		return 0;
+	}
+
+	return 1;
+}
+
+static void dump_send_generation(conn_t *conn, const st_tree_timespec_t *gen)
+{
+	send_to_one(conn, "DUMPGEN %s %" PRIiMAX " %" PRIiMAX "\n",
+		dump_instance, (intmax_t)gen->tv_sec,
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+		(intmax_t)gen->tv_nsec
+#else
+		(intmax_t)gen->tv_usec
+#endif
+		);
+}
+
 static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 {
 #ifdef WIN32
@@ -760,13 +845,42 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 	}
 
 	if (!strcasecmp(arg[0], "DUMPALL") || !strcasecmp(arg[0], "DUMPSTATUS") || (!strcasecmp(arg[0], "DUMPVALUE") && numarg > 1)) {
+		/* DUMPALL GEN [<instance> <sec> <subsec>] requests an
+		 * incremental dump since the generation reported by us in
+		 * an earlier DUMPGEN, if possible, and a DUMPGEN in reply */
+		int	want_gen = (!strcasecmp(arg[0], "DUMPALL")
+			&& numarg > 1 && !strcasecmp(arg[1], "GEN"));
+		st_tree_timespec_t	gen, cutoff;
+		const st_tree_timespec_t	*since = NULL;
+
+		if (want_gen) {
+			if (!*dump_instance) {
+				snprintf(dump_instance, sizeof(dump_instance),
+					"%" PRIiMAX "-%" PRIiMAX,
+					(intmax_t)getpid(), (intmax_t)time(NULL));
+			}
+
+			/* anything changed from now on is in the next generation */
+			state_get_timestamp(&gen);
+
+			if (dump_parse_generation(numarg - 2, &arg[2], &cutoff))
+				since = &cutoff;
+
+			upsdebugx(2, "%s: %s dump requested with generation, serving a%s dump",
+				__func__, arg[0], since ? "n incremental" : " full");
+
+			if (!send_to_one(conn, "DUMPMODE %s\n", since ? "INCREMENTAL" : "FULL")) {
+				return 1;
+			}
+		}
+
 		/* first thing: the staleness flag (see also below) */
 		if ((stale == 1) && !send_to_one(conn, "DATASTALE\n")) {
 			return 1;
 		}
 
 		if (!strcasecmp(arg[0], "DUMPALL")) {
-			if (!st_tree_dump_conn(dtree_root, conn)) {
+			if (!st_tree_dump_conn(dtree_root, conn, since)) {
 				return 1;
 			}
 
@@ -792,6 +906,12 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 		}
 
 		send_to_one(conn, "DUMPDONE\n");
+
+		/* only after the dump is complete, so the reader does not
+		 * keep a generation for an interrupted dump */
+		if (want_gen)
+			dump_send_generation(conn, &gen);
+
 		return 1;
 	}
 
@@ -974,6 +1094,7 @@ static int sock_arg(conn_t *conn, size_t numarg, char **arg)
 static void sock_read(conn_t *conn)
 {
 	ssize_t	ret, i;
+	size_t	used;
 	int	ret_arg = -1;
 
 #ifndef WIN32
@@ -1046,9 +1167,9 @@ static void sock_read(conn_t *conn)
 	}
 #endif	/* WIN32 */
 
-	for (i = 0; i < ret; i++) {
+	for (i = 0; i < ret; i += (ssize_t)used) {
 
-		switch(pconf_char(&conn->ctx, buf[i]))
+		switch(pconf_buf(&conn->ctx, buf + i, (size_t)(ret - i), &used))
 		{
 		case 0: /* nothing to parse yet */
 			continue;
@@ -1065,7 +1186,7 @@ static void sock_read(conn_t *conn)
 				}
 			} else if (ret_arg == 2) {
 				/* closed by LOGOUT processing, conn is free()'d */
-				if (i < ret)
+				if (i + (ssize_t)used < ret)
 					upsdebugx(1, "%s: returning early, socket may be not valid anymore", __func__);
 				return;
 			}
@@ -1147,6 +1268,17 @@ char * dstate_init(const char *prog, const char *devname)
 
 #ifndef WIN32
 	upsdebugx(2, "%s: sock %s open on fd %d", __func__, sockname, sockfd);
+
+	/* Opened on first update, after the socket ownership was fixed
+	 * by the caller, to copy it for the readers of the export */
+	if (dstate_getinfo("driver.flag.sharedmem")) {
+		char	shmname[NUT_PATH_MAX + sizeof(NUTSHM_SUFFIX)];
+
+		snprintf(shmname, sizeof(shmname), "%s" NUTSHM_SUFFIX, sockname);
+		shm_path = xstrdup(shmname);
+		shm_refpath = xstrdup(sockname);
+		shm_dirty = 1;
+	}
 #else	/* WIN32 */
 	upsdebugx(2, "%s: sock %s open on handle %p", __func__, sockname, sockfd);
 #endif	/* WIN32 */
@@ -1155,6 +1287,30 @@ char * dstate_init(const char *prog, const char *devname)
 	return xstrdup(sockname);
 }
 
+/* update the shared memory export, if enabled and anything changed */
+static void dstate_shm_publish(void)
+{
+	if (!shm_path || !shm_dirty)
+		return;
+
+	if (!shm_writer) {
+		shm_writer = nutshm_writer_open(shm_path, shm_refpath);
+
+		if (!shm_writer) {
+			upslogx(LOG_WARNING, "Can't export data into shared memory file %s, disabling",
+				shm_path);
+			free(shm_path);
+			shm_path = NULL;
+			return;
+		}
+
+		upslogx(LOG_INFO, "Exporting data into shared memory file %s", shm_path);
+	}
+
+	if (nutshm_writer_publish(shm_writer, dtree_root, stale) == 0)
+		shm_dirty = 0;
+}
+
 /* returns 1 if timeout expired or data is available on UPS fd, 0 otherwise */
 int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 {
@@ -1163,6 +1319,8 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
 	conn_t	*conn, *cnext;
 	struct timeval	now;
 
+	dstate_shm_publish();
+
 #ifndef WIN32
 	int	ret;
 	fd_set	rfds;
@@ -1350,11 +1508,60 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD arg_extrafd)
  * COMMON
  ******************************************************************/
 
+/* count an update of a device data value, and whether it changed it */
+static void dstate_count_update(const char *var, int ret)
+{
+	if (!strncasecmp(var, "driver.", 7))
+		return;
+
+	data_updates++;
+	if (ret == 1)
+		data_changes++;
+}
+
+/* Which argument a plain number format takes, that can be set with
+ * dstate_setinfo_number() instead: 'f' (a double, shown with *prec
+ * digits after the point as for "%.1f"), 'd' (an int, "%d" or "%i"),
+ * 'u' (an unsigned int), or 0 for any other format */
+static char dstate_number_format(const char *fmt, int *prec)
+{
+	if (fmt[0] != '%')
+		return 0;
+
+	if (fmt[1] == '.' && fmt[2] >= '0' && fmt[2] <= '9' && fmt[3] == 'f' && fmt[4] == '\0') {
+		*prec = fmt[2] - '0';
+		return 'f';
+	}
+
+	*prec = 0;
+
+	if ((fmt[1] == 'd' || fmt[1] == 'i') && fmt[2] == '\0')
+		return 'd';
+
+	if (fmt[1] == 'u' && fmt[2] == '\0')
+		return 'u';
+
+	return 0;
+}
+
 int vdstate_setinfo(const char *var, const char *fmt, va_list ap)
 {
-	int	ret;
+	int	ret, prec;
 	char	value[ST_MAX_VALUE_LEN];
 
+	/* most values are numbers which stay the same from one poll
+	 * to the next: compare those before formatting anything */
+	switch (dstate_number_format(fmt, &prec)) {
+	case 'f':
+		return dstate_setinfo_number(var, va_arg(ap, double), prec);
+	case 'd':
+		return dstate_setinfo_number(var, (double)va_arg(ap, int), 0);
+	case 'u':
+		return dstate_setinfo_number(var, (double)va_arg(ap, unsigned int), 0);
+	default:
+		break;
+	}
+
 #ifdef HAVE_PRAGMAS_FOR_GCC_DIAGNOSTIC_IGNORED_FORMAT_NONLITERAL
 #pragma GCC diagnostic push
 #endif
@@ -1380,6 +1587,23 @@ int vdstate_setinfo(const char *var, const char *fmt, va_list ap)
 		send_to_all("SETINFO %s \"%s\"\n", var, value);
 	}
 
+	dstate_count_update(var, ret);
+
+	return ret;
+}
+
+int dstate_setinfo_number(const char *var, double val, int prec)
+{
+	int	ret;
+
+	ret = state_setinfo_number(&dtree_root, var, val, prec);
+
+	if (ret == 1) {
+		send_to_all("SETINFO %s \"%s\"\n", var, state_tree_find(dtree_root, var)->raw);
+	}
+
+	dstate_count_update(var, ret);
+
 	return ret;
 }
 
@@ -1570,6 +1794,7 @@ void dstate_setflags(const char *var, int flags)
 	}
 
 	sttmp->flags = flags;
+	st_tree_node_mark_changed(sttmp);
 
 	/* build the list */
 	snprintf(flist, sizeof(flist), "%s", var);
@@ -1643,6 +1868,7 @@ void dstate_setaux(const char *var, long aux)
 	}
 
 	sttmp->aux = aux;
+	st_tree_node_mark_changed(sttmp);
 
 	/* update listeners */
 	send_to_all("SETAUX %s %ld\n", var, aux);
@@ -1653,6 +1879,14 @@ const char *dstate_getinfo(const char *var)
 	return state_getinfo(dtree_root, var);
 }
 
+/* the value as it was set, rather than escaped for the protocol */
+const char *dstate_getinfo_raw(const char *var)
+{
+	const st_tree_t	*node = state_tree_find(dtree_root, var);
+
+	return node ? node->raw : NULL;
+}
+
 void dstate_addcmd(const char *cmdname)
 {
 	int	ret;
@@ -1673,6 +1907,7 @@ int dstate_delinfo(const char *var)
 
 	/* update listeners */
 	if (ret == 1) {
+		dump_deleted();
 		send_to_all("DELINFO %s\n", var);
 	}
 
@@ -1687,6 +1922,7 @@ int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff)
 
 	/* update listeners */
 	if (ret == 1) {
+		dump_deleted();
 		send_to_all("DELINFO %s\n", var);
 	}
 
@@ -1701,6 +1937,7 @@ int dstate_delenum(const char *var, const char *val)
 
 	/* update listeners */
 	if (ret == 1) {
+		dump_deleted();
 		send_to_all("DELENUM %s \"%s\"\n", var, val);
 	}
 
@@ -1715,6 +1952,7 @@ int dstate_delrange(const char *var, const int min, const int max)
 
 	/* update listeners */
 	if (ret == 1) {
+		dump_deleted();
 		send_to_all("DELRANGE %s %i %i\n", var, min, max);
 	}
 
@@ -1729,6 +1967,7 @@ int dstate_delcmd(const char *cmd)
 
 	/* update listeners */
 	if (ret == 1) {
+		dump_deleted();
 		send_to_all("DELCMD %s\n", cmd);
 	}
 
@@ -1743,6 +1982,13 @@ void dstate_free(void)
 	state_cmdfree(cmdhead);
 	cmdhead = NULL;
 
+	nutshm_writer_close(shm_writer);
+	shm_writer = NULL;
+	free(shm_path);
+	shm_path = NULL;
+	free(shm_refpath);
+	shm_refpath = NULL;
+
 	sock_close();
 }
 
@@ -1756,6 +2002,16 @@ const cmdlist_t *dstate_getcmdlist(void)
 	return cmdhead;
 }
 
+unsigned long dstate_datachanges(void)
+{
+	return data_changes;
+}
+
+unsigned long dstate_dataupdates(void)
+{
+	return data_updates;
+}
+
 void dstate_dataok(void)
 {
 	if (stale == 1) {
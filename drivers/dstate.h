@@ -76,6 +76,11 @@ int dstate_poll_fds(struct timeval timeout, TYPE_FD extrafd);
 int vdstate_setinfo(const char *var, const char *fmt, va_list ap);
 int dstate_setinfo(const char *var, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
+/* Set a number shown with prec digits after the decimal point (0 for an
+ * integer), as dstate_setinfo(var, "%.<prec>f", val) would; unchanged
+ * numbers are noticed without formatting them. dstate_setinfo() does
+ * this by itself for the "%d", "%i", "%u" and "%.<digit>f" formats. */
+int dstate_setinfo_number(const char *var, double val, int prec);
 int dstate_setinfo_dynamic(const char *var, const char *fmt_dynamic, const char *fmt_reference, ...)
 	__attribute__ ((__format__ (__printf__, 3, 4)));
 int vdstate_addenum(const char *var, const char *fmt, va_list ap);
@@ -89,6 +94,7 @@ void dstate_addflags(const char *var, const int addflags);
 void dstate_delflags(const char *var, const int delflags);
 void dstate_setaux(const char *var, long aux);
 const char *dstate_getinfo(const char *var);
+const char *dstate_getinfo_raw(const char *var);
 void dstate_addcmd(const char *cmdname);
 int dstate_delinfo_olderthan(const char *var, const st_tree_timespec_t *cutoff);
 int dstate_delinfo(const char *var);
@@ -99,6 +105,11 @@ void dstate_free(void);
 const st_tree_t *dstate_getroot(void);
 const cmdlist_t *dstate_getcmdlist(void);
 
+/* count of device data value changes so far (not including "driver.*") */
+unsigned long dstate_datachanges(void);
+/* count of device data value updates so far, changed or not */
+unsigned long dstate_dataupdates(void);
+
 void dstate_dataok(void);
 void dstate_datastale(void);
 
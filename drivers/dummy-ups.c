@@ -23,6 +23,7 @@
  * - separate the code between dummy and repeater/meta
  * - for repeater/meta:
  *   * add support for instant commands and setvar
+ *   * repeater groups on WIN32 (no fork() there)
  * - for dummy:
  *   * variable/value enforcement using cmdvartab for testing
  *     the variable existance, and possible values
@@ -36,10 +37,13 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/wait.h>
+#include <fcntl.h>
 #endif	/* !WIN32 */
 
 #include <sys/stat.h>
 #include <string.h>
+#include <errno.h>
 
 #include "main.h"
 #include "parseconf.h"
@@ -48,7 +52,7 @@
 #include "dummy-ups.h"
 
 #define DRIVER_NAME	"Device simulation and repeater driver"
-#define DRIVER_VERSION	"0.22"
+#define DRIVER_VERSION	"0.25"
 
 /* driver description structure */
 upsdrv_info_t upsdrv_info =
@@ -90,35 +94,103 @@ typedef enum drivermode drivermode_t;
 
 static drivermode_t mode = MODE_NONE;
 
-/* parseconf context, for dummy mode using a file */
-static PCONF_CTX_t	*ctx = NULL;
-static time_t		next_update = -1;
+/* for dummy mode using a file: its contents are compiled once into a
+ * list of steps, which is then replayed (and compiled again only when
+ * the file changes) */
+typedef enum {
+	DUMMY_STEP_SET = 0,	/* var = value */
+	DUMMY_STEP_STATUS,	/* ups.status = value */
+	DUMMY_STEP_ALARM,	/* ALARM value, or reset alarms if NULL */
+	DUMMY_STEP_TIMER	/* TIMER delay_ms */
+} dummy_step_type_t;
+
+typedef struct dummy_step_s {
+	dummy_step_type_t	type;
+	char	*var;
+	char	*value;
+	dummy_info_t	*info;	/* definition of var, NULL if unknown */
+	long	delay_ms;
+} dummy_step_t;
+
+static dummy_step_t	*steps = NULL;
+static size_t		numsteps = 0;
+/* next step to replay, 0 when (re)starting a pass */
+static size_t		curstep = 0;
+/* MODE_DUMMY_ONCE: the file was replayed to the end */
+static int		replay_done = 0;
+/* when a TIMER step expires, if one is pending */
+static struct timeval	replay_resume;
+static int		replay_paused = 0;
 static struct stat	datafile_stat;
 
 #define MAX_STRING_SIZE	128
 
 static int setvar(const char *varname, const char *val);
+static void setvar_info(const char *varname, const char *val, dummy_info_t *item);
 static int instcmd(const char *cmdname, const char *extra);
 static int parse_data_file(TYPE_FD arg_upsfd);
+static int replay_data_file(void);
 static dummy_info_t *find_info(const char *varname);
 static int is_valid_data(const char* varname);
 static int is_valid_value(const char* varname, const char *value);
 /* libupsclient update */
-static int upsclient_update_vars(void);
-
-/* connection information */
-static char		*client_upsname = NULL, *hostname = NULL;
-static UPSCONN_t	*ups = NULL;
-static uint16_t	port;
+static void repeater_add(const char *section, const char *target,
+	const char *hostname, uint16_t port, int fd);
+static void repeater_update(void);
+static int repeater_read_feed(int wait);
+#ifndef WIN32
+static void repeater_start_group(void);
+#endif	/* !WIN32 */
+static void repeater_free(void);
+static void upsconf_err(const char *errmsg);
+
+/* Repeater mode: the upsd servers read from, and the devices read from
+ * them. The first device is the one of this driver; the others belong to
+ * the ups.conf sections which name this one as their "repeater_parent",
+ * each served by a process forked for it (see repeater_start_group())
+ * which gets their data through a pipe. The devices of one upsd are all
+ * read over one connection, their LIST VAR requests sent at once. */
+typedef struct repeater_host_s {
+	char	*hostname;
+	uint16_t	port;
+	UPSCONN_t	conn;
+	struct repeater_host_s	*next;
+} repeater_host_t;
+
+typedef struct repeater_dev_s {
+	char	*section;	/* the ups.conf section it is served as */
+	char	*upsname;	/* its name on the upsd host */
+	repeater_host_t	*host;
+	int	fd;	/* pipe to the process serving it, -1 for the own device */
+	int	gone;	/* that process is gone */
+	char	*out;	/* what was not written to the pipe yet */
+	size_t	outlen, outsize;
+	int	upserror;	/* of the last read, UPSCLI_ERR_NONE if it worked */
+	struct repeater_dev_s	*next;
+} repeater_dev_t;
+
+static repeater_host_t	*repeater_hosts = NULL;
+static repeater_dev_t	*repeater_devs = NULL;
+
+/* in a process forked for a device of a group: the pipe its data comes
+ * through from the driver which reads it, -1 otherwise */
+static int	repeater_feed = -1;
+
+/* more than this waiting for a process of the group means it is stuck */
+#define REPEATER_BACKLOG_MAX	(1024 * 1024)
 
 /* repeater mode parameters */
 static int repeater_disable_strict_start = 0;
 
+static void free_steps(dummy_step_t *list, size_t count);
+
 /* Driver functions */
 
 void upsdrv_initinfo(void)
 {
 	dummy_info_t *item;
+	repeater_host_t	*host;
+	repeater_dev_t	*dev;
 
 	switch (mode)
 	{
@@ -140,7 +212,8 @@ void upsdrv_initinfo(void)
 
 			/* Now get user's defined variables */
 			if (parse_data_file(upsfd) < 0)
-				upslogx(LOG_NOTICE, "Unable to parse the definition file %s", device_path);
+				fatalx(EXIT_FAILURE, "Can't open dummy-ups definition file %s", device_path);
+			replay_data_file();
 
 			/* Initialize handler */
 			upsh.setvar = setvar;
@@ -150,49 +223,64 @@ void upsdrv_initinfo(void)
 
 		case MODE_META:
 		case MODE_REPEATER:
-			/* Obtain the target name */
-			if (upscli_splitname(device_path, &client_upsname, &hostname, &port) != 0)
+#ifndef WIN32
+			if (repeater_feed >= 0)
 			{
-				fatalx(EXIT_FAILURE, "Error: invalid UPS definition.\nRequired format: upsname[@hostname[:port]]");
+				/* the data is read by the driver of the group:
+				 * start with its first list */
+				if (repeater_read_feed(1) < 0)
+					fatalx(EXIT_FAILURE, "The driver repeating this device is gone");
+				if (fcntl(repeater_feed, F_SETFL, fcntl(repeater_feed, F_GETFL) | O_NONBLOCK) < 0)
+					fatal_with_errno(EXIT_FAILURE, "Can't make the repeater pipe non-blocking");
+				extrafd = repeater_feed;
+				break;
 			}
-			/* Connect to the target */
-			ups = xmalloc(sizeof(*ups));
-			if (upscli_connect(ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
+#endif	/* !WIN32 */
+
+			/* Connect to the targets */
+			for (host = repeater_hosts; host; host = host->next)
 			{
-				if(repeater_disable_strict_start == 1)
+				if (upscli_connect(&host->conn, host->hostname, host->port, UPSCLI_CONN_TRYSSL) < 0)
 				{
-					upslogx(LOG_WARNING, "Warning: %s", upscli_strerror(ups));
+					if(repeater_disable_strict_start == 1)
+					{
+						upslogx(LOG_WARNING, "Warning: %s", upscli_strerror(&host->conn));
+					}
+					else
+					{
+						fatalx(EXIT_FAILURE, "Error: %s. "
+						"Any errors encountered starting the repeater mode result in driver termination, "
+						"perhaps you want to set the 'repeater_disable_strict_start' option?"
+						, upscli_strerror(&host->conn));
+					}
 				}
 				else
 				{
-					fatalx(EXIT_FAILURE, "Error: %s. "
-					"Any errors encountered starting the repeater mode result in driver termination, "
-					"perhaps you want to set the 'repeater_disable_strict_start' option?"
-					, upscli_strerror(ups));
+					upsdebugx(1, "Connected to %s", host->hostname);
 				}
 			}
-			else
-			{
-				upsdebugx(1, "Connected to %s@%s", client_upsname, hostname);
-			}
-			if (upsclient_update_vars() < 0)
+			repeater_update();
+			for (dev = repeater_devs; dev; dev = dev->next)
 			{
+				if (dev->upserror == UPSCLI_ERR_NONE)
+					continue;
+
 				/* check for an old upsd */
-				if (upscli_upserror(ups) == UPSCLI_ERR_UNKCOMMAND)
+				if (dev->upserror == UPSCLI_ERR_UNKCOMMAND)
 				{
 					fatalx(EXIT_FAILURE, "Error: upsd is too old to support this query");
 				}
 
 				if(repeater_disable_strict_start == 1)
 				{
-					upslogx(LOG_WARNING, "Warning: %s", upscli_strerror(ups));
+					upslogx(LOG_WARNING, "Warning: [%s] %s", dev->section, upscli_strerror(&dev->host->conn));
 				}
 				else
 				{
-					fatalx(EXIT_FAILURE, "Error: %s. "
+					fatalx(EXIT_FAILURE, "Error: [%s] %s. "
 					"Any errors encountered starting the repeater mode result in driver termination, "
 					"perhaps you want to set the 'repeater_disable_strict_start' option?"
-					, upscli_strerror(ups));
+					, dev->section, upscli_strerror(&dev->host->conn));
 				}
 			}
 			/* FIXME: commands and settable variable! */
@@ -266,86 +354,39 @@ void upsdrv_updateinfo(void)
 {
 	upsdebugx(1, "upsdrv_updateinfo...");
 
-	sleep(1);
-
 	switch (mode)
 	{
 		case MODE_DUMMY_LOOP:
-			/* Now get user's defined variables */
-			if (parse_data_file(upsfd) >= 0)
-				dstate_dataok();
-			break;
-
 		case MODE_DUMMY_ONCE:
-			/* less stress on the sys */
-			if (ctx == NULL && next_update == -1) {
-				struct stat	fs;
-				char fn[NUT_PATH_MAX + 1];
-
-				prepare_filepath(fn, sizeof(fn));
-
-				/* Determine if file modification timestamp has changed
-				 * since last use (so we would want to re-read it) */
-#ifndef WIN32
-				/* Either successful stat (zero return) is OK to
-				 * fill the "fs" struct. Note that currently
-				 * "upsfd" is a no-op for files, they are re-opened
-				 * and re-parsed every time so callers can modify
-				 * the data without complications.
-				 */
-				if ( (INVALID_FD(upsfd) || 0 != fstat (upsfd, &fs)) && 0 != stat (fn, &fs))
-#else	/* WIN32 */
-				/* Consider GetFileAttributesEx() for WIN32_FILE_ATTRIBUTE_DATA?
-				 *   https://stackoverflow.com/questions/8991192/check-the-file-size-without-opening-file-in-c/8991228#8991228
-				 */
-				if (0 != stat (fn, &fs))
-#endif	/* WIN32 */
-				{
-					upsdebugx(2, "%s: MODE_DUMMY_ONCE: Can't stat %s currently", __func__, fn);
-					/* retry ASAP until we get a file */
-					memset(&datafile_stat, 0, sizeof(struct stat));
-					next_update = 1;
-				} else {
-					if (datafile_stat.st_mtime != fs.st_mtime) {
-						upsdebugx(2,
-							"%s: MODE_DUMMY_ONCE: input file was already read once "
-							"to the end, but changed later - re-reading: %s",
-							__func__, fn);
-						/* updated file => retry ASAP */
-						next_update = 1;
-						datafile_stat = fs;
-					}
+			/* less stress on the sys: the compiled file is only
+			 * replayed, and only compiled again if it changed */
+			if (replay_done || (curstep == 0 && !replay_paused)) {
+				if (parse_data_file(upsfd) > 0) {
+					replay_done = 0;
+				} else if (replay_done) {
+					upsdebugx(2, "%s: MODE_DUMMY_ONCE: NO-OP: input file was already read once to the end", __func__);
+					dstate_dataok();
+					break;
 				}
 			}
 
-			if (ctx == NULL && next_update == -1) {
-				upsdebugx(2, "%s: MODE_DUMMY_ONCE: NO-OP: input file was already read once to the end", __func__);
+			if (replay_data_file() >= 0)
 				dstate_dataok();
-			} else {
-				/* initial parsing interrupted by e.g. TIMER line */
-				if (parse_data_file(upsfd) >= 0)
-					dstate_dataok();
-			}
 			break;
 
 		case MODE_META:
 		case MODE_REPEATER:
-			if (upsclient_update_vars() > 0)
+			if (repeater_feed < 0)
 			{
-				dstate_dataok();
+				repeater_update();
+				break;
 			}
-			else
+
+			/* a device of a group: apply what its driver read */
+			if (repeater_read_feed(0) < 0)
 			{
-				/* try to reconnect */
-				upscli_disconnect(ups);
-				if (upscli_connect(ups, hostname, port, UPSCLI_CONN_TRYSSL) < 0)
-				{
-					upsdebugx(1, "Error reconnecting: %s", upscli_strerror(ups));
-				}
-				else
-				{
-					upsdebugx(1, "Reconnected");
-				}
+				upslogx(LOG_NOTICE, "The driver repeating this device is gone, exiting");
+				set_exit_flag(EF_EXIT_SUCCESS);
 			}
 			break;
 
@@ -421,11 +462,17 @@ void upsdrv_makevartable(void)
 {
 	addvar(VAR_VALUE,	"mode",	"Specify mode instead of guessing it from port value (dummy = dummy-loop, dummy-once, repeater)"); /* meta */
 	addvar(VAR_FLAG,    "repeater_disable_strict_start", "Do not terminate the driver encountering errors when starting the repeater mode");
+	addvar(VAR_VALUE,	"repeater_parent", "Section of the repeater which repeats this device along with its own");
 }
 
 void upsdrv_initups(void)
 {
 	const char *val;
+#ifndef WIN32
+	const char *parent;
+#endif	/* !WIN32 */
+	char	*target = NULL, *hostname = NULL;
+	uint16_t	port;
 
 	val = dstate_getinfo("driver.parameter.mode");
 	if (val) {
@@ -448,10 +495,34 @@ void upsdrv_initups(void)
 		mode = MODE_REPEATER;
 		dstate_setinfo("driver.parameter.mode", "repeater");
 		/* FIXME: if there is at least one more => MODE_META... */
+
+#ifndef WIN32
+		/* a device of a group is served by the driver of the group */
+		if ((parent = getval("repeater_parent")) != NULL)
+		{
+			upslogx(LOG_NOTICE, "Device [%s] is repeated by the driver of [%s], not on its own",
+				upsname, parent);
+			exit(EXIT_SUCCESS);
+		}
+#endif	/* !WIN32 */
+
+		/* Obtain the target name */
+		if (upscli_splitname(device_path, &target, &hostname, &port) != 0)
+		{
+			fatalx(EXIT_FAILURE, "Error: invalid UPS definition.\nRequired format: upsname[@hostname[:port]]");
+		}
+		repeater_add(upsname, target, hostname, port, -1);
+		free(target);
+		free(hostname);
+
+#ifndef WIN32
+		repeater_start_group();
+#endif	/* !WIN32 */
 	}
 	else
 	{
 		char fn[NUT_PATH_MAX + 1];
+		struct stat	fs;
 		mode = MODE_NONE;
 
 		if (val) {
@@ -534,22 +605,9 @@ void upsdrv_initups(void)
 
 		prepare_filepath(fn, sizeof(fn));
 
-		/* Update file modification timestamp (and other data) */
-#ifndef WIN32
-		/* Either successful stat (zero return) is OK to fill the
-		 * "datafile_stat" struct. Note that currently "upsfd" is
-		 * a no-op for files, they are re-opened and re-parsed
-		 * every time so callers can modify the data without
-		 * complications.
-		 */
-		if ( (INVALID_FD(upsfd) || 0 != fstat (upsfd, &datafile_stat)) && 0 != stat (fn, &datafile_stat))
-#else	/* WIN32 */
-		/* Consider GetFileAttributesEx() for WIN32_FILE_ATTRIBUTE_DATA?
-		 * NUT_WIN32_INCOMPLETE?
-		 *   https://stackoverflow.com/questions/8991192/check-the-file-size-without-opening-file-in-c/8991228#8991228
-		 */
-		if (0 != stat (fn, &datafile_stat))
-#endif	/* WIN32 */
+		/* The file is compiled (and its "datafile_stat" kept, to
+		 * notice later changes) in upsdrv_initinfo() */
+		if (0 != stat (fn, &fs))
 		{
 			upsdebugx(2, "%s: Can't stat %s (%s) currently", __func__, device_path, fn);
 		} else {
@@ -564,33 +622,20 @@ void upsdrv_initups(void)
 
 void upsdrv_cleanup(void)
 {
-	if (ups) {
-		upscli_disconnect(ups);
-		free(ups);
-		ups = NULL;
-	}
+	repeater_free();
 
-	if (client_upsname) {
-		free(client_upsname);
-		client_upsname = NULL;
+	if (repeater_feed >= 0) {
+		close(repeater_feed);
+		repeater_feed = -1;
 	}
 
-	if (hostname) {
-		free(hostname);
-		hostname = NULL;
-	}
-
-	if (ctx) {
-		pconf_finish(ctx);
-		free(ctx);
-		ctx = NULL;
-	}
+	free_steps(steps, numsteps);
+	steps = NULL;
+	numsteps = 0;
 }
 
 static int setvar(const char *varname, const char *val)
 {
-	dummy_info_t *item;
-
 	upsdebug_SET_STARTING(varname, val);
 
 	/* FIXME: the below is only valid if (mode == MODE_DUMMY)
@@ -625,9 +670,17 @@ static int setvar(const char *varname, const char *val)
 		return STAT_SET_UNKNOWN;
 	}
 
+	setvar_info(varname, val, find_info(varname));
+
+	return STAT_SET_HANDLED;
+}
+
+/* set a variable whose definition (if any) was looked up already */
+static void setvar_info(const char *varname, const char *val, dummy_info_t *item)
+{
 	/* If value is empty, remove the variable (FIXME: do we need
 	 * a magic word?) */
-	if (strlen(val) == 0)
+	if (*val == '\0')
 	{
 		dstate_delinfo(varname);
 	}
@@ -635,7 +688,7 @@ static int setvar(const char *varname, const char *val)
 	{
 		dstate_setinfo(varname, "%s", val);
 
-		if ( (item = find_info(varname)) != NULL)
+		if (item != NULL)
 		{
 			dstate_setflags(item->info_type, item->info_flags);
 
@@ -650,50 +703,537 @@ static int setvar(const char *varname, const char *val)
 			dstate_setaux(varname, 32);
 		}
 	}
-	return STAT_SET_HANDLED;
 }
 
 /*************************************************/
 /*               Support functions               */
 /*************************************************/
 
-static int upsclient_update_vars(void)
+/* find a variable (other than driver.*) which was not set since "cutoff" */
+static const st_tree_t *repeater_find_stale(const st_tree_t *node, const st_tree_timespec_t *cutoff)
 {
-	int		ret;
-	size_t	numq, numa;
-	const char	*query[4];
-	char		**answer;
+	const st_tree_t	*stale;
 
-	query[0] = "VAR";
-	query[1] = client_upsname;
-	numq = 2;
+	for (; node; node = node->right) {
+		if ((stale = repeater_find_stale(node->left, cutoff)) != NULL)
+			return stale;
 
-	ret = upscli_list_start(ups, numq, query);
+		if (strncmp(node->var, "driver.", 7)
+		&& st_tree_node_compare_timestamp(node, cutoff) < 0)
+			return node;
+	}
 
-	if (ret < 0)
-	{
-		upsdebugx(1, "Error: %s (%i)", upscli_strerror(ups), upscli_upserror(ups));
-		return ret;
+	return NULL;
+}
+
+/* when the list being applied began, see repeater_apply_line() */
+static st_tree_timespec_t	repeater_listed;
+
+/* Apply a line of what was read for the device of this process:
+ * "BEGIN", "VAR <name> <value>" for each variable, then "END" (or
+ * only "STALE" when it could not be read). Returns 1 once a list is
+ * done with, 0 otherwise */
+static int repeater_apply_line(char *line)
+{
+	char	*var, *val, varname[SMALLBUF];
+	const char	*cur;
+	const st_tree_t	*stale;
+
+	if (!strcmp(line, "BEGIN")) {
+		state_get_timestamp(&repeater_listed);
+		return 0;
 	}
 
-	while (upscli_list_next(ups, numq, query, &numa, &answer) == 1)
-	{
-		/* VAR <upsname> <varname> <val> */
-		if (numa < 4)
+	if (!strncmp(line, "VAR ", 4) && (val = strchr(line + 4, ' ')) != NULL) {
+		var = line + 4;
+		*val++ = '\0';
+
+		/* do not override the driver collection */
+		if (!strncmp(var, "driver.", 7))
+			return 0;
+
+		/* most values do not change between two polls: only refresh
+		 * the timestamp of those (nothing is sent to upsd for them),
+		 * and go through setvar() for the new and changed ones
+		 * (compared as set, not as escaped for the protocol) */
+		cur = dstate_getinfo_raw(var);
+		if (cur && !strcmp(cur, val))
+			dstate_setinfo(var, "%s", val);
+		else
+			setvar(var, val);
+		return 0;
+	}
+
+	if (!strcmp(line, "END")) {
+		/* the whole list was received: drop what upsd does not have anymore */
+		while ((stale = repeater_find_stale(dstate_getroot(), &repeater_listed)) != NULL)
 		{
-			upsdebugx(1, "Error: insufficient data (got %" PRIuSIZE " args, need at least 4)", numa);
+			snprintf(varname, sizeof(varname), "%s", stale->var);
+			upsdebugx(2, "%s: %s is gone upstream, removing it", __func__, varname);
+			dstate_delinfo(varname);
 		}
+		dstate_dataok();
+		return 1;
+	}
 
-		upsdebugx(5, "Received: %s %s %s %s",
-				answer[0], answer[1], answer[2], answer[3]);
+	if (!strcmp(line, "STALE")) {
+		dstate_datastale();
+		return 1;
+	}
 
-		/* do not override the driver collection */
-		if (strncmp(answer[2], "driver.", 7))
-			setvar(answer[2], answer[3]);
+	upsdebugx(1, "%s: unexpected line: %s", __func__, line);
+	return 0;
+}
+
+/* Read what the driver of the group passed on for the device of this
+ * process (see repeater_pass()), and apply it. With "wait", the pipe is
+ * read until a list is done with, otherwise until it is empty. Returns
+ * -1 once that driver is gone, 0 otherwise */
+static int repeater_read_feed(int wait)
+{
+	static char	buf[UPSCLI_NETBUF_LEN * 2];
+	static size_t	len = 0;
+	char	*line, *nl;
+	ssize_t	ret;
+	int	done = 0;
+
+	for (;;) {
+		ret = read(repeater_feed, buf + len, sizeof(buf) - 1 - len);
+
+		if (ret == 0)
+			return -1;
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			upslog_with_errno(LOG_ERR, "Can't read from the repeater pipe");
+			return -1;
+		}
+
+		len += (size_t)ret;
+		buf[len] = '\0';
+
+		for (line = buf; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+			*nl = '\0';
+			done |= repeater_apply_line(line);
+		}
+
+		len -= (size_t)(line - buf);
+		memmove(buf, line, len);
+
+		/* no line it passes on is that long */
+		if (len == sizeof(buf) - 1) {
+			upslogx(LOG_WARNING, "%s: line too long, dropped", __func__);
+			len = 0;
+		}
+
+		if (wait && done)
+			return 0;
+	}
+}
+
+/* Pass a line of what was read for dev on to the process serving it,
+ * or apply it right away for the own device */
+static void repeater_pass(repeater_dev_t *dev, const char *line)
+{
+	char	buf[UPSCLI_NETBUF_LEN];
+	size_t	len;
+
+	if (dev->fd < 0) {
+		snprintf(buf, sizeof(buf), "%s", line);
+		repeater_apply_line(buf);
+		return;
+	}
+
+	if (dev->gone)
+		return;
+
+	len = strlen(line);
+	if (dev->outlen + len + 1 > dev->outsize) {
+		dev->outsize = dev->outlen + len + 1 + LARGEBUF;
+		dev->out = xrealloc(dev->out, dev->outsize);
+	}
+
+	memcpy(dev->out + dev->outlen, line, len);
+	dev->out[dev->outlen + len] = '\n';
+	dev->outlen += len + 1;
+}
+
+/* Write what was passed on for dev to its pipe, as much as fits now */
+static void repeater_flush(repeater_dev_t *dev)
+{
+	ssize_t	ret;
+
+	while (dev->outlen > 0 && !dev->gone) {
+		ret = write(dev->fd, dev->out, dev->outlen);
+
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				upslogx(LOG_ERR, "The process serving [%s] is gone", dev->section);
+				dev->gone = 1;
+			} else if (dev->outlen > REPEATER_BACKLOG_MAX) {
+				upslogx(LOG_ERR, "The process serving [%s] is stuck, no longer repeating it", dev->section);
+				dev->gone = 1;
+			}
+			break;
+		}
+
+		dev->outlen -= (size_t)ret;
+		memmove(dev->out, dev->out + ret, dev->outlen);
+	}
+}
+
+/* Read the answer of upsd to the LIST VAR request (already sent) for
+ * dev, and pass the variables on. Returns 1 if the list was read, 0 if
+ * upsd answered with an error, -1 if the connection can not go on */
+static int repeater_fetch_dev(repeater_dev_t *dev)
+{
+	UPSCONN_t	*conn = &dev->host->conn;
+	const char	*begin[4], *query[2];
+	char	**answer, line[UPSCLI_NETBUF_LEN];
+	size_t	numa;
+	int	ret;
+
+	begin[0] = "BEGIN";
+	begin[1] = "LIST";
+	begin[2] = "VAR";
+	begin[3] = dev->upsname;
+	query[0] = "VAR";
+	query[1] = dev->upsname;
+
+	/* what upscli_list_start() would check of the first line */
+	ret = upscli_list_next(conn, 4, begin, &numa, &answer);
+	if (ret == 1) {
+		repeater_pass(dev, "BEGIN");
+
+		while ((ret = upscli_list_next(conn, 2, query, &numa, &answer)) == 1)
+		{
+			/* VAR <upsname> <varname> <val> */
+			if (numa < 4)
+			{
+				upsdebugx(1, "Error: insufficient data (got %" PRIuSIZE " args, need at least 4)", numa);
+				continue;
+			}
+
+			upsdebugx(5, "Received: %s %s %s %s",
+					answer[0], answer[1], answer[2], answer[3]);
+
+			snprintf(line, sizeof(line), "VAR %s %s", answer[2], answer[3]);
+			repeater_pass(dev, line);
+		}
+
+		if (ret == 0) {
+			repeater_pass(dev, "END");
+			dev->upserror = UPSCLI_ERR_NONE;
+			return 1;
+		}
+	} else if (ret == 0) {
+		/* an END LIST before its BEGIN */
+		conn->upserror = UPSCLI_ERR_PROTOCOL;
+	}
+
+	dev->upserror = upscli_upserror(conn);
+	upsdebugx(1, "Error: [%s] %s (%i)", dev->section, upscli_strerror(conn), dev->upserror);
+
+	/* upsd answered, but has no usable data for this device right
+	 * now (it is stale, or its driver not connected): the connection
+	 * itself is fine, keep it (note that libupsclient also reports
+	 * DRVNOTCONN when not connected at all, hence the check of the
+	 * socket) */
+	if (upscli_fd(conn) < 0
+	||  dev->upserror == UPSCLI_ERR_PARSE
+	||  dev->upserror == UPSCLI_ERR_PROTOCOL)
+		return -1;
+
+	return 0;
+}
+
+/* Read the variables of all the devices on host over its connection:
+ * their LIST VAR requests are sent at once, and the answers read in
+ * turn. Returns -1 if the connection failed on the way, 0 otherwise */
+static int repeater_fetch_host(repeater_host_t *host)
+{
+	repeater_dev_t	*dev;
+	char	*cmd = NULL;
+	size_t	len = 0, size = 0, need;
+	ssize_t	ret;
+
+	for (dev = repeater_devs; dev; dev = dev->next) {
+		if (dev->host != host || dev->gone)
+			continue;
+
+		need = len + strlen(dev->upsname) + sizeof("LIST VAR \n");
+		if (need > size) {
+			size = need + SMALLBUF;
+			cmd = xrealloc(cmd, size);
+		}
+		len += (size_t)snprintf(cmd + len, size - len, "LIST VAR %s\n", dev->upsname);
+	}
+
+	if (!len)
+		return 0;
+
+	ret = upscli_sendline(&host->conn, cmd, len);
+	free(cmd);
+	if (ret != 0)
+		return -1;
+
+	for (dev = repeater_devs; dev; dev = dev->next) {
+		if (dev->host != host || dev->gone)
+			continue;
+
+		if (repeater_fetch_dev(dev) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Read all the devices repeated by this driver, and pass their data on */
+static void repeater_update(void)
+{
+	repeater_host_t	*host;
+	repeater_dev_t	*dev, **pdev;
+	int	tries;
+
+#ifndef WIN32
+	/* the processes of the group which exited */
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+#endif	/* !WIN32 */
+
+	for (host = repeater_hosts; host; host = host->next) {
+		for (dev = repeater_devs; dev; dev = dev->next) {
+			if (dev->host == host)
+				dev->upserror = UPSCLI_ERR_SRVDISC;
+		}
+
+		/* when the connection fails, reconnect and try once more */
+		for (tries = 0; tries < 2; tries++) {
+			if (tries > 0 || upscli_fd(&host->conn) < 0) {
+				upscli_disconnect(&host->conn);
+				if (upscli_connect(&host->conn, host->hostname, host->port, UPSCLI_CONN_TRYSSL) < 0) {
+					upsdebugx(1, "Error connecting to %s: %s",
+						host->hostname, upscli_strerror(&host->conn));
+					break;
+				}
+				upsdebugx(1, "Connected to %s", host->hostname);
+			}
+
+			if (repeater_fetch_host(host) == 0)
+				break;
+
+			upsdebugx(1, "Error reading from %s: %s",
+				host->hostname, upscli_strerror(&host->conn));
+		}
+	}
+
+	/* the devices which could not be read are stale, and the processes
+	 * which are gone are not passed anything anymore */
+	for (pdev = &repeater_devs; (dev = *pdev) != NULL; ) {
+		if (dev->upserror != UPSCLI_ERR_NONE)
+			repeater_pass(dev, "STALE");
+
+		if (dev->fd >= 0)
+			repeater_flush(dev);
+
+		if (!dev->gone) {
+			pdev = &dev->next;
+			continue;
+		}
+
+		*pdev = dev->next;
+		close(dev->fd);
+		free(dev->section);
+		free(dev->upsname);
+		free(dev->out);
+		free(dev);
 	}
-	return 1;
 }
 
+/* Add a device to repeat, read from upsd on hostname:port */
+static void repeater_add(const char *section, const char *target,
+	const char *hostname, uint16_t port, int fd)
+{
+	repeater_host_t	*host;
+	repeater_dev_t	*dev, **pdev;
+
+	for (host = repeater_hosts; host; host = host->next) {
+		if (!strcasecmp(host->hostname, hostname) && host->port == port)
+			break;
+	}
+
+	if (!host) {
+		host = xcalloc(1, sizeof(*host));
+		host->hostname = xstrdup(hostname);
+		host->port = port;
+		host->next = repeater_hosts;
+		repeater_hosts = host;
+	}
+
+	dev = xcalloc(1, sizeof(*dev));
+	dev->section = xstrdup(section);
+	dev->upsname = xstrdup(target);
+	dev->host = host;
+	dev->fd = fd;
+	dev->upserror = UPSCLI_ERR_NONE;
+
+	for (pdev = &repeater_devs; *pdev; pdev = &(*pdev)->next)
+		;
+	*pdev = dev;
+}
+
+/* Forget the devices and hosts, closing the connections and pipes */
+static void repeater_free(void)
+{
+	repeater_host_t	*host;
+	repeater_dev_t	*dev;
+
+	while ((dev = repeater_devs) != NULL) {
+		repeater_devs = dev->next;
+		if (dev->fd >= 0)
+			close(dev->fd);
+		free(dev->section);
+		free(dev->upsname);
+		free(dev->out);
+		free(dev);
+	}
+
+	while ((host = repeater_hosts) != NULL) {
+		repeater_hosts = host->next;
+		upscli_disconnect(&host->conn);
+		free(host->hostname);
+		free(host);
+	}
+}
+
+#ifndef WIN32
+/* a section of ups.conf, as far as repeater_start_group() cares */
+typedef struct {
+	char	*name, *driver, *port, *parent;
+} repeater_section_t;
+
+/* Start a process for the device of section, if it is one of the group
+ * of this driver, and forget the section. Returns 1 in that process */
+static int repeater_start_member(repeater_section_t *section)
+{
+	char	*target = NULL, *hostname = NULL;
+	uint16_t	port;
+	int	pfd[2], ret = 0;
+	pid_t	pid;
+
+	if (!section->name || !section->parent || strcmp(section->parent, upsname)
+	||  !section->driver || strcmp(section->driver, progname))
+		goto done;
+
+	if (!section->port || upscli_splitname(section->port, &target, &hostname, &port) != 0) {
+		upslogx(LOG_ERR, "Device [%s] of the group has no valid port, not repeating it", section->name);
+		goto done;
+	}
+
+	if (pipe(pfd) < 0) {
+		upslog_with_errno(LOG_ERR, "Can't create a pipe for device [%s]", section->name);
+		goto done;
+	}
+
+	pid = fork_device_driver(section->name, section->port);
+
+	if (pid < 0) {
+		upslog_with_errno(LOG_ERR, "Can't start a process for device [%s]", section->name);
+		close(pfd[0]);
+		close(pfd[1]);
+		goto done;
+	}
+
+	if (pid == 0) {
+		/* this process serves that device now */
+		close(pfd[1]);
+		repeater_free();
+		repeater_feed = pfd[0];
+		ret = 1;
+		goto done;
+	}
+
+	close(pfd[0]);
+	if (fcntl(pfd[1], F_SETFL, fcntl(pfd[1], F_GETFL) | O_NONBLOCK) < 0)
+		upslog_with_errno(LOG_WARNING, "Can't make the pipe to device [%s] non-blocking", section->name);
+	repeater_add(section->name, target, hostname, port, pfd[1]);
+	upsdebugx(1, "Repeating [%s] (%s) in process %" PRIdMAX, section->name, section->port, (intmax_t)pid);
+
+done:
+	free(target);
+	free(hostname);
+	free(section->name);
+	free(section->driver);
+	free(section->port);
+	free(section->parent);
+	memset(section, 0, sizeof(*section));
+	return ret;
+}
+
+/* Start a process for each device of the group of this driver: the
+ * ups.conf sections with a "repeater_parent" of this one */
+static void repeater_start_group(void)
+{
+	char	fn[NUT_PATH_MAX + 1];
+	PCONF_CTX_t	ctx;
+	repeater_section_t	section;
+	char	**arg, **pval;
+
+	snprintf(fn, sizeof(fn), "%s/ups.conf", confpath());
+	pconf_init(&ctx, upsconf_err);
+
+	if (!pconf_file_begin(&ctx, fn)) {
+		upslogx(LOG_WARNING, "Can't open %s: %s", fn, ctx.errmsg);
+		pconf_finish(&ctx);
+		return;
+	}
+
+	memset(&section, 0, sizeof(section));
+
+	while (pconf_file_next(&ctx)) {
+		if (pconf_parse_error(&ctx) || ctx.numargs < 1)
+			continue;
+
+		arg = ctx.arglist;
+
+		/* a section header ends the previous section */
+		if (arg[0][0] == '[' && arg[0][strlen(arg[0]) - 1] == ']') {
+			if (repeater_start_member(&section))
+				break;
+			section.name = xstrdup(arg[0] + 1);
+			section.name[strlen(section.name) - 1] = '\0';
+			continue;
+		}
+
+		if (ctx.numargs < 3 || strcmp(arg[1], "="))
+			continue;
+
+		if (!strcmp(arg[0], "driver"))
+			pval = &section.driver;
+		else if (!strcmp(arg[0], "port"))
+			pval = &section.port;
+		else if (!strcmp(arg[0], "repeater_parent"))
+			pval = &section.parent;
+		else
+			continue;
+
+		free(*pval);
+		*pval = xstrdup(arg[2]);
+	}
+
+	/* the last section (unless this is the process of one already) */
+	if (repeater_feed < 0)
+		repeater_start_member(&section);
+
+	pconf_finish(&ctx);
+}
+#endif	/* !WIN32 */
+
 /* find info element definition in info array */
 static dummy_info_t *find_info(const char *varname)
 {
@@ -756,160 +1296,256 @@ static void upsconf_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf(ups.conf): %s", errmsg);
 }
 
+static void free_steps(dummy_step_t *list, size_t count)
+{
+	size_t	i;
+
+	for (i = 0; i < count; i++) {
+		free(list[i].var);
+		free(list[i].value);
+	}
+
+	free(list);
+}
+
+/* join the values of a definition file line, from arglist[first] on */
+static char *join_args(PCONF_CTX_t *ctx, size_t first)
+{
+	char	value[MAX_STRING_SIZE];
+	size_t	counter;
+
+	value[0] = '\0';
+
+	for (counter = first; counter < ctx->numargs; counter++) {
+		if (counter == first) /* don't append the first space separator */
+			snprintf(value, sizeof(value), "%s", ctx->arglist[counter]);
+		else
+			snprintfcat(value, sizeof(value), " %s", ctx->arglist[counter]);
+	}
+
+	return xstrdup(value);
+}
+
 /* for dummy mode
- * parse the definition file and process its content
+ * compile the definition file into the list of steps, unless it did not
+ * change since the last time; returns 1 if it was (re)compiled, 0 if it
+ * did not change, -1 if it can not be read (the steps are kept then)
  */
 static int parse_data_file(TYPE_FD arg_upsfd)
 {
 	char	fn[NUT_PATH_MAX + 1];
-	char	*ptr, var_value[MAX_STRING_SIZE];
-	size_t	value_args = 0, counter;
-	time_t	now;
+	char	*ptr;
+	PCONF_CTX_t	ctx;
+	struct stat	fs;
+	dummy_step_t	*list = NULL, *step;
+	size_t	count = 0, alloced = 0;
+	double	delay;
 	NUT_UNUSED_VARIABLE(arg_upsfd);
 
-	time(&now);
+	prepare_filepath(fn, sizeof(fn));
 
-	upsdebugx(1, "entering parse_data_file()");
-
-	if (now < next_update)
-	{
-		upsdebugx(1, "leaving (paused)...");
-		return 1;
+	/* Determine if the file has changed since it was compiled (a new
+	 * file, e.g. from "sed -i" or an editor, gets another inode) */
+	if (0 != stat (fn, &fs)) {
+		upsdebugx(2, "%s: Can't stat %s currently", __func__, fn);
+		return -1;
 	}
 
-	/* initialise everything, to loop back at the beginning of the file */
-	if (ctx == NULL)
-	{
-		ctx = (PCONF_CTX_t *)xmalloc(sizeof(PCONF_CTX_t));
+	if (steps != NULL
+	 && fs.st_mtime == datafile_stat.st_mtime
+	 && fs.st_size == datafile_stat.st_size
+	 && fs.st_ino == datafile_stat.st_ino
+	) {
+		return 0;
+	}
 
-		prepare_filepath(fn, sizeof(fn));
-		pconf_init(ctx, upsconf_err);
+	upsdebugx(1, "entering parse_data_file(): compiling %s", fn);
 
-		if (!pconf_file_begin(ctx, fn))
-			fatalx(EXIT_FAILURE, "Can't open dummy-ups definition file %s: %s",
-				fn, ctx->errmsg);
+	pconf_init(&ctx, upsconf_err);
 
-		/* we need this for parsing alarm instructions later */
-		status_init(); /* in case no ups.status does it */
-		alarm_init(); /* reset alarms at start of parsing */
+	if (!pconf_file_begin(&ctx, fn)) {
+		upslogx(LOG_ERR, "Can't open dummy-ups definition file %s: %s",
+			fn, ctx.errmsg);
+		pconf_finish(&ctx);
+		return -1;
 	}
 
-	/* Reset the next call time, so that we can loop back on the file
-	 * if there is no blocking action (ie TIMER) until the end of the file */
-	next_update = -1;
-
-	/* Now start or continue parsing... */
-	while (pconf_file_next(ctx))
+	while (pconf_file_next(&ctx))
 	{
-		if (pconf_parse_error(ctx))
+		if (pconf_parse_error(&ctx))
 		{
 			upsdebugx(2, "Parse error: %s:%d: %s",
-				fn, ctx->linenum, ctx->errmsg);
+				fn, ctx.linenum, ctx.errmsg);
 			continue;
 		}
 
 		/* Check if we have something to process */
-		if (ctx->numargs < 1)
+		if (ctx.numargs < 1)
 			continue;
 
-		/* TIMER instruction */
-		if (!strncmp(ctx->arglist[0], "TIMER", 5))
+		/* Remove ":" suffix, after the variable name */
+		if ((ptr = strchr(ctx.arglist[0], ':')) != NULL)
+			*ptr = '\0';
+
+		/* Skip the driver.* collection data */
+		if (!strncmp(ctx.arglist[0], "driver.", 7))
 		{
-			/* TIMER <seconds> will wait "seconds" before
-			 * continuing the parsing */
-			int delay = atoi (ctx->arglist[1]);
-			time(&next_update);
-			next_update += delay;
-			upsdebugx(3, "parse_data_file: TIMER instruction with value \"%i\"", delay);
-			upsdebugx(1, "suspending execution for %i seconds...", delay);
-			break;
+			upsdebugx(2, "parse_data_file: skipping %s", ctx.arglist[0]);
+			continue;
+		}
+
+		if (count == alloced) {
+			alloced = alloced ? alloced * 2 : 64;
+			list = xrealloc(list, alloced * sizeof(*list));
 		}
 
-		/* ALARM instruction */
-		if (!strncmp(ctx->arglist[0], "ALARM", 5))
+		step = &list[count++];
+		memset(step, 0, sizeof(*step));
+
+		/* TIMER <seconds> will wait "seconds" (which may have
+		 * a fraction) before continuing with the next steps */
+		if (!strncmp(ctx.arglist[0], "TIMER", 5))
 		{
-			if (ctx->numargs > 1) {
-				for (counter = 1, value_args = ctx->numargs ;
-					counter < value_args ; counter++)
-				{
-					if (counter == 1) /* don't append the first space separator */
-						snprintf(var_value, sizeof(var_value), "%s", ctx->arglist[counter]);
-					else
-						snprintfcat(var_value, sizeof(var_value), " %s", ctx->arglist[counter]);
-				}
-				if (*var_value != '\0') {
-					alarm_set(var_value);
-					upsdebugx(3, "parse_data_file: ALARM instruction with value \"%s\"", var_value);
+			delay = (ctx.numargs > 1) ? strtod(ctx.arglist[1], NULL) : 0;
+			step->type = DUMMY_STEP_TIMER;
+			step->delay_ms = (delay > 0) ? (long)(delay * 1000 + 0.5) : 0;
+			upsdebugx(3, "parse_data_file: TIMER instruction with value \"%ld\" ms", step->delay_ms);
+			continue;
+		}
 
-					continue;
+		/* ALARM instruction, without a value it resets the alarms */
+		if (!strncmp(ctx.arglist[0], "ALARM", 5))
+		{
+			step->type = DUMMY_STEP_ALARM;
+			if (ctx.numargs > 1) {
+				step->value = join_args(&ctx, 1);
+				if (*step->value == '\0') {
+					free(step->value);
+					step->value = NULL;
 				}
 			}
-
-			alarm_init();
-			upsdebugx(3, "parse_data_file: ALARM instruction with no value (reset alarms)");
-
+			upsdebugx(3, "parse_data_file: ALARM instruction with value \"%s\"",
+				NUT_STRARG(step->value));
 			continue;
 		}
 
-		/* Remove ":" suffix, after the variable name */
-		if ((ptr = strchr(ctx->arglist[0], ':')) != NULL)
-			*ptr = '\0';
-
+		/* From there, we get varname in arg[0], and values in other arg[1...x] */
 		upsdebugx(3, "parse_data_file: variable \"%s\" with %d args",
-			ctx->arglist[0], (int)ctx->numargs);
+			ctx.arglist[0], (int)ctx.numargs);
 
-		/* Skip the driver.* collection data */
-		if (!strncmp(ctx->arglist[0], "driver.", 7))
+		step->value = join_args(&ctx, 1);
+
+		/* special handler for status */
+		if (!strncmp(ctx.arglist[0], "ups.status", 10))
 		{
-			upsdebugx(2, "parse_data_file: skipping %s", ctx->arglist[0]);
+			step->type = DUMMY_STEP_STATUS;
 			continue;
 		}
 
-		/* From there, we get varname in arg[0], and values in other arg[1...x] */
-		/* special handler for status */
-		if (!strncmp( ctx->arglist[0], "ups.status", 10))
-		{
-			status_init();
-			for (counter = 1, value_args = ctx->numargs ;
-				counter < value_args ; counter++)
-			{
-				status_set(ctx->arglist[counter]);
-			}
-			status_commit();
+		step->type = DUMMY_STEP_SET;
+		step->var = xstrdup(ctx.arglist[0]);
+		step->info = find_info(step->var);
+	}
+
+	pconf_finish(&ctx);
+
+	upsdebugx(1, "parse_data_file: compiled %" PRIuSIZE " steps", count);
+
+	free_steps(steps, numsteps);
+	steps = list;
+	numsteps = count;
+	datafile_stat = fs;
+
+	/* start over */
+	curstep = 0;
+	replay_paused = 0;
+
+	return 1;
+}
+
+/* for dummy mode
+ * process the compiled steps from where the last call stopped, up to
+ * a TIMER step (asking the driver loop to come back when it expires)
+ * or to the end of the list
+ */
+static int replay_data_file(void)
+{
+	struct timeval	now;
+	dummy_step_t	*step;
+	double	remaining;
+
+	gettimeofday(&now, NULL);
+
+	if (replay_paused)
+	{
+		remaining = difftimeval(replay_resume, now);
+		if (remaining > 0) {
+			upsdebugx(1, "replay_data_file: paused for %.3f more seconds", remaining);
+			poll_wakeup_ms = (long)(remaining * 1000) + 1;
+			return 1;
 		}
-		else
+		replay_paused = 0;
+	}
+
+	/* we need this for parsing alarm instructions later */
+	if (curstep == 0)
+	{
+		status_init(); /* in case no ups.status does it */
+		alarm_init(); /* reset alarms at start of parsing */
+	}
+
+	while (curstep < numsteps)
+	{
+		step = &steps[curstep++];
+
+		switch (step->type)
 		{
-			for (counter = 1, value_args = ctx->numargs ;
-				counter < value_args ; counter++)
-			{
-				if (counter == 1) /* don't append the first space separator */
-					snprintf(var_value, sizeof(var_value), "%s", ctx->arglist[counter]);
+			case DUMMY_STEP_TIMER:
+				replay_resume = now;
+				replay_resume.tv_sec += step->delay_ms / 1000;
+				replay_resume.tv_usec += (step->delay_ms % 1000) * 1000;
+				if (replay_resume.tv_usec >= 1000000) {
+					replay_resume.tv_sec++;
+					replay_resume.tv_usec -= 1000000;
+				}
+				replay_paused = 1;
+				poll_wakeup_ms = step->delay_ms;
+				upsdebugx(1, "suspending execution for %ld ms...", step->delay_ms);
+				break;
+
+			case DUMMY_STEP_ALARM:
+				if (step->value)
+					alarm_set(step->value);
 				else
-					snprintfcat(var_value, sizeof(var_value), " %s", ctx->arglist[counter]);
-			}
+					alarm_init();
+				continue;
 
-			if (setvar(ctx->arglist[0], var_value) == STAT_SET_UNKNOWN)
-			{
-				upsdebugx(2, "parse_data_file: can't add \"%s\" with value \"%s\"\nError: %s",
-					ctx->arglist[0], var_value, ctx->errmsg);
-			}
-			else
-			{
-				upsdebugx(3, "parse_data_file: added \"%s\" with value \"%s\"",
-					ctx->arglist[0], var_value);
-			}
+			case DUMMY_STEP_STATUS:
+				status_init();
+				status_set(step->value);
+				status_commit();
+				continue;
+
+			case DUMMY_STEP_SET:
+			default:
+				setvar_info(step->var, step->value, step->info);
+				continue;
 		}
+
+		break;
 	}
 
 	alarm_commit(); /* needs to happen first */
 	status_commit(); /* re-commit status for ALARM */
 
-	/* Cleanup parseconf if there is no pending action */
-	if (next_update == -1)
+	/* At the end: loop back on the steps in the next call, or
+	 * (for MODE_DUMMY_ONCE) wait for the file to change */
+	if (curstep >= numsteps && !replay_paused)
 	{
-		pconf_finish(ctx);
-		free(ctx);
-		ctx=NULL;
+		curstep = 0;
+		if (mode == MODE_DUMMY_ONCE)
+			replay_done = 1;
 	}
+
 	return 1;
 }
@@ -27,7 +27,7 @@
 #include "upsdrvquery.h"
 
 #define DRIVER_NAME      "UPS Failover Driver"
-#define DRIVER_VERSION   "0.01"
+#define DRIVER_VERSION   "0.02"
 
 upsdrv_info_t upsdrv_info = {
 	DRIVER_NAME,
@@ -71,13 +71,16 @@ static void handle_arguments(void);
 static void parse_port_argument(void);
 static void parse_status_filters(void);
 static void handle_connections(void);
+#ifndef WIN32
+static void read_connections(void);
+#endif	/* !WIN32 */
 static void export_driver_state(void);
 
 static void handle_no_primaries(void);
 static int handle_init_time(const ups_device_t *primary_candidate);
 
 static int ups_connect(ups_device_t *ups);
-static int ups_read_data(ups_device_t *ups);
+static int ups_read_data(ups_device_t *ups, struct timeval tv);
 static void ups_disconnect(ups_device_t *ups);
 static int ups_parse_protocol(ups_device_t *ups, size_t numargs, char **arg);
 
@@ -93,6 +96,7 @@ static int has_better_runtime(int rt, int rt_low, int best_rt, int best_rt_low,
 static void ups_promote_primary(ups_device_t *ups);
 static void ups_demote_primary(ups_device_t *ups);
 static void ups_export_dstate(ups_device_t *ups);
+static void ups_export_var(const ups_device_t *ups, const ups_var_t *var);
 static void ups_clean_dstate(const ups_device_t *ups);
 
 static int ups_get_cmd_pos(const ups_device_t *ups, const char *cmd);
@@ -100,6 +104,10 @@ static int ups_add_cmd(ups_device_t *ups, const char *val);
 static int ups_del_cmd(ups_device_t *ups, const char *val);
 
 static int ups_get_var_pos(const ups_device_t *ups, const char *key);
+static void ups_hash_var(ups_device_t *ups, ups_var_t *var);
+static void ups_rehash_vars(ups_device_t *ups, size_t size);
+static void ups_mark_var_dirty(ups_device_t *ups, ups_var_t *var);
+static void ups_unmark_var_dirty(ups_device_t *ups, const ups_var_t *var);
 static int ups_set_var(ups_device_t *ups, const char *key, const char *value);
 static int ups_del_var(ups_device_t *ups, const char *key);
 static int ups_set_var_flags(ups_device_t *ups, const char *key, const int flag);
@@ -652,15 +660,120 @@ static void handle_connections(void)
 			continue;
 		}
 
-		if (ups_read_data(ups) < 0 ) {
-			/* Socket failure... warrants immediate disconnect */
-			upslog_with_errno(LOG_ERR, "%s: [%s]: connection to UPS driver was lost (socket failure)",
-				__func__, ups->socketname);
-			ups_disconnect(ups);
+#ifdef WIN32
+		{
+			struct timeval tv;
+
+			tv.tv_sec = CONN_READ_TIMEOUT;
+			tv.tv_usec = 0;
+
+			if (ups_read_data(ups, tv) < 0) {
+				/* Socket failure... warrants immediate disconnect */
+				upslog_with_errno(LOG_ERR, "%s: [%s]: connection to UPS driver was lost (socket failure)",
+					__func__, ups->socketname);
+				ups_disconnect(ups);
+			}
 		}
+#endif	/* WIN32 */
 	}
+
+#ifndef WIN32
+	read_connections();
+#endif	/* !WIN32 */
 }
 
+#ifndef WIN32
+/* Wait for any of the connected UPS drivers to send data, and read from
+ * all of those that did; then keep reading whatever arrives meanwhile
+ * (e.g. the rest of a large DUMPALL) without waiting any more, so that
+ * neither a quiet nor a chatty UPS driver holds up the others. */
+static void read_connections(void)
+{
+	struct timeval tv;
+	size_t i = 0;
+	size_t rounds = 0;
+	int ready = 0;
+
+	tv.tv_sec = CONN_READ_TIMEOUT;
+	tv.tv_usec = 0;
+
+	do {
+		fd_set rfds;
+		TYPE_FD maxfd = ERROR_FD;
+
+		FD_ZERO(&rfds);
+
+		for (i = 0; i < ups_count; ++i) {
+			ups_device_t *ups = ups_list[i];
+
+			if (!ups->conn || INVALID_FD(ups->conn->sockfd)) {
+				continue;
+			}
+
+			FD_SET(ups->conn->sockfd, &rfds);
+
+			if (ups->conn->sockfd > maxfd) {
+				maxfd = ups->conn->sockfd;
+			}
+		}
+
+		if (INVALID_FD(maxfd)) {
+			upsdebugx(5, "%s: no UPS driver connections to read from",
+				__func__);
+
+			return;
+		}
+
+		ready = select(maxfd + 1, &rfds, NULL, NULL, &tv);
+
+		if (ready < 0) {
+			if (errno != EINTR) {
+				upslog_with_errno(LOG_ERR, "%s: select on UPS driver connections has failed",
+					__func__);
+			}
+
+			return;
+		}
+
+		for (i = 0; i < ups_count; ++i) {
+			ups_device_t *ups = ups_list[i];
+			struct timeval notv;
+			int ret = 0;
+
+			if (!ups->conn || INVALID_FD(ups->conn->sockfd)
+			 || !FD_ISSET(ups->conn->sockfd, &rfds)
+			) {
+				continue;
+			}
+
+			notv.tv_sec = 0;
+			notv.tv_usec = 0;
+
+			ret = ups_read_data(ups, notv);
+
+			if (ret < 0) {
+				/* Socket failure... warrants immediate disconnect */
+				upslog_with_errno(LOG_ERR, "%s: [%s]: connection to UPS driver was lost (socket failure)",
+					__func__, ups->socketname);
+				ups_disconnect(ups);
+			}
+			else if (ret == 0) {
+				/* Readable, but nothing to read: the other end is gone */
+				upslogx(LOG_ERR, "%s: [%s]: connection to UPS driver was lost (closed by driver)",
+					__func__, ups->socketname);
+				ups_disconnect(ups);
+			}
+		}
+
+		tv.tv_sec = 0;
+		tv.tv_usec = 0;
+	} while (ready > 0 && ++rounds < CONN_READ_ROUNDS);
+
+	upsdebugx(5, "%s: finished after %" PRIuSIZE " round(s) of reading",
+		__func__, rounds);
+}
+#endif	/* !WIN32 */
+
 static void export_driver_state(void)
 {
 	dstate_setinfo("driver.stats.alive_drivers", "%" PRIuSIZE, ups_alive_count);
@@ -886,14 +999,10 @@ static int ups_connect(ups_device_t *ups)
 	return ret;
 }
 
-static int ups_read_data(ups_device_t *ups)
+static int ups_read_data(ups_device_t *ups, struct timeval tv)
 {
 	int	i = 0;
 	ssize_t	ret;
-	struct timeval tv;
-
-	tv.tv_sec = CONN_READ_TIMEOUT;
-	tv.tv_usec = 0;
 
 	ret = upsdrvquery_read_timeout(ups->conn, tv);
 
@@ -1595,67 +1704,77 @@ static void ups_export_dstate(ups_device_t *ups)
 		}
 	}
 
-	for (i = 0; i < ups->var_count; ++i) {
-		ups_var_t *var = ups->var_list[i];
+	if (ups->force_dstate_export) {
+		for (i = 0; i < ups->var_count; ++i) {
+			ups_export_var(ups, ups->var_list[i]);
+			ups->var_list[i]->needs_export = 0;
+		}
+	} else {
+		/* only what changed since the last export */
+		for (i = 0; i < ups->var_dirty_count; ++i) {
+			ups_export_var(ups, ups->var_dirty[i]);
+			ups->var_dirty[i]->needs_export = 0;
+		}
+	}
 
-		if (var->needs_export || ups->force_dstate_export) {
-			size_t j = 0;
+	ups->var_dirty_count = 0;
 
-			if (!strcmp(var->key, "ups.alarm")) {
-				alarm_init();
-				alarm_set(var->value);
-				alarm_commit();
-				status_commit(); /* publish ALARM */
-				upsdebugx(5, "%s: [%s]: exported UPS alarm to dstate: [%s] : [%s]",
-					__func__, ups->socketname, var->key, var->value);
-			}
-			else if (!strcmp(var->key, "ups.status")) {
-				status_init();
-				status_set(var->value);
-				status_commit();
-				upsdebugx(5, "%s: [%s]: exported UPS status to dstate: [%s] : [%s]",
-					__func__, ups->socketname, var->key, var->value);
-			}
-			else {
-				dstate_setinfo(var->key, "%s", var->value);
-				upsdebugx(5, "%s: [%s]: exported variable to dstate: [%s] : [%s]",
-					__func__, ups->socketname, var->key, var->value);
-			}
+	if (ups->force_dstate_export) {
+		alarm_commit();
+		status_commit();
+	}
 
-			if (var->flags) {
-				dstate_setflags(var->key, var->flags);
-				upsdebugx(5, "%s: [%s]: exported variable flags to dstate: [%s] : [%d]",
-					__func__, ups->socketname, var->key, var->flags);
-			}
+	ups->force_dstate_export = 0;
+}
 
-			if (var->aux) {
-				dstate_setaux(var->key, var->aux);
-				upsdebugx(5, "%s: [%s]: exported variable aux to dstate: [%s] : [%ld]",
-					__func__, ups->socketname, var->key, var->aux);
-			}
+static void ups_export_var(const ups_device_t *ups, const ups_var_t *var)
+{
+	size_t j = 0;
 
-			for (j = 0; j < var->enum_count; ++j) {
-				dstate_addenum(var->key, "%s", var->enum_list[j]);
-				upsdebugx(5, "%s: [%s]: exported variable enum to dstate: [%s] : [%s]",
-					__func__, ups->socketname, var->key, var->enum_list[j]);
-			}
+	if (!strcmp(var->key, "ups.alarm")) {
+		alarm_init();
+		alarm_set(var->value);
+		alarm_commit();
+		status_commit(); /* publish ALARM */
+		upsdebugx(5, "%s: [%s]: exported UPS alarm to dstate: [%s] : [%s]",
+			__func__, ups->socketname, var->key, var->value);
+	}
+	else if (!strcmp(var->key, "ups.status")) {
+		status_init();
+		status_set(var->value);
+		status_commit();
+		upsdebugx(5, "%s: [%s]: exported UPS status to dstate: [%s] : [%s]",
+			__func__, ups->socketname, var->key, var->value);
+	}
+	else {
+		dstate_setinfo(var->key, "%s", var->value);
+		upsdebugx(5, "%s: [%s]: exported variable to dstate: [%s] : [%s]",
+			__func__, ups->socketname, var->key, var->value);
+	}
 
-			for (j = 0; j < var->range_count; ++j) {
-				dstate_addrange(var->key, var->range_list[j]->min, var->range_list[j]->max);
-				upsdebugx(5, "%s: [%s]: exported variable range to dstate: [%s] : min=[%d] : max=[%d]",
-					__func__, ups->socketname, var->key, var->range_list[j]->min, var->range_list[j]->max);
-			}
+	if (var->flags) {
+		dstate_setflags(var->key, var->flags);
+		upsdebugx(5, "%s: [%s]: exported variable flags to dstate: [%s] : [%d]",
+			__func__, ups->socketname, var->key, var->flags);
+	}
 
-			var->needs_export = 0;
-		}
+	if (var->aux) {
+		dstate_setaux(var->key, var->aux);
+		upsdebugx(5, "%s: [%s]: exported variable aux to dstate: [%s] : [%ld]",
+			__func__, ups->socketname, var->key, var->aux);
 	}
 
-	if (ups->force_dstate_export) {
-		alarm_commit();
-		status_commit();
+	for (j = 0; j < var->enum_count; ++j) {
+		dstate_addenum(var->key, "%s", var->enum_list[j]);
+		upsdebugx(5, "%s: [%s]: exported variable enum to dstate: [%s] : [%s]",
+			__func__, ups->socketname, var->key, var->enum_list[j]);
 	}
 
-	ups->force_dstate_export = 0;
+	for (j = 0; j < var->range_count; ++j) {
+		dstate_addrange(var->key, var->range_list[j]->min, var->range_list[j]->max);
+		upsdebugx(5, "%s: [%s]: exported variable range to dstate: [%s] : min=[%d] : max=[%d]",
+			__func__, ups->socketname, var->key, var->range_list[j]->min, var->range_list[j]->max);
+	}
 }
 
 static void ups_clean_dstate(const ups_device_t *ups)
@@ -1770,17 +1889,94 @@ static int ups_del_cmd(ups_device_t *ups, const char *val)
 
 static int ups_get_var_pos(const ups_device_t *ups, const char *key)
 {
+	uint32_t hash;
+	size_t mask;
 	size_t i = 0;
 
-	for (i = 0; i < ups->var_count; ++i) {
-		if (!strcmp(ups->var_list[i]->key, key)) {
-			return i;
+	if (!ups->var_hash_size) {
+		return -1;
+	}
+
+	hash = str_hash_nocase(key);
+	mask = ups->var_hash_size - 1;
+
+	for (i = hash & mask; ups->var_hash[i]; i = (i + 1) & mask) {
+		const ups_var_t *var = ups->var_hash[i];
+
+		if (var->hash == hash && !strcmp(var->key, key)) {
+			return (int)var->pos;
 		}
 	}
 
 	return -1;
 }
 
+static void ups_hash_var(ups_device_t *ups, ups_var_t *var)
+{
+	size_t mask = ups->var_hash_size - 1;
+	size_t i = 0;
+
+	/* open addressing with linear probing, the table is never full */
+	for (i = var->hash & mask; ups->var_hash[i]; i = (i + 1) & mask);
+
+	ups->var_hash[i] = var;
+}
+
+static void ups_rehash_vars(ups_device_t *ups, size_t size)
+{
+	size_t i = 0;
+
+	if (size != ups->var_hash_size) {
+		free(ups->var_hash);
+		ups->var_hash = xcalloc(size, sizeof(*ups->var_hash));
+		ups->var_hash_size = size;
+	} else {
+		memset(ups->var_hash, 0, sizeof(*ups->var_hash) * size);
+	}
+
+	for (i = 0; i < ups->var_count; ++i) {
+		ups_hash_var(ups, ups->var_list[i]);
+	}
+
+	upsdebugx(6, "%s: [%s]: indexed %" PRIuSIZE " variables in %" PRIuSIZE " slots",
+		__func__, ups->socketname, ups->var_count, size);
+}
+
+static void ups_mark_var_dirty(ups_device_t *ups, ups_var_t *var)
+{
+	if (var->needs_export) {
+		return;
+	}
+
+	if (ups->var_dirty_count >= ups->var_dirty_allocs) {
+		ups->var_dirty = xrealloc(ups->var_dirty, sizeof(*ups->var_dirty) * (ups->var_dirty_allocs + VAR_ALLOC_BATCH));
+		ups->var_dirty_allocs = ups->var_dirty_allocs + VAR_ALLOC_BATCH;
+	}
+
+	ups->var_dirty[ups->var_dirty_count] = var;
+	ups->var_dirty_count++;
+	var->needs_export = 1;
+}
+
+static void ups_unmark_var_dirty(ups_device_t *ups, const ups_var_t *var)
+{
+	size_t i = 0;
+
+	if (!var->needs_export) {
+		return;
+	}
+
+	for (i = 0; i < ups->var_dirty_count; ++i) {
+		if (ups->var_dirty[i] == var) {
+			memmove(ups->var_dirty + i, ups->var_dirty + i + 1,
+				sizeof(*ups->var_dirty) * (ups->var_dirty_count - i - 1));
+			ups->var_dirty_count--;
+
+			return;
+		}
+	}
+}
+
 static int ups_set_var(ups_device_t *ups, const char *key, const char *value)
 {
 	ups_var_t *new_var = NULL;
@@ -1792,7 +1988,7 @@ static int ups_set_var(ups_device_t *ups, const char *key, const char *value)
 		if (strcmp(var->value, value)) {
 			free(var->value);
 			var->value = xstrdup(value);
-			var->needs_export = 1;
+			ups_mark_var_dirty(ups, var);
 
 			upsdebugx(5, "%s: [%s]: updated in ups->var_list: [%s] : [%s]",
 				__func__, ups->socketname, key, value);
@@ -1815,11 +2011,21 @@ static int ups_set_var(ups_device_t *ups, const char *key, const char *value)
 	new_var = xcalloc(1, sizeof(**ups->var_list));
 	new_var->key = xstrdup(key);
 	new_var->value = xstrdup(value);
-	new_var->needs_export = 1;
+	new_var->hash = str_hash_nocase(key);
+	new_var->pos = ups->var_count;
 
 	ups->var_list[ups->var_count] = new_var;
 	ups->var_count++;
 
+	/* keep the index at most half full */
+	if (ups->var_count * 2 > ups->var_hash_size) {
+		ups_rehash_vars(ups, ups->var_hash_size ? ups->var_hash_size * 2 : VAR_HASH_MIN_SIZE);
+	} else {
+		ups_hash_var(ups, new_var);
+	}
+
+	ups_mark_var_dirty(ups, new_var);
+
 	upsdebugx(5, "%s: [%s]: stored in ups->var_list: [%s] : [%s]",
 		__func__, ups->socketname, key, value);
 
@@ -1857,11 +2063,13 @@ static int ups_del_var(ups_device_t *ups, const char *key)
 				__func__, ups->socketname, key);
 		}
 
+		ups_unmark_var_dirty(ups, var);
 		ups_free_var_state(var);
 		free(var);
 
 		for (i = var_pos; i < ups->var_count - 1; ++i) {
 			ups->var_list[i] = ups->var_list[i + 1];
+			ups->var_list[i]->pos = i;
 		}
 
 		ups->var_list[ups->var_count - 1] = NULL;
@@ -1877,6 +2085,9 @@ static int ups_del_var(ups_device_t *ups, const char *key)
 			ups->var_allocs = ups->var_count;
 		}
 
+		/* probe sequences may run across the removed entry, re-index */
+		ups_rehash_vars(ups, ups->var_hash_size);
+
 		upsdebugx(5, "%s: [%s]: removed from ups->var_list: [%s]",
 			__func__, ups->socketname, key);
 
@@ -1904,7 +2115,7 @@ static int ups_set_var_flags(ups_device_t *ups, const char *key, const int flags
 		}
 
 		var->flags = flags;
-		var->needs_export = 1;
+		ups_mark_var_dirty(ups, var);
 
 		upsdebugx(5, "%s: [%s]: stored flags in ups->var_list: [%s] : [%d]",
 			__func__, ups->socketname, key, flags);
@@ -1933,7 +2144,7 @@ static int ups_set_var_aux(ups_device_t *ups, const char *key, const long aux)
 		}
 
 		var->aux = aux;
-		var->needs_export = 1;
+		ups_mark_var_dirty(ups, var);
 
 		upsdebugx(5, "%s: [%s]: stored aux in ups->var_list: [%s] : [%ld]",
 			__func__, ups->socketname, key, aux);
@@ -1977,7 +2188,7 @@ static int ups_add_range(ups_device_t *ups, const char *key, const int min, cons
 
 		var->range_list[var->range_count] = new_range;
 		var->range_count++;
-		var->needs_export = 1;
+		ups_mark_var_dirty(ups, var);
 
 		upsdebugx(5, "%s: [%s]: added to ups->var_list->range_list: [%s] : min=[%d] : max=[%d]",
 			__func__, ups->socketname, key, min, max);
@@ -2066,7 +2277,7 @@ static int ups_add_enum(ups_device_t *ups, const char *key, const char *val)
 		var->enum_list[var->enum_count] = xstrdup(val);
 
 		var->enum_count++;
-		var->needs_export = 1;
+		ups_mark_var_dirty(ups, var);
 
 		upsdebugx(5, "%s: [%s]: added to ups->var_list->enum_list: [%s] : [%s]",
 			__func__, ups->socketname, key, val);
@@ -2197,6 +2408,19 @@ static void ups_free_ups_state(ups_device_t *ups)
 		ups->var_allocs = 0;
 	}
 
+	if (ups->var_hash) {
+		free(ups->var_hash);
+		ups->var_hash = NULL;
+		ups->var_hash_size = 0;
+	}
+
+	if (ups->var_dirty) {
+		free(ups->var_dirty);
+		ups->var_dirty = NULL;
+		ups->var_dirty_count = 0;
+		ups->var_dirty_allocs = 0;
+	}
+
 	if (ups->cmd_list) {
 		for (i = 0; i < ups->cmd_count; ++i) {
 			if (ups->cmd_list[i]) {
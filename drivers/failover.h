@@ -23,15 +23,18 @@
 
 #include "config.h"
 #include "main.h"
+#include "nut_stdint.h"
 #include "parseconf.h"
 #include "timehead.h"
 #include "upsdrvquery.h"
 
 #define VAR_ALLOC_BATCH      50
+#define VAR_HASH_MIN_SIZE    64
 #define SUBVAR_ALLOC_BATCH   10
 #define CMD_ALLOC_BATCH      20
 #define CONN_READ_TIMEOUT     3
 #define CONN_CMD_TIMEOUT      3
+#define CONN_READ_ROUNDS    256
 #define ALARM_PROPAG_TIME    15
 
 #define DEFAULT_INIT_TIMEOUT         30
@@ -81,6 +84,9 @@ typedef struct {
 
 	long aux;
 
+	size_t pos;
+	uint32_t hash;
+
 	int flags;
 	int needs_export;
 } ups_var_t;
@@ -111,10 +117,15 @@ typedef struct {
 	PCONF_CTX_t parse_ctx;
 
 	ups_var_t **var_list;
+	ups_var_t **var_hash;
+	ups_var_t **var_dirty;
 	ups_cmd_t **cmd_list;
 
 	size_t var_count;
 	size_t var_allocs;
+	size_t var_hash_size;
+	size_t var_dirty_count;
+	size_t var_dirty_allocs;
 	size_t cmd_count;
 	size_t cmd_allocs;
 
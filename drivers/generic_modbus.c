@@ -22,6 +22,7 @@
 
 #include "main.h"
 #include "generic_modbus.h"
+#include "modbus_plan.h"
 #include <modbus.h>
 #include "timehead.h"
 #include "nut_stdint.h"
@@ -31,7 +32,7 @@
 #endif
 
 #define DRIVER_NAME	"NUT Generic Modbus driver (libmodbus link type: " NUT_MODBUS_LINKTYPE_STR ")"
-#define DRIVER_VERSION	"0.07"
+#define DRIVER_VERSION	"0.08"
 
 /* variables */
 static modbus_t *mbctx = NULL;                             /* modbus memory context */
@@ -50,6 +51,7 @@ static uint32_t mod_resp_to_s = MODRESP_TIMEOUT_s;         /* set the modbus res
 static uint32_t mod_resp_to_us = MODRESP_TIMEOUT_us;       /* set the modbus response time out (us) */
 static uint32_t mod_byte_to_s = MODBYTE_TIMEOUT_s;         /* set the modbus byte time out (us) */
 static uint32_t mod_byte_to_us = MODBYTE_TIMEOUT_us;       /* set the modbus byte time out (us) */
+static mbplan_t *mbplan = NULL;                            /* signal registers read each poll */
 
 /* get config vars set by -x or defined in ups.conf driver section */
 void get_config_vars(void);
@@ -60,8 +62,8 @@ modbus_t *modbus_new(const char *port);
 /* reconnect upon communication error */
 void modbus_reconnect(void);
 
-/* modbus register read function */
-int register_read(modbus_t *mb, int addr, regtype_t type, void *data);
+/* read the registers of all signals, as few block reads as possible */
+static int plan_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *dest);
 
 /* instant command triggered by upsd */
 int upscmd(const char *cmd, const char *arg);
@@ -193,6 +195,9 @@ void upsdrv_updateinfo(void)
 	status_init();      /* initialize ups.status update */
 	alarm_init();       /* initialize ups.alarm update */
 
+	/* one pass over the device, get_signal_state() picks from that */
+	mbplan_read(mbplan, plan_read, NULL);
+
 	/*
 	 * update UPS status regarding MAINS state either via OL | OB.
 	 * if both statuses are mapped to contacts then only OL is evaluated.
@@ -389,6 +394,7 @@ void upsdrv_makevartable(void)
 	addvar(VAR_VALUE, "DISCHRG_noro", "NO/NC configuration for DISCHRG state");
 	addvar(VAR_VALUE, "FSD_noro", "NO/NC configuration for FSD state");
 	addvar(VAR_VALUE, "FSD_pulse_duration", "FSD pulse duration");
+	addvar(VAR_VALUE, "read_max_gap", "max unused registers to read along between signals (0 to disable)");
 }
 
 /* close modbus connection and free modbus context allocated memory */
@@ -398,75 +404,34 @@ void upsdrv_cleanup(void)
 		modbus_close(mbctx);
 		modbus_free(mbctx);
 	}
+	mbplan_free(mbplan);
+	mbplan = NULL;
 }
 
 /*
  * driver support functions
  */
 
-/* Read a modbus register */
-int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
+/* Read a block of modbus registers for the plan */
+static int plan_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *dest)
 {
-	int rval = -1;
-
-	/* register bit masks */
-	uint16_t mask8 = 0x000F;
-	uint16_t mask16 = 0x00FF;
+	int rval;
 
-	switch (type) {
-		case COIL:
-			rval = modbus_read_bits(mb, addr, 1, (uint8_t *)data);
-			*(uint16_t *)data = *(uint16_t *)data & mask8;
-			break;
-		case INPUT_B:
-			rval = modbus_read_input_bits(mb, addr, 1, (uint8_t *)data);
-			*(uint16_t *)data = *(uint16_t *)data & mask8;
-			break;
-		case INPUT_R:
-			rval = modbus_read_input_registers(mb, addr, 1, (uint16_t *)data);
-			*(uint16_t *)data = *(uint16_t *)data & mask16;
-			break;
-		case HOLDING:
-			rval = modbus_read_registers(mb, addr, 1, (uint16_t *)data);
-			*(uint16_t *)data = *(uint16_t *)data & mask16;
-			break;
+	NUT_UNUSED_VARIABLE(ctx);
 
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic push
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT
-# pragma GCC diagnostic ignored "-Wcovered-switch-default"
-#endif
-#ifdef HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE
-# pragma GCC diagnostic ignored "-Wunreachable-code"
-#endif
-/* Older CLANG (e.g. clang-3.4) seems to not support the GCC pragmas above */
-#ifdef __clang__
-# pragma clang diagnostic push
-# pragma clang diagnostic ignored "-Wunreachable-code"
-# pragma clang diagnostic ignored "-Wcovered-switch-default"
-#endif
-		/* All enum cases defined as of the time of coding
-		 * have been covered above. Handle later definitions,
-		 * memory corruptions and buggy inputs below...
-		 */
-		default:
-			upsdebugx(2, "ERROR: register_read: invalid register type %u", type);
-			break;
-#ifdef __clang__
-# pragma clang diagnostic pop
-#endif
-#if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
-# pragma GCC diagnostic pop
-#endif
-	}
-	if (rval == -1) {
-		upslogx(LOG_ERR, "ERROR:(%s) modbus_read: addr:0x%x, type:%8s, path:%s",
+	rval = mbplan_modbus_read(mbctx, type, addr, count, dest);
+	if (rval == MBPLAN_READ_ILLEGAL) {
+		/* the plan will read around the addresses the device rejects */
+		upsdebugx(2, "modbus_read: addr:0x%x, count:%d rejected as illegal",
+			(unsigned int)addr, count);
+	} else if (rval == -1) {
+		upslogx(LOG_ERR, "ERROR:(%s) modbus_read: addr:0x%x, count:%d, type:%8s, path:%s",
 			modbus_strerror(errno),
 			(unsigned int)addr,
-			(type == COIL) ? "COIL" :
-			(type == INPUT_B) ? "INPUT_B" :
-			(type == INPUT_R) ? "INPUT_R" : "HOLDING",
+			count,
+			(type == MBPLAN_COIL) ? "COIL" :
+			(type == MBPLAN_INPUT_B) ? "INPUT_B" :
+			(type == MBPLAN_INPUT_R) ? "INPUT_R" : "HOLDING",
 			device_path
 		);
 
@@ -476,8 +441,8 @@ int register_read(modbus_t *mb, int addr, regtype_t type, void *data)
 			modbus_reconnect();
 		}
 	}
-	upsdebugx(3, "register addr: 0x%x, register type: %u read: %u",
-		(unsigned int)addr, type, *(unsigned int *)data);
+	upsdebugx(3, "register addr: 0x%x, register type: %u, count: %d, read: %d",
+		(unsigned int)addr, type, count, rval);
 	return rval;
 }
 
@@ -682,7 +647,7 @@ int upscmd(const char *cmd, const char *arg)
 int get_signal_state(devstate_t state)
 {
 	int rval = -1;
-	int reg_val;
+	uint16_t reg_val;
 	regtype_t rtype = 0;    /* register type */
 	int addr = -1;          /* register address */
 
@@ -739,11 +704,13 @@ int get_signal_state(devstate_t state)
 			break;
 	}
 
-	rval = register_read(mbctx, addr, rtype, &reg_val);
-	if (rval > -1) {
+	/* taken from the last read of the plan, masked as single reads were */
+	if (mbplan_get(mbplan, (mbplan_type_t)rtype, addr, 1, &reg_val) == 0) {
+		if (rtype == INPUT_R || rtype == HOLDING)
+			reg_val &= 0x00FF;
 		rval = reg_val;
 	}
-	upsdebugx(3, "get_signal_state: state: %d", reg_val);
+	upsdebugx(3, "get_signal_state: state: %d", rval);
 	return rval;
 }
 
@@ -1050,6 +1017,23 @@ void get_config_vars(void)
 				sigar[i].type);
 		}
 	}
+
+	/* plan the reads of the signals polled by upsdrv_updateinfo() */
+	mbplan = mbplan_new();
+	if (testvar("read_max_gap")) {
+		int gap = (int)strtol(getval("read_max_gap"), NULL, 10);
+		for (i = 0; i < MBPLAN_NUM_TYPES; i++)
+			mbplan_set_limits(mbplan, (mbplan_type_t)i, 0, gap > 0 ? gap : -1);
+	}
+	for (i = 0; i < NUMOF_SIG_STATES; i++) {
+		if (sigar[i].addr == NOTUSED || i == FSD_T)
+			continue;
+		if (mbplan_add(mbplan, (mbplan_type_t)sigar[i].type, sigar[i].addr, 1) < 0) {
+			fatalx(EXIT_FAILURE, "Invalid modbus address 0x%x or register type %u for signal %d",
+				(unsigned int)(sigar[i].addr), sigar[i].type, i);
+		}
+	}
+	upsdebugx(2, "signals read in %" PRIuSIZE " block read(s)", mbplan_build(mbplan));
 }
 
 /* create a new modbus context based on connection type (serial or TCP) */
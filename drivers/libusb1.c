@@ -33,7 +33,7 @@
 #include "nut_stdint.h"
 
 #define USB_DRIVER_NAME		"USB communication driver (libusb 1.0)"
-#define USB_DRIVER_VERSION	"0.50"
+#define USB_DRIVER_VERSION	"0.51"
 
 /* driver description structure */
 upsdrv_info_t comm_upsdrv_info = {
@@ -110,6 +110,88 @@ static inline int matches(USBDeviceMatcher_t *matcher, USBDevice_t *device) {
 	return matcher->match_function(device, matcher->privdata);
 }
 
+#if (defined __linux__) && (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+# define NUT_LIBUSB_SYSFS_STRINGS 1
+
+/* read one cached string descriptor of a device from sysfs, as
+ * nut_usb_get_string() would return it into a buffer of "buflen" bytes:
+ * the kernel decoded the same descriptor (in the same first language)
+ * to UTF-8, which gives the same bytes as long as it is all printable
+ * ASCII; anything else (or a string not read whole, or an empty one
+ * which nut_usb_get_string() does not return) gives NULL, and the
+ * device must be opened to read it */
+static char *nut_libusb_sysfs_string(const char *sysname, const char *attr, size_t buflen)
+{
+	char	fn[NUT_PATH_MAX], buf[512];
+	FILE	*f;
+	size_t	len, i;
+
+	snprintf(fn, sizeof(fn), "/sys/bus/usb/devices/%s/%s", sysname, attr);
+
+	if ((f = fopen(fn, "r")) == NULL)
+		return NULL;
+
+	len = fread(buf, 1, sizeof(buf), f);
+	fclose(f);
+
+	if (len < 2 || len == sizeof(buf) || buf[len - 1] != '\n')
+		return NULL;
+	len--;
+
+	for (i = 0; i < len; i++) {
+		if ((unsigned char)buf[i] < 0x20 || (unsigned char)buf[i] > 0x7e)
+			return NULL;
+	}
+
+	/* nut_usb_get_string() keeps at most buflen / 2 - 1 characters */
+	if (len > buflen / 2 - 1)
+		len = buflen / 2 - 1;
+	buf[len] = '\0';
+
+	return xstrdup(buf);
+}
+
+/* fill the Vendor, Product and Serial of a device from the strings the
+ * kernel read when it was plugged in, without any USB transfers; returns
+ * 1 if all the strings the device has were found, 0 if it must be opened
+ * to read them */
+static int nut_libusb_sysfs_strings(libusb_device *device,
+	struct libusb_device_descriptor *dev_desc, USBDevice_t *curDevice,
+	size_t buflen)
+{
+	uint8_t	ports[7];
+	char	sysname[64];
+	int	numports, i;
+
+	numports = libusb_get_port_numbers(device, ports, (int)sizeof(ports));
+	if (numports < 1)
+		return 0;
+
+	snprintf(sysname, sizeof(sysname), "%d-%d",
+		libusb_get_bus_number(device), ports[0]);
+	for (i = 1; i < numports; i++)
+		snprintfcat(sysname, sizeof(sysname), ".%d", ports[i]);
+
+	if (dev_desc->iManufacturer
+	 && (curDevice->Vendor = nut_libusb_sysfs_string(sysname, "manufacturer", buflen)) == NULL)
+		return 0;
+
+	if (dev_desc->iProduct
+	 && (curDevice->Product = nut_libusb_sysfs_string(sysname, "product", buflen)) == NULL)
+		return 0;
+
+	if (dev_desc->iSerialNumber
+	 && (curDevice->Serial = nut_libusb_sysfs_string(sysname, "serial", buflen)) == NULL)
+		return 0;
+
+	upsdebugx(3, "%s: found the strings of %s: %s / %s / %s", __func__, sysname,
+		NUT_STRARG(curDevice->Vendor), NUT_STRARG(curDevice->Product),
+		NUT_STRARG(curDevice->Serial));
+
+	return 1;
+}
+#endif	/* __linux__ && WITH_USB_BUSPORT */
+
 /*! If needed, set the USB alternate interface.
  *
  * In NUT 2.7.2 and earlier, the following call was made unconditionally:
@@ -206,6 +288,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 	int count_open_EACCESS = 0;
 	int count_open_errors = 0;
 	int count_open_attempts = 0;
+	int strings_known;
 
 	/* report descriptor */
 	unsigned char	rdbuf[MAX_REPORT_SIZE];
@@ -318,26 +401,10 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 
 		/* supported vendors are now checked by the supplied matcher */
 
-		/* open the device */
-		ret = libusb_open(device, udevp);
-		if (ret != 0) {
-			upsdebugx(1, "Failed to open device (%04X/%04X), skipping: %s",
-				dev_desc.idVendor,
-				dev_desc.idProduct,
-				libusb_strerror((enum libusb_error)ret));
-			count_open_errors++;
-			if (ret == LIBUSB_ERROR_ACCESS) {
-				count_open_EACCESS++;
-			}
-			continue;
-		}
-		udev = *udevp;
-
 		/* collect the identifying information of this
-		   device. Note that this is safe, because
-		   there's no need to claim an interface for
-		   this (and therefore we do not yet need to
-		   detach any kernel drivers). */
+		   device; what libusb knows without opening it
+		   comes first, so that devices ruled out by it
+		   are not opened at all */
 
 		free(curDevice->Vendor);
 		free(curDevice->Product);
@@ -406,7 +473,73 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 		curDevice->ProductID = dev_desc.idProduct;
 		curDevice->bcdDevice = dev_desc.bcdDevice;
 
-		if (dev_desc.iManufacturer) {
+		if (!USBMatchUnopened(matcher, curDevice)) {
+			upsdebugx(2, "Device does not match - skipping without opening it");
+			continue;
+		}
+
+		strings_known = 0;
+
+#ifdef NUT_LIBUSB_SYSFS_STRINGS
+		/* the kernel keeps the strings it read when the device was
+		 * plugged in; when they are the same as what would be read
+		 * from the device (see nut_libusb_sysfs_string()), the
+		 * matcher chain decides on them without opening a device
+		 * it rejects, nor reading the strings again of one it
+		 * accepts; after a matcher error, the device's own strings
+		 * decide as usual */
+		if (nut_libusb_sysfs_strings(device, &dev_desc, curDevice, sizeof(string))) {
+			for (m = matcher; m; m = m->next) {
+				if ((ret = matches(m, curDevice)) != 1)
+					break;
+			}
+
+			if (m == NULL) {
+				upsdebugx(2, "Device matches by its sysfs strings - not reading them again");
+				strings_known = 1;
+			} else {
+				/* reset any parameters modified by matchers
+				 * which accepted these strings */
+				nut_libusb_subdriver_defaults(&usb_subdriver);
+
+				if (ret == 0) {
+					upsdebugx(2, "Device does not match by its sysfs strings - skipping without opening it");
+					continue;
+				}
+			}
+		}
+
+		if (!strings_known) {
+			free(curDevice->Vendor);
+			free(curDevice->Product);
+			free(curDevice->Serial);
+			curDevice->Vendor = curDevice->Product = curDevice->Serial = NULL;
+		}
+#endif	/* NUT_LIBUSB_SYSFS_STRINGS */
+
+		/* open the device */
+		ret = libusb_open(device, udevp);
+		if (ret != 0) {
+			upsdebugx(1, "Failed to open device (%04X/%04X), skipping: %s",
+				dev_desc.idVendor,
+				dev_desc.idProduct,
+				libusb_strerror((enum libusb_error)ret));
+			count_open_errors++;
+			if (ret == LIBUSB_ERROR_ACCESS) {
+				count_open_EACCESS++;
+			}
+			/* the matchers may have accepted its sysfs strings */
+			nut_libusb_subdriver_defaults(&usb_subdriver);
+			continue;
+		}
+		udev = *udevp;
+
+		/* the strings need a control transfer each; this is safe,
+		   because there's no need to claim an interface for
+		   this (and therefore we do not yet need to
+		   detach any kernel drivers). */
+
+		if (dev_desc.iManufacturer && !strings_known) {
 			ret = nut_usb_get_string(udev, dev_desc.iManufacturer,
 				string, sizeof(string));
 			if (ret > 0) {
@@ -420,7 +553,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 		}
 
-		if (dev_desc.iProduct) {
+		if (dev_desc.iProduct && !strings_known) {
 			ret = nut_usb_get_string(udev, dev_desc.iProduct,
 				string, sizeof(string));
 			if (ret > 0) {
@@ -434,7 +567,7 @@ static int nut_libusb_open(libusb_device_handle **udevp,
 			}
 		}
 
-		if (dev_desc.iSerialNumber) {
+		if (dev_desc.iSerialNumber && !strings_known) {
 			ret = nut_usb_get_string(udev, dev_desc.iSerialNumber,
 				string, sizeof(string));
 			if (ret > 0) {
@@ -47,6 +47,10 @@ const char	*progname = NULL, *upsname = NULL, *device_name = NULL;
 
 /* may be set by the driver to wake up while in dstate_poll_fds */
 TYPE_FD	extrafd = ERROR_FD;
+
+/* may be set by the driver in upsdrv_updateinfo() to have the next poll
+ * that many milliseconds later, if sooner than the poll interval */
+long	poll_wakeup_ms = 0;
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
 # ifdef WIN32
 static HANDLE	mutex = INVALID_HANDLE_VALUE;
@@ -86,6 +90,15 @@ vartab_t	*vartab_h = NULL;
  */
 time_t	poll_interval = 2;
 static char	*chroot_path = NULL, *user = NULL, *group = NULL;
+
+/* Poll intervals in milliseconds, 0 if not set: poll_interval_ms is
+ * the base interval if it was configured with a fraction of a second
+ * (poll_interval keeps it rounded up to whole seconds for drivers which
+ * use that directly); the other two enable the adaptive polling */
+static long	poll_interval_ms = 0, poll_interval_fast_ms = 0, poll_interval_max_ms = 0;
+
+/* poll this many cycles with poll_interval_fast_ms after a status change */
+#define POLL_FAST_CYCLES	5
 static int	user_from_cmdline = 0, group_from_cmdline = 0;
 
 /* signal handling */
@@ -132,6 +145,8 @@ static int nut_debug_level_protocol = -1;
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
 /* everything else */
 static char	*pidfn = NULL;
+/* a process forked by fork_device_driver() has no PID file */
+static int	no_pidfile = 0;
 static int	help_only = 0,
 		cli_args_accepted = 0,
 		dump_data = 0; /* Store the update_count requested */
@@ -273,7 +288,7 @@ static void help_msg(void)
 	/* NOTE for FIXME above: PID-signalling is non-WIN32-only for us */
 	printf("  -P <pid>       - send the signal above to specified PID (bypassing PID file)\n");
 # endif	/* WIN32 */
-	printf("  -i <int>       - poll interval\n");
+	printf("  -i <sec>       - poll interval (may be fractional, e.g. 0.5)\n");
 	printf("  -r <dir>       - chroot to <dir>\n");
 	printf("  -u <user>      - switch to <user> (if started as root)\n");
 	printf("  -g <group>     - set pipe access to <group> (if started as root)\n");
@@ -1079,6 +1094,21 @@ int main_instcmd(const char *cmdname, const char *extra, conn_t *conn) {
 	return STAT_INSTCMD_UNKNOWN;
 }
 
+/* Boolean-ish values of driver.flag.* settable via protocol */
+static int parse_flag_value(const char *val)
+{
+	int num = 0;
+
+	if (str_to_int(val, &num, 10))
+		return (num > 0);
+
+	/* support certain strings */
+	return (!strncmp(val, "enable", 6)	/* "enabled" matches too */
+	 || !strcmp(val, "true")
+	 || !strcmp(val, "yes")
+	 || !strcmp(val, "on"));
+}
+
 /* handle setting variables common for all drivers */
 int main_setvar(const char *varname, const char *val, conn_t *conn) {
 	char buf[SMALLBUF];
@@ -1112,23 +1142,14 @@ int main_setvar(const char *varname, const char *val, conn_t *conn) {
 		}
 	}
 
-	if (!strcmp(varname, "driver.flag.allow_killpower")) {
-		int num = 0;
-		if (str_to_int(val, &num, 10)) {
-			if (num <= 0) {
-				num = 0;
-			} else	num = 1;
-		} else {
-			/* support certain strings */
-			if (!strncmp(val, "enable", 6)	/* "enabled" matches too */
-			 || !strcmp(val, "true")
-			 || !strcmp(val, "yes")
-			 || !strcmp(val, "on")
-			) num = 1;
-		}
+	if (!strcmp(varname, "driver.flag.allow_killpower")
+	 || !strcmp(varname, "driver.flag.report_poll_state")
+	 || !strcmp(varname, "driver.flag.report_poll_stats")
+	) {
+		int num = parse_flag_value(val);
 
 		upsdebugx(1, "%s: Setting %s=%d", __func__, varname, num);
-		dstate_setinfo("driver.flag.allow_killpower", "%d", num);
+		dstate_setinfo(varname, "%d", num);
 		return STAT_SET_HANDLED;
 	}
 
@@ -1145,11 +1166,77 @@ invalid:
 	return STAT_SET_INVALID;
 }
 
+/* Parse a poll interval in (possibly fractional) seconds,
+ * returns milliseconds or 0 if not valid */
+static long poll_interval_parse(const char *val)
+{
+	double	sec;
+
+	if (!val || !str_to_double_strict(val, &sec, 10) || sec < 0.01 || sec > 86400)
+		return 0;
+
+	return (long)(sec * 1000 + 0.5);
+}
+
+static void poll_interval_format(char *buf, size_t buflen, long ms)
+{
+	snprintf(buf, buflen, "%g", (double)ms / 1000.0);
+}
+
+/* the base poll interval in milliseconds; drivers may also have
+ * changed the whole-second poll_interval themselves */
+static long poll_interval_base(void)
+{
+	if (poll_interval_ms > 0 && poll_interval == (time_t)((poll_interval_ms + 999) / 1000))
+		return poll_interval_ms;
+
+	return (long)poll_interval * 1000;
+}
+
+/* handle "pollinterval" (including the one from global section or the
+ * command line) and the adaptive "pollinterval_fast" and "pollinterval_max"
+ * settings, in seconds which may be fractional; fatal if invalid */
+static void poll_interval_arg(const char *var, const char *val, const char *where)
+{
+	char	buf[SMALLBUF];
+	long	*ms_ptr, ms;
+	int	do_handle = 1;
+
+	if (!strcmp(var, "pollinterval")) {
+		ms_ptr = &poll_interval_ms;
+		poll_interval_format(buf, sizeof(buf), poll_interval_base());
+	} else if (!strcmp(var, "pollinterval_fast")) {
+		ms_ptr = &poll_interval_fast_ms;
+		poll_interval_format(buf, sizeof(buf), poll_interval_fast_ms);
+	} else {
+		ms_ptr = &poll_interval_max_ms;
+		poll_interval_format(buf, sizeof(buf), poll_interval_max_ms);
+	}
+
+	/* log a message if value changed; the command line always wins */
+	if (where && (do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
+		/* Should not happen, but... */
+		fatalx(EXIT_FAILURE, "Error: failed to check "
+			"testval_reloadable() for %s: "
+			"old %s vs. new %s", var, buf, NUT_STRARG(val));
+	}
+
+	if (do_handle <= 0)
+		return;
+
+	if (!(ms = poll_interval_parse(val))) {
+		fatalx(EXIT_FAILURE, "Error: %s: invalid %s: %s",
+			where ? where : "command-line", var, NUT_STRARG(val));
+	}
+
+	*ms_ptr = ms;
+	if (ms_ptr == &poll_interval_ms)
+		poll_interval = (time_t)((ms + 999) / 1000);
+}
+
 /* handle -x / ups.conf config details that are for this part of the code */
 static int main_arg(char *var, char *val)
 {
-	int do_handle = -2;
-
 	/* flags for main */
 
 	upsdebugx(3, "%s: var='%s' val='%s'",
@@ -1183,6 +1270,36 @@ static int main_arg(char *var, char *val)
 		return 1;	/* handled */
 	}
 
+	/* the export file is set up with the socket, so no reloading */
+	if (!strcmp(var, "sharedmem")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' can not be reloaded", __func__, var);
+		} else {
+			dstate_setinfo("driver.flag.sharedmem", "enabled");
+		}
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "report_poll_state")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
+				"(but may be changed by protocol SETVAR)", __func__, var);
+		} else {
+			dstate_setinfo("driver.flag.report_poll_state", "1");
+		}
+		return 1;	/* handled */
+	}
+
+	if (!strcmp(var, "report_poll_stats")) {
+		if (reload_flag) {
+			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
+				"(but may be changed by protocol SETVAR)", __func__, var);
+		} else {
+			dstate_setinfo("driver.flag.report_poll_stats", "1");
+		}
+		return 1;	/* handled */
+	}
+
 	if (!strcmp(var, "allow_killpower")) {
 		if (reload_flag) {
 			upsdebugx(6, "%s: SKIP: flag var='%s' currently can not be reloaded "
@@ -1262,29 +1379,14 @@ static int main_arg(char *var, char *val)
 	 * and the other to take hold. Both disappearing would not
 	 * be noticed by the reload operation currently, however.
 	 */
-	if (!strcmp(var, "pollinterval")) {
+	if (!strcmp(var, "pollinterval")
+	 || !strcmp(var, "pollinterval_fast")
+	 || !strcmp(var, "pollinterval_max")
+	) {
 		char buf[SMALLBUF];
 
-		/* log a message if value changed; skip if no good buf */
-		if (snprintf(buf, sizeof(buf), "%" PRIdMAX, (intmax_t)poll_interval)) {
-			if ((do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
-				/* Should not happen, but... */
-				fatalx(EXIT_FAILURE, "Error: failed to check "
-					"testval_reloadable() for pollinterval: "
-					"old %s vs. new %s", buf, NUT_STRARG(val));
-			}
-		}
-
-		if (do_handle > 0) {
-			int ipv = atoi(val);
-			if (ipv > 0) {
-				poll_interval = (time_t)ipv;
-			} else {
-				fatalx(EXIT_FAILURE, "Error: UPS [%s]: invalid pollinterval: %d",
-					NUT_STRARG(upsname), ipv);
-			}
-		}	/* else: no-op */
-
+		snprintf(buf, sizeof(buf), "UPS [%s]", NUT_STRARG(upsname));
+		poll_interval_arg(var, val, buf);
 		return 1;	/* handled */
 	}
 
@@ -1382,7 +1484,6 @@ static int main_arg(char *var, char *val)
 static void do_global_args(const char *var, const char *val)
 {
 	char buf[SMALLBUF];
-	int do_handle = 1;
 
 	upsdebugx(3, "%s: var='%s' val='%s'",
 		__func__,
@@ -1390,26 +1491,11 @@ static void do_global_args(const char *var, const char *val)
 		val ? val : "<null>");
 
 	/* Allow to reload this, why not */
-	if (!strcmp(var, "pollinterval")) {
-		/* log a message if value changed; skip if no good buf */
-		if (snprintf(buf, sizeof(buf), "%" PRIdMAX, (intmax_t)poll_interval)) {
-			if ((do_handle = testval_reloadable(var, buf, val, 1)) == 0) {
-				/* Should not happen, but... */
-				fatalx(EXIT_FAILURE, "Error: failed to check "
-					"testval_reloadable() for pollinterval: "
-					"old %s vs. new %s", buf, val);
-			}
-		}
-
-		if (do_handle > 0) {
-			int ipv = atoi(val);
-			if (ipv > 0) {
-				poll_interval = (time_t)ipv;
-			} else {
-				fatalx(EXIT_FAILURE, "Error: invalid pollinterval: %d", ipv);
-			}
-		}	/* else: no-op */
-
+	if (!strcmp(var, "pollinterval")
+	 || !strcmp(var, "pollinterval_fast")
+	 || !strcmp(var, "pollinterval_max")
+	) {
+		poll_interval_arg(var, val, "global section");
 		return;
 	}
 
@@ -1894,6 +1980,36 @@ static void exit_cleanup(void)
 	}
 #endif	/* WIN32 */
 }
+
+#ifndef WIN32
+pid_t fork_device_driver(const char *name, const char *port)
+{
+	pid_t	pid = fork();
+
+	if (pid != 0)
+		return pid;
+
+	/* The new process is started and stopped along with this one,
+	 * which upsdrvctl and the service units know of: it neither
+	 * takes over the PID file of this one (nor removes it when it
+	 * exits), nor has one of its own, which would have a driver
+	 * started for that section on its own stop this process */
+	free(pidfn);
+	pidfn = NULL;
+	no_pidfile = 1;
+
+	/* only this process talks to the service manager */
+	unsetenv("NOTIFY_SOCKET");
+
+	upsname = xstrdup(name);
+	free(device_path);
+	device_path = xstrdup(port);
+	device_name = xbasename(device_path);
+	dstate_setinfo("driver.parameter.port", "%s", port);
+
+	return 0;
+}
+#endif	/* !WIN32 */
 #endif /* DRIVERS_MAIN_WITHOUT_MAIN */
 
 void set_exit_flag(int sig)
@@ -2030,11 +2146,54 @@ void setup_signals(void)
  * behavior - using a production driver skeleton, but their own main().
  */
 #ifndef DRIVERS_MAIN_WITHOUT_MAIN
+/* Pick the interval until the next poll: pollinterval_fast while on
+ * battery, or for a few cycles after a status change; a growing one
+ * up to pollinterval_max while no data changes at all; otherwise the
+ * base interval. Returns milliseconds, and the mode for reporting. */
+static long poll_schedule(unsigned long changes, const char **mode)
+{
+	static char	last_status[SMALLBUF] = "";
+	static int	fast_cycles = 0;
+	static long	backoff_ms = 0;
+	const char	*status = dstate_getinfo("ups.status");
+	long	base_ms = poll_interval_base();
+
+	if (status && strcmp(status, last_status)) {
+		if (*last_status)
+			fast_cycles = POLL_FAST_CYCLES;
+		snprintf(last_status, sizeof(last_status), "%s", status);
+	}
+
+	if (poll_interval_fast_ms > 0 && (fast_cycles > 0
+	 || (status && (str_contains_token(status, "OB") || str_contains_token(status, "LB"))))
+	) {
+		if (fast_cycles > 0)
+			fast_cycles--;
+		backoff_ms = 0;
+		*mode = "fast";
+		return poll_interval_fast_ms;
+	}
+	fast_cycles = 0;
+
+	if (poll_interval_max_ms > base_ms && !changes) {
+		backoff_ms = backoff_ms ? backoff_ms * 2 : base_ms * 2;
+		if (backoff_ms > poll_interval_max_ms)
+			backoff_ms = poll_interval_max_ms;
+		*mode = "backoff";
+		return backoff_ms;
+	}
+
+	backoff_ms = 0;
+	*mode = (poll_interval_fast_ms > 0 || poll_interval_max_ms > 0) ? "normal" : "fixed";
+	return base_ms;
+}
+
 int main(int argc, char **argv)
 {
 	struct	passwd	*new_uid = NULL;
 	int	i, do_forceshutdown = 0;
 	int	update_count = 0;
+	char	buf[SMALLBUF];
 
 #ifndef WIN32
 	int	cmd = 0;
@@ -2197,15 +2356,8 @@ int main(int argc, char **argv)
 			case 'd':
 				/* Processed above */
 				break;
-			case 'i': { /* scope */
-					int ipv = atoi(optarg);
-					if (ipv > 0) {
-						poll_interval = (time_t)ipv;
-					} else {
-						fatalx(EXIT_FAILURE, "Error: command-line: invalid pollinterval: %d",
-							ipv);
-					}
-				}
+			case 'i':
+				poll_interval_arg("pollinterval", optarg, NULL);
 				break;
 			case 'k':
 				do_lock_port = 0;
@@ -3014,7 +3166,16 @@ sockname_ownership_finished:
 	}
 
 	/* The poll_interval may have been changed from the default */
-	dstate_setinfo("driver.parameter.pollinterval", "%" PRIdMAX, (intmax_t)poll_interval);
+	poll_interval_format(buf, sizeof(buf), poll_interval_base());
+	dstate_setinfo("driver.parameter.pollinterval", "%s", buf);
+	if (poll_interval_fast_ms > 0) {
+		poll_interval_format(buf, sizeof(buf), poll_interval_fast_ms);
+		dstate_setinfo("driver.parameter.pollinterval_fast", "%s", buf);
+	}
+	if (poll_interval_max_ms > 0) {
+		poll_interval_format(buf, sizeof(buf), poll_interval_max_ms);
+		dstate_setinfo("driver.parameter.pollinterval_max", "%s", buf);
+	}
 
 	/* The synchronous option may have been changed from the default */
 	dstate_setinfo("driver.parameter.synchronous", "%s",
@@ -3034,13 +3195,18 @@ sockname_ownership_finished:
 			/* We had saved a PID before backgrounding, but
 			 * it changes when backgrounding - so save again
 			 */
-			writepid(pidfn);
+			if (!no_pidfile)
+				writepid(pidfn);
 			break;
 
 		/* >0: Keep the initial PID; don't care about "!dump_data" here
 		 * currently: let users figure out their mess (or neat hacks)
 		 */
 		case 2:
+			if (no_pidfile) {
+				upslogx(LOG_WARNING, "Running as foreground process for another device, not saving a PID file");
+				break;
+			}
 			if (!pidfn) {
 				char	pidfnbuf[NUT_PATH_MAX + 1];
 				snprintf(pidfnbuf, sizeof(pidfnbuf), "%s/%s-%s.pid", altpidpath(), progname, upsname);
@@ -3063,6 +3229,18 @@ sockname_ownership_finished:
 	dstate_setflags("driver.flag.allow_killpower", ST_FLAG_RW | ST_FLAG_NUMBER);
 	dstate_addcmd("driver.killpower");
 
+	/* Report driver.state transitions of each poll cycle? */
+	if (dstate_getinfo("driver.flag.report_poll_state") == NULL)
+		dstate_setinfo("driver.flag.report_poll_state", "0");
+
+	dstate_setflags("driver.flag.report_poll_state", ST_FLAG_RW | ST_FLAG_NUMBER);
+
+	/* Report how many data updates of each poll cycle changed anything? */
+	if (dstate_getinfo("driver.flag.report_poll_stats") == NULL)
+		dstate_setinfo("driver.flag.report_poll_stats", "0");
+
+	dstate_setflags("driver.flag.report_poll_stats", ST_FLAG_RW | ST_FLAG_NUMBER);
+
 #ifndef WIN32
 /* TODO: Equivalent for WIN32 - see SIGCMD_RELOAD in upsd and upsmon */
 	dstate_addcmd("driver.reload");
@@ -3087,18 +3265,83 @@ sockname_ownership_finished:
 	}
 
 	while (!exit_flag) {
-		struct timeval	timeout;
+		struct timeval	start, timeout, wakeup;
+		unsigned long	changes, updates;
+		const char	*mode = NULL, *report;
+		int	report_state, report_stats;
+		long	interval_ms;
 
 		if (!dump_data) {
 			upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
 		}
 
-		gettimeofday(&timeout, NULL);
-		timeout.tv_sec += poll_interval;
+		/* Only publish the per-cycle driver.state transitions if
+		 * asked to: otherwise they are two updates every cycle to
+		 * everyone connected, for nothing */
+		report = dstate_getinfo("driver.flag.report_poll_state");
+		report_state = (report && strcmp(report, "0"));
+		report = dstate_getinfo("driver.flag.report_poll_stats");
+		report_stats = (report && strcmp(report, "0"));
+
+		gettimeofday(&start, NULL);
+		changes = dstate_datachanges();
+		updates = dstate_dataupdates();
 
-		dstate_setinfo("driver.state", "updateinfo");
+		if (report_state)
+			dstate_setinfo("driver.state", "updateinfo");
+		poll_wakeup_ms = 0;
 		upsdrv_updateinfo();
-		dstate_setinfo("driver.state", "quiet");
+		if (report_state)
+			dstate_setinfo("driver.state", "quiet");
+
+		gettimeofday(&timeout, NULL);
+		wakeup = timeout;
+		changes = dstate_datachanges() - changes;
+		updates = dstate_dataupdates() - updates;
+		interval_ms = poll_schedule(changes, &mode);
+
+		/* These are only sent out when the interval or mode
+		 * changes; the duration differs on every cycle, so it
+		 * is only reported along with the per-cycle state or
+		 * stats when asked for */
+		poll_interval_format(buf, sizeof(buf), interval_ms);
+		dstate_setinfo("driver.poll.interval", "%s", buf);
+		dstate_setinfo("driver.poll.mode", "%s", mode);
+
+		if (report_state || report_stats)
+			dstate_setinfo("driver.poll.duration", "%.3f", difftimeval(timeout, start));
+		else
+			dstate_delinfo("driver.poll.duration");
+
+		/* To see how much of a driver's work each cycle is spent
+		 * on values which did not change (and were not sent) */
+		if (report_stats) {
+			dstate_setinfo("driver.poll.changed", "%lu", changes);
+			dstate_setinfo("driver.poll.unchanged", "%lu", updates - changes);
+		} else {
+			dstate_delinfo("driver.poll.changed");
+			dstate_delinfo("driver.poll.unchanged");
+		}
+
+		/* next poll is due one interval after this one started */
+		timeout.tv_sec = start.tv_sec + interval_ms / 1000;
+		timeout.tv_usec = start.tv_usec + (interval_ms % 1000) * 1000;
+		if (timeout.tv_usec >= 1000000) {
+			timeout.tv_sec++;
+			timeout.tv_usec -= 1000000;
+		}
+
+		/* or sooner, if the driver asked for that */
+		if (poll_wakeup_ms > 0) {
+			wakeup.tv_sec += poll_wakeup_ms / 1000;
+			wakeup.tv_usec += (poll_wakeup_ms % 1000) * 1000;
+			if (wakeup.tv_usec >= 1000000) {
+				wakeup.tv_sec++;
+				wakeup.tv_usec -= 1000000;
+			}
+			if (difftimeval(wakeup, timeout) < 0)
+				timeout = wakeup;
+		}
 
 		/* Dump the data tree (in upsc-like format) to stdout and exit */
 		if (dump_data) {
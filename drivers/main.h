@@ -17,6 +17,7 @@ extern int		broken_driver, experimental_driver,
 			do_lock_port, exit_flag, handling_upsdrv_shutdown;
 extern TYPE_FD		upsfd, extrafd;
 extern time_t		poll_interval;
+extern long		poll_wakeup_ms;
 
 /* functions & variables required in each driver */
 void upsdrv_initups(void);	/* open connection to UPS, fail if not found */
@@ -29,6 +30,15 @@ void upsdrv_cleanup(void);	/* free any resources before shutdown */
 
 void set_exit_flag(int sig);
 
+#ifndef WIN32
+/* For drivers which get the data of several devices at once (see the
+ * dummy-ups repeater groups): fork a process which goes on as the
+ * driver of ups.conf section "name", with "port" as its device_path.
+ * To be called from upsdrv_initups(), before any socket is opened.
+ * Returns 0 in the new process, its PID here, or -1 on errors. */
+pid_t fork_device_driver(const char *name, const char *port);
+#endif	/* !WIN32 */
+
 /* --- details for the variable/value sharing --- */
 
 /* Try each instant command in the comma-separated list of
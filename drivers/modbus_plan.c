@@ -0,0 +1,402 @@
+/*  modbus_plan.c - coalescing of Modbus register reads for NUT drivers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "modbus_plan.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* a range of addresses requested by the driver */
+typedef struct mbplan_range_s {
+	mbplan_type_t	type;
+	int	addr;
+	int	count;
+	int	valid;		/* read successfully by the last mbplan_read() */
+	uint16_t	*data;	/* points into the data of its block */
+} mbplan_range_t;
+
+/* a read request covering one or more ranges */
+typedef struct mbplan_block_s {
+	mbplan_type_t	type;
+	int	addr;
+	int	count;
+	size_t	first;		/* index of the first range covered */
+	size_t	nranges;	/* number of ranges covered */
+	int	split;		/* device rejected the block: read by range */
+	uint16_t	*data;
+} mbplan_block_t;
+
+struct mbplan_s {
+	int	max_span[MBPLAN_NUM_TYPES];
+	int	max_gap[MBPLAN_NUM_TYPES];
+	mbplan_range_t	*ranges;	/* sorted by type and address */
+	size_t	nranges, rangesize;
+	mbplan_block_t	*blocks;
+	size_t	nblocks;
+	int	dirty;		/* ranges changed since the blocks were built */
+};
+
+static const char *mbplan_typename(mbplan_type_t type)
+{
+	static const char	*names[MBPLAN_NUM_TYPES] = {
+		"COIL", "INPUT_B", "INPUT_R", "HOLDING"
+	};
+
+	return ((int)type >= 0 && (int)type < MBPLAN_NUM_TYPES) ? names[type] : "unknown";
+}
+
+static int mbplan_protocol_span(mbplan_type_t type)
+{
+	return (type == MBPLAN_COIL || type == MBPLAN_INPUT_B)
+		? MBPLAN_MAX_READ_BITS : MBPLAN_MAX_READ_REGISTERS;
+}
+
+mbplan_t *mbplan_new(void)
+{
+	mbplan_t	*plan = xcalloc(1, sizeof(*plan));
+	int	i;
+
+	for (i = 0; i < MBPLAN_NUM_TYPES; i++)
+		mbplan_set_limits(plan, (mbplan_type_t)i, 0, 0);
+
+	return plan;
+}
+
+static void mbplan_free_blocks(mbplan_t *plan)
+{
+	size_t	i;
+
+	for (i = 0; i < plan->nblocks; i++)
+		free(plan->blocks[i].data);
+
+	free(plan->blocks);
+	plan->blocks = NULL;
+	plan->nblocks = 0;
+
+	for (i = 0; i < plan->nranges; i++) {
+		plan->ranges[i].data = NULL;
+		plan->ranges[i].valid = 0;
+	}
+}
+
+void mbplan_free(mbplan_t *plan)
+{
+	if (!plan)
+		return;
+
+	mbplan_free_blocks(plan);
+	free(plan->ranges);
+	free(plan);
+}
+
+void mbplan_set_limits(mbplan_t *plan, mbplan_type_t type, int max_span, int max_gap)
+{
+	int	limit;
+
+	if (!plan || (int)type < 0 || (int)type >= MBPLAN_NUM_TYPES)
+		return;
+
+	limit = mbplan_protocol_span(type);
+	plan->max_span[type] = (max_span > 0 && max_span < limit) ? max_span : limit;
+
+	if (max_gap > 0)
+		plan->max_gap[type] = max_gap;
+	else if (max_gap < 0)
+		plan->max_gap[type] = 0;	/* never read unneeded addresses */
+	else
+		plan->max_gap[type] = (limit == MBPLAN_MAX_READ_BITS)
+			? MBPLAN_DEFAULT_GAP_BITS : MBPLAN_DEFAULT_GAP_REGISTERS;
+
+	plan->dirty = 1;
+}
+
+/* index of the first range of 'type' not before 'addr' */
+static size_t mbplan_find(const mbplan_t *plan, mbplan_type_t type, int addr)
+{
+	size_t	lo = 0, hi = plan->nranges;
+
+	while (lo < hi) {
+		size_t	mid = lo + (hi - lo) / 2;
+		const mbplan_range_t	*r = &plan->ranges[mid];
+
+		if (r->type < type || (r->type == type && r->addr + r->count <= addr))
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+int mbplan_add(mbplan_t *plan, mbplan_type_t type, int addr, int count)
+{
+	size_t	i, j;
+	int	end;
+
+	if (!plan || (int)type < 0 || (int)type >= MBPLAN_NUM_TYPES
+	 || addr < 0 || addr > 0xFFFF || count < 1 || addr + count > 0x10000
+	 || count > mbplan_protocol_span(type)
+	) {
+		return -1;
+	}
+
+	/* first range which overlaps or follows the new one */
+	i = mbplan_find(plan, type, addr);
+	end = addr + count;
+
+	if (i < plan->nranges && plan->ranges[i].type == type
+	 && plan->ranges[i].addr <= addr && plan->ranges[i].addr + plan->ranges[i].count >= end
+	) {
+		return 0;	/* already covered */
+	}
+
+	/* merge with the ranges it overlaps, so that any requested range
+	 * is always covered by one range of the plan */
+	for (j = i; j < plan->nranges && plan->ranges[j].type == type
+	 && plan->ranges[j].addr < end; j++
+	) {
+		if (plan->ranges[j].addr < addr)
+			addr = plan->ranges[j].addr;
+		if (plan->ranges[j].addr + plan->ranges[j].count > end)
+			end = plan->ranges[j].addr + plan->ranges[j].count;
+	}
+
+	if (end - addr > mbplan_protocol_span(type))
+		return -1;
+
+	mbplan_free_blocks(plan);
+
+	if (j == i) {
+		/* insert a new range */
+		if (plan->nranges == plan->rangesize) {
+			plan->rangesize = plan->rangesize ? plan->rangesize * 2 : 16;
+			plan->ranges = xrealloc(plan->ranges, plan->rangesize * sizeof(*plan->ranges));
+		}
+		memmove(&plan->ranges[i + 1], &plan->ranges[i],
+			(plan->nranges - i) * sizeof(*plan->ranges));
+		plan->nranges++;
+	} else if (j > i + 1) {
+		/* drop the ranges merged into the first one */
+		memmove(&plan->ranges[i + 1], &plan->ranges[j],
+			(plan->nranges - j) * sizeof(*plan->ranges));
+		plan->nranges -= j - i - 1;
+	}
+
+	memset(&plan->ranges[i], 0, sizeof(plan->ranges[i]));
+	plan->ranges[i].type = type;
+	plan->ranges[i].addr = addr;
+	plan->ranges[i].count = end - addr;
+	plan->dirty = 1;
+
+	return 1;
+}
+
+size_t mbplan_build(mbplan_t *plan)
+{
+	size_t	i, j;
+
+	if (!plan)
+		return 0;
+
+	mbplan_free_blocks(plan);
+	plan->dirty = 0;
+
+	if (!plan->nranges)
+		return 0;
+
+	/* at most one block per range */
+	plan->blocks = xcalloc(plan->nranges, sizeof(*plan->blocks));
+
+	for (i = 0; i < plan->nranges; i = j) {
+		mbplan_range_t	*r = &plan->ranges[i];
+		mbplan_block_t	*b = &plan->blocks[plan->nblocks++];
+		int	end = r->addr + r->count;
+
+		b->type = r->type;
+		b->addr = r->addr;
+		b->first = i;
+
+		/* add the following ranges while the gap before them and
+		 * the resulting span of the read are within the limits */
+		for (j = i + 1; j < plan->nranges; j++) {
+			const mbplan_range_t	*next = &plan->ranges[j];
+			int	next_end = next->addr + next->count;
+
+			if (next->type != b->type
+			 || next->addr - end > plan->max_gap[b->type]
+			 || (next_end > end ? next_end : end) - b->addr > plan->max_span[b->type]
+			) {
+				break;
+			}
+
+			if (next_end > end)
+				end = next_end;
+		}
+
+		b->count = end - b->addr;
+		b->nranges = j - i;
+		b->data = xcalloc((size_t)b->count, sizeof(*b->data));
+
+		for (; i < j; i++)
+			plan->ranges[i].data = b->data + (plan->ranges[i].addr - b->addr);
+
+		upsdebugx(4, "%s: block %" PRIuSIZE ": %s %d+%d for %" PRIuSIZE " range(s)",
+			__func__, plan->nblocks - 1, mbplan_typename(b->type),
+			b->addr, b->count, b->nranges);
+	}
+
+	upsdebugx(3, "%s: %" PRIuSIZE " range(s) in %" PRIuSIZE " block read(s)",
+		__func__, plan->nranges, plan->nblocks);
+
+	return plan->nblocks;
+}
+
+size_t mbplan_nblocks(const mbplan_t *plan)
+{
+	return plan ? plan->nblocks : 0;
+}
+
+int mbplan_block(const mbplan_t *plan, size_t i, mbplan_type_t *type, int *addr, int *count)
+{
+	if (!plan || i >= plan->nblocks)
+		return -1;
+
+	if (type)
+		*type = plan->blocks[i].type;
+	if (addr)
+		*addr = plan->blocks[i].addr;
+	if (count)
+		*count = plan->blocks[i].count;
+
+	return 0;
+}
+
+int mbplan_read(mbplan_t *plan, mbplan_read_fn_t fn, void *ctx)
+{
+	size_t	i, k;
+	int	failed = 0, ret;
+
+	if (!plan || !fn)
+		return -1;
+
+	if (plan->dirty)
+		mbplan_build(plan);
+
+	mbplan_invalidate(plan);
+
+	for (i = 0; i < plan->nblocks; i++) {
+		mbplan_block_t	*b = &plan->blocks[i];
+
+		if (!b->split) {
+			ret = fn(ctx, b->type, b->addr, b->count, b->data);
+			if (ret == b->count) {
+				for (k = b->first; k < b->first + b->nranges; k++)
+					plan->ranges[k].valid = 1;
+				continue;
+			}
+
+			if (ret != MBPLAN_READ_ILLEGAL || b->nranges < 2) {
+				failed++;
+				continue;
+			}
+
+			/* the device does not like something in the gaps */
+			upsdebugx(2, "%s: %s %d+%d rejected, will read its %" PRIuSIZE
+				" ranges separately", __func__, mbplan_typename(b->type),
+				b->addr, b->count, b->nranges);
+			b->split = 1;
+		}
+
+		for (k = b->first; k < b->first + b->nranges; k++) {
+			mbplan_range_t	*r = &plan->ranges[k];
+
+			if (fn(ctx, r->type, r->addr, r->count, r->data) == r->count)
+				r->valid = 1;
+			else
+				failed++;
+		}
+	}
+
+	return failed;
+}
+
+int mbplan_get(const mbplan_t *plan, mbplan_type_t type, int addr, int count, uint16_t *dest)
+{
+	const mbplan_range_t	*r;
+	size_t	i;
+
+	if (!plan || plan->dirty || count < 1 || !dest)
+		return -1;
+
+	i = mbplan_find(plan, type, addr);
+	if (i >= plan->nranges)
+		return -1;
+
+	r = &plan->ranges[i];
+	if (r->type != type || !r->valid || !r->data
+	 || r->addr > addr || r->addr + r->count < addr + count
+	) {
+		return -1;
+	}
+
+	memcpy(dest, r->data + (addr - r->addr), (size_t)count * sizeof(*dest));
+
+	return 0;
+}
+
+void mbplan_invalidate(mbplan_t *plan)
+{
+	size_t	i;
+
+	if (!plan)
+		return;
+
+	for (i = 0; i < plan->nranges; i++)
+		plan->ranges[i].valid = 0;
+}
+
+#ifdef WITH_MODBUS
+int mbplan_modbus_read(modbus_t *mb, mbplan_type_t type, int addr, int count, uint16_t *dest)
+{
+	uint8_t	bits[MBPLAN_MAX_READ_BITS];
+	int	ret, i;
+
+	if (count < 1 || count > mbplan_protocol_span(type))
+		return -1;
+
+	if (type == MBPLAN_INPUT_R) {
+		ret = modbus_read_input_registers(mb, addr, count, dest);
+	} else if (type == MBPLAN_HOLDING) {
+		ret = modbus_read_registers(mb, addr, count, dest);
+	} else {
+		if (type == MBPLAN_COIL)
+			ret = modbus_read_bits(mb, addr, count, bits);
+		else
+			ret = modbus_read_input_bits(mb, addr, count, bits);
+
+		for (i = 0; i < ret; i++)
+			dest[i] = bits[i];
+	}
+
+	if (ret == -1 && errno == EMBXILADD)
+		return MBPLAN_READ_ILLEGAL;
+
+	return ret;
+}
+#endif	/* WITH_MODBUS */
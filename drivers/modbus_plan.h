@@ -0,0 +1,109 @@
+/*  modbus_plan.h - coalescing of Modbus register reads for NUT drivers
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/* Drivers register the address ranges they need each poll (per register
+ * type), and the plan merges them into the fewest block reads allowed by
+ * the protocol: each block stays within the maximum span of one request,
+ * and only bridges gaps of unneeded addresses up to a limit. A poll then
+ * reads all blocks with mbplan_read(), and the driver picks the values
+ * from the plan with mbplan_get() instead of a transaction per value.
+ *
+ * If a device rejects a block read as an illegal address (some do for
+ * the gaps), the plan falls back to reading the ranges of that block one
+ * by one from then on.
+ */
+
+#ifndef NUT_MODBUS_PLAN_H_SEEN
+#define NUT_MODBUS_PLAN_H_SEEN 1
+
+#include "nut_stdint.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* protocol limits of one read request (as MODBUS_MAX_READ_* in libmodbus) */
+#define MBPLAN_MAX_READ_BITS		2000
+#define MBPLAN_MAX_READ_REGISTERS	125
+
+/* default limits for gaps of unneeded addresses read along */
+#define MBPLAN_DEFAULT_GAP_BITS		128
+#define MBPLAN_DEFAULT_GAP_REGISTERS	8
+
+/* register types, in the same order as the regtype_t of the drivers */
+typedef enum mbplan_type {
+	MBPLAN_COIL = 0,
+	MBPLAN_INPUT_B,
+	MBPLAN_INPUT_R,
+	MBPLAN_HOLDING
+} mbplan_type_t;
+#define MBPLAN_NUM_TYPES	4
+
+/* Read 'count' items of 'type' from 'addr' into 'dest' (one per item,
+ * also for bits); returns the number of items read, -1 on errors, or
+ * MBPLAN_READ_ILLEGAL if the device rejected the address range */
+typedef int (*mbplan_read_fn_t)(void *ctx, mbplan_type_t type, int addr,
+	int count, uint16_t *dest);
+#define MBPLAN_READ_ILLEGAL	-2
+
+typedef struct mbplan_s mbplan_t;
+
+mbplan_t *mbplan_new(void);
+void mbplan_free(mbplan_t *plan);
+
+/* maximum span of one block read (capped to the protocol limit) and
+ * the largest gap to read along, for a register type; 0 for defaults */
+void mbplan_set_limits(mbplan_t *plan, mbplan_type_t type, int max_span, int max_gap);
+
+/* request a range of addresses to be read every poll; returns 1 if
+ * it was added, 0 if it was already covered, -1 if invalid */
+int mbplan_add(mbplan_t *plan, mbplan_type_t type, int addr, int count);
+
+/* (re)compute the block reads, also done by mbplan_read() as needed;
+ * returns the number of block reads */
+size_t mbplan_build(mbplan_t *plan);
+
+/* for debugging and tests: the computed block reads */
+size_t mbplan_nblocks(const mbplan_t *plan);
+int mbplan_block(const mbplan_t *plan, size_t i, mbplan_type_t *type, int *addr, int *count);
+
+/* read all blocks; returns the number of failed reads (0 if all good) */
+int mbplan_read(mbplan_t *plan, mbplan_read_fn_t fn, void *ctx);
+
+/* copy values from the last mbplan_read(): returns 0 if the range was
+ * requested and read successfully, -1 if not */
+int mbplan_get(const mbplan_t *plan, mbplan_type_t type, int addr, int count, uint16_t *dest);
+
+/* forget the values read, e.g. at the end of a poll */
+void mbplan_invalidate(mbplan_t *plan);
+
+#ifdef WITH_MODBUS
+#include <modbus.h>
+
+/* a mbplan_read_fn_t-like reader for a libmodbus context */
+int mbplan_modbus_read(modbus_t *mb, mbplan_type_t type, int addr, int count, uint16_t *dest);
+#endif	/* WITH_MODBUS */
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_MODBUS_PLAN_H_SEEN */
@@ -58,7 +58,7 @@
 #	define DRIVER_NAME	"Generic Q* Serial driver"
 #endif	/* QX_USB */
 
-#define DRIVER_VERSION	"0.44"
+#define DRIVER_VERSION	"0.45"
 
 #ifdef QX_SERIAL
 #	include "serial.h"
@@ -66,6 +66,7 @@
 #endif	/* QX_SERIAL */
 
 #include "nutdrv_qx.h"
+#include "nutdrv_qx_cache.h"
 
 /* == Subdrivers == */
 /* Include all known subdrivers */
@@ -157,11 +158,6 @@ static int	hunnox_step = 0;
 static int	is_usb = 0;	/* Whether the device is connected through USB (1) or serial (0) */
 #endif	/* QX_USB && QX_SERIAL */
 
-static struct {
-	char	command[SMALLBUF];	/* Command sent to the UPS to get answer/to execute an instant command */
-	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
-} previous_item = { "", "" };	/* Hold the values of the item processed just before the actual one */
-
 
 /* == Support functions == */
 static int	subdriver_matcher(void);
@@ -4022,6 +4018,8 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 {
 	item_t	*item;
 	int	retcode;
+	const char	*cached_answer;
+	size_t	queries_sent = 0, queries_saved = 0;
 
 	/* Clear batt.{chrg,runt}.act for guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE) {
@@ -4030,9 +4028,8 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 		battery_voltage_reports_one_pack_considered = 0;
 	}
 
-	/* Clear data from previous_item */
-	memset(previous_item.command, 0, sizeof(previous_item.command));
-	memset(previous_item.answer, 0, sizeof(previous_item.answer));
+	/* Forget answers got during the previous walk */
+	qx_answer_cache_clear();
 
 	/* 3 modes: QX_WALKMODE_INIT, QX_WALKMODE_QUICK_UPDATE
 	 *      and QX_WALKMODE_FULL_UPDATE */
@@ -4151,31 +4148,34 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 		}
 
-		/* Check whether the previous item uses the same command
-		 * and then use its answer, if available.. */
-		if (strlen(previous_item.command) > 0
-		&&  strlen(previous_item.answer) > 0
-		&&  !strcasecmp(previous_item.command, item->command)
-		) {
+		/* Check whether an item already processed during this walk
+		 * used the same command and then use its answer, if available.. */
+		cached_answer = qx_answer_cache_get(item);
+		if (cached_answer) {
 
 			snprintf(item->answer, sizeof(item->answer), "%s",
-				previous_item.answer);
+				cached_answer);
 
 			/* Process the answer */
 			retcode = qx_process_answer(item, strlen(item->answer));
 
+			queries_saved++;
+
 		/* ..otherwise: execute command to get answer from the UPS */
 		} else {
 
 			retcode = qx_process(item, NULL);
 
-		}
+			/* Remember the answer for the next items,
+			 * unless the UPS failed to give a good one */
+			if (retcode)
+				qx_answer_cache_drop(item);
+			else
+				qx_answer_cache_put(item);
+
+			queries_sent++;
 
-		/* Record item as previous_item */
-		snprintf(previous_item.command, sizeof(previous_item.command), "%s",
-			item->command);
-		snprintf(previous_item.answer, sizeof(previous_item.answer), "%s",
-			item->answer);
+		}
 
 		if (retcode) {
 
@@ -4221,6 +4221,9 @@ static bool_t	qx_ups_walk(walkmode_t mode)
 
 	}
 
+	upsdebugx(3, "%s: %" PRIuSIZE " queries sent to the UPS, %" PRIuSIZE " answered from cache",
+		__func__, queries_sent, queries_saved);
+
 	/* Update battery guesstimation */
 	if (mode == QX_WALKMODE_FULL_UPDATE
 	&&  (d_equal(batt.runt.act, -1) || d_equal(batt.chrg.act, -1))
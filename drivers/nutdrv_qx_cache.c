@@ -0,0 +1,122 @@
+/* nutdrv_qx_cache.c - Answers kept during a walk of nutdrv_qx items
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "common.h"
+#include "nutdrv_qx.h"
+#include "nutdrv_qx_cache.h"
+
+/* Answers already received from the UPS during the current walk, keyed by
+ * command (and answer preprocessing function, since the answer is stored
+ * already preprocessed), so that items using the same command need not be
+ * adjacent in the qx2nut table to share a single query to the device.
+ * Entries are kept oldest first, so the first one goes when it is full. */
+static struct {
+	char	command[SMALLBUF];	/* Command sent to the UPS to get answer */
+	int	(*preprocess_answer)(item_t *item, const int len);	/* Function used to preprocess the answer, if any */
+	char	answer[SMALLBUF];	/* Answer from the UPS, filled at runtime */
+} answer_cache[QX_ANSWER_CACHE_SIZE];
+static size_t	answer_cache_used = 0;	/* Number of valid entries in answer_cache */
+
+/* Index of the entry kept for item's command, or -1 if none */
+static int	answer_cache_find(const item_t *item)
+{
+	size_t	i;
+
+	if (!item->command)
+		return -1;
+
+	for (i = 0; i < answer_cache_used; i++) {
+
+		if (answer_cache[i].preprocess_answer != item->preprocess_answer)
+			continue;
+
+		if (strcasecmp(answer_cache[i].command, item->command))
+			continue;
+
+		return (int)i;
+
+	}
+
+	return -1;
+}
+
+void	qx_answer_cache_clear(void)
+{
+	answer_cache_used = 0;
+}
+
+/* Forget entry i, keeping the others in their order */
+static void	answer_cache_remove(size_t i)
+{
+	answer_cache_used--;
+	memmove(&answer_cache[i], &answer_cache[i + 1],
+		(answer_cache_used - i) * sizeof(answer_cache[0]));
+}
+
+const char	*qx_answer_cache_get(const item_t *item)
+{
+	int	i = answer_cache_find(item);
+
+	if (i < 0)
+		return NULL;
+
+	return answer_cache[i].answer;
+}
+
+void	qx_answer_cache_put(const item_t *item)
+{
+	int	i;
+
+	if (!item->command || strlen(item->command) >= sizeof(answer_cache[0].command))
+		return;
+
+	if (!strlen(item->answer)) {
+		qx_answer_cache_drop(item);
+		return;
+	}
+
+	/* A new answer to the same command replaces the one kept */
+	i = answer_cache_find(item);
+
+	if (i < 0) {
+		if (answer_cache_used == QX_ANSWER_CACHE_SIZE)
+			answer_cache_remove(0);
+		i = (int)answer_cache_used++;
+		snprintf(answer_cache[i].command, sizeof(answer_cache[i].command), "%s",
+			item->command);
+		answer_cache[i].preprocess_answer = item->preprocess_answer;
+	}
+
+	snprintf(answer_cache[i].answer, sizeof(answer_cache[i].answer), "%s",
+		item->answer);
+}
+
+void	qx_answer_cache_drop(const item_t *item)
+{
+	int	i = answer_cache_find(item);
+
+	if (i < 0)
+		return;
+
+	answer_cache_remove((size_t)i);
+}
+
+size_t	qx_answer_cache_count(void)
+{
+	return answer_cache_used;
+}
@@ -0,0 +1,45 @@
+/* nutdrv_qx_cache.h - Answers kept during a walk of nutdrv_qx items
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#ifndef NUTDRV_QX_CACHE_H
+#define NUTDRV_QX_CACHE_H
+
+#include "nutdrv_qx.h"
+
+/* Max number of distinct commands whose answers are kept during a single walk */
+#define QX_ANSWER_CACHE_SIZE	16
+
+/* Forget all the answers (at the start of a walk) */
+void	qx_answer_cache_clear(void);
+
+/* Answer (already preprocessed) got earlier in the walk for item's command
+ * and preprocess_answer() function, or NULL if none */
+const char	*qx_answer_cache_get(const item_t *item);
+
+/* Remember item's answer for the next items, replacing the one kept for
+ * the same command if any; when the cache is full, the oldest entry is
+ * replaced. An empty answer just forgets the one kept. */
+void	qx_answer_cache_put(const item_t *item);
+
+/* Forget the answer kept for item's command (e.g. when its query failed) */
+void	qx_answer_cache_drop(const item_t *item);
+
+/* Number of answers currently kept */
+size_t	qx_answer_cache_count(void);
+
+#endif	/* NUTDRV_QX_CACHE_H */
@@ -22,6 +22,7 @@
  */
 
 #include "main.h"
+#include "modbus_plan.h"
 #include <modbus.h>
 #include "nut_stdint.h"
 
@@ -30,7 +31,7 @@
 #endif
 
 #define DRIVER_NAME	"NUT PhoenixContact Modbus driver (libmodbus link type: " NUT_MODBUS_LINKTYPE_STR ")"
-#define DRIVER_VERSION	"0.08"
+#define DRIVER_VERSION	"0.09"
 
 #define CHECK_BIT(var,pos) ((var) & (1<<(pos)))
 #define MODBUS_SLAVE_ID 192
@@ -83,6 +84,13 @@ static int errcount = 0;
 
 static int mrir(modbus_t * arg_ctx, int addr, int nb, uint16_t * dest);
 
+/* Input registers read by upsdrv_updateinfo(): learned from what mrir()
+ * reads there, then read in as few blocks as possible when it starts */
+static mbplan_t *mbplan = NULL;
+static int in_update = 0;
+
+static int plan_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *dest);
+
 static models UPSModel = NONE;
 
 /*
@@ -232,6 +240,11 @@ void upsdrv_updateinfo(void)
 
 	upsdebugx(2, "upsdrv_updateinfo");
 
+	if (!mbplan)
+		mbplan = mbplan_new();
+	mbplan_read(mbplan, plan_read, NULL);
+	in_update = 1;
+
 	switch (UPSModel)
 	{
 	case QUINT4_UPS:
@@ -624,6 +637,9 @@ void upsdrv_updateinfo(void)
 #endif
 	}
 
+	in_update = 0;
+	mbplan_invalidate(mbplan);
+
 	if (errcount == 0) {
 		alarm_commit();
 		status_commit();
@@ -732,16 +748,40 @@ void upsdrv_cleanup(void)
 		modbus_close(modbus_ctx);
 		modbus_free(modbus_ctx);
 	}
+	mbplan_free(mbplan);
+	mbplan = NULL;
 }
 
 /* Modbus Read Input Registers */
 static int mrir(modbus_t * arg_ctx, int addr, int nb, uint16_t * dest)
 {
 	int r;
+
+	/* during updates, use what the plan has read at the start */
+	if (in_update && mbplan_get(mbplan, MBPLAN_INPUT_R, addr, nb, dest) == 0)
+		return nb;
+
 	r = modbus_read_input_registers(arg_ctx, addr, nb, dest);
 	if (r == -1) {
 		upslogx(LOG_ERR, "mrir: modbus_read_input_registers(addr:%d, count:%d): %s (%s)", addr, nb, modbus_strerror(errno), device_path);
 		errcount++;
+	} else if (in_update) {
+		/* read it along with the others next time */
+		mbplan_add(mbplan, MBPLAN_INPUT_R, addr, nb);
+	}
+	return r;
+}
+
+/* Block reads for the plan; on errors mrir() tries the single reads */
+static int plan_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *dest)
+{
+	int r;
+
+	NUT_UNUSED_VARIABLE(ctx);
+
+	r = mbplan_modbus_read(modbus_ctx, type, addr, count, dest);
+	if (r < 0) {
+		upsdebugx(2, "plan_read(addr:%d, count:%d): %s", addr, count, modbus_strerror(errno));
 	}
 	return r;
 }
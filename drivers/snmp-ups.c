@@ -176,8 +176,15 @@ alarms_info_t *alarms_info;
 static const char *mibname;
 static const char *mibvers;
 
+/* Index for su_find_info(): an open addressing hash table pointing to the
+ * first snmp_info entry of each (case-insensitive) NUT name, built for the
+ * snmp_info array it was last called with */
+static snmp_info_t **su_info_index = NULL;
+static size_t su_info_index_size = 0;
+static snmp_info_t *su_info_indexed = NULL;
+
 #define DRIVER_NAME	"Generic SNMP UPS driver"
-#define DRIVER_VERSION	"1.35"
+#define DRIVER_VERSION	"1.36"
 
 /* driver description structure */
 upsdrv_info_t	upsdrv_info = {
@@ -786,6 +793,10 @@ void upsdrv_cleanup(void)
 	if (daisychain_info)
 		free(daisychain_info);
 
+	free(su_info_index);
+	su_info_index = NULL;
+	su_info_indexed = NULL;
+
 	/* Net-SNMP specific cleanup */
 	nut_snmp_cleanup();
 }
@@ -1819,10 +1830,49 @@ void su_alarm_set(snmp_info_t *su_info_p, long value)
 	/* TODO: else */
 }
 
+/* (re)build the su_find_info() index for the current snmp_info */
+static void su_info_index_build(void)
+{
+	snmp_info_t *su_info_p;
+	size_t	num = 0, size, pos;
+
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++)
+		num++;
+
+	/* keep it at most half full, so that probe sequences stay short */
+	for (size = 64; size < num * 2; size *= 2)
+		;
+
+	free(su_info_index);
+	su_info_index = xcalloc(size, sizeof(*su_info_index));
+	su_info_index_size = size;
+
+	/* several entries may map the same name (e.g. with alternate
+	 * OIDs): like the linear search did, only the first one is found */
+	for (su_info_p = &snmp_info[0]; su_info_p->info_type != NULL; su_info_p++) {
+		pos = (size_t)str_hash_nocase(su_info_p->info_type) & (size - 1);
+
+		while (su_info_index[pos] != NULL
+		&&  strcasecmp(su_info_index[pos]->info_type, su_info_p->info_type)
+		) {
+			pos = (pos + 1) & (size - 1);
+		}
+
+		if (su_info_index[pos] == NULL)
+			su_info_index[pos] = su_info_p;
+	}
+
+	su_info_indexed = snmp_info;
+
+	upsdebugx(2, "%s: indexed %" PRIuSIZE " mapping entries in %" PRIuSIZE " slots",
+		__func__, num, size);
+}
+
 /* find info element definition in my info array. */
 snmp_info_t *su_find_info(const char *type)
 {
 	snmp_info_t *su_info_p;
+	size_t	pos;
 
 	if (snmp_info == NULL) {
 		fatalx(EXIT_FAILURE, "%s: snmp_info is not initialized", __func__);
@@ -1832,11 +1882,19 @@ snmp_info_t *su_find_info(const char *type)
 		upsdebugx(1, "%s: WARNING: snmp_info is empty", __func__);
 	}
 
-	for (su_info_p = &snmp_info[0]; (su_info_p != NULL && su_info_p->info_type != NULL) ; su_info_p++)
+	/* load_mib2nut() tries the candidate MIBs in turn */
+	if (snmp_info != su_info_indexed)
+		su_info_index_build();
+
+	for (pos = (size_t)str_hash_nocase(type) & (su_info_index_size - 1);
+		(su_info_p = su_info_index[pos]) != NULL;
+		pos = (pos + 1) & (su_info_index_size - 1)
+	) {
 		if (!strcasecmp(su_info_p->info_type, type)) {
 			upsdebugx(3, "%s: \"%s\" found", __func__, type);
 			return su_info_p;
 		}
+	}
 
 	upsdebugx(3, "%s: unknown info type (%s)", __func__, type);
 	return NULL;
@@ -2493,6 +2551,7 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 	/* Needed *2 to fit a max size_t in snprintf() below,
 	 * even if that should never happen */
 	char tmp_buf[SU_INFOSIZE];
+	const char *template_count_str;
 
 	upsdebugx(1, "%s template definition found (%s)...", type, su_info_p->info_type);
 
@@ -2502,7 +2561,7 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 		snprintf(template_count_var, sizeof(template_count_var), "%s.count", type);
 	}
 
-	if(dstate_getinfo(template_count_var) == NULL) {
+	if ((template_count_str = dstate_getinfo(template_count_var)) == NULL) {
 		/* FIXME: should we disable it?
 		 * su_info_p->flags &= ~SU_FLAG_OK;
 		 * or rely on guesstimation? */
@@ -2513,7 +2572,7 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 		}
 	}
 	else {
-		template_count = atoi(dstate_getinfo(template_count_var));
+		template_count = atoi(template_count_str);
 	}
 	upsdebugx(1, "%i instances found...", template_count);
 
@@ -2522,6 +2581,13 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 		/* general init of data using the template */
 		instantiate_info(su_info_p, &cur_info_p);
 
+		/* a templated default value gets one buffer, reused by all
+		 * the instances (and freed below) */
+		if ((cur_info_p.dfl != NULL) &&
+			(strstr(su_info_p->dfl, "%i") != NULL)) {
+			cur_info_p.dfl = (char *)xmalloc(SU_INFOSIZE);
+		}
+
 		base_snmp_index = base_snmp_template_index(su_info_p);
 
 		for (cur_template_number = base_snmp_index ;
@@ -2628,7 +2694,6 @@ static bool_t process_template(int mode, const char* type, snmp_info_t *su_info_
 			/* check if default value is also a template */
 			if ((cur_info_p.dfl != NULL) &&
 				(strstr(su_info_p->dfl, "%i") != NULL)) {
-				cur_info_p.dfl = (char *)xmalloc(SU_INFOSIZE);
 				snprintf_dynamic((char *)cur_info_p.dfl, SU_INFOSIZE, su_info_p->dfl, "%i", cur_nut_index);
 			}
 
@@ -376,6 +376,52 @@ void USBFreeRegexMatcher(USBDeviceMatcher_t *matcher)
 	free(matcher);
 }
 
+/* Check a device against the exact and regex matchers in the chain by
+ * the fields which are known before it is opened: VendorID, ProductID
+ * and its place on the bus. The strings (Vendor, Product, Serial) and
+ * the other (driver-specific) matchers are left for the complete match
+ * after opening the device.
+ */
+int USBMatchUnopened(USBDeviceMatcher_t *matcher, USBDevice_t *hd)
+{
+	USBDeviceMatcher_t	*m;
+	USBDevice_t	*exact;
+	regex_matcher_data_t	*data;
+
+	for (m = matcher; m; m = m->next) {
+		if (m->match_function == &match_function_exact) {
+			exact = (USBDevice_t *)m->privdata;
+
+			if (hd->VendorID != exact->VendorID
+			 || hd->ProductID != exact->ProductID
+			) {
+				return 0;
+			}
+
+			continue;
+		}
+
+		if (m->match_function != &match_function_regex) {
+			continue;
+		}
+
+		data = (regex_matcher_data_t *)m->privdata;
+
+		if (match_regex_hex(data->regex[0], hd->VendorID) == 0
+		 || match_regex_hex(data->regex[1], hd->ProductID) == 0
+		 || match_regex(data->regex[5], hd->Bus) == 0
+		 || match_regex(data->regex[6], hd->Device) == 0
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+		 || match_regex(data->regex[7], hd->BusPort) == 0
+#endif
+		) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
 void warn_if_bad_usb_port_filename(const char *fn) {
 	/* USB drivers ignore the 'port' setting - log a notice
 	 * if it is not "auto". Note: per se, ignoring the port
@@ -533,6 +533,11 @@ int USBNewRegexMatcher(USBDeviceMatcher_t **matcher, char **regex, int cflags);
 void USBFreeExactMatcher(USBDeviceMatcher_t *matcher);
 void USBFreeRegexMatcher(USBDeviceMatcher_t *matcher);
 
+/* Returns 0 if the exact or regex matchers in the chain already reject
+ * the device by its VendorID, ProductID, Bus, Device or BusPort, so it
+ * need not be opened to read its strings; 1 if it may still match. */
+int USBMatchUnopened(USBDeviceMatcher_t *matcher, USBDevice_t *hd);
+
 /* dummy USB function and macro, inspired from the Linux kernel
  * this allows USB information extraction */
 #define USB_DEVICE(vendorID, productID)	vendorID, productID
@@ -474,6 +474,24 @@ void upslog_with_errno(int priority, const char *fmt, ...)
 void upslogx(int priority, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
 
+/* Optionally hand the formatted upslog*() and upsdebug*() messages over
+ * to a background thread which writes them to syslog and/or stderr, so
+ * a slow consumer of those does not stall the caller. The ring buffer
+ * has "slots" messages (0 for default); when it is full, messages are
+ * dropped and counted. Fatal messages are written synchronously after
+ * the queued ones. Started by the NUT_LOG_ASYNC envvar, or explicitly;
+ * returns -1 if not supported on the platform (logging stays sync). */
+int upslog_async_start(size_t slots);
+/* Write out the queued messages and log synchronously from now on */
+void upslog_async_stop(void);
+size_t upslog_async_dropped(void);
+
+/* Let through at most this many messages per second from each place in
+ * the code that logs (0 to disable, the default; NUT_LOG_RATELIMIT envvar);
+ * the next message let through tells how many similar ones were dropped */
+void upslog_set_ratelimit(unsigned int per_second);
+size_t upslog_ratelimit_suppressed(void);
+
 /* upsdebug*() messages are only logged if debugging
  * level is high enough. To speed up a bit (minimize
  * passing of ultimately ignored data trough the stack)
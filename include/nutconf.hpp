@@ -1661,8 +1661,8 @@ public:
 	void parseFromString(const std::string& str);
 
 	Settable<int> debugMin;
-	Settable<unsigned int> maxAge, maxConn, trackingDelay, certRequestLevel;
-	Settable<std::string>  statePath, certFile, certPath;
+	Settable<unsigned int> maxAge, maxConn, trackingDelay, maxConcurrentDumps, certRequestLevel;
+	Settable<std::string>  statePath, statsSocket, certFile, certPath;
 	Settable<bool> allowNoDevice, allowNotAllListeners, disableWeakSsl;
 
 	struct Listen
@@ -2058,6 +2058,8 @@ public:
 	inline bool getNoWarnNoImp(const std::string & ups)    const { return getFlag(ups, "nowarn_noimp"); }
 	inline bool getOldMAC(const std::string & ups)         const { return getFlag(ups, "oldmac"); }
 	inline bool getPollOnly(const std::string & ups)       const { return getFlag(ups, "pollonly"); }
+	inline bool getReportPollState(const std::string & ups) const { return getFlag(ups, "report_poll_state"); }
+	inline bool getSharedMem(const std::string & ups)      const { return getFlag(ups, "sharedmem"); }
 	inline bool getSilent(const std::string & ups)         const { return getFlag(ups, "silent"); }
 	inline bool getStatusOnly(const std::string & ups)     const { return getFlag(ups, "status_only"); }
 	inline bool getSubscribe(const std::string & ups)      const { return getFlag(ups, "subscribe"); }
@@ -2305,6 +2307,8 @@ public:
 	inline void setNoWarnNoImp(const std::string & ups, bool set = true)    { setFlag(ups, "nowarn_noimp",   set); }
 	inline void setOldMAC(const std::string & ups, bool set = true)         { setFlag(ups, "oldmac",         set); }
 	inline void setPollOnly(const std::string & ups, bool set = true)       { setFlag(ups, "pollonly",       set); }
+	inline void setReportPollState(const std::string & ups, bool set = true) { setFlag(ups, "report_poll_state", set); }
+	inline void setSharedMem(const std::string & ups, bool set = true)      { setFlag(ups, "sharedmem",      set); }
 	inline void setSilent(const std::string & ups, bool set = true)         { setFlag(ups, "silent",         set); }
 	inline void setStatusOnly(const std::string & ups, bool set = true)     { setFlag(ups, "status_only",    set); }	// aka OPTI_MINPOLL
 	inline void setSubscribe(const std::string & ups, bool set = true)      { setFlag(ups, "subscribe",      set); }
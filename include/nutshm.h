@@ -0,0 +1,116 @@
+/* nutshm.h - Network UPS Tools shared memory export of driver data
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* Drivers started with the "sharedmem" flag publish a copy of their data
+ * tree into a file named like their socket with a ".shm" suffix in the
+ * state path, which co-located readers can map to take snapshots of the
+ * current values without going through the socket protocol.
+ *
+ * The file starts with a nutshm_header_t followed by the data area with
+ * "name\0value\0" records (values are raw, not escaped). The writer bumps
+ * the sequence counter to an odd value before changing anything, and to
+ * the next even value after that; readers copy the data and retry if the
+ * counter was odd or changed meanwhile (a "seqlock"). When the data grows
+ * beyond the file size, the writer replaces the file and marks the old
+ * one obsolete, so the readers re-open it.
+ *
+ * The reader side is exported by libupsclient for programs outside NUT;
+ * the writer side is only for the drivers.
+ */
+
+#ifndef NUT_SHM_H_SEEN
+#define NUT_SHM_H_SEEN 1
+
+/* Not including nut_stdint.h because this is part of end-user API
+ * (in NUT sources, common.h has already brought it in) */
+#if defined HAVE_STDINT_H || !defined NUT_NETVERSION
+#	include <stdint.h>
+#endif
+
+#include <stddef.h>
+#include <time.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+#define NUTSHM_MAGIC	"NUTSHM1"
+#define NUTSHM_VERSION	1
+#define NUTSHM_SUFFIX	".shm"
+
+/* header flags */
+#define NUTSHM_FLAG_STALE	0x0001	/* driver says data is stale */
+#define NUTSHM_FLAG_OBSOLETE	0x0002	/* file was replaced, re-open it */
+
+typedef struct nutshm_header_s {
+	char		magic[8];	/* NUTSHM_MAGIC */
+	uint32_t	version;	/* NUTSHM_VERSION */
+	uint32_t	flags;		/* NUTSHM_FLAG_* */
+	uint64_t	seq;		/* odd while the data is being written */
+	uint64_t	size;		/* of the whole file */
+	uint64_t	datalen;	/* bytes used in the data area */
+	uint64_t	count;		/* number of records in the data area */
+	int64_t		updated;	/* time() of the last update */
+} nutshm_header_t;
+
+typedef struct nutshm_writer_s nutshm_writer_t;
+typedef struct nutshm_reader_s nutshm_reader_t;
+
+/* a consistent copy of the data, owned by the caller */
+typedef struct nutshm_snapshot_s {
+	char		*buf;		/* "name\0value\0" records */
+	size_t		buflen;		/* bytes used */
+	size_t		bufsize;	/* bytes allocated */
+	size_t		count;		/* number of records */
+	uint32_t	flags;		/* NUTSHM_FLAG_* at the time of the copy */
+	time_t		updated;	/* when the driver published it */
+	uint64_t	seq;		/* sequence number it was taken at */
+	uint64_t	mapgen;		/* ...in which file the reader mapped */
+} nutshm_snapshot_t;
+
+/* writer side, for drivers; the file gets the group ownership of refpath
+ * (the driver socket) if specified */
+struct st_tree_s;
+nutshm_writer_t *nutshm_writer_open(const char *path, const char *refpath);
+int nutshm_writer_publish(nutshm_writer_t *w, const struct st_tree_s *root, int stale);
+void nutshm_writer_close(nutshm_writer_t *w);
+
+/* reader side: open by file name, or by driver and device name
+ * in the default state path (see dflt_statepath()) */
+nutshm_reader_t *nutshm_reader_open(const char *path);
+nutshm_reader_t *nutshm_reader_open_ups(const char *drvname, const char *upsname);
+void nutshm_reader_close(nutshm_reader_t *r);
+
+/* take a snapshot; returns 1 if it was updated, 0 if the data did not
+ * change since the snapshot passed in was taken, or -1 on errors */
+int nutshm_reader_snapshot(nutshm_reader_t *r, nutshm_snapshot_t *snap);
+
+/* walk the snapshot: start with *pos = 0, returns 0 at the end */
+int nutshm_snapshot_next(const nutshm_snapshot_t *snap, size_t *pos,
+	const char **name, const char **value);
+const char *nutshm_snapshot_get(const nutshm_snapshot_t *snap, const char *name);
+void nutshm_snapshot_free(nutshm_snapshot_t *snap);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif /* NUT_SHM_H_SEEN */
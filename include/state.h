@@ -41,7 +41,7 @@ typedef struct timeval	st_tree_timespec_t;
 #endif
 
 typedef struct st_tree_s {
-	char	*var;
+	char	*var;			/* interned, shared with other trees */
 	char	*val;			/* points to raw or safe */
 
 	char	*raw;			/* raw data from caller */
@@ -53,12 +53,26 @@ typedef struct st_tree_s {
 	int	flags;
 	long	aux;
 
+	/* The number the value was last set from by state_setinfo_number(),
+	 * and the digits shown after its decimal point (-1 if the value was
+	 * last set as a string), so that the same number is not formatted
+	 * and compared again */
+	double	numval;
+	int	numprec;
+
 	/* When was this entry last written (meaning that
 	 * val/raw/safe, flags, aux, enum or range value
 	 * was added, changed or deleted)?
 	 */
 	st_tree_timespec_t	lastset;
 
+	/* When was this entry last actually changed (meaning that
+	 * val/raw/safe, flags, aux were changed, or an enum or range
+	 * value was added)? Unlike lastset, this is not refreshed
+	 * when the same value is written again.
+	 */
+	st_tree_timespec_t	lastchanged;
+
 	struct enum_s		*enum_list;
 	struct range_s		*range_list;
 
@@ -68,7 +82,10 @@ typedef struct st_tree_s {
 
 int state_get_timestamp(st_tree_timespec_t *now);
 int st_tree_node_compare_timestamp(const st_tree_t *node, const st_tree_timespec_t *cutoff);
+int st_tree_node_compare_changed(const st_tree_t *node, const st_tree_timespec_t *cutoff);
+int st_tree_node_mark_changed(st_tree_t *node);
 int state_setinfo(st_tree_t **nptr, const char *var, const char *val);
+int state_setinfo_number(st_tree_t **nptr, const char *var, double val, int prec);
 int state_addenum(st_tree_t *root, const char *var, const char *val);
 int state_addrange(st_tree_t *root, const char *var, const int min, const int max);
 int state_setaux(st_tree_t *root, const char *var, const char *auxs);
@@ -88,6 +105,9 @@ int state_delenum(st_tree_t *root, const char *var, const char *val);
 int state_delrange(st_tree_t *root, const char *var, const int min, const int max);
 st_tree_t *state_tree_find(st_tree_t *node, const char *var);
 
+/* number of distinct variable and command names currently in use */
+size_t state_names_count(void);
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 }
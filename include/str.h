@@ -23,6 +23,8 @@
 #ifndef NUT_STR_H_SEEN
 #define NUT_STR_H_SEEN 1
 
+#include "nut_stdint.h"
+
 #ifdef __cplusplus
 /* *INDENT-OFF* */
 extern "C" {
@@ -135,6 +137,11 @@ int	str_to_double_strict(const char *string, double *number, const int base);
  */
 int	str_ends_with(const char *s, const char *suff);
 
+/* Hash (FNV-1a) of a null-terminated string, ignoring the case of its
+ * ASCII letters: strings equal by strcasecmp() hash the same, so it
+ * suits hash tables of names which are compared that way */
+uint32_t	str_hash_nocase(const char *s);
+
 #ifndef HAVE_STRSEP
 /* Makefile should add the implem to libcommon(client).la */
 char *strsep(char **stringp, const char *delim);
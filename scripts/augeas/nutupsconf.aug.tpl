@@ -38,6 +38,8 @@ let ups_global   = "chroot"
                  | "nowait"
                  | "retrydelay"
                  | "pollinterval"
+                 | "pollinterval_fast"
+                 | "pollinterval_max"
                  | "synchronous"
                  | "user"
                  | "group"
@@ -54,6 +56,9 @@ let ups_fields   = "driver"
                  | "desc"
                  | "nolock"
                  | "ignorelb"
+                 | "sharedmem"
+                 | "report_poll_state"
+                 | "report_poll_stats"
                  | "maxstartdelay"
                  | "synchronous"
                  | "user"
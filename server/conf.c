@@ -23,6 +23,7 @@
 #include "sstate.h"
 #include "user.h"
 #include "netssl.h"
+#include "stats.h"
 #include "nut_stdint.h"
 #include <ctype.h>
 
@@ -41,6 +42,9 @@ int	nut_debug_level_global = -1;
  */
 int nut_debug_level_args = 0;
 
+/* what the current reload changed, for its summary */
+static int	ups_added = 0, ups_changed = 0, ups_removed = 0;
+
 /* add another UPS for monitoring from ups.conf */
 static void ups_create(const char *fn, const char *name, const char *desc)
 {
@@ -77,7 +81,16 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 		return;
 	}
 #endif	/* WIN32 */
-	temp->sock_fd = sstate_connect(temp);
+	if (max_concurrent_dumps > 0
+	 && sstate_dumps_in_progress() >= (size_t)max_concurrent_dumps
+	) {
+		/* the main loop would connect later */
+		upsdebugx(1, "%s: UPS [%s] will connect after other drivers finish their dumps",
+			__func__, name);
+		temp->sock_fd = ERROR_FD;
+	} else {
+		temp->sock_fd = sstate_connect(temp);
+	}
 
 	/* preload this to the current time to avoid false staleness */
 	time(&temp->last_heard);
@@ -85,23 +98,18 @@ static void ups_create(const char *fn, const char *name, const char *desc)
 	temp->next = firstups;
 	firstups = temp;
 	num_ups++;
+	ups_added++;
 }
 
-/* change the configuration of an existing UPS (used during reloads) */
-static void ups_update(const char *fn, const char *name, const char *desc)
+/* change the configuration of an existing UPS (used during reloads),
+ * an entry whose settings are the same is left alone */
+static void ups_update(upstype_t *temp, const char *fn, const char *desc)
 {
-	upstype_t	*temp;
-
-	temp = get_ups_ptr(name);
-
-	if (!temp) {
-		upslogx(LOG_ERR, "UPS %s disappeared during reload", name);
-		return;
-	}
+	int	changed = 0;
 
 	/* paranoia */
 	if (!temp->fn) {
-		upslogx(LOG_ERR, "UPS %s had a NULL filename!", name);
+		upslogx(LOG_ERR, "UPS %s had a NULL filename!", temp->name);
 
 		/* let's give it something quick to use later */
 		temp->fn = xstrdup("");
@@ -110,11 +118,12 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 	/* when the filename changes, force a reconnect */
 	if (strcmp(temp->fn, fn) != 0) {
 
-		upslogx(LOG_NOTICE, "Redefined UPS [%s]", name);
+		upslogx(LOG_NOTICE, "Redefined UPS [%s]", temp->name);
 
 		/* release all data */
 		sstate_infofree(temp);
 		sstate_cmdfree(temp);
+		sstate_genfree(temp);
 		pconf_finish(&temp->sock_ctx);
 
 #ifndef WIN32
@@ -128,16 +137,23 @@ static void ups_update(const char *fn, const char *name, const char *desc)
 		/* now redefine the filename and wrap up */
 		free(temp->fn);
 		temp->fn = xstrdup(fn);
+		changed = 1;
 	}
 
 	/* update the description */
+	if ((!desc) != (!temp->desc) || (desc && strcmp(temp->desc, desc))) {
+		free(temp->desc);
 
-	free(temp->desc);
+		if (desc)
+			temp->desc = xstrdup(desc);
+		else
+			temp->desc = NULL;
 
-	if (desc)
-		temp->desc = xstrdup(desc);
-	else
-		temp->desc = NULL;
+		changed = 1;
+	}
+
+	if (changed)
+		ups_changed++;
 
 	/* always set this on reload */
 	temp->retain = 1;
@@ -202,6 +218,18 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		}
 	}
 
+	/* MAXCONCURRENTDUMPS <count> */
+	if (!strcmp(arg[0], "MAXCONCURRENTDUMPS")) {
+		if (isdigit((size_t)arg[1][0])) {
+			max_concurrent_dumps = atoi(arg[1]);
+			return 1;
+		}
+		else {
+			upslogx(LOG_ERR, "MAXCONCURRENTDUMPS has non numeric value (%s)!", arg[1]);
+			return 0;
+		}
+	}
+
 	/* ALLOW_NO_DEVICE <bool> */
 	if (!strcmp(arg[0], "ALLOW_NO_DEVICE")) {
 		if (isdigit((size_t)arg[1][0])) {
@@ -256,6 +284,12 @@ static int parse_upsd_conf_args(size_t numargs, char **arg)
 		return 1;
 	}
 
+	/* STATS_SOCKET <path> */
+	if (!strcmp(arg[0], "STATS_SOCKET")) {
+		stats_socket_set(arg[1]);
+		return 1;
+	}
+
 	/* DATAPATH <dir> */
 	if (!strcmp(arg[0], "DATAPATH")) {
 		free(datapath);
@@ -497,6 +531,7 @@ void do_upsconf_args(char *upsname, char *var, char *val)
 void upsconf_add(int reloading)
 {
 	ups_t	*tmp = upstable, *next;
+	upstype_t	*ups;
 	char	statefn[NUT_PATH_MAX];
 
 	if (!tmp) {
@@ -524,8 +559,8 @@ void upsconf_add(int reloading)
 				tmp->driver, tmp->upsname);
 
 			/* if a UPS exists, update it, else add it as new */
-			if ((reloading) && (get_ups_ptr(tmp->upsname) != NULL))
-				ups_update(statefn, tmp->upsname, tmp->desc);
+			if ((reloading) && ((ups = get_ups_ptr(tmp->upsname)) != NULL))
+				ups_update(ups, statefn, tmp->desc);
 			else
 				ups_create(statefn, tmp->upsname, tmp->desc);
 		}
@@ -578,6 +613,7 @@ static void delete_ups(upstype_t *target)
 			/* release memory */
 			sstate_infofree(ptr);
 			sstate_cmdfree(ptr);
+			sstate_genfree(ptr);
 			pconf_finish(&ptr->sock_ctx);
 
 			free(ptr->fn);
@@ -585,6 +621,7 @@ static void delete_ups(upstype_t *target)
 			free(ptr->desc);
 			free(ptr);
 
+			ups_removed++;
 			return;
 		}
 
@@ -615,16 +652,34 @@ static int check_file(const char *fn)
 	return 1;	/* OK */
 }
 
-/* called after SIGHUP */
+/* called after SIGHUP: the new settings are read and compared with the
+ * current ones, and only the UPS entries that were added, removed or
+ * redefined are touched; nothing is changed if the files are unreadable */
 void conf_reload(void)
 {
 	upstype_t	*upstmp, *upsnext;
+	uint64_t	start = stats_now_usec(), elapsed;
 
 	upslogx(LOG_INFO, "SIGHUP: reloading configuration");
 
-	/* see if we can access upsd.conf before blowing away the config */
-	if (!check_file("upsd.conf"))
+	/* see if we can access the files before blowing away the config */
+	if (!check_file("upsd.conf")
+	 || !check_file("ups.conf")
+	 || !check_file("upsd.users")
+	) {
+		upsd_stats.reload_failures++;
 		return;
+	}
+
+	/* read ups.conf into upstable; if it went away meanwhile,
+	 * keep the UPS entries we have rather than dropping them */
+	if (read_upsconf(0) < 0) {	/* 0 = do not abort */
+		upslogx(LOG_ERR, "Reload failed: keeping the current configuration");
+		upsd_stats.reload_failures++;
+		return;
+	}
+
+	ups_added = ups_changed = ups_removed = 0;
 
 	/* reset retain flags on all known UPS entries */
 	upstmp = firstups;
@@ -633,8 +688,7 @@ void conf_reload(void)
 		upstmp = upstmp->next;
 	}
 
-	/* reload from ups.conf */
-	read_upsconf(1);		/* 1 = may abort upon fundamental errors */
+	/* apply ups.conf */
 	upsconf_add(1);			/* 1 = reloading */
 
 	/* now reread upsd.conf */
@@ -658,13 +712,15 @@ void conf_reload(void)
 	if (firstups == NULL)
 		upslogx(LOG_WARNING, "Warning: no UPSes currently defined!");
 
-	/* and also make sure upsd.users can be read... */
-	if (!check_file("upsd.users"))
-		return;
+	/* and finally reread upsd.users, which replaces the
+	 * current users only if it could be read */
+	user_load();
 
-	/* delete all users */
-	user_flush();
+	elapsed = stats_now_usec() - start;
+	stats_histogram_add(&upsd_stats.reload, elapsed);
 
-	/* and finally reread from upsd.users */
-	user_load();
+	upslogx(LOG_INFO, "Reloaded configuration in %" PRIu64 ".%03" PRIu64
+		" ms: UPS entries %d added, %d changed, %d removed",
+		elapsed / 1000, elapsed % 1000,
+		ups_added, ups_changed, ups_removed);
 }
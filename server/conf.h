@@ -35,7 +35,7 @@ void load_upsdconf(int reloading);
 /* add valid UPSes from ups.conf to the internal structures */
 void upsconf_add(int reloading);
 
-/* flush existing config, then reread everything */
+/* reread everything, applying only what changed */
 void conf_reload(void);
 
 typedef struct ups_s {
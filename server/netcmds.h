@@ -36,6 +36,7 @@
 #include "netinstcmd.h"
 
 #define FLAG_USER	0x0001		/* username and password must be set */
+#define FLAG_SUBCMD	0x0002		/* first argument is a sub-command (for stats) */
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -54,8 +55,8 @@ static struct {
 	{ "HELP",	net_help,	0		},
 	{ "STARTTLS",	net_starttls,	0		},
 
-	{ "GET",	net_get,	0		},
-	{ "LIST",	net_list,	0		},
+	{ "GET",	net_get,	FLAG_SUBCMD	},
+	{ "LIST",	net_list,	FLAG_SUBCMD	},
 
 	{ "USERNAME",	net_username,	0		},
 	{ "PASSWORD",	net_password,	0		},
@@ -70,7 +71,7 @@ static struct {
 
 	{ "FSD",	net_fsd,	FLAG_USER	},
 
-	{ "SET",	net_set,	FLAG_USER	},
+	{ "SET",	net_set,	FLAG_USER | FLAG_SUBCMD	},
 	{ "INSTCMD",	net_instcmd,	FLAG_USER	},
 
 	{ NULL,		(void(*)(struct nut_ctype_s *, size_t,  const char **))(NULL), 0		}
@@ -21,40 +21,112 @@
 
 #include "common.h"
 
+#include <ctype.h>
+
 #include "upsd.h"
 #include "sstate.h"
 #include "state.h"
 #include "neterr.h"
+#include "stats.h"
 
 #include "netlist.h"
 
 extern	upstype_t	*firstups;	/* for list_ups */
 extern	nut_ctype_t *firstclient;	/* for list_clients */
 
-static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
-	int rw, int fsd)
+/* append <lines> complete lines of <len> bytes to the reply in <cache> */
+static void listcache_append(listcache_t *cache, const char *buf, size_t len,
+	size_t lines)
 {
-	int	ret;
+	if (cache->len + len + 1 > cache->size) {
+		cache->size = (cache->len + len + 1) * 2;
+		cache->buf = xrealloc(cache->buf, cache->size);
+	}
 
-	if (!node)
-		return 1;	/* not an error */
+	memcpy(cache->buf + cache->len, buf, len);
+	cache->len += len;
+	cache->buf[cache->len] = '\0';
+	cache->lines += lines;
+}
 
-	if (node->left) {
-		ret = tree_dump(node->left, client, ups, rw, fsd);
+/* append a line to the reply being made in <cache>, cut to the length
+ * sendback() would have sent it with */
+static void listcache_add(listcache_t *cache, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 2, 3)));
 
-		if (!ret)
-			return 0;		/* write failed in child */
+static void listcache_add(listcache_t *cache, const char *fmt, ...)
+{
+	char	ans[NUT_NET_ANSWER_MAX+1];
+	va_list	ap;
+
+	va_start(ap, fmt);
+	vsnprintf(ans, sizeof(ans), fmt, ap);
+	va_end(ap);
+
+	listcache_append(cache, ans, strlen(ans), 1);
+}
+
+/* does <name> match one of the "|" separated <patterns>, where "*" stands
+ * for any text and "?" for any character (case-insensitive, like the
+ * names of devices and variables) */
+static int name_match(const char *patterns, const char *name)
+{
+	const char	*p = patterns, *n = name, *star = NULL, *back = NULL;
+
+	for (;;) {
+		if (*p == '*') {
+			star = ++p;
+			back = n;
+			continue;
+		}
+
+		if (*n && *p && *p != '|'
+		 && (*p == '?' || tolower((unsigned char)*p) == tolower((unsigned char)*n))
+		) {
+			p++;
+			n++;
+			continue;
+		}
+
+		if (!*n && (!*p || *p == '|'))
+			return 1;
+
+		/* let the last "*" take one more character */
+		if (star && *back) {
+			p = star;
+			n = ++back;
+			continue;
+		}
+
+		/* try the next alternative */
+		while (*p && *p != '|')
+			p++;
+
+		if (!*p)
+			return 0;
+
+		p++;
+		n = name;
+		star = NULL;
 	}
+}
+
+static void tree_dump(const st_tree_t *node, listcache_t *cache, const char *ups,
+	int rw, int fsd, const char *varpatterns)
+{
+	if (!node)
+		return;
+
+	tree_dump(node->left, cache, ups, rw, fsd, varpatterns);
 
-	if (rw) {
+	if (varpatterns && !name_match(varpatterns, node->var)) {
+		/* not asked for */
+	} else if (rw) {
 
 		/* only send this back if it's been flagged RW */
 		if (node->flags & ST_FLAG_RW) {
-			ret = sendback(client, "RW %s %s \"%s\"\n",
+			listcache_add(cache, "RW %s %s \"%s\"\n",
 				ups, node->var, node->val);
-
-		} else {
-			ret = 1;	/* dummy */
 		}
 
 	} else {
@@ -63,50 +135,57 @@ static int tree_dump(st_tree_t *node, nut_ctype_t *client, const char *ups,
 
 		/* status is always a special case */
 		if ((fsd == 1) && (!strcasecmp(node->var, "ups.status"))) {
-			ret = sendback(client, "VAR %s %s \"FSD %s\"\n",
+			listcache_add(cache, "VAR %s %s \"FSD %s\"\n",
 				ups, node->var, node->val);
 
 		} else {
-			ret = sendback(client, "VAR %s %s \"%s\"\n",
+			listcache_add(cache, "VAR %s %s \"%s\"\n",
 				ups, node->var, node->val);
 		}
 	}
 
-	if (ret != 1)
-		return 0;
-
-	if (node->right)
-		return tree_dump(node->right, client, ups, rw, fsd);
-
-	return 1;
+	tree_dump(node->right, cache, ups, rw, fsd, varpatterns);
 }
 
-static void list_rw(nut_ctype_t *client, const char *upsname)
+/* make the LIST <type> reply for <ups>, called <upsname> in it,
+ * in <cache> unless the one kept there is still valid */
+static void list_render(const upstype_t *ups, const char *upsname,
+	const char *type, listcache_t *cache)
 {
-	const   upstype_t *ups;
-
-	ups = get_ups_ptr(upsname);
+	const	cmdlist_t	*ctmp;
 
-	if (!ups) {
-		send_err(client, NUT_ERR_UNKNOWN_UPS);
+	if (cache->valid) {
+		upsd_stats.lists_cached++;
 		return;
 	}
 
-	if (!ups_available(ups, client))
-		return;
+	cache->len = 0;
+	cache->lines = 0;
 
-	if (!sendback(client, "BEGIN LIST RW %s\n", upsname))
-		return;
+	listcache_add(cache, "BEGIN LIST %s %s\n", type, upsname);
 
-	if (!tree_dump(ups->inforoot, client, upsname, 1, ups->fsd))
-		return;
+	if (!strcmp(type, "CMD")) {
+		for (ctmp = ups->cmdlist; ctmp != NULL; ctmp = ctmp->next)
+			listcache_add(cache, "CMD %s %s\n", upsname, ctmp->name);
+	} else {
+		tree_dump(ups->inforoot, cache, upsname,
+			!strcmp(type, "RW"), ups->fsd, NULL);
+	}
+
+	listcache_add(cache, "END LIST %s %s\n", type, upsname);
 
-	sendback(client, "END LIST RW %s\n", upsname);
+	cache->valid = 1;
+	upsd_stats.lists_rendered++;
 }
 
-static void list_var(nut_ctype_t *client, const char *upsname)
+/* LIST VAR, LIST RW and LIST CMD: the whole reply is made from the data
+ * as it is now and sent at once. It is kept with the UPS and sent again
+ * to later clients until sstate.c sees the data change (or FSD is set),
+ * so clients polling the same UPS do not each get it formatted anew. */
+static void list_cached(nut_ctype_t *client, const char *upsname, const char *type)
 {
-	const   upstype_t *ups;
+	upstype_t	*ups;
+	listcache_t	*cache, tmp;
 
 	ups = get_ups_ptr(upsname);
 
@@ -118,39 +197,112 @@ static void list_var(nut_ctype_t *client, const char *upsname)
 	if (!ups_available(ups, client))
 		return;
 
-	if (!sendback(client, "BEGIN LIST VAR %s\n", upsname))
-		return;
+	if (!strcmp(type, "VAR"))
+		cache = &ups->list_var;
+	else if (!strcmp(type, "RW"))
+		cache = &ups->list_rw;
+	else
+		cache = &ups->list_cmd;
 
-	if (!tree_dump(ups->inforoot, client, upsname, 0, ups->fsd))
-		return;
+	/* the reply repeats the name as the client spelled it,
+	 * only keep the one spelled as in ups.conf */
+	if (strcmp(upsname, ups->name)) {
+		memset(&tmp, 0, sizeof(tmp));
+		cache = &tmp;
+	}
+
+	list_render(ups, upsname, type, cache);
+
+	sendback_buf(client, cache->buf, cache->len, cache->lines);
 
-	sendback(client, "END LIST VAR %s\n", upsname);
+	if (cache == &tmp)
+		free(tmp.buf);
+}
+
+static void list_rw(nut_ctype_t *client, const char *upsname)
+{
+	list_cached(client, upsname, "RW");
+}
+
+static void list_var(nut_ctype_t *client, const char *upsname)
+{
+	list_cached(client, upsname, "VAR");
 }
 
 static void list_cmd(nut_ctype_t *client, const char *upsname)
 {
-	const   upstype_t *ups;
-	cmdlist_t	*ctmp;
+	list_cached(client, upsname, "CMD");
+}
 
-	ups = get_ups_ptr(upsname);
+/* LIST VARS: the variables of all devices whose names match <upspatterns>
+ * (or only those matching <varpatterns>) in one reply, so a client
+ * watching many devices needs neither a query nor a round trip for each.
+ * Devices whose data can not be served are named with the error rather
+ * than failing the whole list. */
+static void list_vars(nut_ctype_t *client, const char *upspatterns,
+	const char *varpatterns)
+{
+	upstype_t	*ups;
+	listcache_t	reply;
+	const char	*err, *p, *first, *last;
+	char	name[SMALLBUF];
+	size_t	len;
+
+	memset(&reply, 0, sizeof(reply));
+
+	if (varpatterns)
+		listcache_add(&reply, "BEGIN LIST VARS %s %s\n", upspatterns, varpatterns);
+	else
+		listcache_add(&reply, "BEGIN LIST VARS %s\n", upspatterns);
+
+	for (ups = firstups; ups; ups = ups->next) {
+		if (!name_match(upspatterns, ups->name))
+			continue;
+
+		if ((err = ups_unavailable(ups)) != NULL) {
+			listcache_add(&reply, "UNAVAILABLE %s %s\n", ups->name, err);
+			continue;
+		}
 
-	if (!ups) {
-		send_err(client, NUT_ERR_UNKNOWN_UPS);
-		return;
+		if (varpatterns) {
+			tree_dump(ups->inforoot, &reply, ups->name, 0, ups->fsd, varpatterns);
+			continue;
+		}
+
+		/* the lines of its own LIST VAR reply, without BEGIN and END */
+		list_render(ups, ups->name, "VAR", &ups->list_var);
+
+		first = (const char *)memchr(ups->list_var.buf, '\n', ups->list_var.len) + 1;
+		last = ups->list_var.buf + ups->list_var.len - 1;
+		while (last > first && last[-1] != '\n')
+			last--;
+
+		listcache_append(&reply, first, (size_t)(last - first),
+			ups->list_var.lines - 2);
 	}
 
-	if (!ups_available(ups, client))
-		return;
+	/* names without wildcards are expected to exist */
+	for (p = upspatterns; *p; p += len + (p[len] == '|')) {
+		len = strcspn(p, "|");
 
-	if (!sendback(client, "BEGIN LIST CMD %s\n", upsname))
-		return;
+		if (len == 0 || len >= sizeof(name) || memchr(p, '*', len) || memchr(p, '?', len))
+			continue;
 
-	for (ctmp = ups->cmdlist; ctmp != NULL; ctmp = ctmp->next) {
-		if (!sendback(client, "CMD %s %s\n", upsname, ctmp->name))
-			return;
+		memcpy(name, p, len);
+		name[len] = '\0';
+
+		if (!get_ups_ptr(name))
+			listcache_add(&reply, "UNAVAILABLE %s %s\n", name, NUT_ERR_UNKNOWN_UPS);
 	}
 
-	sendback(client, "END LIST CMD %s\n", upsname);
+	if (varpatterns)
+		listcache_add(&reply, "END LIST VARS %s %s\n", upspatterns, varpatterns);
+	else
+		listcache_add(&reply, "END LIST VARS %s\n", upspatterns);
+
+	sendback_buf(client, reply.buf, reply.len, reply.lines);
+
+	free(reply.buf);
 }
 
 static void list_enum(nut_ctype_t *client, const char *upsname, const char *var)
@@ -298,6 +450,12 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST STATS */
+	if (!strcasecmp(arg[0], "STATS")) {
+		stats_list(client);
+		return;
+	}
+
 	if (numarg < 2) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
 		return;
@@ -327,6 +485,12 @@ void net_list(nut_ctype_t *client, size_t numarg, const char **arg)
 		return;
 	}
 
+	/* LIST VARS UPSPATTERNS [VARPATTERNS] */
+	if (!strcasecmp(arg[0], "VARS") && numarg <= 3) {
+		list_vars(client, arg[1], (numarg > 2) ? arg[2] : NULL);
+		return;
+	}
+
 	if (numarg < 3) {
 		send_err(client, NUT_ERR_INVALID_ARGUMENT);
 		return;
@@ -123,6 +123,7 @@ void net_fsd(nut_ctype_t *client, size_t numarg, const char **arg)
 		client->username, client->addr, ups->name);
 
 	ups->fsd = 1;
+	ups->list_var.valid = 0;	/* ups.status is listed with FSD now */
 	sendback(client, "OK FSD-SET\n");
 }
 
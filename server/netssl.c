@@ -37,6 +37,7 @@
 #include "upsd.h"
 #include "neterr.h"
 #include "netssl.h"
+#include "stats.h"
 #include "nut_stdint.h"
 
 #ifdef WITH_NSS
@@ -105,6 +106,14 @@ ssize_t ssl_read(nut_ctype_t *client, char *buf, size_t buflen)
 	return -1;
 }
 
+int ssl_handshake(nut_ctype_t *client)
+{
+	NUT_UNUSED_VARIABLE(client);
+
+	upslogx(LOG_ERR, "ssl_handshake called but SSL wasn't compiled in");
+	return -1;
+}
+
 void ssl_init(void)
 {
 	ssl_initialized = 0;	/* keep gcc quiet */
@@ -274,14 +283,155 @@ static void HandshakeCallback(PRFileDesc *fd, nut_ctype_t *client_data)
 
 #endif /* WITH_OPENSSL | WITH_NSS */
 
-void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+#ifndef WIN32
+/* The TLS handshake is driven from mainloop() on a non-blocking socket,
+ * so that a slow (or stalled) client does not hold up everyone else;
+ * once it is done, the socket is blocking again like for plain clients */
+static void ssl_set_nonblocking(nut_ctype_t *client, int nonblocking)
+{
+#ifdef WITH_OPENSSL
+	int	flags;
+
+	if ((flags = fcntl(client->sock_fd, F_GETFL)) < 0) {
+		upslog_with_errno(LOG_ERR, "fcntl(F_GETFL) failed for %s", client->addr);
+		return;
+	}
+
+	if (nonblocking)
+		flags |= O_NONBLOCK;
+	else
+		flags &= ~O_NONBLOCK;
+
+	if (fcntl(client->sock_fd, F_SETFL, flags) < 0)
+		upslog_with_errno(LOG_ERR, "fcntl(F_SETFL) failed for %s", client->addr);
+#elif defined(WITH_NSS) /* WITH_OPENSSL */
+	PRSocketOptionData	opt;
+
+	opt.option = PR_SockOpt_Nonblocking;
+	opt.value.non_blocking = nonblocking ? PR_TRUE : PR_FALSE;
+
+	if (PR_SetSocketOption(client->ssl, &opt) != PR_SUCCESS)
+		nss_error("ssl_set_nonblocking / PR_SetSocketOption");
+#endif /* WITH_OPENSSL | WITH_NSS */
+}
+#endif	/* !WIN32 */
+
+static void ssl_handshake_done(nut_ctype_t *client)
+{
+	client->ssl_handshaking = 0;
+	client->ssl_connected = 1;
+#ifndef WIN32
+	ssl_set_nonblocking(client, 0);
+#endif	/* !WIN32 */
+
+	stats_histogram_add(&upsd_stats.tls_handshake,
+		stats_now_usec() - client->ssl_handshake_start);
+}
+
+static void ssl_handshake_failed(nut_ctype_t *client)
+{
+	client->ssl_handshaking = 0;
+	upsd_stats.tls_failures++;
+}
+
+/* continue the TLS handshake started by STARTTLS; returns 1 when it is
+ * complete, 0 when it should be called again once the socket is readable
+ * (or writable, if client->ssl_want_write), and -1 when it failed */
+int ssl_handshake(nut_ctype_t *client)
 {
 #ifdef WITH_OPENSSL
-	int ret;
+	int	ret;
+
+	ret = SSL_accept(client->ssl);
+	if (ret == 1) {
+		ssl_handshake_done(client);
+		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
+		return 1;
+	}
+
+	switch (SSL_get_error(client->ssl, ret))
+	{
+	case SSL_ERROR_WANT_READ:
+		client->ssl_want_write = 0;
+		return 0;
+
+	case SSL_ERROR_WANT_WRITE:
+		client->ssl_want_write = 1;
+		return 0;
+
+	default:
+		break;
+	}
+
+	if (ret == 0) {
+		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
+	} else {
+		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
+	}
+	ssl_error(client->ssl, ret);
+	ssl_handshake_failed(client);
+	return -1;
+
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 	SECStatus	status;
-	PRFileDesc	*socket;
+
+	/* Note: this call can generate memory leaks not resolvable
+	 * by any release function.
+	 * Probably SSL session key object allocation. */
+	status = SSL_ForceHandshake(client->ssl);
+	if (status != SECSuccess) {
+		PRErrorCode code = PR_GetError();
+		if (code == PR_WOULD_BLOCK_ERROR) {
+			/* NSS does not tell which way it is blocked; the
+			 * server side mostly waits for the client, and its
+			 * own small writes are buffered by the socket */
+			client->ssl_want_write = 0;
+			return 0;
+		} else if (code==SSL_ERROR_NO_CERTIFICATE) {
+			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
+				client->addr);
+		} else {
+			nss_error("net_starttls / SSL_ForceHandshake");
+			ssl_handshake_failed(client);
+			/* TODO : Close the connection. */
+			return -1;
+		}
+	}
+	ssl_handshake_done(client);
+	return 1;
 #endif /* WITH_OPENSSL | WITH_NSS */
+}
+
+/* begin the handshake; on POSIX systems it is finished by mainloop(),
+ * returns like ssl_handshake() */
+static int ssl_handshake_start(nut_ctype_t *client)
+{
+	client->ssl_handshaking = 1;
+	client->ssl_want_write = 0;
+	client->ssl_handshake_start = stats_now_usec();
+	client->ssl_handshake_deadline = time(NULL) + SSL_HANDSHAKE_TIMEOUT;
+
+#ifndef WIN32
+	ssl_set_nonblocking(client, 1);
+#endif	/* !WIN32 */
+
+	return ssl_handshake(client);
+}
+
+/* the client was told to go ahead with TLS, but that did not work out:
+ * it can not be freed while its command is handled, so have mainloop()
+ * drop it the next time around, like after LOGOUT */
+static void ssl_starttls_failed(nut_ctype_t *client)
+{
+	client->last_heard = 0;
+}
+
+void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
+{
+#ifdef WITH_NSS
+	SECStatus	status;
+	PRFileDesc	*socket;
+#endif /* WITH_NSS */
 
 	NUT_UNUSED_VARIABLE(numarg);
 	NUT_UNUSED_VARIABLE(arg);
@@ -320,35 +470,19 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (!client->ssl) {
 		upslog_with_errno(LOG_ERR, "SSL_new failed\n");
 		ssl_debug();
+		ssl_starttls_failed(client);
 		return;
 	}
 
 	if (SSL_set_fd(client->ssl, client->sock_fd) != 1) {
 		upslog_with_errno(LOG_ERR, "SSL_set_fd failed\n");
 		ssl_debug();
+		ssl_starttls_failed(client);
 		return;
 	}
 
-	ret = SSL_accept(client->ssl);
-	switch (ret)
-	{
-	case 1:
-		client->ssl_connected = 1;
-		upsdebugx(3, "SSL connected (%s)", SSL_get_version(client->ssl));
-		break;
-
-	case 0:
-		upslog_with_errno(LOG_ERR, "SSL_accept do not accept handshake.");
-		ssl_error(client->ssl, ret);
-		break;
-
-	case -1:
-		upslog_with_errno(LOG_ERR, "Unknown return value from SSL_accept");
-		ssl_error(client->ssl, ret);
-		break;
-	default:
-		break;
-	}
+	if (ssl_handshake_start(client) < 0)
+		ssl_starttls_failed(client);
 
 #elif defined(WITH_NSS) /* WITH_OPENSSL */
 
@@ -356,6 +490,7 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (socket == NULL) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / PR_ImportTCPSocket");
+		ssl_starttls_failed(client);
 		return;
 	}
 
@@ -363,12 +498,14 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (client->ssl == NULL) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_ImportFD");
+		ssl_starttls_failed(client);
 		return;
 	}
 
 	if (SSL_SetPKCS11PinArg(client->ssl, client) == -1) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_SetPKCS11PinArg");
+		ssl_starttls_failed(client);
 		return;
 	}
 
@@ -383,6 +520,7 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_AuthCertificateHook");
+		ssl_starttls_failed(client);
 		return;
 	}
 
@@ -390,6 +528,7 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_BadCertHook");
+		ssl_starttls_failed(client);
 		return;
 	}
 
@@ -397,6 +536,7 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_HandshakeCallback");
+		ssl_starttls_failed(client);
 		return;
 	}
 
@@ -404,6 +544,7 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_ConfigSecureServer");
+		ssl_starttls_failed(client);
 		return;
 	}
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_CAST_FUNCTION_TYPE_STRICT)
@@ -414,25 +555,12 @@ void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg)
 	if (status != SECSuccess) {
 		upslogx(LOG_ERR, "Can not initialize SSL connection");
 		nss_error("net_starttls / SSL_ResetHandshake");
+		ssl_starttls_failed(client);
 		return;
 	}
 
-	/* Note: this call can generate memory leaks not resolvable
-	 * by any release function.
-	 * Probably SSL session key object allocation. */
-	status = SSL_ForceHandshake(client->ssl);
-	if (status != SECSuccess) {
-		PRErrorCode code = PR_GetError();
-		if (code==SSL_ERROR_NO_CERTIFICATE) {
-			upslogx(LOG_WARNING, "Client %s do not provide certificate.",
-				client->addr);
-		} else {
-			nss_error("net_starttls / SSL_ForceHandshake");
-			/* TODO : Close the connection. */
-			return;
-		}
-	}
-	client->ssl_connected = 1;
+	if (ssl_handshake_start(client) < 0)
+		ssl_starttls_failed(client);
 #endif /* WITH_OPENSSL | WITH_NSS */
 }
 
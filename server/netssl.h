@@ -45,6 +45,9 @@ extern int certrequest;
 #define NETSSL_CERTREQ_REQUIRE	2
 
 
+/* seconds a client has to complete the TLS handshake after STARTTLS */
+#define SSL_HANDSHAKE_TIMEOUT	10
+
 void ssl_init(void);
 void ssl_finish(nut_ctype_t *client);
 void ssl_cleanup(void);
@@ -52,6 +55,10 @@ void ssl_cleanup(void);
 ssize_t ssl_read(nut_ctype_t *client, char *buf, size_t buflen);
 ssize_t ssl_write(nut_ctype_t *client, const char *buf, size_t buflen);
 
+/* see client->ssl_handshaking; returns 1 when done, 0 to be called
+ * again when the socket is ready, -1 on failure */
+int ssl_handshake(nut_ctype_t *client);
+
 void net_starttls(nut_ctype_t *client, size_t numarg, const char **arg);
 
 #ifdef __cplusplus
@@ -38,6 +38,7 @@
 #endif
 
 #include "parseconf.h"
+#include "nut_stdint.h"
 
 #ifdef __cplusplus
 /* *INDENT-OFF* */
@@ -66,8 +67,20 @@ typedef struct nut_ctype_s {
 #endif
 	int	ssl_connected;
 
+	/* TLS handshake in progress after STARTTLS (driven by mainloop()
+	 * through ssl_handshake() when the socket is ready for it) */
+	int	ssl_handshaking;
+	int	ssl_want_write;
+	uint64_t	ssl_handshake_start;	/* see stats_now_usec() */
+	time_t	ssl_handshake_deadline;
+
 	PCONF_CTX_t	ctx;
 
+	/* traffic counters, see stats.h */
+	uint64_t	stats_bytes_in;
+	uint64_t	stats_bytes_out;
+	uint64_t	stats_commands;
+
 	/* doubly linked list */
 	struct nut_ctype_s	*prev;
 	struct nut_ctype_s	*next;
@@ -27,6 +27,7 @@
 #include "sstate.h"
 #include "upsd.h"
 #include "upstype.h"
+#include "stats.h"
 #include "nut_stdint.h"
 
 #include <fcntl.h>
@@ -39,53 +40,46 @@
 #include <sys/un.h>
 #endif	/* !WIN32 */
 
-static int parse_args(upstype_t *ups, size_t numargs, char **arg)
+/* the variables listed for <ups> changed: LIST VAR and LIST RW must be
+ * made again; enums, ranges and aux values are not part of these */
+static void sstate_info_changed(upstype_t *ups)
 {
-	if (numargs < 1)
-		return 0;
-
-	if (!strcasecmp(arg[0], "PONG")) {
-		upsdebugx(3, "%s: Got PONG from UPS [%s]", __func__, ups->name);
-		return 1;
-	}
-
-	if (!strcasecmp(arg[0], "DUMPDONE")) {
-		upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
-		ups->dumpdone = 1;
-		return 1;
-	}
-
-	if (!strcasecmp(arg[0], "DATASTALE")) {
-		upsdebugx(3, "%s: UPS [%s]: data is STALE now", __func__, ups->name);
-		ups->data_ok = 0;
-		return 1;
-	}
+	ups->list_var.valid = 0;
+	ups->list_rw.valid = 0;
+}
 
-	if (!strcasecmp(arg[0], "DATAOK")) {
-		upsdebugx(3, "%s: UPS [%s]: data is NOT STALE now", __func__, ups->name);
-		ups->data_ok = 1;
-		return 1;
-	}
+static void sstate_listcache_free(listcache_t *cache)
+{
+	free(cache->buf);
+	memset(cache, 0, sizeof(*cache));
+}
 
+/* Lines which change the data of a device (variables and commands) */
+static int parse_data_args(upstype_t *ups, st_tree_t **inforoot, cmdlist_t **cmdlist,
+	size_t numargs, char **arg)
+{
 	if (numargs < 2)
 		return 0;
 
 	/* FIXME: all these should return their state_...() value! */
 	/* ADDCMD <cmdname> */
 	if (!strcasecmp(arg[0], "ADDCMD")) {
-		state_addcmd(&ups->cmdlist, arg[1]);
+		if (state_addcmd(cmdlist, arg[1]))
+			ups->list_cmd.valid = 0;
 		return 1;
 	}
 
 	/* DELCMD <cmdname> */
 	if (!strcasecmp(arg[0], "DELCMD")) {
-		state_delcmd(&ups->cmdlist, arg[1]);
+		if (state_delcmd(cmdlist, arg[1]))
+			ups->list_cmd.valid = 0;
 		return 1;
 	}
 
 	/* DELINFO <var> */
 	if (!strcasecmp(arg[0], "DELINFO")) {
-		state_delinfo(&ups->inforoot, arg[1]);
+		if (state_delinfo(inforoot, arg[1]))
+			sstate_info_changed(ups);
 		return 1;
 	}
 
@@ -94,43 +88,33 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 
 	/* SETFLAGS <varname> <flags>... */
 	if (!strcasecmp(arg[0], "SETFLAGS")) {
-		state_setflags(ups->inforoot, arg[1], numargs - 2, &arg[2]);
+		state_setflags(*inforoot, arg[1], numargs - 2, &arg[2]);
+		ups->list_rw.valid = 0;
 		return 1;
 	}
 
 	/* SETINFO <varname> <value> */
 	if (!strcasecmp(arg[0], "SETINFO")) {
-		state_setinfo(&ups->inforoot, arg[1], arg[2]);
+		if (state_setinfo(inforoot, arg[1], arg[2]))
+			sstate_info_changed(ups);
 		return 1;
 	}
 
 	/* ADDENUM <varname> <enumval> */
 	if (!strcasecmp(arg[0], "ADDENUM")) {
-		state_addenum(ups->inforoot, arg[1], arg[2]);
+		state_addenum(*inforoot, arg[1], arg[2]);
 		return 1;
 	}
 
 	/* DELENUM <varname> <enumval> */
 	if (!strcasecmp(arg[0], "DELENUM")) {
-		state_delenum(ups->inforoot, arg[1], arg[2]);
+		state_delenum(*inforoot, arg[1], arg[2]);
 		return 1;
 	}
 
 	/* SETAUX <varname> <auxval> */
 	if (!strcasecmp(arg[0], "SETAUX")) {
-		state_setaux(ups->inforoot, arg[1], arg[2]);
-		return 1;
-	}
-
-	/* TRACKING <id> <status> */
-	if (!strcasecmp(arg[0], "TRACKING")) {
-		tracking_set(arg[1], arg[2]);
-		upsdebugx(1, "%s: TRACKING: ID %s status %s", __func__, arg[1], arg[2]);
-
-		/* log actual result of instcmd / setvar */
-		if (strncmp(arg[2], "PENDING", 7) != 0) {
-			upslogx(LOG_INFO, "tracking ID: %s\tresult: %s", arg[1], tracking_get(arg[1]));
-		}
+		state_setaux(*inforoot, arg[1], arg[2]);
 		return 1;
 	}
 
@@ -139,19 +123,131 @@ static int parse_args(upstype_t *ups, size_t numargs, char **arg)
 
 	/* ADDRANGE <varname> <minvalue> <maxvalue> */
 	if (!strcasecmp(arg[0], "ADDRANGE")) {
-		state_addrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
+		state_addrange(*inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
 		return 1;
 	}
 
 	/* DELRANGE <varname> <minvalue> <maxvalue> */
 	if (!strcasecmp(arg[0], "DELRANGE")) {
-		state_delrange(ups->inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
+		state_delrange(*inforoot, arg[1], atoi(arg[2]), atoi(arg[3]));
 		return 1;
 	}
 
 	return 0;
 }
 
+static int parse_args(upstype_t *ups, size_t numargs, char **arg)
+{
+	if (numargs < 1)
+		return 0;
+
+	if (!strcasecmp(arg[0], "PONG")) {
+		upsdebugx(3, "%s: Got PONG from UPS [%s]", __func__, ups->name);
+		return 1;
+	}
+
+	/* We may have asked for changes since a generation we kept the
+	 * data of: only adopt that data if the driver confirms it would
+	 * send an incremental dump; any other DUMPMODE means a full dump,
+	 * and so does a DUMPDONE without any (from older drivers which
+	 * ignore the DUMPALL arguments). Other lines do not decide it. */
+	if (!strcasecmp(arg[0], "DUMPMODE")) {
+		int	incremental = (numargs > 1 && !strcasecmp(arg[1], "INCREMENTAL"));
+
+		if (ups->gen_inforoot && incremental) {
+			upsdebugx(2, "%s: UPS [%s]: incremental dump since generation %s",
+				__func__, ups->name, ups->dumpgen);
+
+			sstate_infofree(ups);
+			sstate_cmdfree(ups);
+			ups->inforoot = ups->gen_inforoot;
+			ups->cmdlist = ups->gen_cmdlist;
+			ups->gen_inforoot = NULL;
+			ups->gen_cmdlist = NULL;
+
+			state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+			return 1;
+		}
+
+		if (ups->gen_inforoot) {
+			upsdebugx(2, "%s: UPS [%s]: full dump, dropping data kept since generation %s",
+				__func__, ups->name, NUT_STRARG(ups->dumpgen));
+			sstate_genfree(ups);
+		}
+
+		/* full dump: what we have is not consistent with the
+		 * generation reported earlier anymore, until DUMPGEN */
+		if (!incremental) {
+			free(ups->dumpgen);
+			ups->dumpgen = NULL;
+		}
+		return 1;
+	}
+
+	/* DUMPGEN <instance> <sec> <subsec> */
+	if (!strcasecmp(arg[0], "DUMPGEN")) {
+		char	gen[SMALLBUF];
+
+		if (numargs < 4)
+			return 0;
+
+		snprintf(gen, sizeof(gen), "%s %s %s", arg[1], arg[2], arg[3]);
+		free(ups->dumpgen);
+		ups->dumpgen = xstrdup(gen);
+
+		upsdebugx(3, "%s: UPS [%s]: dump generation is %s", __func__, ups->name, gen);
+		return 1;
+	}
+
+	if (!strcasecmp(arg[0], "DUMPDONE")) {
+		upsdebugx(3, "%s: UPS [%s]: dump is done", __func__, ups->name);
+		ups->dumpdone = 1;
+
+		/* a driver which did not say DUMPMODE sent it all */
+		if (ups->gen_inforoot) {
+			upsdebugx(2, "%s: UPS [%s]: dump without a DUMPMODE, dropping data kept since generation %s",
+				__func__, ups->name, NUT_STRARG(ups->dumpgen));
+			sstate_genfree(ups);
+		}
+		return 1;
+	}
+
+	if (!strcasecmp(arg[0], "DATASTALE")) {
+		upsdebugx(3, "%s: UPS [%s]: data is STALE now", __func__, ups->name);
+		ups->data_ok = 0;
+		return 1;
+	}
+
+	if (!strcasecmp(arg[0], "DATAOK")) {
+		upsdebugx(3, "%s: UPS [%s]: data is NOT STALE now", __func__, ups->name);
+		ups->data_ok = 1;
+		return 1;
+	}
+
+	/* TRACKING <id> <status> */
+	if (!strcasecmp(arg[0], "TRACKING")) {
+		if (numargs < 3)
+			return 0;
+
+		tracking_set(arg[1], arg[2]);
+		upsdebugx(1, "%s: TRACKING: ID %s status %s", __func__, arg[1], arg[2]);
+
+		/* log actual result of instcmd / setvar */
+		if (strncmp(arg[2], "PENDING", 7) != 0) {
+			upslogx(LOG_INFO, "tracking ID: %s\tresult: %s", arg[1], tracking_get(arg[1]));
+		}
+		return 1;
+	}
+
+	/* Until the driver says (with DUMPMODE) whether the data we kept
+	 * is still good, changes it sends (e.g. broadcast before it got to
+	 * our DUMPALL) go to both that data and the data we start afresh */
+	if (ups->gen_inforoot)
+		parse_data_args(ups, &ups->gen_inforoot, &ups->gen_cmdlist, numargs, arg);
+
+	return parse_data_args(ups, &ups->inforoot, &ups->cmdlist, numargs, arg);
+}
+
 /* nothing fancy - just make the driver say something back to us */
 static void sendping(upstype_t *ups)
 {
@@ -192,12 +288,23 @@ static void sendping(upstype_t *ups)
 
 /* interface */
 
+/* Ask for changes since the generation we kept the data of, if any;
+ * for the generation of the reply in any case */
+static void sstate_dumpcmd(upstype_t *ups, char *buf, size_t buflen)
+{
+	if (ups->gen_inforoot && ups->dumpgen) {
+		snprintf(buf, buflen, "DUMPALL GEN %s\n", ups->dumpgen);
+	} else {
+		snprintf(buf, buflen, "DUMPALL GEN\n");
+	}
+}
+
 TYPE_FD sstate_connect(upstype_t *ups)
 {
 	TYPE_FD	fd;
+	char	dumpcmd[SMALLBUF];
 #ifndef WIN32
-	const char	*dumpcmd = "DUMPALL\n";
-	size_t	dumpcmdlen = strlen(dumpcmd);
+	size_t	dumpcmdlen;
 	ssize_t	ret;
 	struct sockaddr_un	sa;
 
@@ -266,6 +373,8 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	}
 
 	/* get a dump started so we have a fresh set of data */
+	sstate_dumpcmd(ups, dumpcmd, sizeof(dumpcmd));
+	dumpcmdlen = strlen(dumpcmd);
 	ret = write(fd, dumpcmd, dumpcmdlen);
 
 	if ((ret < 1) || (ret != (ssize_t)dumpcmdlen))  {
@@ -276,7 +385,6 @@ TYPE_FD sstate_connect(upstype_t *ups)
 
 #else	/* WIN32 */
 	char pipename[NUT_PATH_MAX];
-	const char	*dumpcmd = "DUMPALL\n";
 	BOOL  result = FALSE;
 	DWORD bytesWritten;
 
@@ -309,6 +417,7 @@ TYPE_FD sstate_connect(upstype_t *ups)
 
 	/* get a dump started so we have a fresh set of data */
 	bytesWritten = 0;
+	sstate_dumpcmd(ups, dumpcmd, sizeof(dumpcmd));
 
 	result = WriteFile(fd, dumpcmd, strlen(dumpcmd), &bytesWritten, NULL);
 	if (result == 0 || bytesWritten != strlen(dumpcmd)) {
@@ -334,10 +443,14 @@ TYPE_FD sstate_connect(upstype_t *ups)
 	time(&ups->last_heard);
 
 	/* set ups.status to "WAIT" while waiting for the driver response to dumpcmd */
-	state_setinfo(&ups->inforoot, "ups.status", "WAIT");
+	if (state_setinfo(&ups->inforoot, "ups.status", "WAIT"))
+		sstate_info_changed(ups);
 
 	upslogx(LOG_INFO, "Connected to UPS [%s]: %s", ups->name, ups->fn);
 
+	ups->stats_connects++;
+	upsd_stats.driver_connects++;
+
 	return fd;
 }
 
@@ -347,8 +460,25 @@ void sstate_disconnect(upstype_t *ups)
 		return;
 	}
 
-	sstate_infofree(ups);
-	sstate_cmdfree(ups);
+	if (ups->dumpgen && ups->dumpdone && ups->inforoot) {
+		/* keep the data to only ask for changes when reconnecting */
+		char	*dumpgen = ups->dumpgen;
+
+		ups->dumpgen = NULL;
+		sstate_genfree(ups);
+
+		ups->dumpgen = dumpgen;
+		ups->gen_inforoot = ups->inforoot;
+		ups->gen_cmdlist = ups->cmdlist;
+		ups->inforoot = NULL;
+		ups->cmdlist = NULL;
+		sstate_info_changed(ups);
+		ups->list_cmd.valid = 0;
+	} else {
+		sstate_genfree(ups);
+		sstate_infofree(ups);
+		sstate_cmdfree(ups);
+	}
 
 	pconf_finish(&ups->sock_ctx);
 
@@ -364,6 +494,7 @@ void sstate_disconnect(upstype_t *ups)
 void sstate_readline(upstype_t *ups)
 {
 	ssize_t	i, ret;
+	size_t	used;
 
 #ifndef WIN32
 	char	buf[SMALLBUF];
@@ -399,11 +530,19 @@ void sstate_readline(upstype_t *ups)
 	ret = bytesRead;
 #endif	/* WIN32 */
 
-	for (i = 0; i < ret; i++) {
+	if (ret > 0) {
+		ups->stats_bytes += (uint64_t)ret;
+		upsd_stats.driver_bytes += (uint64_t)ret;
+	}
+
+	for (i = 0; i < ret; i += (ssize_t)used) {
 
-		switch (pconf_char(&ups->sock_ctx, buf[i]))
+		switch (pconf_buf(&ups->sock_ctx, buf + i, (size_t)(ret - i), &used))
 		{
 		case 1:
+			ups->stats_lines++;
+			upsd_stats.driver_lines++;
+
 			/* set the 'last heard' time to now for later staleness checks */
 			if (parse_args(ups, ups->sock_ctx.numargs, ups->sock_ctx.arglist)) {
 				time(&ups->last_heard);
@@ -415,6 +554,8 @@ void sstate_readline(upstype_t *ups)
 
 		default:
 			/* parse error */
+			ups->stats_parse_errors++;
+			upsd_stats.driver_parse_errors++;
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", ups->sock_ctx.errmsg);
 			return;
 		}
@@ -497,6 +638,8 @@ int sstate_dead(upstype_t *ups, int arg_maxage)
 void sstate_infofree(upstype_t *ups)
 {
 	state_infofree(ups->inforoot);
+	sstate_listcache_free(&ups->list_var);
+	sstate_listcache_free(&ups->list_rw);
 
 	ups->inforoot = NULL;
 }
@@ -504,10 +647,37 @@ void sstate_infofree(upstype_t *ups)
 void sstate_cmdfree(upstype_t *ups)
 {
 	state_cmdfree(ups->cmdlist);
+	sstate_listcache_free(&ups->list_cmd);
 
 	ups->cmdlist = NULL;
 }
 
+/* release the dump generation and the data kept for it */
+void sstate_genfree(upstype_t *ups)
+{
+	free(ups->dumpgen);
+	state_infofree(ups->gen_inforoot);
+	state_cmdfree(ups->gen_cmdlist);
+
+	ups->dumpgen = NULL;
+	ups->gen_inforoot = NULL;
+	ups->gen_cmdlist = NULL;
+}
+
+/* how many drivers are connected but did not complete their dump yet */
+size_t sstate_dumps_in_progress(void)
+{
+	upstype_t	*ups;
+	size_t	count = 0;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		if (VALID_FD(ups->sock_fd) && !ups->dumpdone)
+			count++;
+	}
+
+	return count;
+}
+
 int sstate_sendline(upstype_t *ups, const char *buf)
 {
 	ssize_t	ret;
@@ -51,6 +51,8 @@ void sstate_makeinstcmdlist_t(const upstype_t *ups, char *buf, size_t bufsize);
 int sstate_dead(upstype_t *ups, int maxage);
 void sstate_infofree(upstype_t *ups);
 void sstate_cmdfree(upstype_t *ups);
+void sstate_genfree(upstype_t *ups);
+size_t sstate_dumps_in_progress(void);
 int sstate_sendline(upstype_t *ups, const char *buf);
 const st_tree_t *sstate_getnode(const upstype_t *ups, const char *varname);
 
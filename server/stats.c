@@ -0,0 +1,711 @@
+/* stats.c - upsd performance counters, LIST STATS and the OpenMetrics
+   exporter socket
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+
+#ifndef WIN32
+# include <sys/un.h>
+# include <sys/socket.h>
+#endif	/* !WIN32 */
+
+#include "upsd.h"
+#include "stats.h"
+
+upsd_stats_t	upsd_stats;
+
+char		*stats_socket_path = NULL;
+TYPE_FD_SOCK	stats_socket_fd = ERROR_FD_SOCK;
+stats_conn_t	*stats_firstconn = NULL;
+
+/* upper bounds of the histogram buckets, in microseconds */
+static const uint64_t	stats_bucket_usec[STATS_HISTOGRAM_BUCKETS] = {
+	50, 100, 250, 500,
+	1000, 2500, 5000, 10000,
+	25000, 100000, 250000, 1000000
+};
+
+/* Per-command timings, keyed by "CMD" or "CMD.SUB"; the few dozen
+ * known commands are found by a linear search. Sub-commands which are
+ * not in the protocol (clients making them up) are accounted as "OTHER",
+ * so that they can not take up the table. */
+#define STATS_COMMANDS_MAX	48
+#define STATS_COMMAND_NAMELEN	24
+
+typedef struct {
+	char	name[STATS_COMMAND_NAMELEN];
+	stats_histogram_t	hist;
+} stats_command_t;
+
+static stats_command_t	stats_commands[STATS_COMMANDS_MAX];
+static size_t	stats_numcommands = 0;
+
+/* the sub-commands of GET, LIST and SET */
+static const char	*stats_subcommands[] = {
+	"CLIENT", "CMD", "CMDDESC", "DESC", "ENUM", "NUMLOGINS", "RANGE", "RW",
+	"STATS", "TRACKING", "TYPE", "UPS", "UPSDESC", "VAR", "VARS",
+	NULL
+};
+
+uint64_t stats_now_usec(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(HAVE_CLOCK_MONOTONIC) && HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC
+	struct timespec	ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0) {
+		return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+	}
+#endif	/* HAVE_CLOCK_GETTIME && HAVE_CLOCK_MONOTONIC */
+	{ /* scope */
+		struct timeval	tv;
+
+		gettimeofday(&tv, NULL);
+		return (uint64_t)tv.tv_sec * 1000000 + (uint64_t)tv.tv_usec;
+	}
+}
+
+void stats_histogram_add(stats_histogram_t *hist, uint64_t usec)
+{
+	size_t	i;
+
+	for (i = 0; i < STATS_HISTOGRAM_BUCKETS && usec > stats_bucket_usec[i]; i++);
+
+	hist->bucket[i]++;
+	hist->count++;
+	hist->sum_usec += usec;
+
+	if (usec > hist->max_usec) {
+		hist->max_usec = usec;
+	}
+}
+
+/* approximate quantile: the upper bound of the bucket it falls into
+ * (or the maximum seen, for the last bucket) */
+static uint64_t stats_histogram_quantile(const stats_histogram_t *hist, unsigned int percent)
+{
+	uint64_t	rank, seen = 0;
+	size_t	i;
+
+	if (!hist->count) {
+		return 0;
+	}
+
+	rank = (hist->count * percent + 99) / 100;
+
+	for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		seen += hist->bucket[i];
+		if (seen >= rank) {
+			return (stats_bucket_usec[i] < hist->max_usec)
+				? stats_bucket_usec[i] : hist->max_usec;
+		}
+	}
+
+	return hist->max_usec;
+}
+
+static stats_command_t *stats_command_find(const char *cmd, const char *sub)
+{
+	char	name[STATS_COMMAND_NAMELEN];
+	size_t	i, len;
+
+	snprintf(name, sizeof(name), "%s", cmd);
+	len = strlen(name);
+
+	/* only take the sub-commands of the protocol, to keep junk out */
+	if (sub) {
+		for (i = 0; stats_subcommands[i]; i++) {
+			if (!strcasecmp(sub, stats_subcommands[i]))
+				break;
+		}
+
+		if (stats_subcommands[i] && strlen(stats_subcommands[i]) + len + 1 < sizeof(name)) {
+			snprintf(name + len, sizeof(name) - len, ".%s", stats_subcommands[i]);
+		} else {
+			snprintf(name, sizeof(name), "OTHER");
+		}
+	}
+
+	for (i = 0; i < stats_numcommands; i++) {
+		if (!strcmp(stats_commands[i].name, name)) {
+			return &stats_commands[i];
+		}
+	}
+
+	/* the last entry is kept for "OTHER" */
+	if (stats_numcommands < STATS_COMMANDS_MAX - 1
+	 || (stats_numcommands < STATS_COMMANDS_MAX && !strcmp(name, "OTHER"))
+	) {
+		snprintf(stats_commands[stats_numcommands].name,
+			sizeof(stats_commands[stats_numcommands].name), "%s", name);
+		return &stats_commands[stats_numcommands++];
+	}
+
+	/* not with the commands of the protocol, but just in case */
+	return stats_command_find("OTHER", NULL);
+}
+
+void stats_command_done(const char *cmd, const char *sub, uint64_t start)
+{
+	uint64_t	now = stats_now_usec();
+
+	stats_histogram_add(&stats_command_find(cmd, sub)->hist,
+		now > start ? now - start : 0);
+}
+
+void stats_loop_done(uint64_t start)
+{
+	uint64_t	busy = stats_now_usec() - start;
+
+	stats_histogram_add(&upsd_stats.loop_busy,
+		busy > upsd_stats.poll_wait_usec ? busy - upsd_stats.poll_wait_usec : 0);
+	upsd_stats.poll_wait_usec = 0;
+}
+
+void stats_init(void)
+{
+	memset(&upsd_stats, 0, sizeof(upsd_stats));
+	time(&upsd_stats.started);
+
+	memset(stats_commands, 0, sizeof(stats_commands));
+	stats_numcommands = 0;
+}
+
+/* LIST STATS */
+
+static int stats_send(nut_ctype_t *client, const char *name, uint64_t value)
+{
+	return sendback(client, "STAT %s \"%" PRIu64 "\"\n", name, value);
+}
+
+static int stats_send_histogram(nut_ctype_t *client, const char *prefix,
+	const stats_histogram_t *hist)
+{
+	char	name[SMALLBUF];
+
+	snprintf(name, sizeof(name), "%s.count", prefix);
+	if (!stats_send(client, name, hist->count))
+		return 0;
+
+	snprintf(name, sizeof(name), "%s.usec.sum", prefix);
+	if (!stats_send(client, name, hist->sum_usec))
+		return 0;
+
+	snprintf(name, sizeof(name), "%s.usec.max", prefix);
+	if (!stats_send(client, name, hist->max_usec))
+		return 0;
+
+	snprintf(name, sizeof(name), "%s.usec.p50", prefix);
+	if (!stats_send(client, name, stats_histogram_quantile(hist, 50)))
+		return 0;
+
+	snprintf(name, sizeof(name), "%s.usec.p99", prefix);
+	return stats_send(client, name, stats_histogram_quantile(hist, 99));
+}
+
+void stats_list(nut_ctype_t *client)
+{
+	const struct {
+		const char	*name;
+		uint64_t	*value;
+	} counters[] = {
+		{ "server.clients.accepted",	&upsd_stats.clients_accepted },
+		{ "server.clients.disconnected",	&upsd_stats.clients_disconnected },
+		{ "server.bytes.in",	&upsd_stats.bytes_in },
+		{ "server.bytes.out",	&upsd_stats.bytes_out },
+		{ "server.lines.in",	&upsd_stats.lines_in },
+		{ "server.lines.out",	&upsd_stats.lines_out },
+		{ "server.errors.write",	&upsd_stats.write_errors },
+		{ "server.errors.parse",	&upsd_stats.parse_errors },
+		{ "server.commands.unknown",	&upsd_stats.unknown_commands },
+		{ "server.commands.denied",	&upsd_stats.denied_commands },
+		{ "lists.cached",	&upsd_stats.lists_cached },
+		{ "lists.rendered",	&upsd_stats.lists_rendered },
+		{ "drivers.connects",	&upsd_stats.driver_connects },
+		{ "drivers.bytes",	&upsd_stats.driver_bytes },
+		{ "drivers.lines",	&upsd_stats.driver_lines },
+		{ "drivers.errors.parse",	&upsd_stats.driver_parse_errors },
+		{ "tls.failures",	&upsd_stats.tls_failures },
+		{ "config.reload_failures",	&upsd_stats.reload_failures },
+		{ "loop.poll_timeouts",	&upsd_stats.poll_timeouts },
+		{ NULL, NULL }
+	};
+	char	name[SMALLBUF];
+	nut_ctype_t	*c;
+	upstype_t	*ups;
+	uint64_t	numclients = 0;
+	size_t	i;
+
+	if (!sendback(client, "BEGIN LIST STATS\n"))
+		return;
+
+	for (c = firstclient; c; c = c->next) {
+		numclients++;
+	}
+
+	if (!stats_send(client, "server.uptime", (uint64_t)difftime(time(NULL), upsd_stats.started)))
+		return;
+
+	if (!stats_send(client, "server.clients", numclients))
+		return;
+
+	if (!stats_send(client, "server.tracking", (uint64_t)tracking_count()))
+		return;
+
+	for (i = 0; counters[i].name; i++) {
+		if (!stats_send(client, counters[i].name, *counters[i].value))
+			return;
+	}
+
+	if (!stats_send_histogram(client, "loop.busy", &upsd_stats.loop_busy))
+		return;
+
+	if (!stats_send_histogram(client, "tls.handshake", &upsd_stats.tls_handshake))
+		return;
+
+	if (!stats_send_histogram(client, "config.reload", &upsd_stats.reload))
+		return;
+
+	for (ups = firstups; ups; ups = ups->next) {
+		snprintf(name, sizeof(name), "driver.%s.connects", ups->name);
+		if (!stats_send(client, name, ups->stats_connects))
+			return;
+
+		snprintf(name, sizeof(name), "driver.%s.bytes", ups->name);
+		if (!stats_send(client, name, ups->stats_bytes))
+			return;
+
+		snprintf(name, sizeof(name), "driver.%s.lines", ups->name);
+		if (!stats_send(client, name, ups->stats_lines))
+			return;
+
+		snprintf(name, sizeof(name), "driver.%s.errors.parse", ups->name);
+		if (!stats_send(client, name, ups->stats_parse_errors))
+			return;
+	}
+
+	for (i = 0; i < stats_numcommands; i++) {
+		snprintf(name, sizeof(name), "command.%.*s",
+			STATS_COMMAND_NAMELEN - 1, stats_commands[i].name);
+		if (!stats_send_histogram(client, name, &stats_commands[i].hist))
+			return;
+	}
+
+	sendback(client, "END LIST STATS\n");
+}
+
+/* OpenMetrics text exposition */
+
+typedef struct {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+} stats_text_t;
+
+static void stats_printf(stats_text_t *text, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 2, 3)));
+
+static void stats_printf(stats_text_t *text, const char *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	for (;;) {
+		va_start(ap, fmt);
+		ret = vsnprintf(text->buf + text->len, text->size - text->len, fmt, ap);
+		va_end(ap);
+
+		if (ret < 0) {
+			return;
+		}
+
+		if ((size_t)ret < text->size - text->len) {
+			text->len += (size_t)ret;
+			return;
+		}
+
+		text->size = text->size * 2 + (size_t)ret;
+		text->buf = xrealloc(text->buf, text->size);
+	}
+}
+
+/* label values may hold anything but quotes, backslashes and newlines */
+static const char *stats_label(const char *val, char *buf, size_t buflen)
+{
+	size_t	i;
+
+	for (i = 0; val[i] && i < buflen - 1; i++) {
+		buf[i] = (val[i] == '"' || val[i] == '\\' || val[i] == '\n') ? '_' : val[i];
+	}
+	buf[i] = '\0';
+
+	return buf;
+}
+
+static void stats_om_meta(stats_text_t *text, const char *family,
+	const char *type, const char *unit, const char *help)
+{
+	stats_printf(text, "# TYPE %s %s\n", family, type);
+	if (unit) {
+		stats_printf(text, "# UNIT %s %s\n", family, unit);
+	}
+	stats_printf(text, "# HELP %s %s\n", family, help);
+}
+
+static void stats_om_counter(stats_text_t *text, const char *family,
+	const char *help, uint64_t value)
+{
+	stats_om_meta(text, family, "counter", NULL, help);
+	stats_printf(text, "%s_total %" PRIu64 "\n", family, value);
+}
+
+static void stats_om_histogram(stats_text_t *text, const char *family,
+	const char *labels, const stats_histogram_t *hist)
+{
+	uint64_t	cumulative = 0;
+	size_t	i;
+
+	for (i = 0; i < STATS_HISTOGRAM_BUCKETS; i++) {
+		cumulative += hist->bucket[i];
+		stats_printf(text, "%s_bucket{%s%sle=\"%g\"} %" PRIu64 "\n",
+			family, labels, *labels ? "," : "",
+			(double)stats_bucket_usec[i] / 1000000.0, cumulative);
+	}
+
+	stats_printf(text, "%s_bucket{%s%sle=\"+Inf\"} %" PRIu64 "\n",
+		family, labels, *labels ? "," : "", hist->count);
+	if (*labels) {
+		stats_printf(text, "%s_count{%s} %" PRIu64 "\n", family, labels, hist->count);
+		stats_printf(text, "%s_sum{%s} %.6f\n", family, labels,
+			(double)hist->sum_usec / 1000000.0);
+	} else {
+		stats_printf(text, "%s_count %" PRIu64 "\n", family, hist->count);
+		stats_printf(text, "%s_sum %.6f\n", family,
+			(double)hist->sum_usec / 1000000.0);
+	}
+}
+
+static char *stats_openmetrics(size_t *len)
+{
+	stats_text_t	text;
+	char	labels[SMALLBUF], lbuf[SMALLBUF], lbuf2[SMALLBUF];
+	nut_ctype_t	*client;
+	upstype_t	*ups;
+	uint64_t	numclients = 0;
+	size_t	i;
+
+	text.size = LARGEBUF * 4;
+	text.len = 0;
+	text.buf = xmalloc(text.size);
+
+	for (client = firstclient; client; client = client->next) {
+		numclients++;
+	}
+
+	stats_om_meta(&text, "upsd_uptime_seconds", "gauge", "seconds",
+		"Time since upsd started");
+	stats_printf(&text, "upsd_uptime_seconds %.0f\n",
+		difftime(time(NULL), upsd_stats.started));
+
+	stats_om_meta(&text, "upsd_clients", "gauge", NULL,
+		"Currently connected clients");
+	stats_printf(&text, "upsd_clients %" PRIu64 "\n", numclients);
+
+	stats_om_meta(&text, "upsd_tracking_entries", "gauge", NULL,
+		"Kept status tracking entries of commands and settings");
+	stats_printf(&text, "upsd_tracking_entries %" PRIuSIZE "\n", tracking_count());
+
+	stats_om_counter(&text, "upsd_clients_accepted",
+		"Accepted client connections", upsd_stats.clients_accepted);
+	stats_om_counter(&text, "upsd_clients_disconnected",
+		"Closed client connections", upsd_stats.clients_disconnected);
+	stats_om_counter(&text, "upsd_received_bytes",
+		"Bytes received from clients", upsd_stats.bytes_in);
+	stats_om_counter(&text, "upsd_sent_bytes",
+		"Bytes sent to clients", upsd_stats.bytes_out);
+	stats_om_counter(&text, "upsd_received_lines",
+		"Command lines received from clients", upsd_stats.lines_in);
+	stats_om_counter(&text, "upsd_sent_lines",
+		"Answer lines sent to clients", upsd_stats.lines_out);
+	stats_om_counter(&text, "upsd_write_errors",
+		"Failed writes to clients", upsd_stats.write_errors);
+	stats_om_counter(&text, "upsd_parse_errors",
+		"Unparsable lines from clients", upsd_stats.parse_errors);
+	stats_om_counter(&text, "upsd_unknown_commands",
+		"Unknown commands from clients", upsd_stats.unknown_commands);
+	stats_om_counter(&text, "upsd_denied_commands",
+		"Commands refused for lack of authentication", upsd_stats.denied_commands);
+	stats_om_counter(&text, "upsd_lists_cached",
+		"LIST VAR, RW and CMD replies sent as kept from an earlier request", upsd_stats.lists_cached);
+	stats_om_counter(&text, "upsd_lists_rendered",
+		"LIST VAR, RW and CMD replies made anew after their data changed", upsd_stats.lists_rendered);
+	stats_om_counter(&text, "upsd_driver_connects",
+		"Connections made to driver sockets", upsd_stats.driver_connects);
+	stats_om_counter(&text, "upsd_driver_received_bytes",
+		"Bytes received from drivers", upsd_stats.driver_bytes);
+	stats_om_counter(&text, "upsd_driver_received_lines",
+		"Lines received from drivers", upsd_stats.driver_lines);
+	stats_om_counter(&text, "upsd_driver_parse_errors",
+		"Unparsable lines from drivers", upsd_stats.driver_parse_errors);
+	stats_om_counter(&text, "upsd_tls_failures",
+		"Failed STARTTLS handshakes", upsd_stats.tls_failures);
+	stats_om_counter(&text, "upsd_config_reload_failures",
+		"Configuration reloads abandoned for unreadable files", upsd_stats.reload_failures);
+	stats_om_counter(&text, "upsd_poll_timeouts",
+		"Event loop iterations without events", upsd_stats.poll_timeouts);
+
+	stats_om_meta(&text, "upsd_loop_busy_seconds", "histogram", "seconds",
+		"Time spent handling the events of one event loop iteration");
+	stats_om_histogram(&text, "upsd_loop_busy_seconds", "", &upsd_stats.loop_busy);
+
+	stats_om_meta(&text, "upsd_tls_handshake_seconds", "histogram", "seconds",
+		"Duration of STARTTLS handshakes");
+	stats_om_histogram(&text, "upsd_tls_handshake_seconds", "", &upsd_stats.tls_handshake);
+
+	stats_om_meta(&text, "upsd_config_reload_seconds", "histogram", "seconds",
+		"Duration of configuration reloads");
+	stats_om_histogram(&text, "upsd_config_reload_seconds", "", &upsd_stats.reload);
+
+	stats_om_meta(&text, "upsd_command_seconds", "histogram", "seconds",
+		"Time taken to handle client commands");
+	for (i = 0; i < stats_numcommands; i++) {
+		snprintf(labels, sizeof(labels), "command=\"%.*s\"",
+			STATS_COMMAND_NAMELEN - 1, stats_commands[i].name);
+		stats_om_histogram(&text, "upsd_command_seconds", labels, &stats_commands[i].hist);
+	}
+
+	stats_om_meta(&text, "upsd_device_driver_received_lines", "counter", NULL,
+		"Lines received from the driver of a device");
+	for (ups = firstups; ups; ups = ups->next) {
+		stats_printf(&text, "upsd_device_driver_received_lines_total{ups=\"%s\"} %" PRIu64 "\n",
+			stats_label(ups->name, lbuf, sizeof(lbuf)), ups->stats_lines);
+	}
+
+	stats_om_meta(&text, "upsd_device_driver_received_bytes", "counter", NULL,
+		"Bytes received from the driver of a device");
+	for (ups = firstups; ups; ups = ups->next) {
+		stats_printf(&text, "upsd_device_driver_received_bytes_total{ups=\"%s\"} %" PRIu64 "\n",
+			stats_label(ups->name, lbuf, sizeof(lbuf)), ups->stats_bytes);
+	}
+
+	stats_om_meta(&text, "upsd_device_driver_parse_errors", "counter", NULL,
+		"Unparsable lines from the driver of a device");
+	for (ups = firstups; ups; ups = ups->next) {
+		stats_printf(&text, "upsd_device_driver_parse_errors_total{ups=\"%s\"} %" PRIu64 "\n",
+			stats_label(ups->name, lbuf, sizeof(lbuf)), ups->stats_parse_errors);
+	}
+
+	stats_om_meta(&text, "upsd_device_driver_connects", "counter", NULL,
+		"Connections made to the driver of a device");
+	for (ups = firstups; ups; ups = ups->next) {
+		stats_printf(&text, "upsd_device_driver_connects_total{ups=\"%s\"} %" PRIu64 "\n",
+			stats_label(ups->name, lbuf, sizeof(lbuf)), ups->stats_connects);
+	}
+
+	stats_om_meta(&text, "upsd_client_received_bytes", "counter", NULL,
+		"Bytes received from a connected client");
+	for (client = firstclient; client; client = client->next) {
+		stats_printf(&text, "upsd_client_received_bytes_total{client=\"%s\",fd=\"%d\",user=\"%s\"} %" PRIu64 "\n",
+			stats_label(client->addr, lbuf, sizeof(lbuf)), (int)client->sock_fd,
+			stats_label(client->username ? client->username : "", lbuf2, sizeof(lbuf2)),
+			client->stats_bytes_in);
+	}
+
+	stats_om_meta(&text, "upsd_client_sent_bytes", "counter", NULL,
+		"Bytes sent to a connected client");
+	for (client = firstclient; client; client = client->next) {
+		stats_printf(&text, "upsd_client_sent_bytes_total{client=\"%s\",fd=\"%d\",user=\"%s\"} %" PRIu64 "\n",
+			stats_label(client->addr, lbuf, sizeof(lbuf)), (int)client->sock_fd,
+			stats_label(client->username ? client->username : "", lbuf2, sizeof(lbuf2)),
+			client->stats_bytes_out);
+	}
+
+	stats_om_meta(&text, "upsd_client_commands", "counter", NULL,
+		"Commands received from a connected client");
+	for (client = firstclient; client; client = client->next) {
+		stats_printf(&text, "upsd_client_commands_total{client=\"%s\",fd=\"%d\",user=\"%s\"} %" PRIu64 "\n",
+			stats_label(client->addr, lbuf, sizeof(lbuf)), (int)client->sock_fd,
+			stats_label(client->username ? client->username : "", lbuf2, sizeof(lbuf2)),
+			client->stats_commands);
+	}
+
+	stats_printf(&text, "# EOF\n");
+
+	*len = text.len;
+	return text.buf;
+}
+
+/* exporter socket */
+
+void stats_socket_set(const char *path)
+{
+	if (VALID_FD_SOCK(stats_socket_fd)) {
+		if (strcmp(path, stats_socket_path)) {
+			upslogx(LOG_WARNING, "STATS_SOCKET can not be changed "
+				"without a restart, still using %s", stats_socket_path);
+		}
+		return;
+	}
+
+	free(stats_socket_path);
+	stats_socket_path = xstrdup(path);
+}
+
+#ifndef WIN32
+void stats_socket_open(void)
+{
+	struct sockaddr_un	ssaddr;
+	TYPE_FD_SOCK	fd;
+	mode_t	prev;
+
+	if (!stats_socket_path || VALID_FD_SOCK(stats_socket_fd)) {
+		return;
+	}
+
+	if (strlen(stats_socket_path) >= sizeof(ssaddr.sun_path)) {
+		upslogx(LOG_ERR, "STATS_SOCKET path is too long: %s", stats_socket_path);
+		return;
+	}
+
+	fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (INVALID_FD_SOCK(fd)) {
+		upslog_with_errno(LOG_ERR, "Can't create the STATS_SOCKET");
+		return;
+	}
+
+	memset(&ssaddr, 0, sizeof(ssaddr));
+	ssaddr.sun_family = AF_UNIX;
+	snprintf(ssaddr.sun_path, sizeof(ssaddr.sun_path), "%s", stats_socket_path);
+
+	unlink(stats_socket_path);
+
+	/* same access as to the driver sockets: owner and group */
+	prev = umask(0007);
+	if (bind(fd, (struct sockaddr *) &ssaddr, sizeof(ssaddr)) < 0
+	|| chmod(stats_socket_path, 0660) < 0
+	|| listen(fd, 8) < 0
+	) {
+		upslog_with_errno(LOG_ERR, "Can't listen on STATS_SOCKET %s", stats_socket_path);
+		umask(prev);
+		close(fd);
+		return;
+	}
+	umask(prev);
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	stats_socket_fd = fd;
+	upslogx(LOG_INFO, "Serving statistics on socket %s", stats_socket_path);
+}
+
+void stats_socket_accept(void)
+{
+	stats_conn_t	*conn;
+	TYPE_FD_SOCK	fd;
+
+	fd = accept(stats_socket_fd, NULL, NULL);
+	if (INVALID_FD_SOCK(fd)) {
+		return;
+	}
+
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	conn = xcalloc(1, sizeof(*conn));
+	conn->sock_fd = fd;
+	conn->buf = stats_openmetrics(&conn->len);
+	conn->next = stats_firstconn;
+	stats_firstconn = conn;
+
+	/* usually fits in the socket buffer right away */
+	stats_conn_write(conn);
+}
+
+int stats_conn_write(stats_conn_t *conn)
+{
+	ssize_t	ret;
+
+	while (conn->sent < conn->len) {
+		ret = write(conn->sock_fd, conn->buf + conn->sent, conn->len - conn->sent);
+		if (ret < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) {
+				return 1;	/* poll() tells when to go on */
+			}
+			break;
+		}
+		conn->sent += (size_t)ret;
+	}
+
+	stats_conn_close(conn);
+	return 0;
+}
+#else	/* WIN32 */
+void stats_socket_open(void)
+{
+	if (stats_socket_path) {
+		upslogx(LOG_WARNING, "STATS_SOCKET is not supported on this platform");
+	}
+}
+
+void stats_socket_accept(void)
+{
+}
+
+int stats_conn_write(stats_conn_t *conn)
+{
+	stats_conn_close(conn);
+	return 0;
+}
+#endif	/* WIN32 */
+
+void stats_conn_close(stats_conn_t *conn)
+{
+	stats_conn_t	**pp;
+
+	for (pp = &stats_firstconn; *pp; pp = &(*pp)->next) {
+		if (*pp == conn) {
+			*pp = conn->next;
+			break;
+		}
+	}
+
+	if (VALID_FD_SOCK(conn->sock_fd)) {
+		close(conn->sock_fd);
+	}
+	free(conn->buf);
+	free(conn);
+}
+
+void stats_socket_close(void)
+{
+	while (stats_firstconn) {
+		stats_conn_close(stats_firstconn);
+	}
+
+	if (VALID_FD_SOCK(stats_socket_fd)) {
+		close(stats_socket_fd);
+		stats_socket_fd = ERROR_FD_SOCK;
+		if (stats_socket_path) {
+			unlink(stats_socket_path);
+		}
+	}
+}
+
+void stats_free(void)
+{
+	stats_socket_close();
+	free(stats_socket_path);
+	stats_socket_path = NULL;
+}
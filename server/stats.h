@@ -0,0 +1,139 @@
+/* stats.h - upsd performance counters
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+/* The counters are plain integers bumped from the single-threaded event
+ * loop; timings are taken with one clock read before and after the work
+ * they measure. They can be read with the "LIST STATS" protocol command,
+ * or in the OpenMetrics text format from the optional STATS_SOCKET (which
+ * also has the per-client figures).
+ */
+
+#ifndef NUT_UPSD_STATS_H_SEEN
+#define NUT_UPSD_STATS_H_SEEN 1
+
+#include "nut_stdint.h"
+#include "nut_ctype.h"
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* upper bounds (in microseconds) of the latency histogram buckets,
+ * the last bucket takes everything longer */
+#define STATS_HISTOGRAM_BUCKETS	12
+
+typedef struct stats_histogram_s {
+	uint64_t	count;
+	uint64_t	sum_usec;
+	uint64_t	max_usec;
+	uint64_t	bucket[STATS_HISTOGRAM_BUCKETS + 1];
+} stats_histogram_t;
+
+typedef struct upsd_stats_s {
+	time_t		started;
+
+	/* client connections and traffic */
+	uint64_t	clients_accepted;
+	uint64_t	clients_disconnected;
+	uint64_t	bytes_in;
+	uint64_t	bytes_out;
+	uint64_t	lines_in;
+	uint64_t	lines_out;
+	uint64_t	write_errors;
+	uint64_t	parse_errors;
+	uint64_t	unknown_commands;
+	uint64_t	denied_commands;
+
+	/* LIST VAR/RW/CMD replies sent as kept, or made again */
+	uint64_t	lists_cached;
+	uint64_t	lists_rendered;
+
+	/* driver sockets */
+	uint64_t	driver_connects;
+	uint64_t	driver_bytes;
+	uint64_t	driver_lines;
+	uint64_t	driver_parse_errors;
+
+	/* STARTTLS */
+	uint64_t	tls_failures;
+	stats_histogram_t	tls_handshake;
+
+	/* configuration reloads (SIGHUP) */
+	uint64_t	reload_failures;
+	stats_histogram_t	reload;
+
+	/* event loop: time spent in an iteration other than waiting in poll() */
+	uint64_t	poll_timeouts;
+	uint64_t	poll_wait_usec;	/* of the current iteration */
+	stats_histogram_t	loop_busy;
+} upsd_stats_t;
+
+extern upsd_stats_t	upsd_stats;
+
+/* monotonic timestamp in microseconds, for the differences below */
+uint64_t stats_now_usec(void);
+
+void stats_histogram_add(stats_histogram_t *hist, uint64_t usec);
+
+/* account one handled client command, "sub" is its first argument
+ * which is counted separately for the commands that have sub-commands
+ * (GET, LIST, ...); the start timestamp is from stats_now_usec() */
+void stats_command_done(const char *cmd, const char *sub, uint64_t start);
+
+/* account one event loop iteration which began at "start" */
+void stats_loop_done(uint64_t start);
+
+void stats_init(void);
+void stats_free(void);
+
+/* LIST STATS */
+void stats_list(nut_ctype_t *client);
+
+/* Local OpenMetrics exporter socket (STATS_SOCKET in upsd.conf): each
+ * connection gets a snapshot of the metrics, written out as the socket
+ * accepts it, and is then closed */
+typedef struct stats_conn_s {
+	TYPE_FD_SOCK	sock_fd;
+	char	*buf;
+	size_t	len;
+	size_t	sent;
+
+	struct stats_conn_s	*next;
+} stats_conn_t;
+
+extern char		*stats_socket_path;
+extern TYPE_FD_SOCK	stats_socket_fd;
+extern stats_conn_t	*stats_firstconn;
+
+/* from upsd.conf; can not change once the socket is open */
+void stats_socket_set(const char *path);
+void stats_socket_open(void);
+void stats_socket_close(void);
+void stats_socket_accept(void);
+/* returns 0 when done with (and closed) the connection */
+int stats_conn_write(stats_conn_t *conn);
+void stats_conn_close(stats_conn_t *conn);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_UPSD_STATS_H_SEEN */
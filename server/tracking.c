@@ -0,0 +1,287 @@
+/* tracking.c - upsd status tracking of instant commands and settings
+
+   Copyright (C)
+	2019		Eaton (author: Arnaud Quette <ArnaudQuette@eaton.com>)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#include "common.h"
+#include "nut_stdint.h"
+
+#include "tracking.h"
+
+/* general enable/disable status info for commands and settings
+ * (disabled by default)
+ * Note that only client that requested it will have it enabled
+ * (see nut_ctype.h) */
+static int	tracking_enabled = 0;
+
+/* Commands and settings status tracking structure */
+typedef struct tracking_s {
+	char	*id;
+	uint32_t	hash;
+	int	status;
+	time_t	request_time; /* for cleanup */
+
+	/* doubly linked list in the order of addition, which is also the
+	 * order of request_time, so the oldest entries are at the head */
+	struct tracking_s	*prev;
+	struct tracking_s	*next;
+
+	/* next entry in the same hash bucket */
+	struct tracking_s	*hnext;
+} tracking_t;
+
+static tracking_t	*tracking_head = NULL, *tracking_tail = NULL;
+
+/* IDs are compared case-insensitively, and hashed with str_hash_nocase();
+ * the table starts with this many buckets, doubled as entries come */
+#define TRACKING_HASH_MIN	64
+
+static tracking_t	**tracking_hash = NULL;
+static size_t	tracking_hashsize = 0;
+static size_t	tracking_num = 0;
+
+static void tracking_rehash(size_t newsize)
+{
+	tracking_t	**newhash, *item, *next_item;
+	size_t	i, bucket;
+
+	newhash = xcalloc(newsize, sizeof(*newhash));
+
+	for (i = 0; i < tracking_hashsize; i++) {
+		for (item = tracking_hash[i]; item; item = next_item) {
+			next_item = item->hnext;
+			bucket = item->hash & (newsize - 1);
+			item->hnext = newhash[bucket];
+			newhash[bucket] = item;
+		}
+	}
+
+	free(tracking_hash);
+	tracking_hash = newhash;
+	tracking_hashsize = newsize;
+}
+
+static tracking_t *tracking_find(const char *id)
+{
+	tracking_t	*item;
+	uint32_t	hash;
+
+	if (!tracking_num || !id)
+		return NULL;
+
+	hash = str_hash_nocase(id);
+
+	for (item = tracking_hash[hash & (tracking_hashsize - 1)]; item; item = item->hnext) {
+		if (item->hash == hash && !strcasecmp(item->id, id))
+			return item;
+	}
+
+	return NULL;
+}
+
+static void tracking_remove(tracking_t *item)
+{
+	tracking_t	**pp;
+
+	for (pp = &tracking_hash[item->hash & (tracking_hashsize - 1)]; *pp; pp = &(*pp)->hnext) {
+		if (*pp == item) {
+			*pp = item->hnext;
+			break;
+		}
+	}
+
+	if (item->prev)
+		item->prev->next = item->next;
+	else
+		/* deleting first entry */
+		tracking_head = item->next;
+
+	if (item->next)
+		item->next->prev = item->prev;
+	else
+		/* deleting last entry */
+		tracking_tail = item->prev;
+
+	tracking_num--;
+
+	free(item->id);
+	free(item);
+}
+
+/* allocate a new status tracking entry */
+int tracking_add(const char *id)
+{
+	tracking_t	*item;
+	size_t	bucket;
+
+	if ((!tracking_enabled) || (!id))
+		return 0;
+
+	if (tracking_num >= tracking_hashsize) {
+		tracking_rehash(tracking_hashsize ? tracking_hashsize * 2 : TRACKING_HASH_MIN);
+	}
+
+	item = xcalloc(1, sizeof(*item));
+
+	item->id = xstrdup(id);
+	item->hash = str_hash_nocase(id);
+	item->status = STAT_PENDING;
+	time(&item->request_time);
+
+	/* the newest entry of an ID (if reused) is found first */
+	bucket = item->hash & (tracking_hashsize - 1);
+	item->hnext = tracking_hash[bucket];
+	tracking_hash[bucket] = item;
+
+	if (tracking_tail) {
+		tracking_tail->next = item;
+		item->prev = tracking_tail;
+	} else {
+		tracking_head = item;
+	}
+
+	tracking_tail = item;
+	tracking_num++;
+
+	return 1;
+}
+
+/* set status of a specific tracking entry */
+int tracking_set(const char *id, const char *value)
+{
+	tracking_t	*item;
+
+	/* sanity checks */
+	if ((!id) || (!value))
+		return 0;
+
+	if ((item = tracking_find(id)) == NULL)
+		return 0; /* id not found! */
+
+	item->status = atoi(value);
+	return 1;
+}
+
+/* free a specific tracking entry */
+int tracking_del(const char *id)
+{
+	tracking_t	*item;
+
+	/* sanity check */
+	if (!id)
+		return 0;
+
+	upsdebugx(3, "%s: deleting id %s", __func__, id);
+
+	if ((item = tracking_find(id)) == NULL)
+		return 0; /* id not found! */
+
+	tracking_remove(item);
+	return 1;
+}
+
+/* free all status tracking entries */
+void tracking_free(void)
+{
+	tracking_t	*item, *next_item;
+
+	/* sanity check */
+	if (!tracking_hash)
+		return;
+
+	upsdebugx(3, "%s", __func__);
+
+	for (item = tracking_head; item; item = next_item) {
+		next_item = item->next;
+		free(item->id);
+		free(item);
+	}
+
+	free(tracking_hash);
+	tracking_hash = NULL;
+	tracking_hashsize = 0;
+	tracking_num = 0;
+	tracking_head = tracking_tail = NULL;
+}
+
+/* cleanup status tracking entries according to their age and tracking_delay;
+ * only the expired ones at the head of the list need to be looked at */
+void tracking_cleanup(void)
+{
+	time_t	now;
+
+	/* sanity check */
+	if (!tracking_head)
+		return;
+
+	time(&now);
+
+	while (tracking_head && difftime(now, tracking_head->request_time) > tracking_delay) {
+		upsdebugx(3, "%s: expiring id %s", __func__, tracking_head->id);
+		tracking_remove(tracking_head);
+	}
+}
+
+/* get status of a specific tracking entry */
+char *tracking_get(const char *id)
+{
+	tracking_t	*item;
+
+	/* sanity checks */
+	if ((item = tracking_find(id)) == NULL)
+		return "ERR UNKNOWN"; /* id not found! */
+
+	switch (item->status)
+	{
+	case STAT_PENDING:
+		return "PENDING";
+	case STAT_HANDLED:
+		return "SUCCESS";
+	case STAT_UNKNOWN:
+		return "ERR UNKNOWN";
+	case STAT_INVALID:
+	case STAT_CONVERSION_FAILED:
+		return "ERR INVALID-ARGUMENT";
+	case STAT_FAILED:
+		return "ERR FAILED";
+	default:
+		break;
+	}
+
+	return "ERR UNKNOWN";
+}
+
+/* number of status tracking entries currently kept */
+size_t tracking_count(void)
+{
+	return tracking_num;
+}
+
+/* enable general status tracking (tracking_enabled) and return its value (1). */
+int tracking_enable(void)
+{
+	tracking_enabled = 1;
+
+	return tracking_enabled;
+}
+
+/* return current general status of tracking (tracking_enabled). */
+int tracking_is_enabled(void)
+{
+	return tracking_enabled;
+}
@@ -0,0 +1,66 @@
+/* tracking.h - upsd status tracking of instant commands and settings
+
+   Copyright (C)
+	2019		Eaton (author: Arnaud Quette <ArnaudQuette@eaton.com>)
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*/
+
+#ifndef NUT_UPSD_TRACKING_H_SEEN
+#define NUT_UPSD_TRACKING_H_SEEN 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+extern "C" {
+/* *INDENT-ON* */
+#endif
+
+/* return values for instcmd / setvar status tracking,
+ * mapped on drivers/upshandler.h, apart from STAT_PENDING (initial state) */
+enum {
+   STAT_PENDING = -1,	/* not yet completed */
+   STAT_HANDLED = 0,	/* completed successfully (NUT_SUCCESS or "OK") */
+   STAT_UNKNOWN,	/* unspecified error (NUT_ERR_UNKNOWN) */
+   STAT_INVALID,	/* invalid command/setvar (NUT_ERR_INVALID_ARGUMENT) */
+   STAT_FAILED,		/* command/setvar failed (NUT_ERR_INSTCMD_FAILED / NUT_ERR_SET_FAILED) */
+   STAT_CONVERSION_FAILED	/* STAT_INSTCMD_CONVERSION_FAILED / STAT_SET_CONVERSION_FAILED in drivers/upshandler.h => "ERR INVALID-ARGUMENT" same as STAT_INVALID */
+};
+
+/* seconds to keep the entries for, from upsd.conf (TRACKINGDELAY) */
+extern int	tracking_delay;
+
+/* Commands and settings status tracking functions; the entries are
+ * found by a (case-insensitive) hash of their ID, and expire in the
+ * order they were added */
+int tracking_add(const char *id);
+int tracking_set(const char *id, const char *value);
+int tracking_del(const char *id);
+void tracking_free(void);
+void tracking_cleanup(void);
+char *tracking_get(const char *id);
+size_t tracking_count(void);
+int tracking_enable(void);
+int tracking_disable(void);	/* in upsd.c, looks at the clients */
+int tracking_is_enabled(void);
+
+#ifdef __cplusplus
+/* *INDENT-OFF* */
+}
+/* *INDENT-ON* */
+#endif
+
+#endif	/* NUT_UPSD_TRACKING_H_SEEN */
@@ -65,6 +65,7 @@
 #include "sstate.h"
 #include "desc.h"
 #include "neterr.h"
+#include "stats.h"
 
 #ifdef HAVE_WRAP
 #include <tcpd.h>
@@ -82,6 +83,9 @@ int	maxage = 15;
 /* default to 1h before cleaning up status tracking entries */
 int	tracking_delay = 3600;
 
+/* default to no limit of drivers (re)connected and dumping their data at once */
+int	max_concurrent_dumps = 0;
+
 /*
  * Preloaded to ALLOW_NO_DEVICE from upsd.conf or environment variable
  * (with higher prio for envvar); defaults to disabled for legacy compat.
@@ -117,7 +121,9 @@ static int 	opt_af = AF_UNSPEC;
 typedef enum {
 	DRIVER = 1,
 	CLIENT,
-	SERVER
+	SERVER,
+	STATS_SERVER,
+	STATS_CLIENT
 #ifdef WIN32
 	,NAMED_PIPE
 #endif	/* WIN32 */
@@ -129,26 +135,6 @@ typedef struct {
 	void		*data;
 } handler_t;
 
-/* Commands and settings status tracking */
-
-/* general enable/disable status info for commands and settings
- * (disabled by default)
- * Note that only client that requested it will have it enabled
- * (see nut_ctype.h) */
-static int	tracking_enabled = 0;
-
-/* Commands and settings status tracking structure */
-typedef struct tracking_s {
-	char	*id;
-	int	status;
-	time_t	request_time; /* for cleanup */
-	/* doubly linked list */
-	struct tracking_s	*prev;
-	struct tracking_s	*next;
-} tracking_t;
-
-static tracking_t	*tracking_list = NULL;
-
 #ifndef WIN32
 	/* pollfd  */
 static struct pollfd	*fds = NULL;
@@ -557,6 +543,8 @@ static void client_disconnect(nut_ctype_t *client)
 
 	upsdebugx(2, "Disconnect from %s", client->addr);
 
+	upsd_stats.clients_disconnected++;
+
 	shutdown(client->sock_fd, 2);
 	close(client->sock_fd);
 
@@ -595,25 +583,12 @@ static void client_disconnect(nut_ctype_t *client)
 	return;
 }
 
-/* send the buffer <sendbuf> of length <sendlen> to host <dest>
+/* write <len> bytes of <buf> to <client>, accounting them as <lines> lines
  * returns effectively a boolean: 0 = failed, 1 = sent ok
  */
-int sendback(nut_ctype_t *client, const char *fmt, ...)
+static int send_to_client(nut_ctype_t *client, const char *buf, size_t len, size_t lines)
 {
 	ssize_t	res;
-	size_t	len;
-	char	ans[NUT_NET_ANSWER_MAX+1];
-	va_list	ap;
-
-	if (!client) {
-		return 0;
-	}
-
-	va_start(ap, fmt);
-	vsnprintf(ans, sizeof(ans), fmt, ap);
-	va_end(ap);
-
-	len = strlen(ans);
 
 	/* System write() and our ssl_write() have a loophole that they write a
 	 * size_t amount of bytes and upon success return that in ssize_t value
@@ -622,27 +597,68 @@ int sendback(nut_ctype_t *client, const char *fmt, ...)
 
 #ifdef WITH_SSL
 	if (client->ssl) {
-		res = ssl_write(client, ans, len);
+		res = ssl_write(client, buf, len);
 	} else
 #endif /* WITH_SSL */
 	{
-		res = write(client->sock_fd, ans, len);
-	}
-
-	{ /* scoping */
-		char * s = str_rtrim(ans, '\n');
-		upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%s]", client->sock_fd, len, s);
+		res = write(client->sock_fd, buf, len);
 	}
 
 	if (res < 0 || len != (size_t)res) {
 		upslog_with_errno(LOG_NOTICE, "write() failed for %s", client->addr);
+		upsd_stats.write_errors++;
 		client->last_heard = 0;
 		return 0;	/* failed */
 	}
 
+	upsd_stats.bytes_out += len;
+	upsd_stats.lines_out += lines;
+	client->stats_bytes_out += len;
+
 	return 1;	/* OK */
 }
 
+/* send the formatted line to <client>
+ * returns effectively a boolean: 0 = failed, 1 = sent ok
+ */
+int sendback(nut_ctype_t *client, const char *fmt, ...)
+{
+	size_t	len;
+	char	ans[NUT_NET_ANSWER_MAX+1];
+	va_list	ap;
+
+	if (!client) {
+		return 0;
+	}
+
+	va_start(ap, fmt);
+	vsnprintf(ans, sizeof(ans), fmt, ap);
+	va_end(ap);
+
+	len = strlen(ans);
+
+	upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%.*s]", client->sock_fd, len,
+		(int)((len > 0 && ans[len - 1] == '\n') ? len - 1 : len), ans);
+
+	return send_to_client(client, ans, len, 1);
+}
+
+/* send <lines> complete lines already formatted in <buf> at once, so a
+ * multi-line reply leaves in as few packets as the network allows
+ * returns effectively a boolean: 0 = failed, 1 = sent ok
+ */
+int sendback_buf(nut_ctype_t *client, const char *buf, size_t len, size_t lines)
+{
+	if (!client) {
+		return 0;
+	}
+
+	upsdebugx(2, "write: [destfd=%d] [len=%" PRIuSIZE "] [%" PRIuSIZE " lines]",
+		client->sock_fd, len, lines);
+
+	return send_to_client(client, buf, len, lines);
+}
+
 /* just a simple wrapper for now */
 int send_err(nut_ctype_t *client, const char *errtype)
 {
@@ -677,27 +693,37 @@ void kick_login_clients(const char *upsname)
 }
 
 /* make sure a UPS is sane - connected, with fresh data */
-int ups_available(const upstype_t *ups, nut_ctype_t *client)
+/* the error why the data of <ups> can not be served, or NULL if it can */
+const char *ups_unavailable(const upstype_t *ups)
 {
 	if (!ups) {
 		/* Should never happen, but handle this
 		 * just in case instead of segfaulting */
 		upsdebugx(1, "%s: ERROR, called with a NULL ups pointer", __func__);
-		send_err(client, NUT_ERR_FEATURE_NOT_SUPPORTED);
-		return 0;
+		return NUT_ERR_FEATURE_NOT_SUPPORTED;
 	}
 
 	if (INVALID_FD(ups->sock_fd)) {
-		send_err(client, NUT_ERR_DRIVER_NOT_CONNECTED);
-		return 0;
+		return NUT_ERR_DRIVER_NOT_CONNECTED;
 	}
 
 	if (ups->stale) {
-		send_err(client, NUT_ERR_DATA_STALE);
-		return 0;
+		return NUT_ERR_DATA_STALE;
 	}
 
 	/* must be OK */
+	return NULL;
+}
+
+int ups_available(const upstype_t *ups, nut_ctype_t *client)
+{
+	const char	*err = ups_unavailable(ups);
+
+	if (err) {
+		send_err(client, err);
+		return 0;
+	}
+
 	return 1;
 }
 
@@ -705,6 +731,8 @@ int ups_available(const upstype_t *ups, nut_ctype_t *client)
 static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
 	const char **arg)
 {
+	uint64_t	start;
+
 	upsdebugx(6, "Entering %s: %s", __func__, numarg > 0 ? arg[0] : "<>");
 
 	if (netcmds[cmdnum].flags & FLAG_USER) {
@@ -715,12 +743,14 @@ static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
 
 		if (!client->username) {
 			upsdebugx(1, "%s: client not logged in yet", __func__);
+			upsd_stats.denied_commands++;
 			send_err(client, NUT_ERR_USERNAME_REQUIRED);
 			return;
 		}
 
 		if (!client->password) {
 			upsdebugx(1, "%s: client not logged in yet", __func__);
+			upsd_stats.denied_commands++;
 			send_err(client, NUT_ERR_PASSWORD_REQUIRED);
 			return;
 		}
@@ -734,6 +764,7 @@ static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
 				"%s: while authenticating %s found that "
 				"tcp-wrappers says access should be denied",
 				__func__, client->username);
+			upsd_stats.denied_commands++;
 			send_err(client, NUT_ERR_ACCESS_DENIED);
 			return;
 		}
@@ -743,7 +774,11 @@ static void check_command(int cmdnum, nut_ctype_t *client, size_t numarg,
 	upsdebugx(6, "%s: Calling command handler for %s", __func__, numarg > 0 ? arg[0] : "<>");
 
 	/* looks good - call the command */
+	start = stats_now_usec();
 	netcmds[cmdnum].func(client, (numarg < 2) ? 0 : (numarg - 1), (numarg > 1) ? &arg[1] : NULL);
+	stats_command_done(netcmds[cmdnum].name,
+		((netcmds[cmdnum].flags & FLAG_SUBCMD) && numarg > 1) ? arg[1] : NULL,
+		start);
 }
 
 /* parse requests from the network */
@@ -766,6 +801,7 @@ static void parse_net(nut_ctype_t *client)
 
 	/* fallthrough = not matched by any entry in netcmds */
 
+	upsd_stats.unknown_commands++;
 	send_err(client, NUT_ERR_UNKNOWN_COMMAND);
 }
 
@@ -798,6 +834,8 @@ static void client_connect(stype_t *server)
 
 	client->tracking = 0;
 
+	upsd_stats.clients_accepted++;
+
 #ifdef WIN32
 	client->Event = CreateEvent(NULL, /* Security, */
 				FALSE,    /* auto-reset */
@@ -832,8 +870,8 @@ static void client_connect(stype_t *server)
 static void client_readline(nut_ctype_t *client)
 {
 	char	buf[SMALLBUF];
-	int	i;
-	ssize_t	ret;
+	ssize_t	i, ret;
+	size_t	used;
 
 #ifdef WITH_SSL
 	if (client->ssl) {
@@ -856,15 +894,26 @@ static void client_readline(nut_ctype_t *client)
 		return;
 	}
 
+	upsd_stats.bytes_in += (uint64_t)ret;
+	client->stats_bytes_in += (uint64_t)ret;
+
 	/* fragment handling code */
-	for (i = 0; i < ret; i++) {
+	for (i = 0; i < ret; i += (ssize_t)used) {
 
-		/* add to the receive queue one by one */
-		switch (pconf_char(&client->ctx, buf[i]))
+		/* add to the receive queue up to the end of a line */
+		switch (pconf_buf(&client->ctx, buf + i, (size_t)(ret - i), &used))
 		{
 		case 1:
 			time(&client->last_heard);	/* command received */
+			upsd_stats.lines_in++;
+			client->stats_commands++;
 			parse_net(client);
+
+			/* the rest of this read is not for the plain text
+			 * protocol once the client is to be dropped (after
+			 * LOGOUT or a failed STARTTLS) or a TLS handshake began */
+			if (client->last_heard == 0 || client->ssl_handshaking)
+				return;
 			continue;
 
 		case 0:
@@ -872,6 +921,7 @@ static void client_readline(nut_ctype_t *client)
 
 		default:
 			/* parse error */
+			upsd_stats.parse_errors++;
 			upslogx(LOG_NOTICE, "Parse error on sock: %s", client->ctx.errmsg);
 			return;
 		}
@@ -1069,6 +1119,7 @@ static void driver_free(void)
 
 		sstate_infofree(ups);
 		sstate_cmdfree(ups);
+		sstate_genfree(ups);
 
 		pconf_finish(&ups->sock_ctx);
 
@@ -1096,6 +1147,7 @@ static void upsd_cleanup(void)
 	client_free();
 	driver_free();
 	tracking_free();
+	stats_free();
 
 	free(statepath);
 	free(datapath);
@@ -1156,175 +1208,6 @@ static void poll_reload(void)
 
 /* instant command and setvar status tracking */
 
-/* allocate a new status tracking entry */
-int tracking_add(const char *id)
-{
-	tracking_t	*item;
-
-	if ((!tracking_enabled) || (!id))
-		return 0;
-
-	item = xcalloc(1, sizeof(*item));
-
-	item->id = xstrdup(id);
-	item->status = STAT_PENDING;
-	time(&item->request_time);
-
-	if (tracking_list) {
-		tracking_list->prev = item;
-		item->next = tracking_list;
-	}
-
-	tracking_list = item;
-
-	return 1;
-}
-
-/* set status of a specific tracking entry */
-int tracking_set(const char *id, const char *value)
-{
-	tracking_t	*item, *next_item;
-
-	/* sanity checks */
-	if ((!tracking_list) || (!id) || (!value))
-		return 0;
-
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (!strcasecmp(item->id, id)) {
-			item->status = atoi(value);
-			return 1;
-		}
-	}
-
-	return 0; /* id not found! */
-}
-
-/* free a specific tracking entry */
-int tracking_del(const char *id)
-{
-	tracking_t	*item, *next_item;
-
-	/* sanity check */
-	if ((!tracking_list) || (!id))
-		return 0;
-
-	upsdebugx(3, "%s: deleting id %s", __func__, id);
-
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (strcasecmp(item->id, id))
-			continue;
-
-		if (item->prev)
-			item->prev->next = item->next;
-		else
-			/* deleting first entry */
-			tracking_list = item->next;
-
-		if (item->next)
-			item->next->prev = item->prev;
-
-		free(item->id);
-		free(item);
-
-		return 1;
-
-	}
-
-	return 0; /* id not found! */
-}
-
-/* free all status tracking entries */
-void tracking_free(void)
-{
-	tracking_t	*item, *next_item;
-
-	/* sanity check */
-	if (!tracking_list)
-		return;
-
-	upsdebugx(3, "%s", __func__);
-
-	for (item = tracking_list; item; item = next_item) {
-		next_item = item->next;
-		tracking_del(item->id);
-	}
-}
-
-/* cleanup status tracking entries according to their age and tracking_delay */
-void tracking_cleanup(void)
-{
-	tracking_t	*item, *next_item;
-	time_t	now;
-
-	/* sanity check */
-	if (!tracking_list)
-		return;
-
-	time(&now);
-
-	upsdebugx(3, "%s", __func__);
-
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (difftime(now, item->request_time) > tracking_delay) {
-			tracking_del(item->id);
-		}
-	}
-}
-
-/* get status of a specific tracking entry */
-char *tracking_get(const char *id)
-{
-	tracking_t	*item, *next_item;
-
-	/* sanity checks */
-	if ((!tracking_list) || (!id))
-		return "ERR UNKNOWN";
-
-	for (item = tracking_list; item; item = next_item) {
-
-		next_item = item->next;
-
-		if (strcasecmp(item->id, id))
-			continue;
-
-		switch (item->status)
-		{
-		case STAT_PENDING:
-			return "PENDING";
-		case STAT_HANDLED:
-			return "SUCCESS";
-		case STAT_UNKNOWN:
-			return "ERR UNKNOWN";
-		case STAT_INVALID:
-		case STAT_CONVERSION_FAILED:
-			return "ERR INVALID-ARGUMENT";
-		case STAT_FAILED:
-			return "ERR FAILED";
-		default:
-			break;
-		}
-	}
-
-	return "ERR UNKNOWN"; /* id not found! */
-}
-
-/* enable general status tracking (tracking_enabled) and return its value (1). */
-int tracking_enable(void)
-{
-	tracking_enabled = 1;
-
-	return tracking_enabled;
-}
-
 /* disable general status tracking only if no client use it anymore.
  * return the new value for tracking_enabled */
 int tracking_disable(void)
@@ -1339,12 +1222,6 @@ int tracking_disable(void)
 	return 0;
 }
 
-/* return current general status of tracking (tracking_enabled). */
-int tracking_is_enabled(void)
-{
-	return tracking_enabled;
-}
-
 /* UUID v4 basic implementation
  * Note: 'dest' must be at least `UUID4_LEN` long */
 int nut_uuid_v4(char *uuid_str)
@@ -1394,9 +1271,14 @@ static void mainloop(void)
 
 	nfds_t	nfds = 0;
 	upstype_t	*ups;
+	size_t	dumps;
 	nut_ctype_t		*client, *cnext;
 	stype_t		*server;
 	time_t	now;
+	uint64_t	wait_start;
+#ifndef WIN32
+	stats_conn_t	*sconn, *snext;
+#endif	/* !WIN32 */
 
 	upsnotify(NOTIFY_STATE_WATCHDOG, NULL);
 
@@ -1415,10 +1297,18 @@ static void mainloop(void)
 
 #ifndef WIN32
 	/* scan through driver sockets */
+	dumps = sstate_dumps_in_progress();
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
 
 		/* see if we need to (re)connect to the socket */
 		if (INVALID_FD(ups->sock_fd)) {
+			if (max_concurrent_dumps > 0 && dumps >= (size_t)max_concurrent_dumps) {
+				upsdebugx(2, "%s: UPS [%s] is not currently connected, "
+					"but %" PRIuSIZE " drivers are dumping their data now",
+					__func__, ups->name, dumps);
+				continue;
+			}
+
 			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
 				"trying to reconnect",
 				__func__, ups->name);
@@ -1429,6 +1319,7 @@ static void mainloop(void)
 			} else {
 				upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
 					__func__, ups->name, ups->sock_fd);
+				dumps++;
 			}
 			continue;
 		}
@@ -1469,6 +1360,20 @@ static void mainloop(void)
 		fds[nfds].fd = client->sock_fd;
 		fds[nfds].events = POLLIN;
 
+#ifdef WITH_SSL
+		if (client->ssl_handshaking) {
+			if (difftime(now, client->ssl_handshake_deadline) > 0) {
+				upslogx(LOG_NOTICE, "TLS handshake with %s timed out", client->addr);
+				upsd_stats.tls_failures++;
+				client_disconnect(client);
+				continue;
+			}
+
+			if (client->ssl_want_write)
+				fds[nfds].events = POLLOUT;
+		}
+#endif	/* WITH_SSL */
+
 		handler[nfds].type = CLIENT;
 		handler[nfds].data = client;
 
@@ -1491,12 +1396,43 @@ static void mainloop(void)
 		nfds++;
 	}
 
+	/* statistics exporter socket, and its connections still being written to */
+	if (VALID_FD_SOCK(stats_socket_fd) && nfds < maxconn) {
+		fds[nfds].fd = stats_socket_fd;
+		fds[nfds].events = POLLIN;
+
+		handler[nfds].type = STATS_SERVER;
+		handler[nfds].data = NULL;
+
+		nfds++;
+	}
+
+	for (sconn = stats_firstconn; sconn; sconn = snext) {
+		snext = sconn->next;
+
+		if (nfds >= maxconn) {
+			stats_conn_close(sconn);
+			continue;
+		}
+
+		fds[nfds].fd = sconn->sock_fd;
+		fds[nfds].events = POLLOUT;
+
+		handler[nfds].type = STATS_CLIENT;
+		handler[nfds].data = sconn;
+
+		nfds++;
+	}
+
 	upsdebugx(2, "%s: polling %" PRIdMAX " filedescriptors", __func__, (intmax_t)nfds);
 
+	wait_start = stats_now_usec();
 	ret = poll(fds, nfds, 2000);
+	upsd_stats.poll_wait_usec = stats_now_usec() - wait_start;
 
 	if (ret == 0) {
 		upsdebugx(2, "%s: no data available", __func__);
+		upsd_stats.poll_timeouts++;
 		return;
 	}
 
@@ -1520,6 +1456,12 @@ static void mainloop(void)
 			case SERVER:
 				upsdebugx(2, "%s: server disconnected", __func__);
 				break;
+			case STATS_SERVER:
+				upsdebugx(2, "%s: statistics socket disconnected", __func__);
+				break;
+			case STATS_CLIENT:
+				stats_conn_close((stats_conn_t *)handler[i].data);
+				break;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
@@ -1555,6 +1497,20 @@ static void mainloop(void)
 			continue;
 		}
 
+#ifdef WITH_SSL
+		/* STARTTLS handshake still in progress, take the next step */
+		if (handler[i].type == CLIENT
+		&&  ((nut_ctype_t *)handler[i].data)->ssl_handshaking
+		) {
+			if ((fds[i].revents & (POLLIN|POLLOUT))
+			&&  ssl_handshake((nut_ctype_t *)handler[i].data) < 0
+			) {
+				client_disconnect((nut_ctype_t *)handler[i].data);
+			}
+			continue;
+		}
+#endif	/* WITH_SSL */
+
 		if (fds[i].revents & POLLIN) {
 
 			switch(handler[i].type)
@@ -1568,6 +1524,9 @@ static void mainloop(void)
 			case SERVER:
 				client_connect((stype_t *)handler[i].data);
 				break;
+			case STATS_SERVER:
+				stats_socket_accept();
+				break;
 
 #if (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_PUSH_POP) && ( (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_COVERED_SWITCH_DEFAULT) || (defined HAVE_PRAGMA_GCC_DIAGNOSTIC_IGNORED_UNREACHABLE_CODE) )
 # pragma GCC diagnostic push
@@ -1601,13 +1560,25 @@ static void mainloop(void)
 
 			continue;
 		}
+
+		if ((fds[i].revents & POLLOUT) && handler[i].type == STATS_CLIENT) {
+			stats_conn_write((stats_conn_t *)handler[i].data);
+		}
 	}
 #else	/* WIN32 */
 	/* scan through driver sockets */
+	dumps = sstate_dumps_in_progress();
 	for (ups = firstups; ups && (nfds < maxconn); ups = ups->next) {
 
 		/* see if we need to (re)connect to the socket */
 		if (INVALID_FD(ups->sock_fd)) {
+			if (max_concurrent_dumps > 0 && dumps >= (size_t)max_concurrent_dumps) {
+				upsdebugx(2, "%s: UPS [%s] is not currently connected, "
+					"but %" PRIuSIZE " drivers are dumping their data now",
+					__func__, ups->name, dumps);
+				continue;
+			}
+
 			upsdebugx(1, "%s: UPS [%s] is not currently connected, "
 				"trying to reconnect",
 				__func__, ups->name);
@@ -1618,6 +1589,7 @@ static void mainloop(void)
 			} else {
 				upsdebugx(1, "%s: UPS [%s] is now connected as FD %d",
 					__func__, ups->name, ups->sock_fd);
+				dumps++;
 			}
 			continue;
 		}
@@ -1695,12 +1667,15 @@ static void mainloop(void)
 	upsdebugx(2, "%s: wait for %d filedescriptors", __func__, nfds);
 
 	/* https://docs.microsoft.com/en-us/windows/win32/api/synchapi/nf-synchapi-waitformultipleobjects */
+	wait_start = stats_now_usec();
 	ret = WaitForMultipleObjects(nfds,fds,FALSE,2000);
+	upsd_stats.poll_wait_usec = stats_now_usec() - wait_start;
 
 	upsdebugx(6, "%s: wait for filedescriptors done: %" PRIu64, __func__, ret);
 
 	if (ret == WAIT_TIMEOUT) {
 		upsdebugx(2, "%s: no data available", __func__);
+		upsd_stats.poll_timeouts++;
 		return;
 	}
 
@@ -2164,6 +2139,8 @@ int main(int argc, char **argv)
 
 	atexit(upsd_cleanup);
 
+	stats_init();
+
 	setup_signals();
 
 	open_syslog(progname);
@@ -2258,6 +2235,9 @@ int main(int argc, char **argv)
 	/* check statepath perms */
 	check_perms(statepath);
 
+	/* relative to the statepath, like the driver sockets */
+	stats_socket_open();
+
 	/* handle ups.conf */
 	read_upsconf(1);	/* 1 = may abort upon fundamental errors */
 	upsconf_add(0);		/* 0 = initial */
@@ -2298,8 +2278,11 @@ int main(int argc, char **argv)
 	upsnotify(NOTIFY_STATE_READY_WITH_PID, NULL);
 
 	while (!exit_flag) {
+		uint64_t	start = stats_now_usec();
+
 		/* Note: mainloop() calls upsnotify(NOTIFY_STATE_WATCHDOG, NULL); */
 		mainloop();
+		stats_loop_done(start);
 	}
 
 	upslogx(LOG_INFO, "Signal %d: exiting", exit_flag);
@@ -49,6 +49,7 @@ typedef unsigned long int nfds_t;
 #include "parseconf.h"
 #include "nut_ctype.h"
 #include "upstype.h"
+#include "tracking.h"
 
 #define NUT_NET_ANSWER_MAX SMALLBUF
 
@@ -62,12 +63,14 @@ extern "C" {
 
 upstype_t *get_ups_ptr(const char *upsname);
 int ups_available(const upstype_t *ups, nut_ctype_t *client);
+const char *ups_unavailable(const upstype_t *ups);
 
 void listen_add(const char *addr, const char *port);
 
 void kick_login_clients(const char *upsname);
 int sendback(nut_ctype_t *client, const char *fmt, ...)
 	__attribute__ ((__format__ (__printf__, 2, 3)));
+int sendback_buf(nut_ctype_t *client, const char *buf, size_t len, size_t lines);
 int send_err(nut_ctype_t *client, const char *errtype);
 
 void server_load(void);
@@ -75,30 +78,9 @@ void server_free(void);
 
 void check_perms(const char *fn);
 
-/* return values for instcmd / setvar status tracking,
- * mapped on drivers/upshandler.h, apart from STAT_PENDING (initial state) */
-enum {
-   STAT_PENDING = -1,	/* not yet completed */
-   STAT_HANDLED = 0,	/* completed successfully (NUT_SUCCESS or "OK") */
-   STAT_UNKNOWN,	/* unspecified error (NUT_ERR_UNKNOWN) */
-   STAT_INVALID,	/* invalid command/setvar (NUT_ERR_INVALID_ARGUMENT) */
-   STAT_FAILED,		/* command/setvar failed (NUT_ERR_INSTCMD_FAILED / NUT_ERR_SET_FAILED) */
-   STAT_CONVERSION_FAILED	/* STAT_INSTCMD_CONVERSION_FAILED / STAT_SET_CONVERSION_FAILED in drivers/upshandler.h => "ERR INVALID-ARGUMENT" same as STAT_INVALID */
-};
-
-/* Commands and settings status tracking functions */
-int tracking_add(const char *id);
-int tracking_set(const char *id, const char *value);
-int tracking_del(const char *id);
-void tracking_free(void);
-void tracking_cleanup(void);
-char *tracking_get(const char *id);
-int tracking_enable(void);
-int tracking_disable(void);
-int tracking_is_enabled(void);
-
 /* declarations from upsd.c */
 extern int		maxage, tracking_delay, allow_no_device, allow_not_all_listeners;
+extern int		max_concurrent_dumps;
 extern nfds_t		maxconn;
 extern char		*statepath, *datapath;
 extern upstype_t	*firstups;
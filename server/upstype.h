@@ -31,6 +31,16 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
+/* a LIST VAR, LIST RW or LIST CMD reply as last sent (see netlist.c),
+ * reused until the data it was made from changes */
+typedef struct listcache_s {
+	char	*buf;
+	size_t	len;	/* of the reply */
+	size_t	size;	/* of buf */
+	size_t	lines;
+	int	valid;
+} listcache_t;
+
 /* structure for the linked list of each UPS that we track */
 typedef struct upstype_s {
 	char			*name;
@@ -51,11 +61,29 @@ typedef struct upstype_s {
 	struct st_tree_s	*inforoot;
 	struct cmdlist_s	*cmdlist;
 
+	/* replies to LIST VAR, LIST RW and LIST CMD for this UPS */
+	listcache_t		list_var;
+	listcache_t		list_rw;
+	listcache_t		list_cmd;
+
+	/* Generation of the last complete dump reported by the driver
+	 * (DUMPGEN), and the data kept from the previous connection
+	 * to ask only for what changed since then (DUMPALL GEN) */
+	char			*dumpgen;
+	struct st_tree_s	*gen_inforoot;
+	struct cmdlist_s	*gen_cmdlist;
+
 	int	numlogins;
 	int	fsd;		/* forced shutdown in effect? */
 
 	int	retain;
 
+	/* driver socket counters, see stats.h */
+	uint64_t	stats_connects;
+	uint64_t	stats_bytes;
+	uint64_t	stats_lines;
+	uint64_t	stats_parse_errors;
+
 	struct upstype_s	*next;
 
 } upstype_t;
@@ -466,10 +466,80 @@ static void upsd_user_err(const char *errmsg)
 	upslogx(LOG_ERR, "Fatal error in parseconf(upsd.users): %s", errmsg);
 }
 
-void user_load(void)
+static int user_samecmds(instcmdlist_t *a, instcmdlist_t *b)
+{
+	for (; a && b; a = a->next, b = b->next) {
+		if (strcasecmp(a->cmd, b->cmd)) {
+			return 0;
+		}
+	}
+
+	return (a == b);
+}
+
+static int user_sameactions(actionlist_t *a, actionlist_t *b)
+{
+	for (; a && b; a = a->next, b = b->next) {
+		if (strcasecmp(a->action, b->action)) {
+			return 0;
+		}
+	}
+
+	return (a == b);
+}
+
+/* log how the users in "newlist" differ from those in "oldlist";
+ * the user names are unique in either, and usually in the same order */
+static void user_diff(ulist_t *oldlist, ulist_t *newlist)
+{
+	ulist_t	*o, *n, *hint = oldlist;
+	int	added = 0, changed = 0, numold = 0, numnew = 0;
+
+	for (o = oldlist; o != NULL; o = o->next) {
+		numold++;
+	}
+
+	for (n = newlist; n != NULL; n = n->next) {
+		numnew++;
+
+		if (hint && !strcmp(hint->username, n->username)) {
+			o = hint;
+		} else {
+			for (o = oldlist; o != NULL; o = o->next) {
+				if (!strcmp(o->username, n->username)) {
+					break;
+				}
+			}
+		}
+
+		if (!o) {
+			added++;
+			continue;
+		}
+
+		hint = o->next;
+
+		if ((!o->password) != (!n->password)
+		 || (o->password && strcmp(o->password, n->password))
+		 || !user_samecmds(o->firstcmd, n->firstcmd)
+		 || !user_sameactions(o->firstaction, n->firstaction)
+		) {
+			changed++;
+		}
+	}
+
+	upslogx(LOG_INFO, "upsd.users: %d user(s) added, %d changed, %d removed",
+		added, changed, numold - (numnew - added));
+}
+
+/* read upsd.users into a new list of users, which replaces the current
+ * one (if any) only once the file was read, so that a failed reload
+ * leaves the users known so far in place */
+int user_load(void)
 {
 	char	fn[NUT_PATH_MAX];
 	PCONF_CTX_t	ctx;
+	ulist_t	*oldusers = users;
 
 	curr_user = NULL;
 
@@ -484,9 +554,12 @@ void user_load(void)
 		pconf_finish(&ctx);
 
 		upslogx(LOG_WARNING, "%s", ctx.errmsg);
-		return;
+		return 0;
 	}
 
+	/* user_add() and friends fill the new list */
+	users = NULL;
+
 	while (pconf_file_next(&ctx)) {
 
 		if (pconf_parse_error(&ctx)) {
@@ -499,4 +572,13 @@ void user_load(void)
 	}
 
 	pconf_finish(&ctx);
+
+	curr_user = NULL;
+
+	if (oldusers) {
+		user_diff(oldusers, users);
+		flushuser(oldusers);
+	}
+
+	return 1;
 }
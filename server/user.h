@@ -31,7 +31,8 @@ extern "C" {
 /* *INDENT-ON* */
 #endif
 
-void user_load(void);
+/* returns 0 if upsd.users could not be read, and the users are kept */
+int user_load(void);
 
 int user_checkinstcmd(const char *un, const char *pw, const char *cmd);
 int user_checkaction(const char *un, const char *pw, const char *action);
@@ -27,6 +27,10 @@
 #			script can anyway choose to `mktemp` another)
 #	NUT_DEBUG_UPSMON_NOTIFY_SYSLOG=false	To *disable* upsmon
 #			notifications spilling to the script's console.
+#	BENCH_DEVICES=100 BENCH_CLIENTS=100 BENCH_DURATION=10
+#	BENCH_UPDATE_RATE=1 BENCH_MIX=80:15:5	sizes for the
+#			NIT_CASE=testgroup_bench_upsd benchmark (not run
+#			by default, see "make bench-upsd")
 #
 # Common sandbox run for testing goes from NUT root build directory like:
 #	DEBUG_SLEEP=600 NUT_PORT=12345 NIT_CASE=testcase_sandbox_start_drivers_after_upsd NUT_FOREGROUND_WITH_PID=true make check-NIT &
@@ -318,6 +322,8 @@ PID_UPSSCHED=""
 PID_DUMMYUPS=""
 PID_DUMMYUPS1=""
 PID_DUMMYUPS2=""
+PID_FAILOVER=""
+PID_REPEATER=""
 
 # Stash it for some later decisions
 TESTDIR_CALLER="${TESTDIR-}"
@@ -399,10 +405,10 @@ stop_daemons() {
         PID_UPSSCHED_NOW="`head -1 "$NUT_PIDPATH/upssched.pid"`"
     fi
 
-    if [ -n "$PID_UPSD$PID_UPSMON$PID_DUMMYUPS$PID_DUMMYUPS1$PID_DUMMYUPS2$PID_UPSSCHED$PID_UPSSCHED_NOW" ] ; then
+    if [ -n "$PID_UPSD$PID_UPSMON$PID_DUMMYUPS$PID_DUMMYUPS1$PID_DUMMYUPS2$PID_FAILOVER$PID_REPEATER$PID_UPSSCHED$PID_UPSSCHED_NOW" ] ; then
         log_info "Stopping test daemons"
-        kill -15 $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW 2>/dev/null || return 0
-        wait $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_UPSSCHED $PID_UPSSCHED_NOW || true
+        kill -15 $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_FAILOVER $PID_REPEATER $PID_UPSSCHED $PID_UPSSCHED_NOW 2>/dev/null || return 0
+        wait $PID_UPSD $PID_UPSMON $PID_DUMMYUPS $PID_DUMMYUPS1 $PID_DUMMYUPS2 $PID_FAILOVER $PID_REPEATER $PID_UPSSCHED $PID_UPSSCHED_NOW || true
     fi
 
     PID_UPSD=""
@@ -411,6 +417,7 @@ stop_daemons() {
     PID_DUMMYUPS=""
     PID_DUMMYUPS1=""
     PID_DUMMYUPS2=""
+    PID_FAILOVER=""
 
     unset PID_UPSSCHED_NOW
 }
@@ -994,6 +1001,136 @@ testgroup_upsd_questionable_configs() {
     testcase_upsd_allow_no_device
 }
 
+testcase_upsd_starttls() {
+    # The TLS handshake after STARTTLS is driven by the upsd main loop:
+    # tests/nutstarttls checks it does not hold up other clients, that
+    # failed and stalled handshakes get the client dropped, and that
+    # a completed one works
+    log_separator
+    log_info "[testcase_upsd_starttls] Test STARTTLS handshakes with UPSD"
+
+    if [ x"${TOP_BUILDDIR}" = x ] \
+    || [ ! -x "${TOP_BUILDDIR}/tests/nutstarttls" ] \
+    ; then
+        log_warn "[testcase_upsd_starttls] SKIP: needs the build tree with tests/nutstarttls"
+        return 0
+    fi
+
+    if ! (command -v openssl) >/dev/null 2>/dev/null ; then
+        log_warn "[testcase_upsd_starttls] SKIP: needs the openssl program to make a certificate"
+        return 0
+    fi
+
+    generatecfg_upsd_nodev
+    generatecfg_upsdusers_trivial
+    generatecfg_ups_trivial
+
+    # A self-signed certificate and its key, in one file for OpenSSL builds
+    # (NSS builds would need a database there, and the test is skipped)
+    openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj "/CN=localhost" \
+        -keyout "$NUT_CONFPATH/upsd.key" -out "$NUT_CONFPATH/upsd.crt" >/dev/null 2>/dev/null \
+    && cat "$NUT_CONFPATH/upsd.crt" "$NUT_CONFPATH/upsd.key" > "$NUT_CONFPATH/upsd.pem" \
+    && echo "CERTFILE $NUT_CONFPATH/upsd.pem" >> "$NUT_CONFPATH/upsd.conf" \
+    || die "Failed to populate temporary FS structure for the NIT: upsd.pem"
+
+    if [ "`id -u`" = 0 ]; then
+        chmod 644 "$NUT_CONFPATH/upsd.pem"
+    else
+        chmod 640 "$NUT_CONFPATH/upsd.pem"
+    fi
+
+    if ! upsd_start_loop "testcase_upsd_starttls" ; then
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_upsd_starttls"
+        return 1
+    fi
+
+    runcmd "${TOP_BUILDDIR}/tests/nutstarttls" -p "$NUT_PORT" || true
+    case "$CMDRES" in
+        0)
+            log_info "[testcase_upsd_starttls] PASSED: handshakes went as expected"
+            PASSED="`expr $PASSED + 1`"
+            ;;
+        77)
+            log_warn "[testcase_upsd_starttls] SKIP: upsd could not use the certificate (not an OpenSSL build?)"
+            ;;
+        *)
+            echo "$CMDOUT"
+            log_error "[testcase_upsd_starttls] FAILED: see the checks above"
+            FAILED="`expr $FAILED + 1`"
+            FAILED_FUNCS="$FAILED_FUNCS testcase_upsd_starttls"
+            ;;
+    esac
+
+    kill -15 $PID_UPSD
+    wait $PID_UPSD || true
+    PID_UPSD=""
+    rm -f "$NUT_CONFPATH/upsd.key" "$NUT_CONFPATH/upsd.crt" "$NUT_CONFPATH/upsd.pem"
+}
+
+testgroup_upsd_starttls() {
+    testcase_upsd_starttls
+}
+
+testcase_upsd_dumpgen() {
+    # When upsd reconnects to a driver, it keeps the data it had if
+    # the driver says it sends only changes (DUMPMODE INCREMENTAL):
+    # tests/nutdumpgen plays such a driver, which also broadcasts a
+    # change before it reads the DUMPALL request of upsd
+    log_separator
+    log_info "[testcase_upsd_dumpgen] Test UPSD reconnecting to a driver with its data kept"
+
+    if [ x"${TOP_BUILDDIR}" = x ] \
+    || [ ! -x "${TOP_BUILDDIR}/tests/nutdumpgen" ] \
+    ; then
+        log_warn "[testcase_upsd_dumpgen] SKIP: needs the build tree with tests/nutdumpgen"
+        return 0
+    fi
+
+    generatecfg_upsd_trivial
+    generatecfg_upsdusers_trivial
+    generatecfg_ups_trivial
+    cat >> "$NUT_CONFPATH/ups.conf" << EOF
+[dummy]
+    driver = dummy-ups
+    desc = "Played by tests/nutdumpgen"
+    port = dummy.dev
+EOF
+    [ $? = 0 ] || die "Failed to populate temporary FS structure for the NIT: ups.conf"
+
+    if ! upsd_start_loop "testcase_upsd_dumpgen" ; then
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_upsd_dumpgen"
+        return 1
+    fi
+
+    runcmd "${TOP_BUILDDIR}/tests/nutdumpgen" -p "$NUT_PORT" -u dummy \
+        -s "$NUT_STATEPATH/dummy-ups-dummy" || true
+    case "$CMDRES" in
+        0)
+            log_info "[testcase_upsd_dumpgen] PASSED: upsd kept or dropped the data as expected"
+            PASSED="`expr $PASSED + 1`"
+            ;;
+        77)
+            log_warn "[testcase_upsd_dumpgen] SKIP: not supported on this platform"
+            ;;
+        *)
+            echo "$CMDOUT"
+            log_error "[testcase_upsd_dumpgen] FAILED: see the checks above"
+            FAILED="`expr $FAILED + 1`"
+            FAILED_FUNCS="$FAILED_FUNCS testcase_upsd_dumpgen"
+            ;;
+    esac
+
+    kill -15 $PID_UPSD
+    wait $PID_UPSD || true
+    PID_UPSD=""
+}
+
+testgroup_upsd_dumpgen() {
+    testcase_upsd_dumpgen
+}
+
 #########################################################
 ### Tests in a common sandbox with driver(s) + server ###
 #########################################################
@@ -1624,6 +1761,195 @@ testcases_sandbox_nutscanner() {
 
 ####################################
 
+testcase_sandbox_repeater_group() {
+    # One dummy-ups repeater serves UPS1 and UPS2 (read from our upsd over
+    # one connection): its own section, and the one naming it as parent
+    if [ x"${TOP_SRCDIR}" = x ] ; then
+        log_info "[testcase_sandbox_repeater_group] SKIP: needs the UPS1/UPS2 dummies"
+        return 0
+    fi
+
+    log_separator
+    log_info "[testcase_sandbox_repeater_group] Test a dummy-ups repeater group over the UPS1 and UPS2 dummy-ups drivers"
+    sandbox_start_drivers || die "[testcase_sandbox_repeater_group] dummy-ups drivers are not running"
+
+    cat >> "$NUT_CONFPATH/ups.conf" << EOF
+[rep1]
+    driver = dummy-ups
+    desc = "Repeater of UPS1, and of UPS2 for rep2"
+    port = UPS1@localhost:$NUT_PORT
+    pollinterval = 1
+
+[rep2]
+    driver = dummy-ups
+    desc = "Repeated by rep1"
+    port = UPS2@localhost:$NUT_PORT
+    repeater_parent = rep1
+EOF
+    [ $? = 0 ] || die "Failed to populate temporary FS structure for the NIT: ups.conf"
+
+    res_testcase_sandbox_repeater_group=0
+
+    # A device of the group is not served on its own
+    if ! dummy-ups -a rep2 ${ARG_FG} ; then
+        log_error "[testcase_sandbox_repeater_group] dummy-ups started for rep2 alone did not just step aside"
+        res_testcase_sandbox_repeater_group=1
+    fi
+
+    if [ -n "${NUT_DEBUG_LEVEL_DRIVERS-}" ]; then
+        NUT_DEBUG_LEVEL="${NUT_DEBUG_LEVEL_DRIVERS}"
+    fi
+    dummy-ups -a rep1 ${ARG_FG} &
+    PID_REPEATER="$!"
+    NUT_DEBUG_LEVEL="${NUT_DEBUG_LEVEL_ORIG}"
+    log_debug "[testcase_sandbox_repeater_group] Tried to start dummy-ups repeater as PID $PID_REPEATER"
+
+    # Let upsd know about the new devices
+    sleep 2
+    kill -1 "$PID_UPSD"
+
+    MODEL_UPS1="`upsc UPS1@localhost:$NUT_PORT device.model 2>/dev/null`" || MODEL_UPS1=""
+    MODEL_UPS2="`upsc UPS2@localhost:$NUT_PORT device.model 2>/dev/null`" || MODEL_UPS2=""
+    MODEL_REP1=""
+    MODEL_REP2=""
+    COUNTDOWN=30
+    while [ "$COUNTDOWN" -gt 0 ] ; do
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+        MODEL_REP1="`upsc rep1@localhost:$NUT_PORT device.model 2>/dev/null`" || MODEL_REP1=""
+        MODEL_REP2="`upsc rep2@localhost:$NUT_PORT device.model 2>/dev/null`" || MODEL_REP2=""
+        [ -n "$MODEL_REP1" ] && [ -n "$MODEL_REP2" ] && break
+    done
+
+    if [ -n "$MODEL_UPS1" ] && [ x"$MODEL_REP1" = x"$MODEL_UPS1" ] \
+    && [ -n "$MODEL_UPS2" ] && [ x"$MODEL_REP2" = x"$MODEL_UPS2" ] \
+    ; then
+        log_info "[testcase_sandbox_repeater_group] rep1 and rep2 serve the data of UPS1 and UPS2"
+    else
+        log_error "[testcase_sandbox_repeater_group] Got unexpected models: rep1 '$MODEL_REP1' vs. UPS1 '$MODEL_UPS1', rep2 '$MODEL_REP2' vs. UPS2 '$MODEL_UPS2'"
+        res_testcase_sandbox_repeater_group=1
+    fi
+
+    # The devices of the group go away with their repeater
+    kill -15 "$PID_REPEATER" 2>/dev/null
+    wait "$PID_REPEATER" 2>/dev/null || true
+    PID_REPEATER=""
+
+    COUNTDOWN=30
+    while [ "$COUNTDOWN" -gt 0 ] ; do
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+        upsc rep2@localhost:$NUT_PORT device.model >/dev/null 2>&1 || break
+    done
+    if [ "$COUNTDOWN" = 0 ] ; then
+        log_error "[testcase_sandbox_repeater_group] rep2 is still served after its repeater was stopped"
+        res_testcase_sandbox_repeater_group=1
+    fi
+
+    if [ "$res_testcase_sandbox_repeater_group" = 0 ]; then
+        log_info "[testcase_sandbox_repeater_group] PASSED: one repeater served both devices of its group"
+        PASSED="`expr $PASSED + 1`"
+    else
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_repeater_group"
+    fi
+}
+
+####################################
+
+testcase_sandbox_failover() {
+    # The failover driver multiplexes the sockets of the dummy-ups drivers
+    # (one of them replaying the larger ePDU data dump), and should switch
+    # over to the other one when the primary goes away
+    if [ x"${TOP_SRCDIR}" = x ] || ! (command -v failover) >/dev/null ; then
+        log_info "[testcase_sandbox_failover] SKIP: needs the failover driver and UPS1/UPS2 dummies"
+        return 0
+    fi
+
+    log_separator
+    log_info "[testcase_sandbox_failover] Test failover driver over the UPS1 and UPS2 dummy-ups drivers"
+    sandbox_start_drivers || die "[testcase_sandbox_failover] dummy-ups drivers are not running"
+
+    cat >> "$NUT_CONFPATH/ups.conf" << EOF
+[failover]
+    driver = failover
+    desc = "Failover between UPS1 and UPS2"
+    port = dummy-ups-UPS1,dummy-ups-UPS2
+    pollinterval = 1
+    inittime = 10
+EOF
+    [ $? = 0 ] || die "Failed to populate temporary FS structure for the NIT: ups.conf"
+
+    if [ -n "${NUT_DEBUG_LEVEL_DRIVERS-}" ]; then
+        NUT_DEBUG_LEVEL="${NUT_DEBUG_LEVEL_DRIVERS}"
+    fi
+    failover -a failover ${ARG_FG} &
+    PID_FAILOVER="$!"
+    NUT_DEBUG_LEVEL="${NUT_DEBUG_LEVEL_ORIG}"
+    log_debug "[testcase_sandbox_failover] Tried to start failover driver as PID $PID_FAILOVER"
+
+    # Let upsd know about the new device
+    sleep 2
+    kill -1 "$PID_UPSD"
+
+    PRIMARY=""
+    COUNTDOWN=30
+    while [ "$COUNTDOWN" -gt 0 ] ; do
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+        PRIMARY="`upsc failover@localhost:$NUT_PORT driver.primary.socketname 2>/dev/null`" || PRIMARY=""
+        [ -n "$PRIMARY" ] && break
+    done
+
+    ALIVE="`upsc failover@localhost:$NUT_PORT driver.stats.alive_drivers 2>/dev/null`" || ALIVE=""
+    case "$PRIMARY" in
+        dummy-ups-UPS1) OTHER="UPS2" ; PID_PRIMARY="$PID_DUMMYUPS1" ;;
+        dummy-ups-UPS2) OTHER="UPS1" ; PID_PRIMARY="$PID_DUMMYUPS2" ;;
+        *)  log_error "[testcase_sandbox_failover] No primary was elected: '$PRIMARY'"
+            FAILED="`expr $FAILED + 1`"
+            FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_failover"
+            kill -15 "$PID_FAILOVER" 2>/dev/null
+            wait "$PID_FAILOVER" 2>/dev/null || true
+            PID_FAILOVER=""
+            return 1
+            ;;
+    esac
+    log_info "[testcase_sandbox_failover] Primary is $PRIMARY of $ALIVE alive drivers, stopping it"
+
+    kill -15 "$PID_PRIMARY" 2>/dev/null
+    wait "$PID_PRIMARY" 2>/dev/null || true
+    if [ "$OTHER" = UPS1 ] ; then PID_DUMMYUPS2="" ; else PID_DUMMYUPS1="" ; fi
+
+    NEWPRIMARY=""
+    COUNTDOWN=30
+    while [ "$COUNTDOWN" -gt 0 ] ; do
+        sleep 1
+        COUNTDOWN="`expr $COUNTDOWN - 1`"
+        NEWPRIMARY="`upsc failover@localhost:$NUT_PORT driver.primary.socketname 2>/dev/null`" || NEWPRIMARY=""
+        [ x"$NEWPRIMARY" = x"dummy-ups-$OTHER" ] && break
+    done
+
+    MODEL_FAILOVER="`upsc failover@localhost:$NUT_PORT device.model 2>/dev/null`" || MODEL_FAILOVER=""
+    MODEL_OTHER="`upsc $OTHER@localhost:$NUT_PORT device.model 2>/dev/null`" || MODEL_OTHER=""
+
+    if [ "$ALIVE" = 2 ] && [ x"$NEWPRIMARY" = x"dummy-ups-$OTHER" ] \
+    && [ -n "$MODEL_OTHER" ] && [ x"$MODEL_FAILOVER" = x"$MODEL_OTHER" ] \
+    ; then
+        log_info "[testcase_sandbox_failover] PASSED: failover switched over to $NEWPRIMARY and serves its data"
+        PASSED="`expr $PASSED + 1`"
+    else
+        log_error "[testcase_sandbox_failover] Got unexpected state: alive drivers '$ALIVE', new primary '$NEWPRIMARY', model '$MODEL_FAILOVER' vs. '$MODEL_OTHER'"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testcase_sandbox_failover"
+    fi
+
+    kill -15 "$PID_FAILOVER" 2>/dev/null
+    wait "$PID_FAILOVER" 2>/dev/null || true
+    PID_FAILOVER=""
+}
+
+####################################
+
 # TODO: Some upsmon tests?
 
 upsmon_start_loop() {
@@ -1681,6 +2007,8 @@ testgroup_sandbox() {
     testcases_sandbox_python
     testcases_sandbox_cppnit
     testcases_sandbox_nutscanner
+    testcase_sandbox_repeater_group
+    testcase_sandbox_failover
 
     log_separator
     sandbox_forget_configs
@@ -1732,6 +2060,71 @@ testgroup_sandbox_upsmon_master() {
     sandbox_forget_configs
 }
 
+####################################
+
+testgroup_bench_upsd() {
+    # Not a functional test: upsd serving many devices (emulated by the
+    # nutloadgen program, which also acts as their drivers) to many clients
+    BENCH_DEVICES="${BENCH_DEVICES-100}"
+    BENCH_CLIENTS="${BENCH_CLIENTS-100}"
+    BENCH_DURATION="${BENCH_DURATION-10}"
+    BENCH_UPDATE_RATE="${BENCH_UPDATE_RATE-1}"
+    BENCH_MIX="${BENCH_MIX-80:15:5}"
+
+    if [ x"${TOP_SRCDIR}" = x ] || [ x"${TOP_BUILDDIR}" = x ] \
+    || [ ! -x "${TOP_BUILDDIR}/tests/nutloadgen" ] \
+    ; then
+        log_warn "[testgroup_bench_upsd] SKIP: needs the source and build trees with tests/nutloadgen (see 'make bench-upsd')"
+        return 0
+    fi
+
+    log_separator
+    log_info "[testgroup_bench_upsd] Benchmark upsd with $BENCH_DEVICES devices and $BENCH_CLIENTS clients for $BENCH_DURATION sec"
+
+    generatecfg_upsd_nodev
+    echo "MAXCONN `expr $BENCH_DEVICES + $BENCH_CLIENTS + 64`" >> "$NUT_CONFPATH/upsd.conf" \
+    || die "Failed to populate temporary FS structure for the NIT: upsd.conf"
+    generatecfg_upsdusers_trivial
+    generatecfg_ups_trivial
+    cp "${TOP_SRCDIR}/data/evolution500.seq" "${TOP_SRCDIR}/data/epdu-managed.dev" "$NUT_CONFPATH/"
+
+    # Odd devices replay the UPS sequence, even ones the larger ePDU dump
+    # (nutloadgen takes the data files in turn the same way)
+    N=1
+    while [ "$N" -le "$BENCH_DEVICES" ] ; do
+        if [ "`expr $N % 2`" = 1 ] ; then BENCH_PORT="evolution500.seq" ; else BENCH_PORT="epdu-managed.dev" ; fi
+        printf '[bench%s]\n    driver = dummy-ups\n    port = %s\n' "$N" "$BENCH_PORT"
+        N="`expr $N + 1`"
+    done >> "$NUT_CONFPATH/ups.conf" \
+    || die "Failed to populate temporary FS structure for the NIT: ups.conf"
+
+    "${TOP_BUILDDIR}/tests/nutloadgen" -n "$BENCH_DEVICES" -N bench -d dummy-ups \
+        -f "$NUT_CONFPATH/evolution500.seq" -f "$NUT_CONFPATH/epdu-managed.dev" \
+        -c "$BENCH_CLIENTS" -t "$BENCH_DURATION" -u "$BENCH_UPDATE_RATE" -m "$BENCH_MIX" \
+        -p "$NUT_PORT" -U admin -W "$TESTPASS_ADMIN" -P "$NUT_STATEPATH/bench-upsd.pid" &
+    PID_NUTLOADGEN="$!"
+    sleep 1
+
+    if upsd_start_loop "testgroup_bench_upsd" ; then
+        echo "$PID_UPSD" > "$NUT_STATEPATH/bench-upsd.pid"
+    else
+        kill -15 "$PID_NUTLOADGEN" 2>/dev/null || true
+    fi
+
+    if wait "$PID_NUTLOADGEN" ; then
+        log_info "[testgroup_bench_upsd] PASSED: see the figures above"
+        PASSED="`expr $PASSED + 1`"
+    else
+        log_error "[testgroup_bench_upsd] FAILED: the load generator did not complete"
+        FAILED="`expr $FAILED + 1`"
+        FAILED_FUNCS="$FAILED_FUNCS testgroup_bench_upsd"
+    fi
+    PID_NUTLOADGEN=""
+
+    log_separator
+    stop_daemons
+}
+
 ################################################################
 
 case "${NIT_CASE}" in
@@ -1770,6 +2163,8 @@ case "${NIT_CASE}" in
     "") # Default test groups:
         testgroup_upsd_invalid_configs
         testgroup_upsd_questionable_configs
+        testgroup_upsd_starttls
+        testgroup_upsd_dumpgen
         testgroup_sandbox
         ;;
     *)  die "Unsupported NIT_CASE='$NIT_CASE' was requested" ;;
@@ -80,6 +80,7 @@ class NutActiveClientTest : public CppUnit::TestFixture
 	CPPUNIT_TEST_SUITE( NutActiveClientTest );
 		CPPUNIT_TEST( test_query_ver );
 		CPPUNIT_TEST( test_list_ups );
+		CPPUNIT_TEST( test_list_devices_vars );
 		CPPUNIT_TEST( test_list_ups_clients );
 		CPPUNIT_TEST( test_auth_user );
 		CPPUNIT_TEST( test_auth_primary );
@@ -99,6 +100,7 @@ public:
 
 	void test_query_ver();
 	void test_list_ups();
+	void test_list_devices_vars();
 	void test_list_ups_clients();
 	void test_auth_user();
 	void test_auth_primary();
@@ -250,6 +252,53 @@ void NutActiveClientTest::test_list_ups() {
 		noException);
 }
 
+void NutActiveClientTest::test_list_devices_vars() {
+	nut::TcpClient c("localhost", NUT_PORT);
+	std::set<std::string> devs;
+	std::map<std::string, std::map<std::string, std::vector<std::string>>> all;
+	bool noException = true, sameVars = true;
+
+	try {
+		devs = c.getDeviceNames();
+		if (!devs.empty()) {
+			/* asked for with "LIST VARS" in one go */
+			all = c.getDevicesVariableValues(devs);
+
+			/* same variables as with "LIST VAR" for each device
+			 * (values may change meanwhile) */
+			for (std::set<std::string>::iterator it = devs.begin();
+				it != devs.end(); it++
+			) {
+				std::map<std::string, std::vector<std::string>> one =
+					c.getDeviceVariableValues(*it);
+
+				if (all.find(*it) == all.end() || all[*it].size() != one.size()) {
+					std::cerr << "[D] Different variables of " << *it
+						<< " in bulk and single device lists" << std::endl;
+					sameVars = false;
+				}
+			}
+		}
+		std::cerr << "[D] Got variables of " << all.size() << " of "
+			<< devs.size() << " devices" << std::endl;
+	}
+	catch(nut::NutException& ex)
+	{
+		std::cerr << "[D] Could not get variables of devices: " << ex.what() << std::endl;
+		noException = false;
+	}
+
+	c.logout();
+	c.disconnect();
+
+	CPPUNIT_ASSERT_MESSAGE(
+		"Failed to list variables of devices with TcpClient: threw NutException",
+		noException);
+	CPPUNIT_ASSERT_MESSAGE(
+		"Variables of devices listed at once differ from those of each device",
+		sameVars);
+}
+
 void NutActiveClientTest::test_list_ups_clients() {
 	nut::TcpClient c("localhost", NUT_PORT);
 	std::map<std::string, std::set<std::string>> deviceClients;
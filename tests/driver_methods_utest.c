@@ -69,6 +69,7 @@ static int report_0_means_pass(int i) {
 
 int main(int argc, char **argv) {
 	const char	*valueStr = NULL;
+	unsigned long	changes, updates;
 
 	NUT_UNUSED_VARIABLE(argc);
 	NUT_UNUSED_VARIABLE(argv);
@@ -367,6 +368,31 @@ int main(int argc, char **argv) {
 	report_0_means_pass(strcmp(valueStr, "OB LB FSD"));
 	printf(" test for ups.status with FSD token set and now committed: '%s'; got OB LB FSD?\n", NUT_STRARG(valueStr));
 
+	/* Numbers set with plain formats are compared before formatting */
+	changes = dstate_datachanges();
+	updates = dstate_dataupdates();
+	dstate_setinfo("input.voltage", "%.1f", 230.04);
+	dstate_setinfo("input.voltage", "%.1f", 229.96);
+	dstate_setinfo("ups.load", "%d", -5);
+	dstate_setinfo("ups.load", "%i", -5);
+	dstate_setinfo_number("ups.load", -5, 0);
+
+	/* #21 */
+	valueStr = dstate_getinfo("input.voltage");
+	report_0_means_pass(strcmp(valueStr, "230.0"));
+	printf(" test for input.voltage set with \"%%.1f\": '%s'; got 230.0?\n", NUT_STRARG(valueStr));
+
+	/* #22 */
+	valueStr = dstate_getinfo("ups.load");
+	report_0_means_pass(strcmp(valueStr, "-5"));
+	printf(" test for ups.load set with \"%%d\": '%s'; got -5?\n", NUT_STRARG(valueStr));
+
+	/* #23 */
+	changes = dstate_datachanges() - changes;
+	updates = dstate_dataupdates() - updates;
+	report_0_means_pass(!(changes == 2 && updates == 5));
+	printf(" test for data updates: %lu changed, %lu in all; got 2 of 5?\n", changes, updates);
+
 	/* Clear testing state before finishing. */
 	alarm_init();
 	alarm_commit();
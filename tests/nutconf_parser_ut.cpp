@@ -86,6 +86,7 @@ class NutConfTest : public CppUnit::TestFixture
 		CPPUNIT_TEST( testParseToken );
 		CPPUNIT_TEST( testParseTokenWithoutColon );
 		CPPUNIT_TEST( testGenericConfigParser );
+		CPPUNIT_TEST( testUpsConfigCaseInsensitive );
 		CPPUNIT_TEST( testUpsmonConfigParser );
 		CPPUNIT_TEST( testNutConfConfigParser );
 		CPPUNIT_TEST( testUpsdConfigParser );
@@ -104,6 +105,7 @@ public:
 	void testParseTokenWithoutColon();
 
 	void testGenericConfigParser();
+	void testUpsConfigCaseInsensitive();
 	void testUpsmonConfigParser();
 	void testNutConfConfigParser();
 	void testUpsdConfigParser();
@@ -623,6 +625,26 @@ void NutConfTest::testGenericConfigParser()
 
 }
 
+void NutConfTest::testUpsConfigCaseInsensitive()
+{
+	static const char* src =
+		"StatePath = /var/state/ups\n"
+		"maxretry = 3\n"
+		"[ups1]\n"
+		"driver = dummy-ups\n"
+		"port = ups1.dev\n";
+
+	UpsConfiguration conf;
+	conf.parseFromString(src);
+
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Cannot find StatePath case-insensitively", string("/var/state/ups"), conf.getStatePath());
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Cannot find ups1's driver", string("dummy-ups"), conf.getDriver("ups1"));
+
+	UpsConfiguration conf2;
+	conf2.parseFromString("[ups1]\ndriver = dummy-ups\n");
+	CPPUNIT_ASSERT_EQUAL_MESSAGE("Found a missing global StatePath", string(""), conf2.getStatePath());
+}
+
 void NutConfTest::testUpsmonConfigParser()
 {
 	static const char* src =
@@ -0,0 +1,353 @@
+/*  nutdumpgen.c - check how upsd keeps the data of a driver it reconnects to
+ *
+ *  Plays the part of a driver on its socket, reconnected to by upsd a
+ *  few times, to check that upsd keeps (or drops) the data it had on
+ *  the DUMPMODE the driver answers its "DUMPALL GEN" request with, or
+ *  at its DUMPDONE (older drivers), even if the driver broadcasts a
+ *  change before it reads that request. The data upsd serves is read
+ *  with libupsclient.
+ *
+ *  Started by tests/NIT (see testgroup_upsd_dumpgen there).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "upsclient.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <poll.h>
+
+/* how long upsd may take to (re)connect, or to serve what it was sent */
+#define DG_TIMEOUT	15
+
+static const char	*sockfn = NULL;
+static const char	*host = "localhost";
+static unsigned short	port = PORT;
+static const char	*upsname = "dummy";
+static int	listen_fd = -1;
+static int	failed = 0;
+
+static double now_sec(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void result(const char *what, int ok)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	fflush(stdout);
+
+	if (!ok)
+		failed++;
+}
+
+static void sock_listen(void)
+{
+	struct sockaddr_un	sa;
+
+	memset(&sa, '\0', sizeof(sa));
+	sa.sun_family = AF_UNIX;
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", sockfn);
+	unlink(sockfn);
+
+	listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (listen_fd < 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't create a unix domain socket");
+
+	if (bind(listen_fd, (struct sockaddr *) &sa, sizeof(sa)) < 0
+	 || listen(listen_fd, 1) < 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't listen on %s", sockfn);
+
+	/* upsd may run as another user, e.g. when NIT was started by root */
+	if (chmod(sockfn, 0777) < 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't chmod %s", sockfn);
+}
+
+/* wait for upsd to (re)connect, as it does every few seconds */
+static int sock_accept(void)
+{
+	struct pollfd	pfd;
+	int	fd;
+
+	pfd.fd = listen_fd;
+	pfd.events = POLLIN;
+
+	if (poll(&pfd, 1, DG_TIMEOUT * 1000) <= 0)
+		fatalx(EXIT_FAILURE, "upsd did not connect to %s", sockfn);
+
+	fd = accept(listen_fd, NULL, NULL);
+	if (fd < 0)
+		fatal_with_errno(EXIT_FAILURE, "Can't accept a connection on %s", sockfn);
+
+	return fd;
+}
+
+static void sock_send(int fd, const char *buf)
+{
+	size_t	len = strlen(buf);
+	ssize_t	ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret <= 0)
+			fatal_with_errno(EXIT_FAILURE, "Can't write to upsd");
+		buf += ret;
+		len -= (size_t)ret;
+	}
+}
+
+/* read the next request from upsd (without its newline), answering
+ * its pings on the way */
+static void sock_request(int fd, char *buf, size_t buflen)
+{
+	struct pollfd	pfd;
+	double	end = now_sec() + DG_TIMEOUT;
+	size_t	len = 0;
+	char	ch;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		double	left = end - now_sec();
+
+		if (left <= 0 || poll(&pfd, 1, (int)(left * 1000) + 1) <= 0
+		 || read(fd, &ch, 1) != 1)
+			fatalx(EXIT_FAILURE, "upsd did not send a request");
+
+		if (ch != '\n') {
+			if (len < buflen - 1)
+				buf[len++] = ch;
+			continue;
+		}
+
+		buf[len] = '\0';
+		if (strcmp(buf, "PING"))
+			return;
+
+		sock_send(fd, "PONG\n");
+		len = 0;
+	}
+}
+
+/* value of var as served by upsd, NULL if it has none */
+static const char *upsd_getvar(const char *var)
+{
+	static char	value[SMALLBUF];
+	UPSCONN_t	ups;
+	const char	*query[3];
+	char	**answer;
+	size_t	numa;
+	const char	*ret = NULL;
+
+	if (upscli_connect(&ups, host, port, UPSCLI_CONN_TRYSSL) < 0)
+		fatalx(EXIT_FAILURE, "Can't connect to upsd at %s:%u: %s",
+			host, (unsigned int)port, upscli_strerror(&ups));
+
+	query[0] = "VAR";
+	query[1] = upsname;
+	query[2] = var;
+
+	if (upscli_get(&ups, 3, query, &numa, &answer) >= 0 && numa >= 4) {
+		snprintf(value, sizeof(value), "%s", answer[3]);
+		ret = value;
+	}
+
+	upscli_disconnect(&ups);
+	return ret;
+}
+
+/* wait until upsd serves "value" for var */
+static int upsd_waitvar(const char *var, const char *value)
+{
+	double	end = now_sec() + DG_TIMEOUT;
+	const char	*got;
+
+	do {
+		got = upsd_getvar(var);
+		if (got && !strcmp(got, value))
+			return 1;
+		usleep(100000);
+	} while (now_sec() < end);
+
+	return 0;
+}
+
+/* One connection from upsd: "early" is sent before its request is read,
+ * which should be "request", and "dump" is the answer to it. The dump
+ * ends with a battery.runtime of "round", to know when upsd has it.
+ * Returns the connection, to be closed once the data was checked
+ * (upsd only serves the data of a connected driver). */
+static int serve_dump(const char *early, const char *request,
+	const char *dump, const char *round)
+{
+	char	buf[SMALLBUF];
+	int	fd = sock_accept();
+
+	if (early)
+		sock_send(fd, early);
+
+	sock_request(fd, buf, sizeof(buf));
+	if (strcmp(buf, request)) {
+		printf("Round %s: expected \"%s\", got \"%s\"\n", round, request, buf);
+		result("upsd asked for the expected dump", 0);
+	}
+
+	sock_send(fd, dump);
+	snprintf(buf, sizeof(buf), "SETINFO battery.runtime %s\nDATAOK\nDUMPDONE\n", round);
+	sock_send(fd, buf);
+	if (!strncmp(dump, "DUMPMODE", 8)) {
+		snprintf(buf, sizeof(buf), "DUMPGEN nutdumpgen-1 %s 0\n", round);
+		sock_send(fd, buf);
+	}
+
+	if (!upsd_waitvar("battery.runtime", round))
+		fatalx(EXIT_FAILURE, "upsd did not take the dump of round %s", round);
+
+	return fd;
+}
+
+static void help(const char *prog)
+{
+	printf("Check how a running upsd keeps the data of a driver it reconnects to,\n");
+	printf("playing that driver, see tests/NIT\n\n");
+	printf("usage: %s -s <socket> [OPTIONS]\n\n", prog);
+	printf("  -s <socket>	driver socket upsd connects to for <upsname>\n");
+	printf("  -u <upsname>	device name in ups.conf (default %s)\n", upsname);
+	printf("  -H <host>	upsd host (default %s)\n", host);
+	printf("  -p <port>	upsd port (default: NUT_PORT or %d)\n", PORT);
+	printf("  -D		raise debugging level\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char	*value, *env;
+	int	opt, fd;
+
+	env = getenv("NUT_PORT");
+	if (env && !str_to_ushort(env, &port, 10))
+		fatalx(EXIT_FAILURE, "Invalid NUT_PORT: %s", env);
+
+	while ((opt = getopt(argc, argv, "hs:u:H:p:D")) != -1) {
+		switch (opt) {
+			case 's':
+				sockfn = optarg;
+				break;
+			case 'H':
+				host = optarg;
+				break;
+			case 'p':
+				if (!str_to_ushort(optarg, &port, 10))
+					fatalx(EXIT_FAILURE, "Invalid port: %s", optarg);
+				break;
+			case 'u':
+				upsname = optarg;
+				break;
+			case 'D':
+				nut_debug_level++;
+				break;
+			case 'h':
+			default:
+				help(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!sockfn) {
+		help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	upscli_init(0, NULL, NULL, NULL);
+	sock_listen();
+
+	/* first connection: nothing is kept yet */
+	fd = serve_dump(NULL, "DUMPALL GEN",
+		"DUMPMODE FULL\n"
+		"SETINFO ups.status OL\n"
+		"SETINFO battery.charge 100\n"
+		"SETINFO device.model Fake\n"
+		"SETINFO device.mfr \"Fake Inc\"\n"
+		"ADDCMD test.battery.start\n", "1");
+	value = upsd_getvar("device.model");
+	result("a first full dump is served", value && !strcmp(value, "Fake"));
+	close(fd);
+
+	/* a change broadcast before the driver got to the request does not
+	 * make upsd drop what it kept: the driver sends only changes */
+	fd = serve_dump("SETINFO battery.charge 99\n", "DUMPALL GEN nutdumpgen-1 1 0",
+		"DUMPMODE INCREMENTAL\n"
+		"SETINFO ups.status OL\n"
+		"SETINFO battery.charge 99\n"
+		"ADDCMD test.battery.start\n", "2");
+	value = upsd_getvar("device.model");
+	result("an incremental dump after a broadcast keeps the data",
+		value && !strcmp(value, "Fake"));
+	value = upsd_getvar("battery.charge");
+	result("an incremental dump after a broadcast is applied",
+		value && !strcmp(value, "99"));
+	close(fd);
+
+	/* but the data is not kept when the driver sends it all again */
+	fd = serve_dump("SETINFO battery.charge 98\n", "DUMPALL GEN nutdumpgen-1 2 0",
+		"DUMPMODE FULL\n"
+		"SETINFO ups.status OL\n"
+		"SETINFO battery.charge 98\n"
+		"SETINFO device.mfr \"Fake Inc\"\n", "3");
+	result("a full dump after a broadcast drops the data",
+		upsd_getvar("device.model") == NULL);
+	close(fd);
+
+	/* an older driver ignores the generation and sends it all */
+	fd = serve_dump("SETINFO battery.charge 97\n", "DUMPALL GEN nutdumpgen-1 3 0",
+		"SETINFO ups.status OL\n"
+		"SETINFO battery.charge 97\n", "4");
+	result("a dump without DUMPMODE drops the data",
+		upsd_getvar("device.mfr") == NULL);
+	close(fd);
+
+	close(listen_fd);
+	unlink(sockfn);
+	upscli_cleanup();
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else	/* WIN32 */
+
+int main(int argc, char **argv)
+{
+	NUT_UNUSED_VARIABLE(argc);
+	NUT_UNUSED_VARIABLE(argv);
+
+	/* upsd talks to drivers over named pipes there */
+	printf("SKIP: not implemented for WIN32\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
@@ -0,0 +1,1161 @@
+/*  nutloadgen.c - synthetic load for benchmarking upsd
+ *
+ *  Emulates many driver sockets serving data from dummy-ups style
+ *  files (.dev / .seq), with a configurable rate of value updates,
+ *  and many clients issuing a configurable mix of GET VAR, LIST VAR
+ *  and SET VAR requests against upsd. Reports the throughput and the
+ *  latency (p50/p99/max) per request type, and the CPU time and RSS
+ *  of upsd if its PID is known.
+ *
+ *  The upsd under test should have a ups.conf section for each of the
+ *  emulated devices, named PREFIX1..PREFIXn with the driver name used
+ *  for the socket names here (see the bench-upsd target of tests/NIT).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "parseconf.h"
+#include "upshandler.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+/* the writable variable used for SET requests */
+#define LG_SETVAR	"ups.delay.shutdown"
+
+/* how much unsent data to keep for one peer before dropping it */
+#define LG_OUT_MAX	(1024 * 1024)
+
+typedef enum {
+	OP_GET = 0,
+	OP_LIST,
+	OP_SET,
+	OP_COUNT
+} lg_op_t;
+
+static const char	*op_names[OP_COUNT] = { "GET", "LIST", "SET" };
+
+/* a variable of a data file, with all values it takes there in turn */
+typedef struct {
+	char	*name;
+	char	**values;
+	size_t	nvalues;
+} lg_var_t;
+
+typedef struct {
+	char	*file;
+	lg_var_t	*vars;
+	size_t	nvars;
+} lg_data_t;
+
+typedef struct {
+	char	*buf;
+	size_t	len;
+	size_t	size;
+} lg_outbuf_t;
+
+typedef struct {
+	char	name[SMALLBUF];
+	char	sockfn[NUT_PATH_MAX + SMALLBUF];
+	lg_data_t	*data;
+	char	**val;		/* current values */
+	size_t	*step;		/* position in the values of the data file */
+	int	listen_fd;
+	int	fd;
+	PCONF_CTX_t	ctx;
+	lg_outbuf_t	out;
+	int	dumped;
+	double	next_update;
+} lg_device_t;
+
+typedef struct {
+	int	fd;
+	int	logins;		/* replies still expected to USERNAME/PASSWORD */
+	int	busy;
+	lg_op_t	op;
+	double	sent;
+	char	endline[SMALLBUF + 16];	/* last line of a LIST reply */
+	char	in[LARGEBUF];
+	size_t	inlen;
+	lg_outbuf_t	out;
+} lg_client_t;
+
+typedef struct {
+	uint32_t	*usec;
+	size_t	count;
+	size_t	size;
+	size_t	errors;
+} lg_stats_t;
+
+static lg_data_t	*datasets;
+static size_t	ndatasets;
+static lg_device_t	*devices;
+static size_t	ndevices = 10;
+static lg_client_t	*clients;
+static size_t	nclients = 10;
+
+static const char	*statepath;
+static const char	*drvname = "dummy-ups";
+static const char	*prefix = "bench";
+static const char	*host = "localhost";
+static const char	*port;
+static const char	*username;
+static const char	*password;
+static const char	*upsd_pid_arg;
+static double	update_rate = 1.0;
+static double	duration = 10;
+static double	warmup_timeout = 60;
+static unsigned int	mix[OP_COUNT] = { 80, 15, 5 };
+static unsigned int	mix_total = 100;
+
+static lg_stats_t	stats[OP_COUNT];
+static int	measuring;
+static unsigned long	updates_sent;
+static size_t	clients_lost;
+
+static double now_sec(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void outbuf_add(lg_outbuf_t *out, const char *buf, size_t len)
+{
+	if (out->len + len > out->size) {
+		out->size = (out->len + len) * 2;
+		out->buf = xrealloc(out->buf, out->size);
+	}
+
+	memcpy(out->buf + out->len, buf, len);
+	out->len += len;
+}
+
+static void outbuf_printf(lg_outbuf_t *out, const char *fmt, ...)
+	__attribute__ ((__format__ (__printf__, 2, 3)));
+
+static void outbuf_printf(lg_outbuf_t *out, const char *fmt, ...)
+{
+	char	buf[LARGEBUF];
+	va_list	ap;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = vsnprintf(buf, sizeof(buf), fmt, ap);
+	va_end(ap);
+
+	if (ret > 0)
+		outbuf_add(out, buf, (size_t)ret < sizeof(buf) ? (size_t)ret : sizeof(buf) - 1);
+}
+
+/* returns -1 if the peer is gone */
+static int outbuf_flush(int fd, lg_outbuf_t *out)
+{
+	ssize_t	ret;
+
+	if (!out->len)
+		return 0;
+
+	ret = write(fd, out->buf, out->len);
+
+	if (ret < 0) {
+		if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)
+			return 0;
+		return -1;
+	}
+
+	memmove(out->buf, out->buf + ret, out->len - (size_t)ret);
+	out->len -= (size_t)ret;
+
+	return (out->len > LG_OUT_MAX) ? -1 : 0;
+}
+
+static void set_nonblock(int fd)
+{
+	int	flags = fcntl(fd, F_GETFL);
+
+	if (flags >= 0)
+		fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+/* --- data files ------------------------------------------------------- */
+
+static lg_var_t *data_var(lg_data_t *data, const char *name)
+{
+	size_t	i;
+
+	for (i = 0; i < data->nvars; i++) {
+		if (!strcmp(data->vars[i].name, name))
+			return &data->vars[i];
+	}
+
+	data->vars = xrealloc(data->vars, sizeof(*data->vars) * (data->nvars + 1));
+	memset(&data->vars[data->nvars], 0, sizeof(*data->vars));
+	data->vars[data->nvars].name = xstrdup(name);
+
+	return &data->vars[data->nvars++];
+}
+
+static void data_errhandler(const char *errmsg)
+{
+	upslogx(LOG_WARNING, "data file: %s", errmsg);
+}
+
+/* Read the variables of a dummy-ups data file, as dummy-ups does; with
+ * a sequence (.seq), each variable keeps all the values it takes */
+static void data_load(const char *fn)
+{
+	PCONF_CTX_t	ctx;
+	lg_data_t	*data;
+	lg_var_t	*var;
+	char	value[LARGEBUF], *ptr;
+	size_t	i;
+
+	datasets = xrealloc(datasets, sizeof(*datasets) * (ndatasets + 1));
+	data = &datasets[ndatasets++];
+	memset(data, 0, sizeof(*data));
+	data->file = xstrdup(fn);
+
+	pconf_init(&ctx, data_errhandler);
+
+	if (!pconf_file_begin(&ctx, fn))
+		fatalx(EXIT_FAILURE, "Can't open data file %s: %s", fn, ctx.errmsg);
+
+	while (pconf_file_next(&ctx)) {
+		if (pconf_parse_error(&ctx) || ctx.numargs < 2)
+			continue;
+
+		if (!strcmp(ctx.arglist[0], "TIMER") || !strcmp(ctx.arglist[0], "ALARM"))
+			continue;
+
+		if ((ptr = strchr(ctx.arglist[0], ':')) != NULL)
+			*ptr = '\0';
+
+		if (!strncmp(ctx.arglist[0], "driver.", 7))
+			continue;
+
+		snprintf(value, sizeof(value), "%s", ctx.arglist[1]);
+		for (i = 2; i < ctx.numargs; i++)
+			snprintfcat(value, sizeof(value), " %s", ctx.arglist[i]);
+
+		var = data_var(data, ctx.arglist[0]);
+		if (var->nvalues && !strcmp(var->values[var->nvalues - 1], value))
+			continue;
+
+		var->values = xrealloc(var->values, sizeof(*var->values) * (var->nvalues + 1));
+		var->values[var->nvalues++] = xstrdup(value);
+	}
+
+	pconf_finish(&ctx);
+
+	/* always have something to SET */
+	var = data_var(data, LG_SETVAR);
+	if (!var->nvalues) {
+		var->values = xmalloc(sizeof(*var->values));
+		var->values[var->nvalues++] = xstrdup("20");
+	}
+
+	upsdebugx(1, "%s: %" PRIuSIZE " variables from %s", __func__, data->nvars, fn);
+}
+
+/* The next value of a variable: the next one from a sequence, or for a
+ * single numeric value, that value and one step of its last digit up in
+ * turn; NULL if there is nothing to vary */
+static const char *data_next_value(lg_device_t *dev, size_t idx, char *buf, size_t buflen)
+{
+	const lg_var_t	*var = &dev->data->vars[idx];
+	const char	*dot;
+	char	*end;
+	double	val, unit = 1;
+	int	decimals = 0;
+
+	dev->step[idx]++;
+
+	if (var->nvalues > 1)
+		return var->values[dev->step[idx] % var->nvalues];
+
+	val = strtod(var->values[0], &end);
+	if (end == var->values[0] || *end != '\0')
+		return NULL;
+
+	if ((dot = strchr(var->values[0], '.')) != NULL) {
+		decimals = (int)strlen(dot + 1);
+		for (; decimals > 0 && unit > 1e-6; decimals--)
+			unit /= 10;
+		decimals = (int)strlen(dot + 1);
+	}
+
+	snprintf(buf, buflen, "%.*f", decimals, val + (double)(dev->step[idx] % 2) * unit);
+	return buf;
+}
+
+/* --- emulated drivers ------------------------------------------------- */
+
+/* returns 1 if upsd was sent the new value */
+static int device_setval(lg_device_t *dev, size_t idx, const char *val)
+{
+	char	enc[LARGEBUF];
+
+	if (!strcmp(dev->val[idx], val))
+		return 0;
+
+	free(dev->val[idx]);
+	dev->val[idx] = xstrdup(val);
+
+	if (dev->fd >= 0 && dev->dumped) {
+		outbuf_printf(&dev->out, "SETINFO %s \"%s\"\n", dev->data->vars[idx].name,
+			pconf_encode(val, enc, sizeof(enc)));
+		return 1;
+	}
+
+	return 0;
+}
+
+static void device_dump(lg_device_t *dev)
+{
+	char	enc[LARGEBUF];
+	size_t	i;
+
+	for (i = 0; i < dev->data->nvars; i++) {
+		outbuf_printf(&dev->out, "SETINFO %s \"%s\"\n", dev->data->vars[i].name,
+			pconf_encode(dev->val[i], enc, sizeof(enc)));
+	}
+
+	outbuf_printf(&dev->out, "SETFLAGS %s RW NUMBER\n", LG_SETVAR);
+	outbuf_printf(&dev->out, "DATAOK\nDUMPDONE\n");
+	dev->dumped = 1;
+
+	/* spread the updates of the devices over the period */
+	if (update_rate > 0)
+		dev->next_update = now_sec() + (double)rand() / RAND_MAX / update_rate;
+}
+
+static void device_command(lg_device_t *dev, size_t numargs, char **arg)
+{
+	size_t	i;
+
+	if (numargs < 1)
+		return;
+
+	if (!strcasecmp(arg[0], "DUMPALL")) {
+		/* always a full dump, whatever generation is asked for */
+		device_dump(dev);
+		return;
+	}
+
+	if (!strcasecmp(arg[0], "PING")) {
+		outbuf_printf(&dev->out, "PONG\n");
+		return;
+	}
+
+	/* SET <var> <value> [TRACKING <id>] */
+	if (!strcasecmp(arg[0], "SET") && numargs >= 3) {
+		for (i = 0; i < dev->data->nvars; i++) {
+			if (!strcmp(dev->data->vars[i].name, arg[1])) {
+				device_setval(dev, i, arg[2]);
+				break;
+			}
+		}
+
+		if (numargs >= 5 && !strcasecmp(arg[3], "TRACKING"))
+			outbuf_printf(&dev->out, "TRACKING %s %d\n", arg[4],
+				i < dev->data->nvars ? STAT_SET_HANDLED : STAT_SET_UNKNOWN);
+		return;
+	}
+
+	/* INSTCMD <cmd> [<value>] [TRACKING <id>] */
+	if (!strcasecmp(arg[0], "INSTCMD")) {
+		for (i = 1; i + 1 < numargs; i++) {
+			if (!strcasecmp(arg[i], "TRACKING"))
+				outbuf_printf(&dev->out, "TRACKING %s %d\n", arg[i + 1], STAT_INSTCMD_UNKNOWN);
+		}
+		return;
+	}
+
+	upsdebugx(3, "%s: [%s]: ignored %s", __func__, dev->name, arg[0]);
+}
+
+static void device_disconnect(lg_device_t *dev)
+{
+	upsdebugx(1, "%s: [%s]: upsd went away", __func__, dev->name);
+	close(dev->fd);
+	dev->fd = -1;
+	dev->dumped = 0;
+	dev->out.len = 0;
+	pconf_finish(&dev->ctx);
+}
+
+static void device_read(lg_device_t *dev)
+{
+	char	buf[LARGEBUF];
+	size_t	i, used;
+	ssize_t	ret;
+
+	ret = read(dev->fd, buf, sizeof(buf));
+
+	if (ret <= 0) {
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		device_disconnect(dev);
+		return;
+	}
+
+	for (i = 0; i < (size_t)ret; i += used) {
+		if (pconf_buf(&dev->ctx, buf + i, (size_t)ret - i, &used) == 1)
+			device_command(dev, dev->ctx.numargs, dev->ctx.arglist);
+		if (!used)
+			break;
+	}
+}
+
+static void device_accept(lg_device_t *dev)
+{
+	int	fd = accept(dev->listen_fd, NULL, NULL);
+
+	if (fd < 0)
+		return;
+
+	if (dev->fd >= 0) {
+		/* upsd reconnected: forget the old connection */
+		device_disconnect(dev);
+	}
+
+	set_nonblock(fd);
+	dev->fd = fd;
+	pconf_init(&dev->ctx, NULL);
+	upsdebugx(2, "%s: [%s]: upsd connected", __func__, dev->name);
+}
+
+static void device_update(lg_device_t *dev, double now)
+{
+	char	buf[SMALLBUF];
+	const char	*val = NULL;
+	size_t	idx, tries;
+
+	if (update_rate <= 0 || dev->fd < 0 || !dev->dumped)
+		return;
+
+	while (dev->next_update <= now) {
+		dev->next_update += 1.0 / update_rate;
+
+		for (tries = 0, val = NULL; !val && tries < 8; tries++) {
+			idx = (size_t)rand() % dev->data->nvars;
+			val = data_next_value(dev, idx, buf, sizeof(buf));
+		}
+
+		if (val && device_setval(dev, idx, val) && measuring)
+			updates_sent++;
+	}
+}
+
+static void devices_init(void)
+{
+	struct sockaddr_un	sa;
+	size_t	i, j;
+
+	devices = xcalloc(ndevices, sizeof(*devices));
+
+	for (i = 0; i < ndevices; i++) {
+		lg_device_t	*dev = &devices[i];
+
+		snprintf(dev->name, sizeof(dev->name), "%s%" PRIuSIZE, prefix, i + 1);
+		snprintf(dev->sockfn, sizeof(dev->sockfn), "%s/%s-%s", statepath, drvname, dev->name);
+		dev->data = &datasets[i % ndatasets];
+		dev->val = xcalloc(dev->data->nvars, sizeof(*dev->val));
+		dev->step = xcalloc(dev->data->nvars, sizeof(*dev->step));
+		dev->fd = -1;
+
+		for (j = 0; j < dev->data->nvars; j++)
+			dev->val[j] = xstrdup(dev->data->vars[j].values[0]);
+
+		memset(&sa, 0, sizeof(sa));
+		sa.sun_family = AF_UNIX;
+		if (strlen(dev->sockfn) >= sizeof(sa.sun_path))
+			fatalx(EXIT_FAILURE, "Socket path too long: %s", dev->sockfn);
+		snprintf(sa.sun_path, sizeof(sa.sun_path), "%s", dev->sockfn);
+
+		unlink(dev->sockfn);
+		dev->listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (dev->listen_fd < 0)
+			fatal_with_errno(EXIT_FAILURE, "Can't create socket");
+		if (bind(dev->listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0)
+			fatal_with_errno(EXIT_FAILURE, "Can't bind socket %s", dev->sockfn);
+		/* upsd may run as another (de-elevated) user than we do */
+		if (chmod(dev->sockfn, 0666) < 0)
+			upslog_with_errno(LOG_WARNING, "Can't chmod socket %s", dev->sockfn);
+		if (listen(dev->listen_fd, 4) < 0)
+			fatal_with_errno(EXIT_FAILURE, "Can't listen on socket %s", dev->sockfn);
+		set_nonblock(dev->listen_fd);
+	}
+}
+
+static void devices_cleanup(void)
+{
+	size_t	i, j;
+
+	for (i = 0; i < ndevices; i++) {
+		lg_device_t	*dev = &devices[i];
+
+		if (dev->fd >= 0)
+			device_disconnect(dev);
+		close(dev->listen_fd);
+		unlink(dev->sockfn);
+
+		for (j = 0; j < dev->data->nvars; j++)
+			free(dev->val[j]);
+		free(dev->val);
+		free(dev->step);
+		free(dev->out.buf);
+	}
+
+	free(devices);
+}
+
+/* --- clients ---------------------------------------------------------- */
+
+static void stats_add(lg_op_t op, double latency, int error)
+{
+	lg_stats_t	*st = &stats[op];
+
+	if (!measuring)
+		return;
+
+	if (st->count >= st->size) {
+		st->size = st->size ? st->size * 2 : 4096;
+		st->usec = xrealloc(st->usec, sizeof(*st->usec) * st->size);
+	}
+
+	st->usec[st->count++] = (uint32_t)(latency * 1000000.0);
+	if (error)
+		st->errors++;
+}
+
+static void client_send(lg_client_t *cl)
+{
+	const lg_device_t	*dev = &devices[(size_t)rand() % ndevices];
+	unsigned int	pick = (unsigned int)rand() % mix_total;
+	int	op;
+
+	for (op = 0; op < OP_COUNT - 1 && pick >= mix[op]; op++)
+		pick -= mix[op];
+
+	cl->op = (lg_op_t)op;
+
+	if (cl->op == OP_GET) {
+		outbuf_printf(&cl->out, "GET VAR %s %s\n", dev->name,
+			dev->data->vars[(size_t)rand() % dev->data->nvars].name);
+	}
+	else if (cl->op == OP_LIST) {
+		outbuf_printf(&cl->out, "LIST VAR %s\n", dev->name);
+		snprintf(cl->endline, sizeof(cl->endline), "END LIST VAR %s", dev->name);
+	}
+	else {
+		outbuf_printf(&cl->out, "SET VAR %s %s %d\n", dev->name, LG_SETVAR, rand() % 600);
+	}
+
+	cl->busy = 1;
+	cl->sent = now_sec();
+}
+
+/* a complete line of a reply; returns 1 if the request is answered */
+static int client_line(lg_client_t *cl, const char *line)
+{
+	int	error = !strncmp(line, "ERR ", 4);
+
+	if (cl->logins > 0) {
+		cl->logins--;
+		if (error)
+			upslogx(LOG_WARNING, "Login failed: %s", line);
+		return 0;
+	}
+
+	if (!cl->busy)
+		return 0;
+
+	if (cl->op == OP_LIST && !error && strcmp(line, cl->endline))
+		return 0;
+
+	stats_add(cl->op, now_sec() - cl->sent, error);
+	cl->busy = 0;
+
+	return 1;
+}
+
+static void client_close(lg_client_t *cl)
+{
+	if (cl->fd >= 0)
+		close(cl->fd);
+	cl->fd = -1;
+	clients_lost++;
+}
+
+static void client_read(lg_client_t *cl)
+{
+	char	*nl, *line;
+	ssize_t	ret;
+
+	ret = read(cl->fd, cl->in + cl->inlen, sizeof(cl->in) - cl->inlen - 1);
+
+	if (ret <= 0) {
+		if (ret < 0 && (errno == EAGAIN || errno == EINTR))
+			return;
+		upslogx(LOG_WARNING, "Client connection closed by upsd");
+		client_close(cl);
+		return;
+	}
+
+	cl->inlen += (size_t)ret;
+	cl->in[cl->inlen] = '\0';
+
+	for (line = cl->in; (nl = strchr(line, '\n')) != NULL; line = nl + 1) {
+		*nl = '\0';
+		if (client_line(cl, line) && measuring >= 0)
+			client_send(cl);
+	}
+
+	cl->inlen -= (size_t)(line - cl->in);
+	memmove(cl->in, line, cl->inlen);
+
+	/* a line longer than the buffer: only its end matters */
+	if (cl->inlen >= sizeof(cl->in) - 1)
+		cl->inlen = 0;
+}
+
+static int client_connect(void)
+{
+	struct addrinfo	hints, *res, *ai;
+	int	fd = -1, one = 1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &res))
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd >= 0) {
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		set_nonblock(fd);
+	}
+
+	return fd;
+}
+
+static size_t clients_init(void)
+{
+	size_t	i, connected = 0;
+
+	clients = xcalloc(nclients, sizeof(*clients));
+
+	for (i = 0; i < nclients; i++) {
+		lg_client_t	*cl = &clients[i];
+
+		cl->fd = client_connect();
+		if (cl->fd < 0) {
+			upslog_with_errno(LOG_WARNING, "Client %" PRIuSIZE " can't connect to %s:%s",
+				i + 1, host, port);
+			continue;
+		}
+		connected++;
+
+		if (username && password && mix[OP_SET]) {
+			outbuf_printf(&cl->out, "USERNAME %s\nPASSWORD %s\n", username, password);
+			cl->logins = 2;
+		}
+	}
+
+	return connected;
+}
+
+static void clients_cleanup(void)
+{
+	size_t	i;
+
+	for (i = 0; i < nclients; i++) {
+		if (clients[i].fd >= 0) {
+			outbuf_printf(&clients[i].out, "LOGOUT\n");
+			outbuf_flush(clients[i].fd, &clients[i].out);
+			close(clients[i].fd);
+		}
+		free(clients[i].out.buf);
+	}
+
+	free(clients);
+}
+
+/* --- the loop --------------------------------------------------------- */
+
+/* one round of I/O for all emulated drivers and clients */
+static void poll_all(int timeout_ms)
+{
+	static struct pollfd	*fds;
+	static size_t	*owner;
+	static size_t	fds_size;
+	size_t	n = 0, i, need = ndevices + nclients;
+	double	now;
+
+	if (fds_size < need) {
+		fds = xrealloc(fds, sizeof(*fds) * need);
+		owner = xrealloc(owner, sizeof(*owner) * need);
+		fds_size = need;
+	}
+
+	for (i = 0; i < ndevices; i++) {
+		lg_device_t	*dev = &devices[i];
+
+		if (dev->fd >= 0) {
+			fds[n].fd = dev->fd;
+			fds[n].events = (short)(POLLIN | (dev->out.len ? POLLOUT : 0));
+		} else {
+			fds[n].fd = dev->listen_fd;
+			fds[n].events = POLLIN;
+		}
+		fds[n].revents = 0;
+		owner[n++] = i;
+	}
+
+	for (i = 0; clients && i < nclients; i++) {
+		lg_client_t	*cl = &clients[i];
+
+		if (cl->fd < 0)
+			continue;
+
+		fds[n].fd = cl->fd;
+		fds[n].events = (short)(POLLIN | (cl->out.len ? POLLOUT : 0));
+		fds[n].revents = 0;
+		owner[n++] = ndevices + i;
+	}
+
+	if (poll(fds, (nfds_t)n, timeout_ms) < 0) {
+		if (errno != EINTR)
+			fatal_with_errno(EXIT_FAILURE, "poll");
+		return;
+	}
+
+	for (i = 0; i < n; i++) {
+		if (!fds[i].revents)
+			continue;
+
+		if (owner[i] < ndevices) {
+			lg_device_t	*dev = &devices[owner[i]];
+
+			if (fds[i].fd == dev->listen_fd) {
+				device_accept(dev);
+				continue;
+			}
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				device_read(dev);
+			if (dev->fd >= 0 && outbuf_flush(dev->fd, &dev->out) < 0)
+				device_disconnect(dev);
+		} else {
+			lg_client_t	*cl = &clients[owner[i] - ndevices];
+
+			if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+				client_read(cl);
+			if (cl->fd >= 0 && outbuf_flush(cl->fd, &cl->out) < 0)
+				client_close(cl);
+		}
+	}
+
+	now = now_sec();
+	for (i = 0; i < ndevices; i++) {
+		device_update(&devices[i], now);
+		if (devices[i].fd >= 0 && devices[i].out.len
+		 && outbuf_flush(devices[i].fd, &devices[i].out) < 0)
+			device_disconnect(&devices[i]);
+	}
+}
+
+/* --- upsd resource usage ---------------------------------------------- */
+
+typedef struct {
+	double	cpu;	/* user + system seconds */
+	long	rss;	/* kB */
+	long	hwm;	/* kB */
+} lg_procstat_t;
+
+static pid_t upsd_pid(void)
+{
+	FILE	*f;
+	long	pid = 0;
+
+	if (!upsd_pid_arg)
+		return 0;
+
+	if (str_to_long(upsd_pid_arg, &pid, 10))
+		return (pid_t)pid;
+
+	if ((f = fopen(upsd_pid_arg, "r")) != NULL) {
+		if (fscanf(f, "%ld", &pid) != 1)
+			pid = 0;
+		fclose(f);
+	}
+
+	return (pid_t)pid;
+}
+
+/* from /proc (Linux and some others); returns -1 if not available */
+static int procstat_read(pid_t pid, lg_procstat_t *ps)
+{
+	char	fn[SMALLBUF], line[LARGEBUF], *p;
+	unsigned long	utime, stime;
+	FILE	*f;
+	int	ret = -1;
+
+	memset(ps, 0, sizeof(*ps));
+
+	if (pid <= 0)
+		return -1;
+
+	snprintf(fn, sizeof(fn), "/proc/%ld/stat", (long)pid);
+	if ((f = fopen(fn, "r")) == NULL)
+		return -1;
+
+	/* fields after the command name: state ppid ... utime(14) stime(15) */
+	if (fgets(line, sizeof(line), f) && (p = strrchr(line, ')')) != NULL
+	 && sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu",
+		&utime, &stime) == 2
+	) {
+		ps->cpu = (double)(utime + stime) / (double)sysconf(_SC_CLK_TCK);
+		ret = 0;
+	}
+	fclose(f);
+
+	snprintf(fn, sizeof(fn), "/proc/%ld/status", (long)pid);
+	if ((f = fopen(fn, "r")) != NULL) {
+		while (fgets(line, sizeof(line), f)) {
+			if (!strncmp(line, "VmRSS:", 6))
+				ps->rss = atol(line + 6);
+			else if (!strncmp(line, "VmHWM:", 6))
+				ps->hwm = atol(line + 6);
+		}
+		fclose(f);
+	}
+
+	return ret;
+}
+
+/* --- report ----------------------------------------------------------- */
+
+static int cmp_u32(const void *a, const void *b)
+{
+	uint32_t	x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_ms(const lg_stats_t *st, double pct)
+{
+	size_t	idx;
+
+	if (!st->count)
+		return 0;
+
+	idx = (size_t)(pct / 100.0 * (double)(st->count - 1) + 0.5);
+	return (double)st->usec[idx] / 1000.0;
+}
+
+static void report_line(const char *name, lg_stats_t *st, double elapsed)
+{
+	qsort(st->usec, st->count, sizeof(*st->usec), cmp_u32);
+
+	printf("%-6s %10" PRIuSIZE " %10.1f %8" PRIuSIZE " %10.3f %10.3f %10.3f\n",
+		name, st->count, (double)st->count / elapsed, st->errors,
+		percentile_ms(st, 50), percentile_ms(st, 99), percentile_ms(st, 100));
+}
+
+static size_t report(double elapsed, pid_t pid, const lg_procstat_t *ps0, const lg_procstat_t *ps1)
+{
+	lg_stats_t	all;
+	size_t	nvars = 0, i;
+	int	op;
+
+	memset(&all, 0, sizeof(all));
+	for (op = 0; op < OP_COUNT; op++) {
+		if (!stats[op].count)
+			continue;
+		all.usec = xrealloc(all.usec, sizeof(*all.usec) * (all.count + stats[op].count));
+		memcpy(all.usec + all.count, stats[op].usec, sizeof(*all.usec) * stats[op].count);
+		all.count += stats[op].count;
+		all.errors += stats[op].errors;
+	}
+
+	for (i = 0; i < ndevices; i++)
+		nvars += devices[i].data->nvars;
+
+	printf("devices: %" PRIuSIZE " (%" PRIuSIZE " variables in all), %.2f updates/sec each, %lu updates sent (%.1f/sec)\n",
+		ndevices, nvars, update_rate, updates_sent, (double)updates_sent / elapsed);
+	printf("clients: %" PRIuSIZE " (%" PRIuSIZE " lost) for %.1f sec, mix GET:LIST:SET = %u:%u:%u\n",
+		nclients, clients_lost, elapsed, mix[OP_GET], mix[OP_LIST], mix[OP_SET]);
+	printf("%-6s %10s %10s %8s %10s %10s %10s\n",
+		"op", "count", "ops/sec", "errors", "p50 (ms)", "p99 (ms)", "max (ms)");
+	for (op = 0; op < OP_COUNT; op++)
+		report_line(op_names[op], &stats[op], elapsed);
+	report_line("all", &all, elapsed);
+
+	if (pid > 0 && ps1->cpu >= ps0->cpu && (ps0->cpu > 0 || ps1->cpu > 0)) {
+		printf("upsd (PID %ld): CPU %.1f%% (%.2f sec), RSS %ld kB (peak %ld kB)\n",
+			(long)pid, 100.0 * (ps1->cpu - ps0->cpu) / elapsed,
+			ps1->cpu - ps0->cpu, ps1->rss, ps1->hwm);
+	} else if (pid > 0) {
+		printf("upsd (PID %ld): CPU and RSS not available on this platform\n", (long)pid);
+	}
+
+	free(all.usec);
+
+	return all.count;
+}
+
+/* --- main ------------------------------------------------------------- */
+
+static void help(const char *prog)
+{
+	printf("Synthetic load for benchmarking upsd, see tests/NIT (make bench-upsd)\n\n");
+	printf("usage: %s [OPTIONS] -f <file> [-f <file> ...]\n\n", prog);
+	printf("  -f <file>	dummy-ups data file (.dev or .seq), devices use them in turn\n");
+	printf("  -n <num>	number of emulated devices (default %" PRIuSIZE ")\n", ndevices);
+	printf("  -N <prefix>	device names are <prefix>1..<prefix>n (default %s)\n", prefix);
+	printf("  -d <driver>	driver name in the socket names (default %s)\n", drvname);
+	printf("  -s <path>	directory for the sockets (default: NUT_STATEPATH)\n");
+	printf("  -u <rate>	value updates per second per device (default %.1f)\n", update_rate);
+	printf("  -c <num>	number of clients (default %" PRIuSIZE ")\n", nclients);
+	printf("  -m <g:l:s>	weights of GET VAR, LIST VAR and SET VAR requests (default %u:%u:%u)\n",
+		mix[OP_GET], mix[OP_LIST], mix[OP_SET]);
+	printf("  -H <host>	upsd host (default %s)\n", host);
+	printf("  -p <port>	upsd port (default: NUT_PORT or %d)\n", PORT);
+	printf("  -U <user>	user name for SET requests\n");
+	printf("  -W <pass>	password for SET requests\n");
+	printf("  -t <sec>	duration of the measurement (default %.0f)\n", duration);
+	printf("  -w <sec>	how long to wait for upsd to read all devices (default %.0f)\n", warmup_timeout);
+	printf("  -P <pid|file>	upsd PID (or PID file) to report its CPU time and RSS\n");
+	printf("  -D		raise debugging level\n");
+}
+
+static int parse_mix(const char *arg)
+{
+	unsigned int	v[OP_COUNT];
+	int	op;
+
+	if (sscanf(arg, "%u:%u:%u", &v[OP_GET], &v[OP_LIST], &v[OP_SET]) != OP_COUNT)
+		return -1;
+
+	for (mix_total = 0, op = 0; op < OP_COUNT; op++) {
+		mix[op] = v[op];
+		mix_total += v[op];
+	}
+
+	return mix_total ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+	struct rlimit	rl;
+	lg_procstat_t	ps0, ps1;
+	double	start, end;
+	size_t	i, dumped, completed;
+	pid_t	pid;
+	int	opt;
+	char	portbuf[SMALLBUF];
+
+	statepath = getenv("NUT_STATEPATH");
+	port = getenv("NUT_PORT");
+
+	while ((opt = getopt(argc, argv, "hf:n:N:d:s:u:c:m:H:p:U:W:t:w:P:D")) != -1) {
+		switch (opt) {
+			case 'f':
+				data_load(optarg);
+				break;
+			case 'n':
+				ndevices = (size_t)atol(optarg);
+				break;
+			case 'N':
+				prefix = optarg;
+				break;
+			case 'd':
+				drvname = optarg;
+				break;
+			case 's':
+				statepath = optarg;
+				break;
+			case 'u':
+				update_rate = atof(optarg);
+				break;
+			case 'c':
+				nclients = (size_t)atol(optarg);
+				break;
+			case 'm':
+				if (parse_mix(optarg))
+					fatalx(EXIT_FAILURE, "Invalid request mix: %s", optarg);
+				break;
+			case 'H':
+				host = optarg;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 'U':
+				username = optarg;
+				break;
+			case 'W':
+				password = optarg;
+				break;
+			case 't':
+				duration = atof(optarg);
+				break;
+			case 'w':
+				warmup_timeout = atof(optarg);
+				break;
+			case 'P':
+				upsd_pid_arg = optarg;
+				break;
+			case 'D':
+				nut_debug_level++;
+				break;
+			case 'h':
+			default:
+				help(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!ndatasets || !ndevices || duration <= 0) {
+		help(argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (!statepath)
+		statepath = dflt_statepath();
+
+	if (!port) {
+		snprintf(portbuf, sizeof(portbuf), "%d", PORT);
+		port = portbuf;
+	}
+
+	/* two descriptors per device and one per client, and some spare */
+	if (!getrlimit(RLIMIT_NOFILE, &rl)) {
+		rlim_t	need = (rlim_t)(ndevices * 2 + nclients + 32);
+
+		if (rl.rlim_cur < need) {
+			rl.rlim_cur = (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < need) ? rl.rlim_max : need;
+			if (setrlimit(RLIMIT_NOFILE, &rl) || rl.rlim_cur < need)
+				upslogx(LOG_WARNING, "Can not have %lu open files, only %lu",
+					(unsigned long)need, (unsigned long)rl.rlim_cur);
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	srand(1);
+
+	devices_init();
+	printf("nutloadgen: serving %" PRIuSIZE " devices in %s\n", ndevices, statepath);
+	fflush(stdout);
+
+	/* let upsd connect and read all the devices first (and the
+	 * caller write its PID file, if that is how we learn it) */
+	start = now_sec();
+	do {
+		poll_all(100);
+		for (dumped = 0, i = 0; i < ndevices; i++) {
+			if (devices[i].dumped && !devices[i].out.len)
+				dumped++;
+		}
+		pid = upsd_pid();
+	} while ((dumped < ndevices || (upsd_pid_arg && pid <= 0))
+		&& now_sec() - start < warmup_timeout);
+
+	printf("nutloadgen: upsd read %" PRIuSIZE " of %" PRIuSIZE " devices in %.1f sec\n",
+		dumped, ndevices, now_sec() - start);
+	if (dumped < ndevices) {
+		devices_cleanup();
+		return EXIT_FAILURE;
+	}
+
+	if (clients_init() < nclients)
+		upslogx(LOG_WARNING, "Not all clients could connect");
+
+	/* logins are done before the first requests go out */
+	start = now_sec();
+	for (;;) {
+		int	pending = 0;
+
+		for (i = 0; i < nclients; i++)
+			pending += (clients[i].fd >= 0 && clients[i].logins > 0);
+		if (!pending || now_sec() - start > warmup_timeout)
+			break;
+		poll_all(100);
+	}
+
+	procstat_read(pid, &ps0);
+
+	measuring = 1;
+	start = now_sec();
+	for (i = 0; i < nclients; i++) {
+		if (clients[i].fd >= 0)
+			client_send(&clients[i]);
+	}
+
+	do {
+		poll_all(update_rate > 0 ? 5 : 100);
+	} while (now_sec() - start < duration);
+
+	end = now_sec();
+	measuring = 0;
+	procstat_read(pid, &ps1);
+
+	completed = report(end - start, pid, &ps0, &ps1);
+
+	clients_cleanup();
+	devices_cleanup();
+
+	return (completed && !clients_lost) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("nutloadgen is not implemented on this platform (SKIP)\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
@@ -0,0 +1,381 @@
+/*  nutlogasynctest.c - test the asynchronous logging backend and the
+ *  rate limiting of upslog*() and upsdebug*() messages, and compare how
+ *  long a busy event loop stalls on logging to a slow consumer of its
+ *  stderr (as a journal or serial console can be) in both modes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/wait.h>
+
+/* defaults of the stall benchmark, kept short for "make check";
+ * see the options in main() for longer runs */
+static int	bench_loops = 200;
+static int	bench_msgs = 10;
+static long	bench_reader_kbps = 256;
+static size_t	bench_slots = 0;
+
+/* send stderr to a temporary file for a while; returns the file */
+static FILE *stderr_to_tmpfile(int *saved)
+{
+	FILE	*f = tmpfile();
+
+	if (!f)
+		return NULL;
+
+	fflush(stderr);
+	*saved = dup(STDERR_FILENO);
+	dup2(fileno(f), STDERR_FILENO);
+
+	return f;
+}
+
+static void stderr_restore(int saved)
+{
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+}
+
+static int test_async_order(void)
+{
+	FILE	*f;
+	char	line[LARGEBUF];
+	int	saved, i, expected = 0, bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	if ((f = stderr_to_tmpfile(&saved)) == NULL) {
+		printf("can not create a temporary file (FAIL)\n");
+		return 1;
+	}
+
+	if (upslog_async_start(0) < 0) {
+		stderr_restore(saved);
+		fclose(f);
+		printf("asynchronous logging not supported here (SKIP)\n");
+		return 0;
+	}
+
+	for (i = 0; i < 500; i++)
+		upslogx(LOG_INFO, "ordered message %d", i);
+
+	/* one longer than a ring slot holds inline */
+	upslogx(LOG_INFO, "long message %0900d", 0);
+
+	upslog_async_stop();
+	stderr_restore(saved);
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		if (expected < 500) {
+			char	want[SMALLBUF];
+
+			snprintf(want, sizeof(want), "ordered message %d\n", expected);
+			if (strcmp(line, want))
+				bad++;
+			expected++;
+		} else if (strncmp(line, "long message 0", 14) || strlen(line) != 13 + 900 + 1) {
+			bad++;
+		} else {
+			expected++;
+		}
+	}
+	fclose(f);
+
+	if (expected != 501 || bad) {
+		printf("got %d of 501 messages, %d out of order or mangled (FAIL)\n", expected, bad);
+		return 1;
+	}
+
+	printf("all messages written in order (OK)\n");
+	return 0;
+}
+
+static int test_async_drop(void)
+{
+	int	fds[2], saved, status, i;
+	pid_t	pid;
+	char	payload[1024];
+
+	printf("=== %s:\t", __func__);
+	fflush(stdout);
+
+	if (pipe(fds) < 0) {
+		printf("can not create a pipe (FAIL)\n");
+		return 1;
+	}
+
+	/* the reader comes late, after the pipe and the ring filled up,
+	 * and reports whether it saw the writer report the dropped ones */
+	if ((pid = fork()) == 0) {
+		FILE	*in;
+		char	line[LARGEBUF];
+		int	found = 0;
+
+		close(fds[1]);
+		usleep(300000);
+		in = fdopen(fds[0], "r");
+		while (in && fgets(line, sizeof(line), in)) {
+			if (strstr(line, "messages were dropped"))
+				found = 1;
+		}
+		_exit(found ? EXIT_SUCCESS : EXIT_FAILURE);
+	}
+	close(fds[0]);
+
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	dup2(fds[1], STDERR_FILENO);
+	close(fds[1]);
+
+	if (upslog_async_start(4) < 0) {
+		stderr_restore(saved);
+		waitpid(pid, &status, 0);
+		printf("asynchronous logging not supported here (SKIP)\n");
+		return 0;
+	}
+
+	memset(payload, 'x', sizeof(payload) - 1);
+	payload[sizeof(payload) - 1] = '\0';
+	for (i = 0; i < 200; i++)
+		upslogx(LOG_INFO, "%d %s", i, payload);
+
+	upslog_async_stop();
+	stderr_restore(saved);
+	waitpid(pid, &status, 0);
+
+	if (!upslog_async_dropped()) {
+		printf("no messages were dropped with a stuck consumer (FAIL)\n");
+		return 1;
+	}
+	if (!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) {
+		printf("%" PRIuSIZE " dropped, but that was not reported in the log (FAIL)\n",
+			upslog_async_dropped());
+		return 1;
+	}
+
+	printf("%" PRIuSIZE " of 200 dropped and reported (OK)\n", upslog_async_dropped());
+	return 0;
+}
+
+static int test_ratelimit(void)
+{
+	FILE	*f;
+	char	line[LARGEBUF];
+	int	saved, i, burst, lines = 0, summary = 0;
+	size_t	suppressed;
+	time_t	start;
+
+	printf("=== %s:\t", __func__);
+	fflush(stdout);
+
+	if ((f = stderr_to_tmpfile(&saved)) == NULL) {
+		printf("can not create a temporary file (FAIL)\n");
+		return 1;
+	}
+
+	/* two bursts from one place in the code, the second one in a later
+	 * second, whose first message tells how many were dropped before */
+	upslog_set_ratelimit(5);
+	for (burst = 0; burst < 2; burst++) {
+		start = time(NULL);
+		while (burst && time(NULL) == start)
+			usleep(10000);
+
+		for (i = 0; i < 25; i++)
+			upslogx(LOG_INFO, "limited message %d", burst * 25 + i);
+	}
+	suppressed = upslog_ratelimit_suppressed();
+	upslog_set_ratelimit(0);
+	stderr_restore(saved);
+
+	rewind(f);
+	while (fgets(line, sizeof(line), f)) {
+		lines++;
+		if (strstr(line, "similar messages suppressed"))
+			summary++;
+	}
+	fclose(f);
+
+	/* a burst could straddle a second boundary: 5 or 10 let through */
+	if (lines < 10 || lines > 20 || lines + (int)suppressed != 50 || !summary) {
+		printf("%d lines, %" PRIuSIZE " suppressed, %d summaries (FAIL)\n",
+			lines, suppressed, summary);
+		return 1;
+	}
+
+	printf("%d of 50 lines let through, %" PRIuSIZE " suppressed (OK)\n", lines, suppressed);
+	return 0;
+}
+
+static int cmp_long(const void *a, const void *b)
+{
+	long	x = *(const long *)a, y = *(const long *)b;
+
+	return (x > y) - (x < y);
+}
+
+static long now_usec(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (long)tv.tv_sec * 1000000L + (long)tv.tv_usec;
+}
+
+/* An event loop iteration logging a burst of debug messages to a stderr
+ * drained by a slow reader; returns the per-iteration stall figures */
+static void bench_loop(const char *mode, long *stall)
+{
+	struct timespec	idle = { 0, 200000L };	/* 0.2 ms of select() */
+	long	start = now_usec(), elapsed;
+	int	i, j;
+
+	for (i = 0; i < bench_loops; i++) {
+		long	t0 = now_usec();
+
+		for (j = 0; j < bench_msgs; j++)
+			upsdebugx(1, "%s: loop %d: comm failure on device bench%d, will retry in %d sec",
+				mode, i, j, 5);
+
+		stall[i] = now_usec() - t0;
+		nanosleep(&idle, NULL);
+	}
+	elapsed = now_usec() - start;
+
+	qsort(stall, (size_t)bench_loops, sizeof(*stall), cmp_long);
+	printf("%-14s %9.3f %9.3f %9.3f %9.0f\n", mode,
+		(double)stall[bench_loops / 2] / 1000.0,
+		(double)stall[(bench_loops * 99) / 100] / 1000.0,
+		(double)stall[bench_loops - 1] / 1000.0,
+		(double)(bench_loops * bench_msgs) * 1000000.0 / (double)elapsed);
+}
+
+static int bench_stalls(void)
+{
+	int	fds[2], saved, status;
+	pid_t	pid;
+	long	*stall;
+	size_t	dropped;
+
+	printf("=== %s:\t%d loops of %d debug messages, stderr read at %ld KiB/s\n",
+		__func__, bench_loops, bench_msgs, bench_reader_kbps);
+	fflush(stdout);
+
+	if (pipe(fds) < 0) {
+		printf("can not create a pipe (FAIL)\n");
+		return 1;
+	}
+
+	if ((pid = fork()) == 0) {
+		char	buf[4096];
+		ssize_t	ret;
+
+		close(fds[1]);
+		while ((ret = read(fds[0], buf, sizeof(buf))) > 0)
+			usleep((useconds_t)(ret * 1000000L / (bench_reader_kbps * 1024)));
+		_exit(EXIT_SUCCESS);
+	}
+	close(fds[0]);
+
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	dup2(fds[1], STDERR_FILENO);
+	close(fds[1]);
+
+	stall = xcalloc((size_t)bench_loops, sizeof(*stall));
+	nut_debug_level = 1;
+
+	printf("%-14s %9s %9s %9s %9s\n", "mode", "p50 (ms)", "p99 (ms)", "max (ms)", "msgs/sec");
+	bench_loop("sync", stall);
+
+	dropped = upslog_async_dropped();
+	if (upslog_async_start(bench_slots) == 0) {
+		bench_loop("async", stall);
+		upslog_async_stop();
+		dropped = upslog_async_dropped() - dropped;
+	}
+
+	upslog_set_ratelimit(20);
+	bench_loop("sync+limit", stall);
+	upslog_set_ratelimit(0);
+
+	nut_debug_level = 0;
+	free(stall);
+
+	stderr_restore(saved);
+	waitpid(pid, &status, 0);
+
+	printf("async dropped %" PRIuSIZE " messages while the reader lagged (OK)\n", dropped);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int	ret = 0, opt;
+
+	while ((opt = getopt(argc, argv, "n:m:r:s:")) != -1) {
+		switch (opt) {
+			case 'n':
+				bench_loops = atoi(optarg);
+				break;
+			case 'm':
+				bench_msgs = atoi(optarg);
+				break;
+			case 'r':
+				bench_reader_kbps = atol(optarg);
+				break;
+			case 's':
+				bench_slots = (size_t)atol(optarg);
+				break;
+			default:
+				printf("usage: %s [-n loops] [-m messages per loop] [-r reader KiB/s] [-s async slots]\n",
+					argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (bench_loops < 1 || bench_msgs < 1 || bench_reader_kbps < 1) {
+		printf("Invalid benchmark parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	ret += test_async_order();
+	ret += test_async_drop();
+	ret += test_ratelimit();
+	ret += bench_stalls();
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("nutlogasynctest is not implemented on this platform (SKIP)\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
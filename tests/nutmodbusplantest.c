@@ -0,0 +1,378 @@
+/*  nutmodbusplantest.c - test the coalescing of Modbus register reads
+ *  (drivers/modbus_plan.c) against a simulated device, and if built with
+ *  libmodbus also against a local Modbus TCP server
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "modbus_plan.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if (defined WITH_MODBUS) && !(defined WIN32)
+# include <sys/wait.h>
+# include <netinet/in.h>
+# include <arpa/inet.h>
+#endif
+
+#define NUM_ADDRS	0x400
+
+/* simulated device: register value is derived from its address and type */
+typedef struct sim_s {
+	int	reads;		/* transactions seen */
+	int	illegal_from;	/* addresses the device rejects, if any */
+	int	illegal_to;
+} sim_t;
+
+static uint16_t sim_value(mbplan_type_t type, int addr)
+{
+	if (type == MBPLAN_COIL || type == MBPLAN_INPUT_B)
+		return (uint16_t)((addr + (int)type) % 2);
+
+	return (uint16_t)(addr * 3 + (int)type * 1000);
+}
+
+static int sim_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *dest)
+{
+	sim_t	*sim = (sim_t *)ctx;
+	int	i;
+
+	sim->reads++;
+	if (addr + count > NUM_ADDRS)
+		return MBPLAN_READ_ILLEGAL;
+
+	if (sim->illegal_to > sim->illegal_from
+	 && addr < sim->illegal_to && addr + count > sim->illegal_from
+	) {
+		return MBPLAN_READ_ILLEGAL;
+	}
+
+	for (i = 0; i < count; i++)
+		dest[i] = sim_value(type, addr + i);
+
+	return count;
+}
+
+/* the addresses a driver like generic_modbus or phoenixcontact_modbus
+ * would poll: scattered single values and a few short ranges */
+static const struct {
+	mbplan_type_t	type;
+	int	addr, count;
+} wanted[] = {
+	{ MBPLAN_INPUT_R, 0x200, 1 },
+	{ MBPLAN_INPUT_R, 0x202, 1 },
+	{ MBPLAN_INPUT_R, 0x206, 2 },
+	{ MBPLAN_INPUT_R, 0x20A, 1 },
+	{ MBPLAN_INPUT_R, 0x20D, 1 },
+	{ MBPLAN_INPUT_R, 0x20F, 2 },
+	{ MBPLAN_INPUT_R, 0x300, 2 },
+	{ MBPLAN_INPUT_R, 0x312, 1 },
+	{ MBPLAN_HOLDING, 0x010, 5 },
+	{ MBPLAN_HOLDING, 0x012, 4 },	/* overlaps the previous one */
+	{ MBPLAN_HOLDING, 0x100, 1 },
+	{ MBPLAN_COIL, 0x001, 1 },
+	{ MBPLAN_COIL, 0x040, 1 },
+	{ MBPLAN_COIL, 0x3F0, 1 },
+	{ MBPLAN_INPUT_B, 0x005, 1 },
+};
+#define NUM_WANTED	(sizeof(wanted) / sizeof(wanted[0]))
+
+static mbplan_t *plan_wanted(void)
+{
+	mbplan_t	*plan = mbplan_new();
+	size_t	i;
+
+	for (i = 0; i < NUM_WANTED; i++)
+		mbplan_add(plan, wanted[i].type, wanted[i].addr, wanted[i].count);
+
+	return plan;
+}
+
+/* all wanted values can be picked from the plan, and are right */
+static int check_values(const mbplan_t *plan)
+{
+	uint16_t	buf[8];
+	size_t	i;
+	int	k;
+
+	for (i = 0; i < NUM_WANTED; i++) {
+		if (mbplan_get(plan, wanted[i].type, wanted[i].addr, wanted[i].count, buf))
+			return 0;
+		for (k = 0; k < wanted[i].count; k++) {
+			if (buf[k] != sim_value(wanted[i].type, wanted[i].addr + k))
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int check_planning(void)
+{
+	mbplan_t	*plan = plan_wanted();
+	mbplan_type_t	type;
+	int	addr, count, res = 0;
+	size_t	n, i;
+
+	printf("=== %s:\t", __func__);
+
+	/* with default limits: INPUT_R 0x200-0x210, 0x300-0x301, 0x312;
+	 * HOLDING 0x10-0x15, 0x100; COIL 0x1-0x40 and 0x3F0; INPUT_B 0x5 */
+	n = mbplan_build(plan);
+	if (n != 8) {
+		printf("%" PRIuSIZE " block reads for %" PRIuSIZE " requests, expected 8 (FAIL)\n",
+			n, NUM_WANTED);
+		res++;
+	}
+
+	for (i = 0; i < n; i++) {
+		mbplan_block(plan, i, &type, &addr, &count);
+		if ((type == MBPLAN_INPUT_R && addr == 0x200 && count != 0x11)
+		 || (type == MBPLAN_HOLDING && addr == 0x10 && count != 6)
+		) {
+			printf("unexpected block %d+%d (FAIL)\n", addr, count);
+			res++;
+		}
+	}
+
+	/* a smaller span and no gaps: one read per separate range */
+	mbplan_set_limits(plan, MBPLAN_INPUT_R, 4, -1);
+	n = mbplan_build(plan);
+	if (n != 13) {
+		printf("%" PRIuSIZE " block reads without gaps, expected 13 (FAIL)\n", n);
+		res++;
+	}
+
+	/* invalid ranges are refused, covered ones not added again */
+	if (mbplan_add(plan, MBPLAN_HOLDING, 0xFFFF, 2) != -1
+	 || mbplan_add(plan, MBPLAN_HOLDING, 0, MBPLAN_MAX_READ_REGISTERS + 1) != -1
+	 || mbplan_add(plan, MBPLAN_HOLDING, 0x13, 2) != 0
+	) {
+		printf("range validation (FAIL)\n");
+		res++;
+	}
+
+	if (!res)
+		printf("%" PRIuSIZE " requests in 8 block reads (OK)\n", NUM_WANTED);
+
+	mbplan_free(plan);
+	return res;
+}
+
+static int check_reading(void)
+{
+	mbplan_t	*plan = plan_wanted();
+	sim_t	sim;
+	uint16_t	val;
+	int	res = 0, failed, reads;
+
+	printf("=== %s:\t", __func__);
+	memset(&sim, 0, sizeof(sim));
+
+	failed = mbplan_read(plan, sim_read, &sim);
+	if (failed || sim.reads != 8 || !check_values(plan)) {
+		printf("%d failed of %d reads, or wrong values (FAIL)\n", failed, sim.reads);
+		res++;
+	}
+
+	/* not requested: not available, even if within a block */
+	if (mbplan_get(plan, MBPLAN_INPUT_R, 0x201, 1, &val) != -1) {
+		printf("got a value which was not requested (FAIL)\n");
+		res++;
+	}
+
+	/* the device rejects a gap: the block is split, the values are still there */
+	sim.illegal_from = 0x203;
+	sim.illegal_to = 0x205;
+	sim.reads = 0;
+	failed = mbplan_read(plan, sim_read, &sim);
+	reads = sim.reads;
+	if (failed || !check_values(plan)) {
+		printf("%d failed reads with an illegal gap (FAIL)\n", failed);
+		res++;
+	}
+
+	/* ... and next time read by range right away: 7 other blocks, 6 ranges */
+	sim.reads = 0;
+	mbplan_read(plan, sim_read, &sim);
+	if (sim.reads != 13 || reads != 14 || !check_values(plan)) {
+		printf("%d reads after splitting, %d when splitting (FAIL)\n", sim.reads, reads);
+		res++;
+	}
+
+	/* forgotten values are not served */
+	mbplan_invalidate(plan);
+	if (mbplan_get(plan, MBPLAN_INPUT_R, 0x200, 1, &val) != -1) {
+		printf("got a value after invalidation (FAIL)\n");
+		res++;
+	}
+
+	if (!res)
+		printf("%" PRIuSIZE " requests read in 8 transactions (OK)\n", NUM_WANTED);
+
+	mbplan_free(plan);
+	return res;
+}
+
+#if (defined WITH_MODBUS) && !(defined WIN32)
+/* Local libmodbus TCP server standing in for a device: holds the same
+ * values as the simulation, and serves requests until the client goes */
+static void tcp_server(int sock)
+{
+	modbus_t	*ctx = modbus_new_tcp("127.0.0.1", 0);
+	modbus_mapping_t	*map = modbus_mapping_new(NUM_ADDRS, NUM_ADDRS, NUM_ADDRS, NUM_ADDRS);
+	uint8_t	query[MODBUS_TCP_MAX_ADU_LENGTH];
+	int	i, len;
+
+	if (!ctx || !map)
+		exit(EXIT_FAILURE);
+
+	for (i = 0; i < NUM_ADDRS; i++) {
+		map->tab_bits[i] = (uint8_t)sim_value(MBPLAN_COIL, i);
+		map->tab_input_bits[i] = (uint8_t)sim_value(MBPLAN_INPUT_B, i);
+		map->tab_input_registers[i] = sim_value(MBPLAN_INPUT_R, i);
+		map->tab_registers[i] = sim_value(MBPLAN_HOLDING, i);
+	}
+
+	if (modbus_tcp_accept(ctx, &sock) == -1)
+		exit(EXIT_FAILURE);
+
+	while ((len = modbus_receive(ctx, query)) != -1) {
+		if (len > 0)
+			modbus_reply(ctx, query, len, map);
+	}
+
+	modbus_mapping_free(map);
+	modbus_free(ctx);
+	exit(EXIT_SUCCESS);
+}
+
+typedef struct tcp_client_s {
+	modbus_t	*ctx;
+	int	reads;
+} tcp_client_t;
+
+static int tcp_read(void *ctx, mbplan_type_t type, int addr, int count, uint16_t *dest)
+{
+	tcp_client_t	*client = (tcp_client_t *)ctx;
+
+	client->reads++;
+	return mbplan_modbus_read(client->ctx, type, addr, count, dest);
+}
+
+static int check_tcp(void)
+{
+	mbplan_t	*plan = plan_wanted();
+	tcp_client_t	client;
+	modbus_t	*listener;
+	struct sockaddr_in	sa;
+	socklen_t	salen = sizeof(sa);
+	struct timeval	start, end;
+	double	t_plan, t_single;
+	uint16_t	buf[8];
+	char	port[16];
+	pid_t	pid;
+	size_t	i;
+	int	sock, status, res = 0, rounds = 200, r;
+
+	printf("=== %s:\t", __func__);
+
+	/* let the system pick a free port */
+	listener = modbus_new_tcp("127.0.0.1", 0);
+	if (!listener || (sock = modbus_tcp_listen(listener, 1)) == -1
+	 || getsockname(sock, (struct sockaddr *)&sa, &salen)
+	) {
+		printf("can not set up a local Modbus TCP server (SKIP)\n");
+		mbplan_free(plan);
+		return 0;
+	}
+	snprintf(port, sizeof(port), "%u", (unsigned int)ntohs(sa.sin_port));
+
+	fflush(stdout);
+	if ((pid = fork()) == 0)
+		tcp_server(sock);
+	close(sock);
+	modbus_free(listener);
+
+	memset(&client, 0, sizeof(client));
+	client.ctx = modbus_new_tcp_pi("127.0.0.1", port);
+	if (!client.ctx || modbus_connect(client.ctx) == -1) {
+		printf("can not connect to the local Modbus TCP server (FAIL)\n");
+		res++;
+		goto finish;
+	}
+
+	gettimeofday(&start, NULL);
+	for (r = 0; r < rounds; r++) {
+		if (mbplan_read(plan, tcp_read, &client) || !check_values(plan))
+			res++;
+	}
+	gettimeofday(&end, NULL);
+	t_plan = difftimeval(end, start);
+
+	/* the same values, read one by one as the drivers did */
+	gettimeofday(&start, NULL);
+	for (r = 0; r < rounds; r++) {
+		for (i = 0; i < NUM_WANTED; i++) {
+			if (mbplan_modbus_read(client.ctx, wanted[i].type, wanted[i].addr,
+				wanted[i].count, buf) != wanted[i].count
+			) {
+				res++;
+			}
+		}
+	}
+	gettimeofday(&end, NULL);
+	t_single = difftimeval(end, start);
+
+	printf("%d transactions per poll instead of %" PRIuSIZE ": %.1fus vs. %.1fus per poll",
+		client.reads / rounds, NUM_WANTED,
+		t_plan * 1e6 / rounds, t_single * 1e6 / rounds);
+	printf(res || client.reads != rounds * 8 ? " (FAIL)\n" : " (OK)\n");
+	if (client.reads != rounds * 8)
+		res++;
+
+finish:
+	if (client.ctx) {
+		modbus_close(client.ctx);
+		modbus_free(client.ctx);
+	}
+	waitpid(pid, &status, 0);
+	mbplan_free(plan);
+
+	return res;
+}
+#endif	/* WITH_MODBUS && !WIN32 */
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += check_planning();
+	ret += check_reading();
+#if (defined WITH_MODBUS) && !(defined WIN32)
+	ret += check_tcp();
+#else
+	printf("=== check_tcp:\tnot built with libmodbus (SKIP)\n");
+#endif
+
+	return (ret != 0);
+}
@@ -0,0 +1,226 @@
+/*  nutpconftest.c - test that buffer-at-a-time parsing with pconf_buf()
+ *  yields the same results as character-at-a-time pconf_char(), and
+ *  compare their throughput
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "parseconf.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define FUZZ_ROUNDS	20000
+#define FUZZ_MAXLEN	300
+#define BENCH_LINES	200000
+
+/* Parse results are serialized into a transcript to compare them */
+#define TRANSCRIPT_LEN	65536
+
+static unsigned long	rng_state = 1;
+
+/* Small self-contained PRNG, so runs are reproducible everywhere */
+static unsigned long rng(void)
+{
+	rng_state = rng_state * 1103515245UL + 12345UL;
+	return (rng_state / 65536UL) % 32768UL;
+}
+
+static void errhandler(const char *errmsg)
+{
+	fprintf(stderr, "parseconf fatal: %s\n", errmsg);
+}
+
+static void record(PCONF_CTX_t *ctx, int ret, char *out, size_t outlen)
+{
+	size_t	i, len = strlen(out);
+
+	if (ret == 1) {
+		snprintf(out + len, outlen - len, "LINE[%" PRIuSIZE "]", ctx->numargs);
+		for (i = 0; i < ctx->numargs; i++) {
+			len = strlen(out);
+			snprintf(out + len, outlen - len, " <%s>", ctx->arglist[i]);
+		}
+		len = strlen(out);
+		snprintf(out + len, outlen - len, "\n");
+	} else if (ret < 0) {
+		snprintf(out + len, outlen - len, "ERR %s\n", ctx->errmsg);
+	}
+}
+
+static void parse_by_char(const char *buf, size_t buflen,
+	size_t arg_limit, size_t wordlen_limit, char *out, size_t outlen)
+{
+	PCONF_CTX_t	ctx;
+	size_t	i;
+
+	pconf_init(&ctx, errhandler);
+	ctx.arg_limit = arg_limit;
+	ctx.wordlen_limit = wordlen_limit;
+
+	out[0] = '\0';
+	for (i = 0; i < buflen; i++)
+		record(&ctx, pconf_char(&ctx, buf[i]), out, outlen);
+
+	pconf_finish(&ctx);
+}
+
+static void parse_by_buf(const char *buf, size_t buflen,
+	size_t arg_limit, size_t wordlen_limit, char *out, size_t outlen)
+{
+	PCONF_CTX_t	ctx;
+	size_t	i, chunk, used;
+
+	pconf_init(&ctx, errhandler);
+	ctx.arg_limit = arg_limit;
+	ctx.wordlen_limit = wordlen_limit;
+
+	out[0] = '\0';
+	for (i = 0; i < buflen; i += chunk) {
+		/* emulate fragmented reads */
+		chunk = 1 + rng() % 64;
+		if (chunk > buflen - i)
+			chunk = buflen - i;
+
+		for (used = 0; chunk > used; ) {
+			size_t	done;
+			int	ret = pconf_buf(&ctx, buf + i + used, chunk - used, &done);
+
+			used += done;
+			record(&ctx, ret, out, outlen);
+		}
+	}
+
+	pconf_finish(&ctx);
+}
+
+static int check_fuzz(void)
+{
+	/* bias towards the characters the state machine cares about */
+	static const char	alphabet[] = "abcXYZ019._-  \t\t\n\n\"\"\\\\##==\r";
+	static char	out1[TRANSCRIPT_LEN], out2[TRANSCRIPT_LEN];
+	char	buf[FUZZ_MAXLEN];
+	size_t	buflen, i, arg_limit, wordlen_limit;
+	int	round, res = 0;
+
+	printf("=== %s:\t", __func__);
+
+	for (round = 0; round < FUZZ_ROUNDS; round++) {
+		buflen = 1 + rng() % FUZZ_MAXLEN;
+		for (i = 0; i < buflen; i++) {
+			/* rarely, throw in bytes that addchar() discards */
+			if (rng() % 500 == 0)
+				buf[i] = (char)(rng() % 256);
+			else
+				buf[i] = alphabet[rng() % (sizeof(alphabet) - 1)];
+		}
+
+		switch (round % 4) {
+			case 1:	/* tight limits */
+				arg_limit = 1 + rng() % 4;
+				wordlen_limit = 1 + rng() % 8;
+				break;
+			case 2:	/* unlimited */
+				arg_limit = 0;
+				wordlen_limit = 0;
+				break;
+			default:
+				arg_limit = PCONF_DEFAULT_ARG_LIMIT;
+				wordlen_limit = PCONF_DEFAULT_WORDLEN_LIMIT;
+				break;
+		}
+
+		parse_by_char(buf, buflen, arg_limit, wordlen_limit, out1, sizeof(out1));
+		parse_by_buf(buf, buflen, arg_limit, wordlen_limit, out2, sizeof(out2));
+
+		if (strcmp(out1, out2)) {
+			printf("FAIL at round %d\n--- pconf_char:\n%s--- pconf_buf:\n%s",
+				round, out1, out2);
+			res++;
+			break;
+		}
+	}
+
+	if (!res)
+		printf("%d random inputs parsed identically (OK)\n", FUZZ_ROUNDS);
+
+	return res;
+}
+
+static int check_throughput(void)
+{
+	PCONF_CTX_t	ctx;
+	const char	*line = "SETINFO outlet.12.realpower.default \"1234.5\"\n";
+	char	*buf;
+	size_t	i, linelen = strlen(line), buflen = linelen * BENCH_LINES, used;
+	size_t	lines_char = 0, lines_buf = 0;
+	struct timeval	start, end;
+	double	t_char, t_buf;
+
+	printf("=== %s:\t", __func__);
+
+	buf = xmalloc(buflen);
+	for (i = 0; i < BENCH_LINES; i++)
+		memcpy(buf + i * linelen, line, linelen);
+
+	pconf_init(&ctx, errhandler);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < buflen; i++) {
+		if (pconf_char(&ctx, buf[i]) == 1)
+			lines_char++;
+	}
+	gettimeofday(&end, NULL);
+	pconf_finish(&ctx);
+	t_char = difftimeval(end, start);
+
+	pconf_init(&ctx, errhandler);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < buflen; i += used) {
+		if (pconf_buf(&ctx, buf + i, buflen - i, &used) == 1)
+			lines_buf++;
+	}
+	gettimeofday(&end, NULL);
+	pconf_finish(&ctx);
+	t_buf = difftimeval(end, start);
+
+	free(buf);
+
+	printf(" %" PRIuSIZE " lines: pconf_char %.3fs, pconf_buf %.3fs",
+		lines_char, t_char, t_buf);
+
+	if (lines_char != BENCH_LINES || lines_buf != BENCH_LINES) {
+		printf(" => line counts differ (FAIL)\n");
+		return 1;
+	}
+
+	printf(" (OK)\n");
+	return 0;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	ret += check_fuzz();
+	ret += check_throughput();
+
+	return (ret != 0);
+}
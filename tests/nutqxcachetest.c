@@ -0,0 +1,223 @@
+/*  nutqxcachetest.c - test the answers kept by nutdrv_qx during a walk
+ *  of its items (drivers/nutdrv_qx_cache.c)
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "nutdrv_qx.h"
+#include "nutdrv_qx_cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static int preprocess_stub(item_t *item, const int len)
+{
+	NUT_UNUSED_VARIABLE(item);
+	return len;
+}
+
+/* an item as the walk would have it after querying the UPS */
+static void set_item(item_t *item, const char *command, const char *answer)
+{
+	memset(item, 0, sizeof(*item));
+	item->command = command;
+	snprintf(item->answer, sizeof(item->answer), "%s", answer);
+}
+
+static int report(int bad, const char *what)
+{
+	if (bad) {
+		printf("%d checks failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("%s (OK)\n", what);
+	return 0;
+}
+
+static int test_hit(void)
+{
+	item_t	a, b;
+	const char	*answer;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	qx_answer_cache_clear();
+	set_item(&a, "Q1\r", "(230.0 229.0 230.0 014 50.0 13.6 25.0 00001001");
+	qx_answer_cache_put(&a);
+	set_item(&b, "F\r", "#230.0 004 12.00 50.0");
+	qx_answer_cache_put(&b);
+
+	/* another item with the same command, not adjacent to the first */
+	set_item(&b, "q1\r", "");
+	answer = qx_answer_cache_get(&b);
+	if (!answer || strcmp(answer, a.answer))
+		bad++;
+
+	/* the same command, but an answer preprocessed differently */
+	b.preprocess_answer = preprocess_stub;
+	if (qx_answer_cache_get(&b))
+		bad++;
+
+	set_item(&b, "QGS\r", "");
+	if (qx_answer_cache_get(&b) || qx_answer_cache_count() != 2)
+		bad++;
+
+	/* a new walk starts afresh */
+	qx_answer_cache_clear();
+	if (qx_answer_cache_get(&a) || qx_answer_cache_count() != 0)
+		bad++;
+
+	return report(bad, "items share answers by command");
+}
+
+static int test_eviction(void)
+{
+	item_t	item;
+	char	command[QX_ANSWER_CACHE_SIZE + 1][SMALLBUF], longcmd[SMALLBUF + 1];
+	size_t	i;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	qx_answer_cache_clear();
+	for (i = 0; i <= QX_ANSWER_CACHE_SIZE; i++) {
+		snprintf(command[i], sizeof(command[i]), "Q%" PRIuSIZE "\r", i);
+		set_item(&item, command[i], "(answer");
+		qx_answer_cache_put(&item);
+	}
+
+	if (qx_answer_cache_count() != QX_ANSWER_CACHE_SIZE)
+		bad++;
+
+	/* the oldest answer made room for the last one */
+	set_item(&item, command[0], "");
+	if (qx_answer_cache_get(&item))
+		bad++;
+	for (i = 1; i <= QX_ANSWER_CACHE_SIZE; i++) {
+		set_item(&item, command[i], "");
+		if (!qx_answer_cache_get(&item))
+			bad++;
+	}
+
+	/* commands too long to be kept are not */
+	qx_answer_cache_clear();
+	memset(longcmd, 'Q', sizeof(longcmd) - 1);
+	longcmd[sizeof(longcmd) - 1] = '\0';
+	set_item(&item, longcmd, "(answer");
+	qx_answer_cache_put(&item);
+	if (qx_answer_cache_count() != 0)
+		bad++;
+
+	return report(bad, "the oldest answer goes when full");
+}
+
+static int test_invalidation(void)
+{
+	item_t	a, b, c;
+	const char	*answer;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	qx_answer_cache_clear();
+	set_item(&a, "Q1\r", "(230.0");
+	qx_answer_cache_put(&a);
+	set_item(&b, "F\r", "#230.0");
+	qx_answer_cache_put(&b);
+	set_item(&c, "QS\r", "(12.0");
+	qx_answer_cache_put(&c);
+
+	/* a changed answer replaces the one kept */
+	set_item(&a, "Q1\r", "(231.0");
+	qx_answer_cache_put(&a);
+	answer = qx_answer_cache_get(&a);
+	if (!answer || strcmp(answer, "(231.0") || qx_answer_cache_count() != 3)
+		bad++;
+
+	/* a failed query forgets it, the other answers stay */
+	qx_answer_cache_drop(&a);
+	if (qx_answer_cache_get(&a) || qx_answer_cache_count() != 2)
+		bad++;
+	answer = qx_answer_cache_get(&c);
+	if (!answer || strcmp(answer, "(12.0"))
+		bad++;
+
+	/* and so does an empty answer */
+	set_item(&b, "F\r", "");
+	qx_answer_cache_put(&b);
+	if (qx_answer_cache_get(&b) || qx_answer_cache_count() != 1)
+		bad++;
+
+	return report(bad, "failed and changed answers are not reused");
+}
+
+static int test_eviction_after_drop(void)
+{
+	item_t	item;
+	char	command[3 * QX_ANSWER_CACHE_SIZE][SMALLBUF];
+	size_t	kept[QX_ANSWER_CACHE_SIZE], nkept = 0, i, j;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	for (i = 0; i < 3 * QX_ANSWER_CACHE_SIZE; i++)
+		snprintf(command[i], sizeof(command[i]), "Q%" PRIuSIZE "\r", i);
+
+	/* "kept" lists what should be in the cache, the oldest first */
+	qx_answer_cache_clear();
+	for (i = 0; i < 3 * QX_ANSWER_CACHE_SIZE; i++) {
+		set_item(&item, command[i], "(answer");
+		qx_answer_cache_put(&item);
+		if (nkept == QX_ANSWER_CACHE_SIZE) {
+			memmove(&kept[0], &kept[1], --nkept * sizeof(kept[0]));
+		}
+		kept[nkept++] = i;
+
+		/* once the cache went round, a failed answer leaves a gap */
+		if (i == QX_ANSWER_CACHE_SIZE + 2) {
+			set_item(&item, command[kept[4]], "");
+			qx_answer_cache_drop(&item);
+			memmove(&kept[4], &kept[5], (--nkept - 4) * sizeof(kept[0]));
+		}
+
+		if (qx_answer_cache_count() != nkept)
+			bad++;
+		for (j = 0; j < nkept; j++) {
+			set_item(&item, command[kept[j]], "");
+			if (!qx_answer_cache_get(&item))
+				bad++;
+		}
+	}
+
+	return report(bad, "the oldest answer still goes after a drop");
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	ret += test_hit();
+	ret += test_eviction();
+	ret += test_invalidation();
+	ret += test_eviction_after_drop();
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
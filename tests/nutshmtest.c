@@ -0,0 +1,362 @@
+/*  nutshmtest.c - test the shared memory export of driver data (nutshm),
+ *  including snapshot consistency against a concurrent writer, and
+ *  compare the latency of reading all values that way to that of
+ *  a socket dump parsed like upsd does
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ *
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "state.h"
+#include "parseconf.h"
+#include "nutshm.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+#define NUM_VARS	300
+#define BENCH_ROUNDS	2000
+#define CONCURRENT_SECS	1
+
+static char	tmpdir[] = "/tmp/nutshmtest.XXXXXX";
+static char	shmpath[NUT_PATH_MAX + 1];
+
+static void set_all(st_tree_t **root, int gen)
+{
+	char	var[SMALLBUF], val[SMALLBUF];
+	int	i;
+
+	for (i = 0; i < NUM_VARS; i++) {
+		snprintf(var, sizeof(var), "test.var.%d", i);
+		snprintf(val, sizeof(val), "gen-%d", gen);
+		state_setinfo(root, var, val);
+	}
+}
+
+/* all values in the snapshot come from the same generation? */
+static int snapshot_consistent(const nutshm_snapshot_t *snap, int *gen)
+{
+	const char	*name, *value, *first = NULL;
+	size_t	pos = 0, count = 0;
+
+	while (nutshm_snapshot_next(snap, &pos, &name, &value)) {
+		if (!first)
+			first = value;
+		else if (strcmp(first, value))
+			return 0;
+		count++;
+	}
+
+	if (count != NUM_VARS || count != snap->count)
+		return 0;
+
+	if (gen && first)
+		*gen = atoi(first + 4);
+
+	return 1;
+}
+
+static int check_basic(void)
+{
+	st_tree_t	*root = NULL;
+	nutshm_writer_t	*w;
+	nutshm_reader_t	*r;
+	nutshm_snapshot_t	snap;
+	const char	*val;
+	char	big[SMALLBUF * 64];
+	int	res = 0;
+
+	printf("=== %s:\t", __func__);
+	memset(&snap, 0, sizeof(snap));
+
+	set_all(&root, 1);
+	state_setinfo(&root, "ups.status", "OL CHRG");
+
+	w = nutshm_writer_open(shmpath, NULL);
+	if (!w || nutshm_writer_publish(w, root, 0)) {
+		printf("can not create the export (FAIL)\n");
+		return 1;
+	}
+
+	r = nutshm_reader_open(shmpath);
+	if (!r || nutshm_reader_snapshot(r, &snap) != 1) {
+		printf("can not read the export (FAIL)\n");
+		res++;
+		goto finish;
+	}
+
+	val = nutshm_snapshot_get(&snap, "ups.status");
+	if (snap.count != NUM_VARS + 1 || !val || strcmp(val, "OL CHRG")
+	 || (snap.flags & NUTSHM_FLAG_STALE)
+	) {
+		printf("unexpected data: %" PRIuSIZE " records, ups.status=%s (FAIL)\n",
+			snap.count, NUT_STRARG(val));
+		res++;
+		goto finish;
+	}
+
+	/* nothing changed since */
+	if (nutshm_reader_snapshot(r, &snap) != 0) {
+		printf("unchanged data reported as new (FAIL)\n");
+		res++;
+		goto finish;
+	}
+
+	/* grow beyond the initial file size: the file is replaced */
+	memset(big, 'x', sizeof(big) - 1);
+	big[sizeof(big) - 1] = '\0';
+	state_setinfo(&root, "test.big", big);
+	nutshm_writer_publish(w, root, 1);
+
+	if (nutshm_reader_snapshot(r, &snap) != 1
+	 || !(val = nutshm_snapshot_get(&snap, "test.big"))
+	 || strcmp(val, big)
+	 || !(snap.flags & NUTSHM_FLAG_STALE)
+	) {
+		printf("grown data not seen by the reader (FAIL)\n");
+		res++;
+		goto finish;
+	}
+
+	/* a restarted driver: a new file, whose sequence number
+	 * happens to be the same as that of the old one */
+	nutshm_writer_close(w);
+	w = nutshm_writer_open(shmpath, NULL);
+	state_setinfo(&root, "ups.status", "OB");
+	nutshm_writer_publish(w, root, 0);
+	nutshm_writer_publish(w, root, 0);
+
+	if (nutshm_reader_snapshot(r, &snap) != 1
+	 || !(val = nutshm_snapshot_get(&snap, "ups.status"))
+	 || strcmp(val, "OB")
+	) {
+		printf("data of a restarted writer not seen by the reader (FAIL)\n");
+		res++;
+		goto finish;
+	}
+
+	printf("%" PRIuSIZE " records exported and read back (OK)\n", snap.count);
+
+finish:
+	nutshm_snapshot_free(&snap);
+	nutshm_reader_close(r);
+	nutshm_writer_close(w);
+	state_infofree(root);
+
+	return res;
+}
+
+static int check_concurrent(void)
+{
+	st_tree_t	*root = NULL;
+	nutshm_writer_t	*w;
+	pid_t	pid;
+	int	gen = 0, status;
+
+	printf("=== %s:\t", __func__);
+
+	set_all(&root, gen);
+	w = nutshm_writer_open(shmpath, NULL);
+	if (!w || nutshm_writer_publish(w, root, 0)) {
+		printf("can not create the export (FAIL)\n");
+		return 1;
+	}
+
+	fflush(stdout);
+	pid = fork();
+	if (pid < 0) {
+		printf("fork failed (FAIL)\n");
+		nutshm_writer_close(w);
+		state_infofree(root);
+		return 1;
+	}
+
+	if (pid == 0) {
+		/* reader: snapshots must never mix generations */
+		nutshm_reader_t	*r = nutshm_reader_open(shmpath);
+		nutshm_snapshot_t	snap;
+		time_t	start = time(NULL);
+		long	snaps = 0, bad = 0;
+		int	last = -1, seen = -1;
+
+		memset(&snap, 0, sizeof(snap));
+		while (r && difftime(time(NULL), start) < CONCURRENT_SECS) {
+			if (nutshm_reader_snapshot(r, &snap) != 1)
+				continue;
+
+			snaps++;
+			if (!snapshot_consistent(&snap, &seen) || seen < last)
+				bad++;
+			last = seen;
+		}
+
+		printf("%ld snapshots up to generation %d, %ld inconsistent (%s)\n",
+			snaps, last, bad, (!r || bad || !snaps) ? "FAIL" : "OK");
+		nutshm_snapshot_free(&snap);
+		nutshm_reader_close(r);
+		exit((!r || bad || !snaps) ? EXIT_FAILURE : EXIT_SUCCESS);
+	}
+
+	/* writer: keep publishing new generations until the reader is done */
+	while (waitpid(pid, &status, WNOHANG) == 0) {
+		set_all(&root, ++gen);
+		nutshm_writer_publish(w, root, 0);
+		usleep(100);	/* still way more often than any driver */
+	}
+
+	nutshm_writer_close(w);
+	state_infofree(root);
+
+	return !(WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS);
+}
+
+/* send a DUMPALL-like reply, and read it back the way upsd does */
+static int socket_round(int fds[2], st_tree_t *root, st_tree_t **copy, PCONF_CTX_t *ctx)
+{
+	static char	out[NUM_VARS * SMALLBUF];
+	char	buf[LARGEBUF];
+	const st_tree_t	*node;
+	size_t	used, len = 0, i;
+	ssize_t	ret;
+	int	done = 0, n;
+
+	/* one write, so the whole dump fits into the socket buffer */
+	for (n = 0; n < NUM_VARS; n++) {
+		snprintf(buf, sizeof(buf), "test.var.%d", n);
+		node = state_tree_find(root, buf);
+		len += (size_t)snprintf(out + len, sizeof(out) - len,
+			"SETINFO %s \"%s\"\n", node->var, node->val);
+	}
+	len += (size_t)snprintf(out + len, sizeof(out) - len, "DUMPDONE\n");
+	if (write(fds[0], out, len) != (ssize_t)len)
+		return -1;
+
+	while (!done) {
+		ret = read(fds[1], buf, sizeof(buf));
+		if (ret <= 0)
+			return -1;
+
+		for (i = 0; i < (size_t)ret; i += used) {
+			if (pconf_buf(ctx, buf + i, (size_t)ret - i, &used) != 1)
+				continue;
+
+			if (ctx->numargs == 3 && !strcmp(ctx->arglist[0], "SETINFO"))
+				state_setinfo(copy, ctx->arglist[1], ctx->arglist[2]);
+			else if (ctx->numargs == 1 && !strcmp(ctx->arglist[0], "DUMPDONE"))
+				done = 1;
+		}
+	}
+
+	return 0;
+}
+
+static int check_latency(void)
+{
+	st_tree_t	*root = NULL, *copy = NULL;
+	nutshm_writer_t	*w;
+	nutshm_reader_t	*r;
+	nutshm_snapshot_t	snap;
+	PCONF_CTX_t	ctx;
+	struct timeval	start, end;
+	double	t_shm, t_sock;
+	int	fds[2], i, res = 0;
+
+	printf("=== %s:\t", __func__);
+	memset(&snap, 0, sizeof(snap));
+
+	set_all(&root, 0);
+	w = nutshm_writer_open(shmpath, NULL);
+	r = w ? nutshm_reader_open(shmpath) : NULL;
+	if (!r || socketpair(AF_UNIX, SOCK_STREAM, 0, fds)) {
+		printf("can not set up (FAIL)\n");
+		nutshm_writer_close(w);
+		state_infofree(root);
+		return 1;
+	}
+
+	/* each round: the driver updates a value, a reader gets all values */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		state_setinfo(&root, "test.var.0", i % 2 ? "gen-1" : "gen-0");
+		nutshm_writer_publish(w, root, 0);
+		if (nutshm_reader_snapshot(r, &snap) != 1 || snap.count != NUM_VARS)
+			res++;
+	}
+	gettimeofday(&end, NULL);
+	t_shm = difftimeval(end, start);
+
+	pconf_init(&ctx, NULL);
+	gettimeofday(&start, NULL);
+	for (i = 0; i < BENCH_ROUNDS; i++) {
+		state_setinfo(&root, "test.var.0", i % 2 ? "gen-1" : "gen-0");
+		if (socket_round(fds, root, &copy, &ctx))
+			res++;
+	}
+	gettimeofday(&end, NULL);
+	t_sock = difftimeval(end, start);
+	pconf_finish(&ctx);
+
+	printf(" %d vars: shared memory %.1fus, socket %.1fus per full read",
+		NUM_VARS, t_shm * 1e6 / BENCH_ROUNDS, t_sock * 1e6 / BENCH_ROUNDS);
+	printf(res ? " (FAIL)\n" : " (OK)\n");
+
+	close(fds[0]);
+	close(fds[1]);
+	nutshm_snapshot_free(&snap);
+	nutshm_reader_close(r);
+	nutshm_writer_close(w);
+	state_infofree(root);
+	state_infofree(copy);
+
+	return res;
+}
+
+int main(void)
+{
+	int ret = 0;
+
+	if (!mkdtemp(tmpdir)) {
+		printf("can not create a temporary directory (FAIL)\n");
+		return 1;
+	}
+	snprintf(shmpath, sizeof(shmpath), "%s/test-ups" NUTSHM_SUFFIX, tmpdir);
+
+	ret += check_basic();
+	ret += check_concurrent();
+	ret += check_latency();
+
+	rmdir(tmpdir);
+
+	return (ret != 0);
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("Shared memory export is not implemented on this platform (SKIP)\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
@@ -0,0 +1,420 @@
+/*  nutstarttls.c - check how upsd goes through STARTTLS handshakes
+ *
+ *  Talks to a running upsd (with a CERTFILE configured) to check that
+ *  the TLS handshake after STARTTLS is driven by its main loop: other
+ *  clients are served while a handshake is stalled, stalled handshakes
+ *  time out, and clients whose handshake failed (at its first step or
+ *  later) are disconnected right away. With OpenSSL, a handshake is
+ *  also completed and a command answered over TLS.
+ *
+ *  Started by tests/NIT (see testgroup_upsd_starttls there).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
+
+#ifdef WITH_OPENSSL
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#endif	/* WITH_OPENSSL */
+
+/* how long upsd may take to drop a client whose handshake failed */
+#define ST_DROP_TIMEOUT	3
+
+/* upsd reads up to SMALLBUF bytes from a client at a time, and the
+ * handshake then looks at a TLS record header (5 bytes) first */
+#define ST_READ_SIZE	SMALLBUF
+#define ST_RECORD_HEADER	5
+
+#define ST_STARTTLS	"STARTTLS\n"
+#define ST_STARTTLS_LEN	(sizeof(ST_STARTTLS) - 1)
+
+static const char	*host = "localhost";
+static const char	*port = NULL;
+static int	handshake_timeout = 10;	/* SSL_HANDSHAKE_TIMEOUT of upsd */
+static int	failed = 0;
+
+static double now_sec(void)
+{
+	struct timeval	tv;
+
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec / 1000000.0;
+}
+
+static void result(const char *what, int ok)
+{
+	printf("%s: %s\n", ok ? "PASS" : "FAIL", what);
+	fflush(stdout);
+
+	if (!ok)
+		failed++;
+}
+
+static int tcp_connect(void)
+{
+	struct addrinfo	hints, *res, *ai;
+	int	fd = -1;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+
+	if (getaddrinfo(host, port, &hints, &res))
+		return -1;
+
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		if (!connect(fd, ai->ai_addr, ai->ai_addrlen))
+			break;
+		close(fd);
+		fd = -1;
+	}
+
+	freeaddrinfo(res);
+
+	if (fd < 0)
+		upslog_with_errno(LOG_ERR, "Can't connect to %s:%s", host, port);
+
+	return fd;
+}
+
+static int send_all(int fd, const char *buf, size_t len)
+{
+	ssize_t	ret;
+
+	while (len > 0) {
+		ret = write(fd, buf, len);
+		if (ret <= 0)
+			return -1;
+		buf += ret;
+		len -= (size_t)ret;
+	}
+
+	return 0;
+}
+
+/* read one line (without its newline) within timeout seconds */
+static int read_line(int fd, char *buf, size_t buflen, double timeout)
+{
+	struct pollfd	pfd;
+	double	end = now_sec() + timeout;
+	size_t	len = 0;
+	char	ch;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	while (len < buflen - 1) {
+		double	left = end - now_sec();
+
+		if (left <= 0 || poll(&pfd, 1, (int)(left * 1000) + 1) <= 0)
+			return -1;
+
+		if (read(fd, &ch, 1) != 1)
+			return -1;
+
+		if (ch == '\n')
+			break;
+
+		buf[len++] = ch;
+	}
+
+	buf[len] = '\0';
+	return 0;
+}
+
+/* wait up to timeout seconds for upsd to close the connection,
+ * returns how long that took, or -1 if it did not */
+static double wait_closed(int fd, double since, double timeout)
+{
+	struct pollfd	pfd;
+	double	end = since + timeout;
+	char	buf[SMALLBUF];
+	ssize_t	ret;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+
+	for (;;) {
+		double	left = end - now_sec();
+
+		if (left <= 0 || poll(&pfd, 1, (int)(left * 1000) + 1) <= 0)
+			return -1;
+
+		/* anything before the end (e.g. a TLS alert) does not matter */
+		ret = read(fd, buf, sizeof(buf));
+		if (ret <= 0)
+			return now_sec() - since;
+	}
+}
+
+/* one of the counters from LIST STATS, or -1 */
+static int64_t get_stat(const char *name)
+{
+	char	line[LARGEBUF], expect[SMALLBUF];
+	int64_t	val = -1;
+	int	fd;
+
+	if ((fd = tcp_connect()) < 0)
+		return -1;
+
+	snprintf(expect, sizeof(expect), "STAT %s \"", name);
+
+	if (send_all(fd, "LIST STATS\n", 11) == 0) {
+		while (read_line(fd, line, sizeof(line), 5) == 0) {
+			if (!strncmp(line, expect, strlen(expect)))
+				val = (int64_t)strtoll(line + strlen(expect), NULL, 10);
+			if (!strcmp(line, "END LIST STATS") || !strncmp(line, "ERR ", 4))
+				break;
+		}
+	}
+
+	close(fd);
+	return val;
+}
+
+/* connect and ask for STARTTLS, returns the socket once upsd agreed */
+static int starttls(const char *extra, size_t extralen, int *unsupported)
+{
+	char	line[SMALLBUF];
+	char	buf[SMALLBUF * 4];
+	int	fd;
+
+	if ((fd = tcp_connect()) < 0)
+		return -1;
+
+	/* anything extra goes out in the same write, as if the
+	 * client did not wait for the answer before going on */
+	memcpy(buf, ST_STARTTLS, ST_STARTTLS_LEN);
+	if (extralen > sizeof(buf) - ST_STARTTLS_LEN)
+		extralen = sizeof(buf) - ST_STARTTLS_LEN;
+	if (extralen)
+		memcpy(buf + ST_STARTTLS_LEN, extra, extralen);
+
+	if (send_all(fd, buf, ST_STARTTLS_LEN + extralen) < 0
+	||  read_line(fd, line, sizeof(line), 5) < 0
+	) {
+		close(fd);
+		return -1;
+	}
+
+	if (strcmp(line, "OK STARTTLS")) {
+		upslogx(LOG_ERR, "STARTTLS was answered with: %s", line);
+		if (unsupported)
+			*unsupported = !strcmp(line, "ERR FEATURE-NOT-CONFIGURED");
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+#ifdef WITH_OPENSSL
+/* complete a handshake, and check a command is answered over TLS */
+static int tls_session(void)
+{
+	SSL_CTX	*ctx;
+	SSL	*ssl;
+	char	line[SMALLBUF];
+	size_t	len = 0;
+	int	fd, ret = -1;
+
+	if ((fd = starttls(NULL, 0, NULL)) < 0)
+		return -1;
+
+	ctx = SSL_CTX_new(SSLv23_client_method());
+	if (!ctx) {
+		close(fd);
+		return -1;
+	}
+
+	/* the sandbox certificate is self-signed, nothing to verify */
+	SSL_CTX_set_verify(ctx, SSL_VERIFY_NONE, NULL);
+
+	ssl = SSL_new(ctx);
+	if (ssl && SSL_set_fd(ssl, fd) == 1 && SSL_connect(ssl) == 1
+	&&  SSL_write(ssl, "VER\n", 4) == 4
+	) {
+		while (len < sizeof(line) - 1 && SSL_read(ssl, line + len, 1) == 1) {
+			if (line[len] == '\n') {
+				ret = 0;
+				break;
+			}
+			len++;
+		}
+	} else {
+		ERR_print_errors_fp(stderr);
+	}
+
+	if (ssl) {
+		SSL_shutdown(ssl);
+		SSL_free(ssl);
+	}
+	SSL_CTX_free(ctx);
+	close(fd);
+
+	return ret;
+}
+#endif	/* WITH_OPENSSL */
+
+static void help(const char *prog)
+{
+	printf("Check the STARTTLS handshakes of a running upsd, see tests/NIT\n\n");
+	printf("usage: %s [OPTIONS]\n\n", prog);
+	printf("  -H <host>	upsd host (default %s)\n", host);
+	printf("  -p <port>	upsd port (default: NUT_PORT or %d)\n", PORT);
+	printf("  -t <sec>	handshake timeout of upsd (default %d)\n", handshake_timeout);
+	printf("  -D		raise debugging level\n");
+}
+
+int main(int argc, char **argv)
+{
+	char	portbuf[SMALLBUF], line[SMALLBUF], junk[ST_READ_SIZE];
+	int	opt, stalled, fd, unsupported = 0;
+	int64_t	failures, handshakes;
+	double	stalled_since, took;
+
+	port = getenv("NUT_PORT");
+
+	while ((opt = getopt(argc, argv, "hH:p:t:D")) != -1) {
+		switch (opt) {
+			case 'H':
+				host = optarg;
+				break;
+			case 'p':
+				port = optarg;
+				break;
+			case 't':
+				handshake_timeout = atoi(optarg);
+				break;
+			case 'D':
+				nut_debug_level++;
+				break;
+			case 'h':
+			default:
+				help(argv[0]);
+				return (opt == 'h') ? EXIT_SUCCESS : EXIT_FAILURE;
+		}
+	}
+
+	if (!port) {
+		snprintf(portbuf, sizeof(portbuf), "%d", PORT);
+		port = portbuf;
+	}
+
+	/* not a TLS record: the handshake fails at its first look at it */
+	memset(junk, 'x', sizeof(junk));
+
+	failures = get_stat("tls.failures");
+
+	/* a client which never goes on with its handshake... */
+	stalled = starttls(NULL, 0, &unsupported);
+	if (stalled < 0) {
+		if (unsupported) {
+			printf("SKIP: upsd has no TLS support configured\n");
+			return 77;
+		}
+		result("STARTTLS is accepted", 0);
+		return EXIT_FAILURE;
+	}
+	stalled_since = now_sec();
+
+	/* ...does not hold up the others */
+	if ((fd = tcp_connect()) >= 0) {
+		result("another client is served during a stalled handshake",
+			send_all(fd, "VER\n", 4) == 0
+			&& read_line(fd, line, sizeof(line), 2) == 0);
+		close(fd);
+	} else {
+		result("another client is served during a stalled handshake", 0);
+	}
+
+	/* the handshake fails in net_starttls(), as the data is there
+	 * already: the command and junk fill the read of upsd, and just
+	 * a record header of junk is left, so that nothing else would
+	 * wake upsd up for this client afterwards */
+	if ((fd = starttls(junk, ST_READ_SIZE - ST_STARTTLS_LEN + ST_RECORD_HEADER, NULL)) >= 0) {
+		took = wait_closed(fd, now_sec(), ST_DROP_TIMEOUT);
+		result("a client failing the first handshake step is dropped", took >= 0);
+		close(fd);
+	} else {
+		result("a client failing the first handshake step is dropped", 0);
+	}
+
+	/* the handshake fails in a later step, driven by mainloop() */
+	if ((fd = starttls(NULL, 0, NULL)) >= 0) {
+		usleep(200000);
+		took = -1;
+		if (send_all(fd, junk, ST_RECORD_HEADER) == 0)
+			took = wait_closed(fd, now_sec(), ST_DROP_TIMEOUT);
+		result("a client failing a later handshake step is dropped", took >= 0);
+		close(fd);
+	} else {
+		result("a client failing a later handshake step is dropped", 0);
+	}
+
+	if (failures >= 0) {
+		result("failed handshakes are counted",
+			get_stat("tls.failures") >= failures + 2);
+	}
+
+#ifdef WITH_OPENSSL
+	handshakes = get_stat("tls.handshake.count");
+	result("a command is answered after a completed handshake", tls_session() == 0);
+	if (handshakes >= 0) {
+		result("completed handshakes are counted",
+			get_stat("tls.handshake.count") == handshakes + 1);
+	}
+#else	/* !WITH_OPENSSL */
+	NUT_UNUSED_VARIABLE(handshakes);
+	printf("SKIP: completing a handshake needs OpenSSL here\n");
+#endif	/* !WITH_OPENSSL */
+
+	/* finally, the stalled handshake is given up on */
+	took = wait_closed(stalled, stalled_since, handshake_timeout + ST_DROP_TIMEOUT);
+	result("a stalled handshake times out",
+		took >= handshake_timeout - 1);
+	close(stalled);
+
+	printf("%s\n", failed ? "FAILED" : "PASSED");
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+#else	/* WIN32 */
+
+int main(void)
+{
+	printf("nutstarttls is not implemented on this platform (SKIP)\n");
+	return 77;
+}
+
+#endif	/* WIN32 */
@@ -0,0 +1,302 @@
+/*  nutstatetest.c - test the state trees with interned variable names,
+ *  and time lookups in as many trees as upsd would have for many UPSes
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+#include "state.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a typical set of data points, as from a UPS with a few outlets */
+static const char *bench_names[] = {
+	"battery.charge", "battery.charge.low", "battery.charge.warning",
+	"battery.runtime", "battery.runtime.low", "battery.type",
+	"battery.voltage", "battery.voltage.nominal", "device.mfr",
+	"device.model", "device.serial", "device.type", "driver.name",
+	"driver.parameter.pollinterval", "driver.parameter.port",
+	"driver.version", "driver.version.internal", "input.frequency",
+	"input.transfer.high", "input.transfer.low", "input.voltage",
+	"input.voltage.nominal", "output.current", "output.frequency",
+	"output.voltage", "output.voltage.nominal", "ups.beeper.status",
+	"ups.delay.shutdown", "ups.delay.start", "ups.firmware", "ups.load",
+	"ups.mfr", "ups.model", "ups.power", "ups.power.nominal",
+	"ups.productid", "ups.realpower", "ups.serial", "ups.status",
+	"ups.temperature", "ups.test.result", "ups.timer.shutdown",
+	"ups.timer.start", "ups.vendorid",
+	"outlet.1.current", "outlet.1.desc", "outlet.1.status",
+	"outlet.1.switchable", "outlet.2.current", "outlet.2.desc",
+	"outlet.2.status", "outlet.2.switchable", "outlet.3.current",
+	"outlet.3.desc", "outlet.3.status", "outlet.3.switchable"
+};
+#define NUM_BENCH_NAMES	(sizeof(bench_names) / sizeof(bench_names[0]))
+
+/* number of trees and lookups for the benchmark; see the options in main() */
+static size_t	bench_trees = 400;
+static size_t	bench_lookups = 1000000;
+
+static int test_basic(void)
+{
+	st_tree_t	*a = NULL, *b = NULL, *c = NULL, *na, *nb, *nc;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	state_setinfo(&a, "ups.status", "OL");
+	state_setinfo(&a, "battery.charge", "100");
+	state_setinfo(&b, "UPS.Status", "OB");
+	state_setinfo(&c, "ups.status", "OL");
+
+	/* one name per spelling, shared by the trees */
+	if (state_names_count() != 3)
+		bad++;
+	na = state_tree_find(a, "Ups.Status");
+	nb = state_tree_find(b, "ups.status");
+	nc = state_tree_find(c, "UPS.STATUS");
+	if (!na || !nb || !nc || na->var != nc->var)
+		bad++;
+
+	/* each tree keeps the spelling it was given */
+	if (!na || !nb || strcmp(na->var, "ups.status") || strcmp(nb->var, "UPS.Status"))
+		bad++;
+	state_setinfo(&a, "UPS.STATUS", "OL CHRG");
+	if (strcmp(a->var, "ups.status") || state_names_count() != 3)
+		bad++;
+	if (strcmp(state_getinfo(a, "UPS.STATUS"), "OL CHRG") || strcmp(state_getinfo(b, "ups.status"), "OB"))
+		bad++;
+
+	/* names which are in no tree, or not in this one */
+	if (state_getinfo(a, "no.such.var") || state_getinfo(b, "battery.charge"))
+		bad++;
+	if (state_delinfo(&b, "battery.charge") || state_names_count() != 3)
+		bad++;
+
+	/* the names go away with the last node using them */
+	if (!state_delinfo(&a, "ups.status") || state_names_count() != 3)
+		bad++;
+	if (!state_delinfo(&c, "Ups.Status") || state_names_count() != 2)
+		bad++;
+	if (!state_delinfo(&b, "ups.status") || state_names_count() != 1)
+		bad++;
+
+	state_infofree(a);
+	state_infofree(b);
+	state_infofree(c);
+
+	if (state_names_count() != 0)
+		bad++;
+
+	if (bad) {
+		printf("%d checks failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("names are shared by spelling and compared case-insensitively (OK)\n");
+	return 0;
+}
+
+static int test_cmds(void)
+{
+	cmdlist_t	*a = NULL, *b = NULL;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	state_addcmd(&a, "test.battery.start");
+	state_addcmd(&a, "beeper.disable");
+	state_addcmd(&b, "Test.Battery.Start");
+
+	if (state_addcmd(&a, "TEST.BATTERY.START") || state_names_count() != 3)
+		bad++;
+	/* still sorted, each list with its spelling */
+	if (!a || strcmp(a->name, "beeper.disable") || strcmp(a->next->name, "test.battery.start")
+	 || !b || strcmp(b->name, "Test.Battery.Start"))
+		bad++;
+	if (state_delcmd(&b, "beeper.disable") || !state_delcmd(&b, "test.battery.start") || b)
+		bad++;
+
+	state_cmdfree(a);
+
+	if (state_names_count() != 0)
+		bad++;
+
+	if (bad) {
+		printf("%d checks failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("command names are shared too (OK)\n");
+	return 0;
+}
+
+static int test_numbers(void)
+{
+	st_tree_t	*a = NULL, *node;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	if (state_setinfo_number(&a, "input.voltage", 230.04, 1) != 1 || strcmp(state_getinfo(a, "input.voltage"), "230.0"))
+		bad++;
+	/* the same number, or another one which looks the same */
+	if (state_setinfo_number(&a, "input.voltage", 230.04, 1) || state_setinfo_number(&a, "input.voltage", 229.96, 1))
+		bad++;
+	if (state_setinfo_number(&a, "input.voltage", 230.04, 0) != 1 || strcmp(state_getinfo(a, "input.voltage"), "230"))
+		bad++;
+
+	/* not the same as 0.0, as it is shown differently */
+	state_setinfo_number(&a, "ups.load", 0.0, 1);
+	if (state_setinfo_number(&a, "ups.load", -0.0, 1) != 1 || strcmp(state_getinfo(a, "ups.load"), "-0.0"))
+		bad++;
+
+	/* a value set as a string is not taken for the last number */
+	state_setinfo(&a, "ups.load", "12.5");
+	if (state_setinfo_number(&a, "ups.load", -0.0, 1) != 1 || strcmp(state_getinfo(a, "ups.load"), "-0.0"))
+		bad++;
+
+	/* nor a number which could not be set */
+	node = state_tree_find(a, "ups.load");
+	node->flags |= ST_FLAG_IMMUTABLE;
+	if (state_setinfo_number(&a, "ups.load", 50, 0) || state_setinfo_number(&a, "ups.load", 50, 0)
+	 || strcmp(state_getinfo(a, "ups.load"), "-0.0"))
+		bad++;
+
+	state_infofree(a);
+
+	if (bad) {
+		printf("%d checks failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("numbers are only formatted when they change (OK)\n");
+	return 0;
+}
+
+static double elapsed_nsec_per(struct timeval *start, size_t ops)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return difftimeval(now, *start) * 1e9 / (double)ops;
+}
+
+static int bench_state(void)
+{
+	st_tree_t	**trees;
+	size_t	i, j, found = 0;
+	struct timeval	start;
+	double	set_ns, setnum_ns, fmt_ns, get_ns, miss_ns;
+	char	value[ST_MAX_VALUE_LEN];
+
+	printf("=== %s:\t%" PRIuSIZE " trees of %" PRIuSIZE " variables\n",
+		__func__, bench_trees, (size_t)NUM_BENCH_NAMES);
+
+	trees = xcalloc(bench_trees, sizeof(*trees));
+
+	for (i = 0; i < bench_trees; i++) {
+		for (j = 0; j < NUM_BENCH_NAMES; j++)
+			state_setinfo(&trees[i], bench_names[j], "0");
+	}
+
+	/* as a driver updating its data (values mostly unchanged) */
+	gettimeofday(&start, NULL);
+	for (i = 0, j = 0; i < bench_lookups; i++, j = (j + 7) % NUM_BENCH_NAMES)
+		state_setinfo(&trees[i % bench_trees], bench_names[j], "1");
+	set_ns = elapsed_nsec_per(&start, bench_lookups);
+
+	/* as a driver updating numbers which did not change, first
+	 * formatting them, then with state_setinfo_number() */
+	for (i = 0; i < bench_trees; i++) {
+		for (j = 0; j < NUM_BENCH_NAMES; j++)
+			state_setinfo_number(&trees[i], bench_names[j], 230.4 + (double)j, 1);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0, j = 0; i < bench_lookups; i++, j = (j + 7) % NUM_BENCH_NAMES) {
+		snprintf(value, sizeof(value), "%.1f", 230.4 + (double)j);
+		state_setinfo(&trees[i % bench_trees], bench_names[j], value);
+	}
+	fmt_ns = elapsed_nsec_per(&start, bench_lookups);
+
+	gettimeofday(&start, NULL);
+	for (i = 0, j = 0; i < bench_lookups; i++, j = (j + 7) % NUM_BENCH_NAMES)
+		state_setinfo_number(&trees[i % bench_trees], bench_names[j], 230.4 + (double)j, 1);
+	setnum_ns = elapsed_nsec_per(&start, bench_lookups);
+
+	/* as clients asking upsd */
+	gettimeofday(&start, NULL);
+	for (i = 0, j = 0; i < bench_lookups; i++, j = (j + 7) % NUM_BENCH_NAMES)
+		found += (state_getinfo(trees[i % bench_trees], bench_names[j]) != NULL);
+	get_ns = elapsed_nsec_per(&start, bench_lookups);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_lookups; i++)
+		found += (state_getinfo(trees[i % bench_trees], "input.voltage.maximum") != NULL);
+	miss_ns = elapsed_nsec_per(&start, bench_lookups);
+
+	printf("setinfo %.0f ns, getinfo %.0f ns, getinfo (unknown) %.0f ns per call; %" PRIuSIZE " names kept\n",
+		set_ns, get_ns, miss_ns, state_names_count());
+	printf("same number: formatted and set %.0f ns, setinfo_number %.0f ns per call\n",
+		fmt_ns, setnum_ns);
+
+	for (i = 0; i < bench_trees; i++)
+		state_infofree(trees[i]);
+	free(trees);
+
+	if (found != bench_lookups || state_names_count() != 0) {
+		printf("%" PRIuSIZE " of %" PRIuSIZE " lookups succeeded (FAIL)\n",
+			found, bench_lookups);
+		return 1;
+	}
+
+	printf("all variables found (OK)\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int	ret = 0, opt;
+
+	while ((opt = getopt(argc, argv, "n:l:")) != -1) {
+		switch (opt) {
+			case 'n':
+				bench_trees = (size_t)atol(optarg);
+				break;
+			case 'l':
+				bench_lookups = (size_t)atol(optarg);
+				break;
+			default:
+				printf("usage: %s [-n trees] [-l lookups]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (bench_trees < 1 || bench_lookups < 1) {
+		printf("Invalid benchmark parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	ret += test_basic();
+	ret += test_cmds();
+	ret += test_numbers();
+	ret += bench_state();
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,232 @@
+/*  nuttrackingtest.c - test the upsd status tracking table of instant
+ *  commands and settings, and time it with many outstanding entries
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "nut_stdint.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tracking.h"
+
+/* normally from upsd.conf */
+int	tracking_delay = 3600;
+
+/* number of entries for the benchmark; see the options in main() */
+static size_t	bench_entries = 100000;
+
+static int test_disabled(void)
+{
+	printf("=== %s:\t", __func__);
+
+	if (tracking_add("11111111-2222-4333-8444-555555555555")
+	|| tracking_count() != 0
+	) {
+		printf("entry added while tracking was not enabled (FAIL)\n");
+		return 1;
+	}
+
+	printf("nothing tracked until enabled (OK)\n");
+	return 0;
+}
+
+static int test_basic(void)
+{
+	const char	*id = "0a1b2c3d-4e5f-4a6b-8c7d-8e9f0a1b2c3d";
+	const char	*id_upper = "0A1B2C3D-4E5F-4A6B-8C7D-8E9F0A1B2C3D";
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	tracking_enable();
+
+	if (!tracking_add(id) || tracking_count() != 1)
+		bad++;
+	if (strcmp(tracking_get(id_upper), "PENDING"))
+		bad++;
+	if (!tracking_set(id_upper, "0") || strcmp(tracking_get(id), "SUCCESS"))
+		bad++;
+	if (!tracking_set(id, "3") || strcmp(tracking_get(id), "ERR FAILED"))
+		bad++;
+	if (!tracking_set(id, "4") || strcmp(tracking_get(id), "ERR INVALID-ARGUMENT"))
+		bad++;
+	if (tracking_set("no-such-id", "0") || strcmp(tracking_get("no-such-id"), "ERR UNKNOWN"))
+		bad++;
+	if (!tracking_del(id) || tracking_del(id) || tracking_count() != 0)
+		bad++;
+	if (strcmp(tracking_get(id), "ERR UNKNOWN"))
+		bad++;
+
+	if (bad) {
+		printf("%d checks of add/set/get/del failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("add/set/get/del work, IDs are case-insensitive (OK)\n");
+	return 0;
+}
+
+static int test_expiry(void)
+{
+	char	id[UUID4_LEN];
+	time_t	start;
+	int	i, bad = 0;
+
+	printf("=== %s:\t", __func__);
+	fflush(stdout);
+
+	/* two generations of entries, a second apart */
+	for (i = 0; i < 20; i++) {
+		if (i == 10) {
+			start = time(NULL);
+			while (time(NULL) == start)
+				usleep(10000);
+		}
+		snprintf(id, sizeof(id), "expiry-%d", i);
+		tracking_add(id);
+	}
+
+	tracking_delay = 0;
+	tracking_cleanup();
+
+	if (tracking_count() != 10)
+		bad++;
+	if (strcmp(tracking_get("expiry-0"), "ERR UNKNOWN") || strcmp(tracking_get("expiry-9"), "ERR UNKNOWN"))
+		bad++;
+	if (strcmp(tracking_get("expiry-10"), "PENDING") || strcmp(tracking_get("expiry-19"), "PENDING"))
+		bad++;
+
+	/* everything is older than -1 seconds */
+	tracking_delay = -1;
+	tracking_cleanup();
+
+	if (tracking_count() != 0)
+		bad++;
+
+	tracking_delay = 3600;
+
+	if (bad) {
+		printf("%d checks failed, %" PRIuSIZE " entries left (FAIL)\n", bad, tracking_count());
+		return 1;
+	}
+
+	printf("only the older entries expired (OK)\n");
+	return 0;
+}
+
+static double elapsed_nsec_per(struct timeval *start, size_t ops)
+{
+	struct timeval	now;
+
+	gettimeofday(&now, NULL);
+	return difftimeval(now, *start) * 1e9 / (double)ops;
+}
+
+static int bench_tracking(void)
+{
+	char	**ids;
+	size_t	i, j, found = 0;
+	struct timeval	start;
+	double	add_ns, set_ns, get_ns, cleanup_ns, del_ns;
+
+	printf("=== %s:\t%" PRIuSIZE " outstanding entries\n", __func__, bench_entries);
+
+	ids = xcalloc(bench_entries, sizeof(*ids));
+	for (i = 0; i < bench_entries; i++) {
+		ids[i] = xmalloc(UUID4_LEN);
+		snprintf(ids[i], UUID4_LEN, "%08x-%04x-4%03x-8%03x-%04x%08x",
+			(unsigned int)rand(), (unsigned int)(rand() & 0xffff),
+			(unsigned int)(rand() & 0xfff), (unsigned int)(rand() & 0xfff),
+			(unsigned int)(rand() & 0xffff), (unsigned int)i);
+	}
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_entries; i++)
+		tracking_add(ids[i]);
+	add_ns = elapsed_nsec_per(&start, bench_entries);
+
+	/* drivers report back in some other order */
+	gettimeofday(&start, NULL);
+	for (i = 0, j = 0; i < bench_entries; i++, j = (j + 7919) % bench_entries)
+		found += (size_t)tracking_set(ids[j], "0");
+	set_ns = elapsed_nsec_per(&start, bench_entries);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_entries; i++)
+		found += (size_t)(strcmp(tracking_get(ids[i]), "SUCCESS") == 0);
+	get_ns = elapsed_nsec_per(&start, bench_entries);
+
+	/* as called by each main loop iteration, with nothing expired yet */
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_entries; i++)
+		tracking_cleanup();
+	cleanup_ns = elapsed_nsec_per(&start, bench_entries);
+
+	gettimeofday(&start, NULL);
+	for (i = 0; i < bench_entries; i++)
+		found += (size_t)tracking_del(ids[i]);
+	del_ns = elapsed_nsec_per(&start, bench_entries);
+
+	for (i = 0; i < bench_entries; i++)
+		free(ids[i]);
+	free(ids);
+
+	printf("add %.0f ns, set %.0f ns, get %.0f ns, cleanup %.0f ns, del %.0f ns per call\n",
+		add_ns, set_ns, get_ns, cleanup_ns, del_ns);
+
+	if (found != 3 * bench_entries || tracking_count() != 0) {
+		printf("%" PRIuSIZE " of %" PRIuSIZE " lookups succeeded (FAIL)\n",
+			found, 3 * bench_entries);
+		return 1;
+	}
+
+	printf("all entries found (OK)\n");
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	int	ret = 0, opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+			case 'n':
+				bench_entries = (size_t)atol(optarg);
+				break;
+			default:
+				printf("usage: %s [-n entries]\n", argv[0]);
+				return EXIT_FAILURE;
+		}
+	}
+
+	if (bench_entries < 1) {
+		printf("Invalid benchmark parameters\n");
+		return EXIT_FAILURE;
+	}
+
+	ret += test_disabled();
+	ret += test_basic();
+	ret += test_expiry();
+	ret += bench_tracking();
+
+	tracking_free();
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,197 @@
+/*  nutusbmatchtest.c - test that USB devices which the matchers can rule
+ *  out by their IDs and place on the bus are skipped before being opened
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+#include "config.h"
+#include "common.h"
+#include "usb-common.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* a host with this many identical UPSes, one per port of a hub */
+#define NUM_DEVICES	24
+
+static USBDevice_t	devices[NUM_DEVICES];
+
+static void make_devices(void)
+{
+	char	buf[8];
+	int	i;
+
+	for (i = 0; i < NUM_DEVICES; i++) {
+		devices[i].VendorID = 0x0463;
+		devices[i].ProductID = 0xffff;
+		devices[i].bcdDevice = 0x0100;
+		/* the strings are not known until the device is opened */
+		devices[i].Vendor = NULL;
+		devices[i].Product = NULL;
+		devices[i].Serial = NULL;
+		devices[i].Bus = xstrdup("001");
+		snprintf(buf, sizeof(buf), "%03d", i + 2);
+		devices[i].Device = xstrdup(buf);
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+		snprintf(buf, sizeof(buf), "%03d", i + 1);
+		devices[i].BusPort = xstrdup(buf);
+#endif
+	}
+}
+
+static void free_devices(void)
+{
+	int	i;
+
+	for (i = 0; i < NUM_DEVICES; i++) {
+		free(devices[i].Bus);
+		free(devices[i].Device);
+#if (defined WITH_USB_BUSPORT) && (WITH_USB_BUSPORT)
+		free(devices[i].BusPort);
+#endif
+	}
+}
+
+/* how many of the devices would have to be opened with this chain */
+static int count_unopened_matches(USBDeviceMatcher_t *matcher)
+{
+	int	i, count = 0;
+
+	for (i = 0; i < NUM_DEVICES; i++)
+		count += USBMatchUnopened(matcher, &devices[i]);
+
+	return count;
+}
+
+static USBDeviceMatcher_t *new_regex_matcher(const char *vendorid,
+	const char *serial, const char *device)
+{
+	USBDeviceMatcher_t	*m = NULL;
+	char	*regex_array[USBMATCHER_REGEXP_ARRAY_LIMIT];
+
+	memset(regex_array, 0, sizeof(regex_array));
+	regex_array[0] = (char *)vendorid;
+	regex_array[4] = (char *)serial;
+	regex_array[6] = (char *)device;
+
+	if (USBNewRegexMatcher(&m, regex_array, REG_ICASE | REG_EXTENDED)) {
+		printf("could not create a regex matcher (FAIL)\n");
+		exit(EXIT_FAILURE);
+	}
+
+	return m;
+}
+
+static int test_regex(void)
+{
+	USBDeviceMatcher_t	*m;
+	int	bad = 0, n;
+
+	printf("=== %s:\t", __func__);
+
+	/* only the serial number tells them apart: all must be opened */
+	m = new_regex_matcher("0463", "SN12345", NULL);
+	if ((n = count_unopened_matches(m)) != NUM_DEVICES) {
+		printf("serial: %d of %d kept; ", n, NUM_DEVICES);
+		bad++;
+	}
+	USBFreeRegexMatcher(m);
+
+	/* another vendor: none need to be opened */
+	m = new_regex_matcher("051d", NULL, NULL);
+	if ((n = count_unopened_matches(m)) != 0) {
+		printf("vendor: %d of %d kept; ", n, NUM_DEVICES);
+		bad++;
+	}
+	USBFreeRegexMatcher(m);
+
+	/* the device number picks one */
+	m = new_regex_matcher(NULL, NULL, "007");
+	if ((n = count_unopened_matches(m)) != 1 || !USBMatchUnopened(m, &devices[5])) {
+		printf("device: %d of %d kept; ", n, NUM_DEVICES);
+		bad++;
+	}
+	USBFreeRegexMatcher(m);
+
+	if (bad) {
+		printf("%d checks failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("only devices which may match are kept (OK)\n");
+	return 0;
+}
+
+static int test_exact(void)
+{
+	USBDeviceMatcher_t	*exact = NULL, *regex;
+	USBDevice_t	other;
+	int	bad = 0;
+
+	printf("=== %s:\t", __func__);
+
+	/* as when reconnecting to a device seen before */
+	memset(&other, 0, sizeof(other));
+	other.VendorID = 0x0463;
+	other.ProductID = 0xffff;
+	other.Serial = "SN12345";
+
+	if (USBNewExactMatcher(&exact, &other)) {
+		printf("could not create an exact matcher (FAIL)\n");
+		return 1;
+	}
+
+	if (count_unopened_matches(exact) != NUM_DEVICES)
+		bad++;
+
+	/* chained with a regex which rules out all of them */
+	regex = new_regex_matcher("051d", NULL, NULL);
+	exact->next = regex;
+	if (count_unopened_matches(exact) != 0)
+		bad++;
+	exact->next = NULL;
+	USBFreeRegexMatcher(regex);
+
+	/* a device with another product ID */
+	other.ProductID = 0xfffe;
+	other.Serial = NULL;
+	if (USBMatchUnopened(exact, &other))
+		bad++;
+
+	USBFreeExactMatcher(exact);
+
+	if (bad) {
+		printf("%d checks failed (FAIL)\n", bad);
+		return 1;
+	}
+
+	printf("exact matchers compare the IDs, chains must all agree (OK)\n");
+	return 0;
+}
+
+int main(void)
+{
+	int	ret = 0;
+
+	make_devices();
+
+	ret += test_regex();
+	ret += test_exact();
+
+	free_devices();
+
+	return ret ? EXIT_FAILURE : EXIT_SUCCESS;
+}
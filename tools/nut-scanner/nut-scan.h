@@ -199,6 +199,12 @@ nutscan_device_t * nutscan_scan_ip_range_xml_http(nutscan_ip_range_list_t * irl,
 nutscan_device_t * nutscan_scan_nut(const char * startIP, const char * stopIP, const char * port, useconds_t usec_timeout);
 nutscan_device_t * nutscan_scan_ip_range_nut(nutscan_ip_range_list_t * irl, const char * port, useconds_t usec_timeout);
 
+/* Have the NUT scan call "callback" for each device as soon as it is found
+ * (one call at a time, before the device is added to the returned list);
+ * NULL to stop */
+typedef void (*nutscan_device_callback_t)(nutscan_device_t * device);
+void nutscan_set_nut_device_callback(nutscan_device_callback_t callback);
+
 nutscan_device_t * nutscan_scan_nut_simulation(void);
 
 nutscan_device_t * nutscan_scan_avahi(useconds_t usec_timeout);
@@ -92,7 +92,7 @@
 
 #define ERR_BAD_OPTION	(-1)
 
-static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOAm:QnNPqIVaD";
+static const char optstring[] = "?ht:T:s:e:E:c:l:u:W:X:w:x:p:b:B:d:L:CUSMOoAm:QnNPqIVaD";
 
 #ifdef HAVE_GETOPT_LONG
 static const struct option longopts[] = {
@@ -119,6 +119,7 @@ static const struct option longopts[] = {
 	{ "snmp_scan", no_argument, NULL, 'S' },
 	{ "xml_scan", no_argument, NULL, 'M' },
 	{ "oldnut_scan", no_argument, NULL, 'O' },	/* "old" NUT libupsclient.so scan */
+	{ "oldnut_stream", no_argument, NULL, 'o' },	/* same, displaying devices as found */
 	{ "avahi_scan", no_argument, NULL, 'A' },	/* "new" NUT scan where deployed */
 	{ "nut_simulation_scan", no_argument, NULL, 'n' },
 	{ "ipmi_scan", no_argument, NULL, 'I' },
@@ -146,6 +147,16 @@ static int cli_link_detail_level = -1;
 /* Track requested IP ranges (from CLI or auto-discovery) */
 static nutscan_ip_range_list_t ip_ranges_list;
 
+/* How to display NUT bus (old) devices as soon as they are found,
+ * rather than with the other results at the end of the scans */
+static void (*stream_display_func)(nutscan_device_t * device) = NULL;
+
+static void stream_nut_device(nutscan_device_t * device)
+{
+	stream_display_func(device);
+	fflush(stdout);
+}
+
 #ifdef HAVE_PTHREAD
 static pthread_t thread[TYPE_END];
 
@@ -996,6 +1007,8 @@ static void show_usage(const char *arg_progname)
 		printf("* Options for XML/HTTP devices scan not enabled: library not detected.\n");
 	}
 	printf("  -O, --oldnut_scan: Scan NUT devices (old method via libupsclient).\n");
+	printf("  -o, --oldnut_stream: Like -O, but display each NUT device as soon as it is found\n");
+	printf("                       (can not be combined with other scan types).\n");
 	if (nutscan_avail_avahi) {
 		printf("  -A, --avahi_scan: Scan NUT devices (new avahi method).\n");
 	} else {
@@ -1172,6 +1185,7 @@ int main(int argc, char *argv[])
 	int allow_snmp = 0;
 	int allow_xml = 0;
 	int allow_oldnut = 0;
+	int stream_oldnut = 0;
 	int allow_nut_simulation = 0;
 	int allow_avahi = 0;
 	int allow_ipmi = 0;
@@ -1518,6 +1532,10 @@ int main(int argc, char *argv[])
 			case 'O':
 				allow_oldnut = 1;
 				break;
+			case 'o':
+				allow_oldnut = 1;
+				stream_oldnut = 1;
+				break;
 			case 'A':
 				if (!nutscan_avail_avahi) {
 					goto display_help;
@@ -1695,6 +1713,17 @@ display_help:
 		/* BEWARE: allow_all does not include allow_eaton_serial! */
 	}
 
+	/* Streamed devices are numbered as they come, and the sanity
+	 * checks only see the NUT bus devices: this would not match
+	 * what the other scans report at the end */
+	if (stream_oldnut && (allow_usb || allow_snmp || allow_xml
+	 || allow_nut_simulation || allow_avahi || allow_ipmi || allow_eaton_serial)
+	) {
+		fatalx(EXIT_FAILURE,
+			"The -o (--oldnut_stream) option can not be combined "
+			"with other scan types; use -O for that");
+	}
+
 /* TODO/discuss : Should the #else...#endif code below for lack of pthreads
  * during build also serve as a fallback for pthread failure at runtime?
  */
@@ -1768,6 +1797,15 @@ display_help:
 		}
 		else {
 			upsdebugx(quiet, "Scanning NUT bus (old libupsclient connect method).");
+			if (stream_oldnut) {
+				/* the sanity checks need the whole list, so they
+				 * are done once the scan is complete */
+				if (display_func == nutscan_display_ups_conf_with_sanity_check)
+					stream_display_func = nutscan_display_ups_conf;
+				else
+					stream_display_func = display_func;
+				nutscan_set_nut_device_callback(stream_nut_device);
+			}
 #ifdef HAVE_PTHREAD
 			upsdebugx(1, "NUT bus (old) SCAN: starting pthread_create with run_nut_old...");
 			if (pthread_create(&thread[TYPE_NUT], NULL, run_nut_old, NULL)) {
@@ -1911,7 +1949,10 @@ display_help:
 	nutscan_free_device(dev[TYPE_XML]);
 
 	upsdebugx(1, "SCANS DONE: display results: NUT bus (old)");
-	display_func(dev[TYPE_NUT]);
+	if (!stream_display_func)
+		display_func(dev[TYPE_NUT]);
+	else if (display_func == nutscan_display_ups_conf_with_sanity_check)
+		nutscan_display_sanity_check(dev[TYPE_NUT]);
 	upsdebugx(1, "SCANS DONE: free resources: NUT bus (old)");
 	nutscan_free_device(dev[TYPE_NUT]);
 
@@ -51,6 +51,8 @@ static int (*nut_upscli_list_start)(UPSCONN_t *ups, size_t numq,
 static int (*nut_upscli_list_next)(UPSCONN_t *ups, size_t numq,
 			const char **query, size_t *numa, char ***answer);
 static int (*nut_upscli_disconnect)(UPSCONN_t *ups);
+static ssize_t (*nut_upscli_sendline)(UPSCONN_t *ups, const char *buf, size_t buflen);
+static ssize_t (*nut_upscli_readline)(UPSCONN_t *ups, char *buf, size_t buflen);
 
 /* This variable collects device(s) from a sequential or parallel scan,
  * is returned to caller, and cleared to allow subsequent independent scans */
@@ -59,6 +61,22 @@ static nutscan_device_t * dev_ret = NULL;
 static pthread_mutex_t dev_mutex;
 #endif
 
+/* If set, called for each device as soon as it is found (under dev_mutex) */
+static nutscan_device_callback_t dev_callback = NULL;
+
+/* Identity of the devices, asked for with pipelined "GET VAR" queries */
+static const char *nut_scan_vars[] = {
+	"device.mfr",
+	"device.model",
+	"device.serial"
+};
+#define NUT_SCAN_NUMVARS	(sizeof(nut_scan_vars) / sizeof(nut_scan_vars[0]))
+
+/* How many devices to query with one batch of pipelined requests; this
+ * keeps both the requests (some 8KB) and the answers within the default
+ * socket buffers, so neither side blocks on writing while the other does */
+#define NUT_SCAN_PIPELINE	64
+
 /* use explicit booleans */
 #ifndef FALSE
 typedef enum ebool { FALSE = 0, TRUE } bool_t;
@@ -144,6 +162,18 @@ int nutscan_load_upsclient_library(const char *libname_path)
 			goto err;
 	}
 
+	*(void **) (&nut_upscli_sendline) = lt_dlsym(dl_handle,
+						"upscli_sendline");
+	if ((dl_error = lt_dlerror()) != NULL) {
+			goto err;
+	}
+
+	*(void **) (&nut_upscli_readline) = lt_dlsym(dl_handle,
+						"upscli_readline");
+	if ((dl_error = lt_dlerror()) != NULL) {
+			goto err;
+	}
+
 	if (dl_saved_libname)
 		free(dl_saved_libname);
 	dl_saved_libname = xstrdup(libname_path);
@@ -164,8 +194,178 @@ err:
 }
 /* end of dynamic link library stuff */
 
+void nutscan_set_nut_device_callback(nutscan_device_callback_t callback)
+{
+	dev_callback = callback;
+}
+
+/* Find the quoted value in a "VAR <upsname> <varname> "<value>"" answer,
+ * and unescape it in place; returns NULL for other (e.g. ERR) answers */
+static char *nut_scan_parse_var(char *line, const char *upsname, const char *varname)
+{
+	size_t	len;
+	char	*in, *out, *value;
+
+	if (strncmp(line, "VAR ", 4))
+		return NULL;
+	line += 4;
+
+	len = strlen(upsname);
+	if (strncmp(line, upsname, len) || line[len] != ' ')
+		return NULL;
+	line += len + 1;
+
+	len = strlen(varname);
+	if (strncmp(line, varname, len) || line[len] != ' ' || line[len + 1] != '"')
+		return NULL;
+
+	value = out = line + len + 2;
+	for (in = value; *in && *in != '"'; in++) {
+		if (*in == '\\' && in[1])
+			in++;
+		*out++ = *in;
+	}
+	*out = '\0';
+
+	return value;
+}
+
+/* Make a device entry for "upsname" at the host:port being scanned */
+static nutscan_device_t *nut_scan_new_device(const char *upsname,
+	const char *hostname, uint16_t port)
+{
+	nutscan_device_t * dev;
+	size_t buf_size;
+	/* Check if IPv6 and needs brackets */
+	char	*hostname_colon = strchr(hostname, ':');
+
+	if (hostname_colon && *hostname_colon == '\0')
+		hostname_colon = NULL;
+	if (*hostname == '[')
+		hostname_colon = NULL;
+
+	/* FIXME: check for duplication by getting driver.port and device.serial
+	 * for comparison with other busses results */
+	dev = nutscan_new_device();
+	dev->type = TYPE_NUT;
+	/* NOTE: There is no driver by such name, in practice it could
+	 * be a dummy-ups relay, a clone driver, or part of upsmon config */
+	dev->driver = strdup(SCAN_NUT_DRIVERNAME);
+	/* +1+1 is for '@' character and terminating 0,
+	 * and the other +1+1 is for possible '[' and ']'
+	 * around the host name:
+	 */
+	buf_size = strlen(upsname) + strlen(hostname) + 1 + 1 + 1 + 1;
+	if (port != PORT) {
+		/* colon and up to 5 digits */
+		buf_size += 6;
+	}
+
+	dev->port = malloc(buf_size);
+
+	if (!dev->port) {
+		nutscan_free_device(dev);
+		return NULL;
+	}
+
+	if (port != PORT) {
+		if (hostname_colon) {
+			snprintf(dev->port, buf_size, "%s@[%s]:%" PRIu16,
+				upsname, hostname, port);
+		} else {
+			snprintf(dev->port, buf_size, "%s@%s:%" PRIu16,
+				upsname, hostname, port);
+		}
+	} else {
+		/* Standard port, not suffixed */
+		if (hostname_colon) {
+			snprintf(dev->port, buf_size, "%s@[%s]",
+				upsname, hostname);
+		} else {
+			snprintf(dev->port, buf_size, "%s@%s",
+				upsname, hostname);
+		}
+	}
+
+	return dev;
+}
+
+/* Ask for the identity of devices[0..count-1] with one batch of requests
+ * sent together, then read the answers (which come in the same order).
+ * Returns -1 if the connection failed. */
+static int nut_scan_get_identity(UPSCONN_t *ups, nutscan_device_t **devices,
+	char **upsnames, size_t count)
+{
+	char	*cmd, *value, buf[UPSCLI_NETBUF_LEN];
+	size_t	i, v, cmdlen = 0, len;
+
+	for (i = 0; i < count; i++) {
+		for (v = 0; v < NUT_SCAN_NUMVARS; v++) {
+			/* "GET VAR <upsname> <varname>\n" */
+			cmdlen += 8 + strlen(upsnames[i]) + 1 + strlen(nut_scan_vars[v]) + 1;
+		}
+	}
+
+	cmd = xcalloc(cmdlen + 1, sizeof(char));
+	for (i = 0, len = 0; i < count; i++) {
+		for (v = 0; v < NUT_SCAN_NUMVARS; v++) {
+			snprintf(cmd + len, cmdlen + 1 - len, "GET VAR %s %s\n",
+				upsnames[i], nut_scan_vars[v]);
+			len += strlen(cmd + len);
+		}
+	}
+
+	if ((*nut_upscli_sendline)(ups, cmd, len) != 0) {
+		free(cmd);
+		return -1;
+	}
+	free(cmd);
+
+	for (i = 0; i < count; i++) {
+		for (v = 0; v < NUT_SCAN_NUMVARS; v++) {
+			if ((*nut_upscli_readline)(ups, buf, sizeof(buf)) != 0)
+				return -1;
+
+			value = nut_scan_parse_var(buf, upsnames[i], nut_scan_vars[v]);
+			if (!value || !*value || !devices[i])
+				continue;
+
+			/* Not settings of the dummy-ups driver, so commented */
+			nutscan_add_commented_option_to_device(devices[i],
+				(char *)(nut_scan_vars[v] + 7), value, "");
+		}
+	}
+
+	return 0;
+}
+
+/* Report (and forget) devices[0..count-1] */
+static void nut_scan_report_devices(nutscan_device_t **devices, char **upsnames, size_t count)
+{
+	size_t	i;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&dev_mutex);
+#endif
+	for (i = 0; i < count; i++) {
+		if (devices[i]) {
+			if (dev_callback)
+				dev_callback(devices[i]);
+			dev_ret = nutscan_add_device_to_device(dev_ret, devices[i]);
+		}
+		devices[i] = NULL;
+		free(upsnames[i]);
+		upsnames[i] = NULL;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&dev_mutex);
+#endif
+}
+
 /* FIXME: SSL support */
 /* Performs a (parallel-able) NUT protocol scan of one remote host:port.
+ * The device list and then their identities are asked for over the same
+ * connection, the latter pipelined in batches of NUT_SCAN_PIPELINE.
  * Returns NULL, updates global dev_ret when a scan is successful.
  * FREES the caller's copy of "nut_arg" and "hostname" in it, if applicable.
  */
@@ -175,13 +375,13 @@ static void * list_nut_devices_thready(void * arg)
 	char *target_hostname = nut_arg->hostname;
 	struct timeval tv;
 	uint16_t port;
-	size_t numq, numa;
+	size_t numq, numa, count = 0, alloced = 0, i;
 	const char *query[4];
 	char **answer = NULL;
 	char *hostname = NULL;
 	UPSCONN_t *ups = xcalloc(1, sizeof(*ups));
-	nutscan_device_t * dev = NULL;
-	size_t buf_size;
+	nutscan_device_t **devices = NULL;
+	char **upsnames = NULL;
 
 	tv.tv_sec = nut_arg->timeout / (1000*1000);
 	tv.tv_usec = nut_arg->timeout % (1000*1000);
@@ -220,69 +420,51 @@ static void * list_nut_devices_thready(void * arg)
 	while ((*nut_upscli_list_next)(ups, numq, query, &numa, &answer) == 1) {
 		/* UPS <upsname> <description> */
 		if (numa < 3) {
+			/* Still report those listed so far, without details:
+			 * the connection is not in a known state to ask more */
+			upsdebugx(1, "%s: %s: unexpected answer to LIST UPS",
+				__func__, target_hostname);
+			nut_scan_report_devices(devices, upsnames, count);
 			goto end;
 		}
 
-		/* FIXME: check for duplication by getting driver.port and device.serial
-		 * for comparison with other busses results */
-		/* FIXME:
-		 * - also print answer[2] if != "Unavailable"?
-		 * - for upsmon.conf or ups.conf (using dummy-ups)? */
-		dev = nutscan_new_device();
-		dev->type = TYPE_NUT;
-		/* NOTE: There is no driver by such name, in practice it could
-		 * be a dummy-ups relay, a clone driver, or part of upsmon config */
-		dev->driver = strdup(SCAN_NUT_DRIVERNAME);
-		/* +1+1 is for '@' character and terminating 0,
-		 * and the other +1+1 is for possible '[' and ']'
-		 * around the host name:
-		 */
-		buf_size = strlen(answer[1]) + strlen(hostname) + 1 + 1 + 1 + 1;
-		if (port != PORT) {
-			/* colon and up to 5 digits */
-			buf_size += 6;
+		if (count == alloced) {
+			alloced = alloced ? alloced * 2 : NUT_SCAN_PIPELINE;
+			devices = xrealloc(devices, alloced * sizeof(*devices));
+			upsnames = xrealloc(upsnames, alloced * sizeof(*upsnames));
 		}
 
-		dev->port = malloc(buf_size);
+		devices[count] = nut_scan_new_device(answer[1], hostname, port);
+		upsnames[count] = xstrdup(answer[1]);
 
-		if (dev->port) {
-			/* Check if IPv6 and needs brackets */
-			char	*hostname_colon = strchr(hostname, ':');
+		/* This is what upsd says if there is no "desc" */
+		if (devices[count] && strcmp(answer[2], "Description unavailable"))
+			nutscan_add_option_to_device(devices[count], "desc", answer[2]);
 
-			if (hostname_colon && *hostname_colon == '\0')
-				hostname_colon = NULL;
-			if (*hostname == '[')
-				hostname_colon = NULL;
+		count++;
+	}
 
-			if (port != PORT) {
-				if (hostname_colon) {
-					snprintf(dev->port, buf_size, "%s@[%s]:%" PRIu16,
-						answer[1], hostname, port);
-				} else {
-					snprintf(dev->port, buf_size, "%s@%s:%" PRIu16,
-						answer[1], hostname, port);
-				}
-			} else {
-				/* Standard port, not suffixed */
-				if (hostname_colon) {
-					snprintf(dev->port, buf_size, "%s@[%s]",
-						answer[1], hostname);
-				} else {
-					snprintf(dev->port, buf_size, "%s@%s",
-						answer[1], hostname);
-				}
-			}
-#ifdef HAVE_PTHREAD
-			pthread_mutex_lock(&dev_mutex);
-#endif
-			dev_ret = nutscan_add_device_to_device(dev_ret, dev);
-#ifdef HAVE_PTHREAD
-			pthread_mutex_unlock(&dev_mutex);
-#endif
+	upsdebugx(2, "%s: %s serves %" PRIuSIZE " device(s)", __func__, target_hostname, count);
+
+	/* The list is complete, ask for the details of a batch of devices
+	 * at a time, and report them as soon as they are known */
+	for (i = 0; i < count; i += NUT_SCAN_PIPELINE) {
+		size_t	batch = (count - i < NUT_SCAN_PIPELINE) ? count - i : NUT_SCAN_PIPELINE;
+
+		if (nut_scan_get_identity(ups, devices + i, upsnames + i, batch) < 0) {
+			upsdebugx(1, "%s: %s: failed to get the device details",
+				__func__, target_hostname);
+			/* upscli_*line() disconnected it on errors */
+			break;
 		}
 
+		nut_scan_report_devices(devices + i, upsnames + i, batch);
 	}
 
+	/* Still report those we could not get details for */
+	if (i < count)
+		nut_scan_report_devices(devices + i, upsnames + i, count - i);
+
 end:
 	if (ups) {
 		(*nut_upscli_disconnect)(ups);
@@ -291,6 +473,18 @@ end:
 		free(ups);
 	}
 
+	/* None should be left over, all were reported above */
+	for (i = 0; i < count; i++) {
+		if (devices[i])
+			nutscan_free_device(devices[i]);
+		if (upsnames[i])
+			free(upsnames[i]);
+	}
+
+	if (devices)
+		free(devices);
+	if (upsnames)
+		free(upsnames);
 	if (target_hostname)
 		free(target_hostname);
 	if (hostname)